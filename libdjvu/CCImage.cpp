@@ -0,0 +1,728 @@
+//C-  -*- C++ -*-
+//C- -------------------------------------------------------------------
+//C- DjVuLibre-3.5
+//C- Copyright (c) 2002  Leon Bottou and Yann Le Cun.
+//C- Copyright (c) 2001  AT&T
+//C-
+//C- This software is subject to, and may be distributed under, the
+//C- GNU General Public License, either Version 2 of the license,
+//C- or (at your option) any later version. The license should have
+//C- accompanied the software or you may obtain a copy of the license
+//C- from the Free Software Foundation at http://www.fsf.org .
+//C-
+//C- This program is distributed in the hope that it will be useful,
+//C- but WITHOUT ANY WARRANTY; without even the implied warranty of
+//C- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//C- GNU General Public License for more details.
+//C- 
+//C- DjVuLibre-3.5 is derived from the DjVu(r) Reference Library from
+//C- Lizardtech Software.  Lizardtech Software has authorized us to
+//C- replace the original DjVu(r) Reference Library notice by the following
+//C- text (see doc/lizard2002.djvu and doc/lizardtech2007.djvu):
+//C-
+//C-  ------------------------------------------------------------------
+//C- | DjVu (r) Reference Library (v. 3.5)
+//C- | Copyright (c) 1999-2001 LizardTech, Inc. All Rights Reserved.
+//C- | The DjVu Reference Library is protected by U.S. Pat. No.
+//C- | 6,058,214 and patents pending.
+//C- |
+//C- | This software is subject to, and may be distributed under, the
+//C- | GNU General Public License, either Version 2 of the license,
+//C- | or (at your option) any later version. The license should have
+//C- | accompanied the software or you may obtain a copy of the license
+//C- | from the Free Software Foundation at http://www.fsf.org .
+//C- |
+//C- | The computer code originally released by LizardTech under this
+//C- | license and unmodified by other parties is deemed "the LIZARDTECH
+//C- | ORIGINAL CODE."  Subject to any third party intellectual property
+//C- | claims, LizardTech grants recipient a worldwide, royalty-free, 
+//C- | non-exclusive license to make, use, sell, or otherwise dispose of 
+//C- | the LIZARDTECH ORIGINAL CODE or of programs derived from the 
+//C- | LIZARDTECH ORIGINAL CODE in compliance with the terms of the GNU 
+//C- | General Public License.   This grant only confers the right to 
+//C- | infringe patent claims underlying the LIZARDTECH ORIGINAL CODE to 
+//C- | the extent such infringement is reasonably necessary to enable 
+//C- | recipient to make, have made, practice, sell, or otherwise dispose 
+//C- | of the LIZARDTECH ORIGINAL CODE (or portions thereof) and not to 
+//C- | any greater extent that may be necessary to utilize further 
+//C- | modifications or combinations.
+//C- |
+//C- | The LIZARDTECH ORIGINAL CODE is provided "AS IS" WITHOUT WARRANTY
+//C- | OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+//C- | TO ANY WARRANTY OF NON-INFRINGEMENT, OR ANY IMPLIED WARRANTY OF
+//C- | MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE.
+//C- +------------------------------------------------------------------
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+#if NEED_GNUG_PRAGMAS
+# pragma implementation
+#endif
+
+#include "CCImage.h"
+#include "GException.h"
+#include "GBitmap.h"
+#include "JB2Image.h"
+#include "DjVuPalette.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#if HAVE_STDINT_H
+# include <stdint.h>
+#elif HAVE_INTTYPES_H
+# include <inttypes.h>
+#endif
+
+
+#ifdef HAVE_NAMESPACES
+namespace DJVU {
+# ifdef NOT_DEFINED // Just to fool emacs c++ mode
+}
+#endif
+#endif
+
+
+// -- Compares runs
+static inline bool
+operator <= (const CCImage::Run &a, const CCImage::Run &b)
+{
+  return (a.y<b.y) || (a.y==b.y && a.x1<=b.x1);
+}
+
+
+// -- Tests whether runs are sorted
+static bool
+runs_sorted(const CCImage::Run *run, int nruns)
+{
+  for (int n=1; n<nruns; n++)
+    if (! (run[n-1] <= run[n]))
+      return false;
+  return true;
+}
+
+
+// -- Constructs CCImage
+CCImage::CCImage(int width, int height)
+  : height(height), width(width), nregularccs(0)
+{
+}
+
+
+// -- Resets the CCImage
+void
+CCImage::init(int w, int h)
+{
+  runs.empty();
+  ccs.empty();
+  height = h;
+  width = w;
+  nregularccs = 0;
+}
+
+
+// -- Loads eight pixels
+static inline uint64_t
+load8(const unsigned char *p)
+{
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+
+// -- Tests whether eight pixels are all black
+static inline bool
+all_black8(uint64_t v)
+{
+  return ! ((v - 0x0101010101010101ULL) & ~v & 0x8080808080808080ULL);
+}
+
+
+// -- Finds the black runs of a row of pixels.
+//    Returns the number of runs and stores their ends into xs.
+static int
+scan_row(const unsigned char *row, int w, short *xs)
+{
+  int n = 0;
+  int x = 0;
+  while (x < w)
+    {
+      while (x+8 <= w && !load8(row+x))
+        x += 8;
+      while (x < w && !row[x])
+        x++;
+      if (x >= w)
+        break;
+      xs[n++] = x;
+      while (x+8 <= w && all_black8(load8(row+x)))
+        x += 8;
+      while (x < w && row[x])
+        x++;
+      xs[n++] = x - 1;
+    }
+  return n / 2;
+}
+
+
+// -- Finds the black runs of a packed row of pixels.
+static int
+scan_packed_row(const unsigned char *row, int w, short *xs)
+{
+  int n = 0;
+  int x = 0;
+  while (x < w)
+    {
+      while (x < w && !(x & 7) && !row[x>>3])
+        x += 8;
+      while (x < w && !(row[x>>3] & (0x80 >> (x&7))))
+        x++;
+      if (x >= w)
+        break;
+      xs[n++] = x;
+      while (x+8 <= w && !(x & 7) && row[x>>3] == 0xff)
+        x += 8;
+      while (x < w && (row[x>>3] & (0x80 >> (x&7))))
+        x++;
+      xs[n++] = x - 1;
+    }
+  return n / 2;
+}
+
+
+// -- Finds the black runs of a row of a RLE encoded bitmap.
+static int
+scan_rle_row(const GBitmap &bm, int y, int *rlens, short *xs)
+{
+  int n = bm.rle_get_runs(y, rlens);
+  int x = 0;
+  int k = 0;
+  for (int i=0; i<n; i++)
+    {
+      if (i & 1)
+        {
+          xs[k++] = x;
+          xs[k++] = x + rlens[i] - 1;
+        }
+      x += rlens[i];
+    }
+  return k / 2;
+}
+
+
+// -- Adds runs extracted from a bitmap
+void 
+CCImage::add_bitmap_runs(const GBitmap &bm, int offx, int offy, int color)
+{
+  int w = bm.columns();
+  int h = bm.rows();
+  if (w <= 0 || h <= 0)
+    return;
+  short *xs;
+  GPBuffer<short> gxs(xs, w+2);
+  int *rlens;
+  GPBuffer<int> grlens(rlens, w+2);
+  bool rle = (bm.rle_get_runs(0, rlens) > 0);
+  // Collect runs in a single pass over the rows
+  int maxrow = (w+1)/2;
+  int capacity = 4*maxrow;
+  int count = 0;
+  Run *buf;
+  GPBuffer<Run> gbuf(buf, capacity);
+  for (int y=0; y<h; y++)
+    {
+      if (count + maxrow > capacity)
+        {
+          capacity = 2*capacity;
+          gbuf.resize(capacity);
+        }
+      const unsigned char *prow = bm.get_packed_row(y);
+      int n = (rle) ? scan_rle_row(bm, y, rlens, xs) :
+        (prow) ? scan_packed_row(prow, w, xs) : scan_row(bm[y], w, xs);
+      Run *run = buf + count;
+      for (int i=0; i<n; i++, run++)
+        {
+          run->y = offy + y;
+          run->x1 = offx + xs[2*i];
+          run->x2 = offx + xs[2*i+1];
+          run->color = color;
+          run->ccid = 0;
+        }
+      count += n;
+    }
+  // Append them at once
+  if (count > 0)
+    {
+      int index = runs.hbound() + 1;
+      runs.resize(0, index + count - 1);
+      memcpy(&runs[index], buf, count*sizeof(Run));
+    }
+}
+
+
+// -- Performs connected component analysis
+void
+CCImage::make_ccids_by_analysis()
+{
+  int nruns = runs.size();
+  if (nruns <= 0)
+    return;
+  // Sort runs unless they already are
+  if (! runs_sorted(runs, nruns))
+    runs.sort();
+  Run *r = runs;
+  // Single pass union-find over runs.
+  // Roots are always the smallest id of their set.
+  int *umap;
+  GPBuffer<int> gumap(umap, nruns);
+  int nid = 0;
+  int n;
+  int p = 0;
+  for (n=0; n<nruns; n++)
+    {
+      int y = r[n].y;
+      int x1 = r[n].x1 - 1;
+      int x2 = r[n].x2 + 1;
+      int color = r[n].color;
+      int id = -1;
+      // iterate over previous line runs
+      // (backing up one run because color runs may be adjacent)
+      if (p > 0) p--;
+      while (r[p].y < y-1)
+        p++;
+      for (; r[p].y < y && r[p].x1 <= x2; p++)
+        {
+          if (r[p].x2 >= x1)
+            {
+              if (r[p].color == color)
+                {
+                  // previous run touches current run and has same color
+                  int oid = r[p].ccid;
+                  while (umap[oid] < oid)
+                    oid = umap[oid];
+                  if (id < 0) {
+                    id = oid;
+                  } else if (id < oid) {
+                    umap[oid] = id;
+                  } else if (oid < id) {
+                    umap[id] = oid;
+                    id = oid;
+                  }
+                  // freshen previous run id
+                  r[p].ccid = id;
+                }
+              // stop if previous run goes past current run
+              if (r[p].x2 >= x2)
+                break;
+            }
+        }
+      // create new entry in umap
+      if (id < 0)
+        {
+          id = nid++;
+          umap[id] = id;
+        }
+      r[n].ccid = id;
+    }
+  // Update umap and ccid
+  for (n=0; n<nruns; n++)
+    {
+      int ccid = r[n].ccid;
+      while (umap[ccid] < ccid)
+        ccid = umap[ccid];
+      umap[r[n].ccid] = ccid;
+      r[n].ccid = ccid;
+    }
+}
+
+
+// -- Constructs the ``ccs'' array from run's ccids.
+void
+CCImage::make_ccs_from_ccids()
+{
+  int n;
+  int nruns = runs.size();
+  Run *pruns = runs;
+  // Find maximal ccid
+  int maxccid = nregularccs-1;
+  for (n=0; n<nruns; n++)
+    if (pruns[n].ccid > maxccid)
+      maxccid = pruns[n].ccid;
+  // Renumber ccs 
+  int *rmap;
+  GPBuffer<int> grmap(rmap, maxccid+1);
+  for (n=0; n<=maxccid; n++)
+    rmap[n] = -1;
+  for (n=0; n<nruns; n++)
+    if (pruns[n].ccid >= 0)
+      rmap[ pruns[n].ccid ] = 1;
+  int nid = 0;
+  for (n=0; n<=maxccid; n++)
+    if (rmap[n] > 0)
+      rmap[n] = nid++;
+  // Adjust nregularccs (since ccs are renumbered)
+  while (nregularccs>0 && rmap[nregularccs-1]<0)
+    nregularccs -= 1;
+  if (nregularccs>0)
+    nregularccs = 1 + rmap[nregularccs-1];
+  // Prepare cc descriptors
+  ccs.resize(0,nid-1);
+  CC *pccs = ccs;
+  for (n=0; n<nid; n++)
+    pccs[n].nrun = 0;
+  // Relabel runs
+  for (n=0; n<nruns; n++)
+    {
+      Run &run = pruns[n];
+      if (run.ccid < 0) continue;  // runs with negative ccids are destroyed
+      run.ccid = rmap[run.ccid];
+      pccs[run.ccid].nrun += 1;
+    }
+  // Compute positions for runs of cc
+  int frun = 0;
+  for (n=0; n<nid; n++) 
+    {
+      pccs[n].frun = rmap[n] = frun;
+      frun += pccs[n].nrun;
+    }
+  // Copy runs (preserving their relative order)
+  GTArray<Run> rtmp;
+  rtmp.steal(runs);
+  Run *ptmp = rtmp;
+  runs.resize(0,frun-1);
+  pruns = runs;
+  for (n=0; n<nruns; n++)
+    {
+      int id = ptmp[n].ccid;
+      if (id < 0) continue;
+      pruns[rmap[id]++] = ptmp[n];
+    }
+  // Finalize ccs
+  for (n=0; n<nid; n++)
+    {
+      CC &cc = pccs[n];
+      if (! runs_sorted(pruns+cc.frun, cc.nrun))
+        runs.sort(cc.frun, cc.frun+cc.nrun-1);
+      const Run *run = pruns + cc.frun;
+      int xmin = run->x1;
+      int xmax = run->x2;
+      int npix = 0;
+      cc.color = run->color;
+      cc.bb.ymin = run->y;
+      cc.bb.ymax = run[cc.nrun-1].y + 1;
+      for (int i=0; i<cc.nrun; i++, run++)
+        {
+          if (run->x1 < xmin)  xmin = run->x1;
+          if (run->x2 > xmax)  xmax = run->x2;
+          npix += run->x2 - run->x1 + 1;
+        }
+      cc.npix = npix;
+      cc.bb.xmin = xmin;
+      cc.bb.xmax = xmax + 1;
+    }
+}
+
+
+// -- Removes ccs which are too small.
+void
+CCImage::erase_tiny_ccs(int tinysize)
+{
+  // ISSUE: HALFTONE DETECTION
+  // We should not remove tiny ccs if they are part of a halftone pattern...
+  for (int i=0; i<ccs.size(); i++)
+    if (ccs[i].npix <= tinysize)
+      erase_cc(i);
+}
+
+
+// -- Marks cc for deletion
+void 
+CCImage::erase_cc(int ccid)
+{
+  CC &cc = ccs[ccid];
+  Run *r = &runs[cc.frun];
+  int nr = cc.nrun;
+  cc.nrun = 0;
+  cc.npix = 0;
+  while (--nr >= 0)
+    (r++)->ccid = -1;  // will be deleted by make_ccs_from_ccids()
+}
+
+
+// -- Helper for merge_and_split_ccs
+struct Grid_x_CCid 
+{
+  short gridi;
+  short gridj;
+  int ccid;
+  int color;
+};
+
+
+// -- Helper for merge_and_split_ccs
+static inline unsigned int
+hash(const Grid_x_CCid &x) 
+{
+  return (x.gridi<<16) ^ (x.gridj<<8) ^ x.ccid ^ (x.color<<20);
+}
+
+
+// -- Helper for merge_and_split_ccs
+static inline bool
+operator==(const Grid_x_CCid &x, const Grid_x_CCid &y)
+{
+  return (x.gridi==y.gridi) && (x.gridj==y.gridj) 
+    && (x.ccid==y.ccid) && (x.color==y.color);
+}
+
+
+// -- Helper for merge_and_split_ccs
+static int
+makeccid(const Grid_x_CCid &x, GMap<Grid_x_CCid,int> &map, int &ncc)
+{
+  GPosition p = map.contains(x);
+  if (p) return map[p];
+  return map[x] = ncc++;
+}
+
+
+// -- Merges small ccs of similar color and splits large ccs
+void
+CCImage::merge_and_split_ccs(int smallsize, int largesize, bool bycolor)
+{
+  int ncc = ccs.size();
+  int nruns = runs.size();
+  int splitsize = largesize;
+  if (ncc <= 0) return;
+  // Associative map for storing merged ccids
+  GMap<Grid_x_CCid,int> map;
+  nregularccs = ncc;
+  // Set the correct ccids for the runs
+  for (int ccid=0; ccid<ccs.size(); ccid++)
+    {
+      CC* cc = &ccs[ccid];
+      if (cc->nrun <= 0) continue;
+      Grid_x_CCid key;
+      key.color = cc->color;
+      int ccheight = cc->bb.height();
+      int ccwidth = cc->bb.width();
+      if (ccheight<=smallsize && ccwidth<=smallsize)
+        {
+          // small ccs are merged by color
+          key.ccid = -1;
+          key.gridi = (cc->bb.ymin+cc->bb.ymax)/splitsize/2;
+          key.gridj = (cc->bb.xmin+cc->bb.xmax)/splitsize/2;
+          int newccid = makeccid(key, map, ncc);
+          for(int runid=cc->frun; runid<cc->frun+cc->nrun; runid++)
+            runs[runid].ccid = newccid;
+        }
+      else if (ccheight>=largesize || ccwidth>=largesize)
+        {
+          // large ccs are split along the grid
+          key.ccid = (bycolor) ? -1 : ccid;
+          for(int runid=cc->frun; runid<cc->frun+cc->nrun; runid++)
+            {
+              Run *r = & runs[runid];
+              key.gridi = r->y/splitsize;
+              key.gridj = r->x1/splitsize;
+              int gridj_end = r->x2/splitsize;
+              int gridj_span = gridj_end - key.gridj;
+              r->ccid = makeccid(key, map, ncc);
+              if (gridj_span>0)
+                {
+                  // truncate current run 
+                  runs.touch(nruns+gridj_span-1);
+                  r = &runs[runid];
+                  int x = key.gridj*splitsize + splitsize;
+                  int x_end = r->x2;
+                  r->x2 = x-1;
+                  // append additional runs to the runs array
+                  while (++key.gridj < gridj_end)
+                    {
+                      Run& newrun = runs[nruns++];
+                      newrun.y = r->y;
+                      newrun.x1 = x;
+                      x += splitsize;
+                      newrun.x2 = x-1;
+                      newrun.color = r->color;
+                      newrun.ccid = makeccid(key, map, ncc);
+                    }
+                  // append last run to the run array
+                  Run& newrun = runs[nruns++];
+                  newrun.y = r->y;
+                  newrun.x1 = x;
+                  newrun.x2 = x_end;
+                  newrun.color = r->color;
+                  newrun.ccid = makeccid(key, map, ncc);
+                }
+            }
+        }
+    }
+  // Recompute cc descriptors
+  make_ccs_from_ccids();
+}
+
+
+// -- Helps sorting cc
+static int 
+top_edges_descending (const void *pa, const void *pb)
+{
+  const CCImage::CC *a = (const CCImage::CC*) pa;
+  const CCImage::CC *b = (const CCImage::CC*) pb;
+  if (a->bb.ymax != b->bb.ymax)
+    return (b->bb.ymax - a->bb.ymax);
+  if (a->bb.xmin != b->bb.xmin)
+    return (a->bb.xmin - b->bb.xmin);
+  return (a->frun - b->frun);
+}
+
+
+// -- Helps sorting cc
+static int 
+left_edges_ascending (const void *pa, const void *pb)
+{
+  const CCImage::CC *a = (const CCImage::CC*) pa;
+  const CCImage::CC *b = (const CCImage::CC*) pb;
+  if (a->bb.xmin != b->bb.xmin)
+    return (a->bb.xmin - b->bb.xmin);
+  if (b->bb.ymax != a->bb.ymax)
+    return (b->bb.ymax - a->bb.ymax);
+  return (a->frun - b->frun);
+}
+
+
+// -- Helps sorting cc
+static int 
+integer_ascending (const void *pa, const void *pb)
+{
+  return ( *(int*)pb - *(int*)pa );
+}
+
+
+// -- Sort ccs in approximate reading order
+void 
+CCImage::sort_in_reading_order()
+{
+  if (nregularccs<2) return;
+  CC *ccarray;
+  GPBuffer<CC> gccarray(ccarray, nregularccs);
+  // Copy existing ccarray (but segregate special ccs)
+  int ccid;
+  for(ccid=0; ccid<nregularccs; ccid++)
+    ccarray[ccid] = ccs[ccid];
+  // Sort the ccarray list into top-to-bottom order.
+  qsort (ccarray, nregularccs, sizeof(CC), top_edges_descending);
+  // Subdivide the ccarray list roughly into text lines [LYB]
+  // - Determine maximal top deviation
+  int maxtopchange = width / 40;
+  if (maxtopchange < 32) 
+    maxtopchange = 32;
+  // - Loop until processing all ccs
+  int ccno = 0;
+  int *bottoms;
+  GPBuffer<int> gbottoms(bottoms, nregularccs);
+  while (ccno < nregularccs)
+    {
+      // - Gather first line approximation
+      int nccno;
+      int sublist_top = ccarray[ccno].bb.ymax-1;
+      int sublist_bottom = ccarray[ccno].bb.ymin;
+      for (nccno=ccno; nccno < nregularccs; nccno++)
+        {
+          if (ccarray[nccno].bb.ymax-1 < sublist_bottom) break;
+          if (ccarray[nccno].bb.ymax-1 < sublist_top - maxtopchange) break;
+          int bottom = ccarray[nccno].bb.ymin;
+          bottoms[nccno-ccno] = bottom;
+          if (bottom < sublist_bottom)
+            sublist_bottom = bottom;
+        }
+      // - If more than one candidate cc for the line
+      if (nccno > ccno + 1)
+        {
+          // - Compute median bottom
+          qsort(bottoms, nccno-ccno, sizeof(int), integer_ascending);
+          int bottom = bottoms[ (nccno-ccno-1)/2 ];
+          // - Compose final line
+          for (nccno=ccno; nccno < nregularccs; nccno++)
+            if (ccarray[nccno].bb.ymax-1 < bottom)
+              break;
+          // - Sort final line
+          qsort (ccarray+ccno, nccno-ccno, sizeof(CC), left_edges_ascending);
+        }
+      // - Next line
+      ccno = nccno;
+    }
+  // Copy ccarray back and renumber the runs
+  for(ccid=0; ccid<nregularccs; ccid++)
+    {
+      CC& cc = ccarray[ccid];
+      ccs[ccid] = cc;
+      for(int r=cc.frun; r<cc.frun+cc.nrun; r++)
+        runs[r].ccid = ccid;
+    }
+}
+
+
+// -- Creates a bitmap for a particular component
+GP<GBitmap>   
+CCImage::get_bitmap_for_cc(const int ccid) const
+{
+  const CC &cc = ccs[ccid];
+  const GRect &bb = cc.bb;
+  GP<GBitmap> bits = GBitmap::create(bb.height(), bb.width());
+  const Run *prun = & runs[(int)cc.frun];
+  for (int i=0; i<cc.nrun; i++,prun++)
+    {
+      if (prun->y<bb.ymin || prun->y>=bb.ymax)
+        G_THROW("Internal error (y bounds)");
+      if (prun->x1<bb.xmin || prun->x2>=bb.xmax)
+        G_THROW("Internal error (x bounds)");
+      unsigned char *row = (*bits)[prun->y - bb.ymin];
+      memset(row + prun->x1 - bb.xmin, 1, prun->x2 - prun->x1 + 1);
+    }
+  return bits;
+}
+
+
+// -- Creates a JB2Image with the remaining components
+GP<JB2Image> 
+CCImage::get_jb2image(int special, DjVuPalette *pal) const
+{
+  GP<JB2Image> jimg = JB2Image::create();
+  jimg->set_dimension(width, height);
+  if (runs.hbound() < 0)
+    return jimg;
+  if (ccs.hbound() < 0)
+    G_THROW("Must first perform a cc analysis");
+  // Iterate over CCs
+  for (int ccid=0; ccid<=ccs.hbound(); ccid++)
+    {
+      JB2Shape shape;
+      JB2Blit  blit;
+      shape.parent = -1;
+      shape.bits = get_bitmap_for_cc(ccid);
+      shape.bits->compress();
+      shape.userdata = 0;
+      if (ccid >= nregularccs)
+        shape.userdata |= special;
+      blit.shapeno = jimg->add_shape(shape);
+      blit.left = ccs[ccid].bb.xmin;
+      blit.bottom = ccs[ccid].bb.ymin;
+      int blitno = jimg->add_blit(blit);
+      if (pal)
+        {
+          pal->colordata.touch(blitno);
+          pal->colordata[blitno] = ccs[ccid].color;
+        }
+    }
+  return jimg;
+}
+
+
+#ifdef HAVE_NAMESPACES
+}
+# ifndef NOT_USING_DJVU_NAMESPACE
+using namespace DJVU;
+# endif
+#endif
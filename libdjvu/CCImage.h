@@ -0,0 +1,214 @@
+//C-  -*- C++ -*-
+//C- -------------------------------------------------------------------
+//C- DjVuLibre-3.5
+//C- Copyright (c) 2002  Leon Bottou and Yann Le Cun.
+//C- Copyright (c) 2001  AT&T
+//C-
+//C- This software is subject to, and may be distributed under, the
+//C- GNU General Public License, either Version 2 of the license,
+//C- or (at your option) any later version. The license should have
+//C- accompanied the software or you may obtain a copy of the license
+//C- from the Free Software Foundation at http://www.fsf.org .
+//C-
+//C- This program is distributed in the hope that it will be useful,
+//C- but WITHOUT ANY WARRANTY; without even the implied warranty of
+//C- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//C- GNU General Public License for more details.
+//C- 
+//C- DjVuLibre-3.5 is derived from the DjVu(r) Reference Library from
+//C- Lizardtech Software.  Lizardtech Software has authorized us to
+//C- replace the original DjVu(r) Reference Library notice by the following
+//C- text (see doc/lizard2002.djvu and doc/lizardtech2007.djvu):
+//C-
+//C-  ------------------------------------------------------------------
+//C- | DjVu (r) Reference Library (v. 3.5)
+//C- | Copyright (c) 1999-2001 LizardTech, Inc. All Rights Reserved.
+//C- | The DjVu Reference Library is protected by U.S. Pat. No.
+//C- | 6,058,214 and patents pending.
+//C- |
+//C- | This software is subject to, and may be distributed under, the
+//C- | GNU General Public License, either Version 2 of the license,
+//C- | or (at your option) any later version. The license should have
+//C- | accompanied the software or you may obtain a copy of the license
+//C- | from the Free Software Foundation at http://www.fsf.org .
+//C- |
+//C- | The computer code originally released by LizardTech under this
+//C- | license and unmodified by other parties is deemed "the LIZARDTECH
+//C- | ORIGINAL CODE."  Subject to any third party intellectual property
+//C- | claims, LizardTech grants recipient a worldwide, royalty-free, 
+//C- | non-exclusive license to make, use, sell, or otherwise dispose of 
+//C- | the LIZARDTECH ORIGINAL CODE or of programs derived from the 
+//C- | LIZARDTECH ORIGINAL CODE in compliance with the terms of the GNU 
+//C- | General Public License.   This grant only confers the right to 
+//C- | infringe patent claims underlying the LIZARDTECH ORIGINAL CODE to 
+//C- | the extent such infringement is reasonably necessary to enable 
+//C- | recipient to make, have made, practice, sell, or otherwise dispose 
+//C- | of the LIZARDTECH ORIGINAL CODE (or portions thereof) and not to 
+//C- | any greater extent that may be necessary to utilize further 
+//C- | modifications or combinations.
+//C- |
+//C- | The LIZARDTECH ORIGINAL CODE is provided "AS IS" WITHOUT WARRANTY
+//C- | OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+//C- | TO ANY WARRANTY OF NON-INFRINGEMENT, OR ANY IMPLIED WARRANTY OF
+//C- | MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE.
+//C- +------------------------------------------------------------------
+
+#ifndef _CCIMAGE_H_
+#define _CCIMAGE_H_
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#if NEED_GNUG_PRAGMAS
+# pragma interface
+#endif
+
+
+#include "GContainer.h"
+#include "GRect.h"
+
+
+#ifdef HAVE_NAMESPACES
+namespace DJVU {
+# ifdef NOT_DEFINED // Just to fool emacs c++ mode
+}
+#endif
+#endif
+
+class GBitmap;
+class JB2Image;
+class DjVuPalette;
+
+
+/** @name CCImage.h
+
+    Files #"CCImage.h"# and #"CCImage.cpp"# implement the connected
+    component analysis shared by the encoders #cjb2#, #cpaldjvu# and
+    #csepdjvu#.  An image is represented as an array of horizontal runs of
+    pixels.  Each run carries a color index, so that bitonal images simply
+    use color zero everywhere.  Connected components are computed by a single
+    pass of union-find over the sorted runs.  The components can then be
+    cleaned, merged, split and sorted in reading order before being turned
+    into the shapes and blits of a \Ref{JB2Image}.
+
+    @memo
+    Connected component analysis for the DjVu encoders.
+*/
+//@{
+
+
+/** Image represented as runs grouped into connected components.
+    The typical sequence of operations consists in (a) adding runs using
+    \Ref{add_single_run} or \Ref{add_bitmap_runs}, (b) labeling the runs with
+    \Ref{make_ccids_by_analysis}, (c) computing the component descriptors
+    with \Ref{make_ccs_from_ccids}, (d) merging tiny components and splitting
+    huge ones with \Ref{merge_and_split_ccs}, (e) ordering the components
+    with \Ref{sort_in_reading_order}, and (f) producing a \Ref{JB2Image}
+    with \Ref{get_jb2image}. */
+
+class DJVUAPI CCImage
+{
+public:
+  /** A run of pixels with the same color. */
+  struct Run
+  {
+    int y;         // vertical coordinate
+    short x1;      // first horizontal coordinate
+    short x2;      // last horizontal coordinate
+    short color;   // color id
+    int ccid;      // component id
+  };
+  /** A component descriptor. */
+  struct CC
+  {
+    GRect bb;      // bounding box
+    int npix;      // number of pixels
+    int nrun;      // number of runs
+    int frun;      // first run in cc ordered array of runs
+    int color;     // color id
+  };
+  /// Height of the image in pixels.
+  int height;
+  /// Width of the image in pixels.
+  int width;
+  /// Array of runs.
+  GTArray<Run> runs;
+  /// Array of component descriptors.
+  GTArray<CC> ccs;
+  /// Number of regular ccs (set by \Ref{merge_and_split_ccs}).
+  int nregularccs;
+  /// Constructs an empty image of size #width# by #height#.
+  CCImage(int width=0, int height=0);
+  /** Removes all runs and components and sets the image size. */
+  void init(int width, int height);
+  /** Adds a run of color #color# on line #y# from #x1# to #x2# inclusive. */
+  void add_single_run(int y, int x1, int x2, int color=0, int ccid=0);
+  /** Adds the runs of black pixels of bilevel image #bm# with color #color#.
+      The bitmap is placed with its bottom left corner at #offx#,#offy#.
+      RLE encoded and packed bitmaps are read without being expanded.
+      Otherwise rows are scanned eight pixels at a time in order to skip
+      quickly over long white or black stretches. */
+  void add_bitmap_runs(const GBitmap &bm, int offx=0, int offy=0, int color=0);
+  /** Labels the runs with their connected component.  Two runs belong to
+      the same component when they have the same color and touch each other,
+      including diagonally.  Runs are sorted first unless they already are.
+      Component ids follow the order of their first run. */
+  void make_ccids_by_analysis();
+  /** Computes array #ccs# from the component ids of the runs.  Runs with a
+      negative id are removed.  Runs are regrouped by component and sorted
+      within each component. */
+  void make_ccs_from_ccids();
+  /** Erases all components with #tinysize# pixels or less. */
+  void erase_tiny_ccs(int tinysize);
+  /** Erases component #ccid#.  Function \Ref{make_ccs_from_ccids} must be
+      called afterwards to actually remove its runs. */
+  void erase_cc(int ccid);
+  /** Merges small components and splits large ones.  Components whose size
+      does not exceed #smallsize# in both directions are merged with all
+      components of the same color whose center is in the same cell of a
+      grid of pitch #largesize#.  Components whose size reaches #largesize#
+      in one direction are cut along the same grid.  When #bycolor# is true,
+      all these pieces are also merged by color within each grid cell.  The
+      resulting components are placed after the #nregularccs# regular
+      ones. */
+  void merge_and_split_ccs(int smallsize, int largesize, bool bycolor=false);
+  /** Sorts the regular components in approximate reading order. */
+  void sort_in_reading_order();
+  /** Returns a bitmap with the pixels of component #ccid#. */
+  GP<GBitmap> get_bitmap_for_cc(int ccid) const;
+  /** Returns a \Ref{JB2Image} with one shape and one blit per component.
+      The #userdata# field of the shapes of the components that are not
+      regular is set to #special#.  When #pal# is not null, the color of each
+      blit is stored into its array #colordata#. */
+  GP<JB2Image> get_jb2image(int special, DjVuPalette *pal=0) const;
+};
+
+//@}
+
+// ------------------------------------------------------------
+// INLINE CODE
+// ------------------------------------------------------------
+
+inline void
+CCImage::add_single_run(int y, int x1, int x2, int color, int ccid)
+{
+  int index = runs.hbound();
+  runs.touch(++index);
+  Run& run = runs[index];
+  run.y = y;
+  run.x1 = x1;
+  run.x2 = x2;
+  run.color = color;
+  run.ccid = ccid;
+}
+
+
+// ---------------------------------------- END
+
+#ifdef HAVE_NAMESPACES
+}
+# ifndef NOT_USING_DJVU_NAMESPACE
+using namespace DJVU;
+# endif
+#endif
+
+#endif
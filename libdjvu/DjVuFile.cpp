@@ -959,6 +959,7 @@ DjVuFile::decode_chunk( const GUTF8String &id, const GP<ByteStream> &gbs,
         G_THROW( ERR_MSG("DjVuFile.dupl_backgrnd") );
       // First chunk
       GP<IW44Image> bg44=IW44Image::create_decode(IW44Image::COLOR);
+      bg44->set_decode_subsample(IW44Image::get_default_decode_subsample());
       bg44->decode_chunk(gbs);
       this->bg44 = bg44;
       desc.format( ERR_MSG("DjVuFile.IW44_bg1") "\t%d\t%d\t%d",
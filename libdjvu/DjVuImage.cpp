@@ -845,7 +845,7 @@ DjVuImage::stencil(GPixmap *pm, const GRect &rect,
   GP<GBitmap> bm;
   if (fgjb)
     {
-      JB2Image *jimg = fgjb;
+      const JB2Image *jimg = fgjb;
       if (! (width && height && 
              jimg->get_width() == width && 
              jimg->get_height() == height ) )
@@ -855,8 +855,13 @@ DjVuImage::stencil(GPixmap *pm, const GRect &rect,
       bm->set_grays(1+subsample*subsample);
       int rxmin = rect.xmin * subsample;
       int rymin = rect.ymin * subsample;
-      for (int blitno = 0; blitno < jimg->get_blit_count(); blitno++)
+      GTArray<int> blitnos;
+      jimg->select_blits(GRect(rxmin, rymin, rect.width() * subsample,
+                               rect.height() * subsample), blitnos);
+      JB2ShapeCache cache(*jimg, subsample);
+      for (int i = 0; i < blitnos.size(); i++)
         {
+          int blitno = blitnos[i];
           const JB2Blit *pblit = jimg->get_blit(blitno);
           const JB2Shape  &pshape = jimg->get_shape(pblit->shapeno);
           if (pshape.bits &&
@@ -868,9 +873,8 @@ DjVuImage::stencil(GPixmap *pm, const GRect &rect,
               // Record component list
               if (fgbc) components.append(blitno);
               // Blit
-              bm->blit(pshape.bits, 
-                       pblit->left - rxmin, pblit->bottom - rymin, 
-                       subsample);
+              cache.blit(*bm, pblit->shapeno,
+                         pblit->left - rxmin, pblit->bottom - rymin);
             }
         }
     }
@@ -882,7 +886,7 @@ DjVuImage::stencil(GPixmap *pm, const GRect &rect,
       // Perform attenuation from scratch
       pm->attenuate(bm, 0, 0);
       // Check that fgbc has the correct size
-      JB2Image *jimg = fgjb;
+      const JB2Image *jimg = fgjb;
       DjVuPalette *fg = fgbc;
       if (jimg->get_blit_count() != fg->colordata.size())
         return 0;
@@ -892,6 +896,7 @@ DjVuImage::stencil(GPixmap *pm, const GRect &rect,
       for (int i=0; i<palettesize; i++)
         fg->index_to_color(i, colors[i]);
       GPixmap::color_correct(gamma_correction, white, colors, palettesize);
+      JB2ShapeCache cache(*jimg, subsample);
       // Blit all components (one color at a time)
       while (components.size() > 0)
         {
@@ -937,10 +942,8 @@ DjVuImage::stencil(GPixmap *pm, const GRect &rect,
             {
               int blitno = compset[pos];
               const JB2Blit *pblit = jimg->get_blit(blitno);
-              const JB2Shape  &pshape = jimg->get_shape(pblit->shapeno);
-              bm->blit(pshape.bits, 
-                       pblit->left - rxmin, pblit->bottom - rymin, 
-                       subsample);
+              cache.blit(*bm, pblit->shapeno,
+                         pblit->left - rxmin, pblit->bottom - rymin);
             }
           // Blend color into background pixmap
           pm->blit(bm, comprect.xmin-rect.xmin, comprect.ymin-rect.ymin, 
@@ -66,6 +66,7 @@
 #include "GString.h"
 #include "GThreads.h"
 #include "GException.h"
+#include "MMX.h"
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
@@ -94,12 +95,13 @@ GBitmap::destroy(void)
   grle.resize(0);
   grlerows.resize(0);
   rlelength = 0;
+  gpbits.resize(0);
 }
 
 GBitmap::GBitmap()
   : nrows(0), ncolumns(0), border(0), 
     bytes_per_row(0), grays(0), bytes(0), gbytes_data(bytes_data), 
-    grle(rle), grlerows(rlerows), rlelength(0),
+    grle(rle), grlerows(rlerows), rlelength(0), pbits(0), gpbits(pbits),
     monitorptr(0)
 {
 }
@@ -107,7 +109,7 @@ GBitmap::GBitmap()
 GBitmap::GBitmap(int nrows, int ncolumns, int border)
   : nrows(0), ncolumns(0), border(0), 
     bytes_per_row(0), grays(0), bytes(0), gbytes_data(bytes_data), 
-    grle(rle), grlerows(rlerows), rlelength(0),
+    grle(rle), grlerows(rlerows), rlelength(0), pbits(0), gpbits(pbits),
     monitorptr(0)
 {
   G_TRY
@@ -125,7 +127,7 @@ GBitmap::GBitmap(int nrows, int ncolumns, int border)
 GBitmap::GBitmap(ByteStream &ref, int border)
   : nrows(0), ncolumns(0), border(0), 
     bytes_per_row(0), grays(0), bytes(0), gbytes_data(bytes_data),
-    grle(rle), grlerows(rlerows), rlelength(0),
+    grle(rle), grlerows(rlerows), rlelength(0), pbits(0), gpbits(pbits),
     monitorptr(0)
 {
   G_TRY
@@ -143,7 +145,7 @@ GBitmap::GBitmap(ByteStream &ref, int border)
 GBitmap::GBitmap(const GBitmap &ref)
   : nrows(0), ncolumns(0), border(0), 
     bytes_per_row(0), grays(0), bytes(0), gbytes_data(bytes_data), 
-    grle(rle), grlerows(rlerows), rlelength(0),
+    grle(rle), grlerows(rlerows), rlelength(0), pbits(0), gpbits(pbits),
     monitorptr(0)
 {
   G_TRY
@@ -161,7 +163,7 @@ GBitmap::GBitmap(const GBitmap &ref)
 GBitmap::GBitmap(const GBitmap &ref, int border)
   : nrows(0), ncolumns(0), border(0), 
     bytes_per_row(0), grays(0), bytes(0), gbytes_data(bytes_data),
-    grle(rle), grlerows(rlerows), rlelength(0),
+    grle(rle), grlerows(rlerows), rlelength(0), pbits(0), gpbits(pbits),
     monitorptr(0)
 {
   G_TRY
@@ -180,7 +182,7 @@ GBitmap::GBitmap(const GBitmap &ref, int border)
 GBitmap::GBitmap(const GBitmap &ref, const GRect &rect, int border)
   : nrows(0), ncolumns(0), border(0), 
     bytes_per_row(0), grays(0), bytes(0), gbytes_data(bytes_data),
-    grle(rle), grlerows(rlerows), rlelength(0),
+    grle(rle), grlerows(rlerows), rlelength(0), pbits(0), gpbits(pbits),
     monitorptr(0)
 {
   G_TRY
@@ -236,6 +238,14 @@ GBitmap::init(const GBitmap &ref, int aborder)
   if (this != &ref) 
     {
       GMonitorLock lock(ref.monitor());
+      if (ref.pbits)
+        {
+          // Copy packed bits
+          init_packed(ref.nrows, ref.ncolumns, aborder);
+          grays = ref.grays;
+          memcpy(pbits, ref.pbits, nrows * packed_rowsize());
+          return;
+        }
       init(ref.nrows, ref.ncolumns, aborder);
       grays = ref.grays;
       unsigned char *row = bytes_data+border;
@@ -265,9 +275,38 @@ GBitmap::init(const GBitmap &ref, const GRect &rect, int border)
       tmp.bytes = bytes;
       tmp.gbytes_data.swap(gbytes_data);
       tmp.grle.swap(grle);
+      tmp.gpbits.swap(gpbits);
       bytes = 0 ;
       init(tmp, rect, border);
     }
+  else if (ref.pbits)
+    {
+      GMonitorLock lock(ref.monitor());
+      // create empty packed bitmap
+      init_packed(rect.height(), rect.width(), border);
+      grays = ref.grays;
+      // compute destination rectangle
+      GRect rect2(0, 0, ref.columns(), ref.rows() );
+      rect2.intersect(rect2, rect);
+      rect2.translate(-rect.xmin, -rect.ymin);
+      // copy bits
+      if (! rect2.isempty())
+        {
+          const int prs = packed_rowsize();
+          const int refprs = ref.packed_rowsize();
+          for (int y=rect2.ymin; y<rect2.ymax; y++)
+            {
+              unsigned char *dst = pbits + y * prs;
+              const unsigned char *src = ref.pbits + (y+rect.ymin) * refprs;
+              for (int x=rect2.xmin; x<rect2.xmax; x++)
+                {
+                  const int sx = x + rect.xmin;
+                  if (src[sx>>3] & (0x80 >> (sx&7)))
+                    dst[x>>3] |= (0x80 >> (x&7));
+                }
+            }
+        }
+    }
   else
     {
       GMonitorLock lock(ref.monitor());
@@ -305,7 +344,10 @@ GBitmap::init(ByteStream &ref, int aborder)
   int acolumns = read_integer(lookahead, ref);
   int arows = read_integer(lookahead, ref);
   int maxval = 1;
-  init(arows, acolumns, aborder);
+  if (magic[0]=='P' && magic[1]=='4')
+    init_packed(arows, acolumns, aborder);
+  else
+    init(arows, acolumns, aborder);
   // go reading file
   if (magic[0]=='P')
     {
@@ -376,6 +418,29 @@ GBitmap::donate_rle(unsigned char *rledata, unsigned int rledatalen, int w, int
   rlelength = rledatalen;
 }
 
+void 
+GBitmap::init_packed(int arows, int acolumns, int aborder)
+{
+  size_t nbytes = (size_t)arows * ((acolumns + 7) >> 3);
+  if (arows != (unsigned short) arows ||
+      acolumns != (unsigned short) acolumns ||
+      acolumns + aborder != (unsigned short)(acolumns + aborder) )
+    G_THROW("GBitmap: image size exceeds maximum (corrupted file?)");
+  GMonitorLock lock(monitor());
+  destroy();
+  grays = 2;
+  nrows = arows;
+  ncolumns = acolumns;
+  border = aborder;
+  bytes_per_row = ncolumns + border;
+  gzerobuffer=zeroes(bytes_per_row + border);
+  if (nbytes > 0)
+    {
+      gpbits.resize(nbytes);
+      gpbits.clear();
+    }
+}
+
 
 unsigned char *
 GBitmap::take_data(size_t &offset)
@@ -405,7 +470,7 @@ GBitmap::compress()
   if (grays > 2)
     G_THROW( ERR_MSG("GBitmap.cant_compress") );
   GMonitorLock lock(monitor());
-  if (bytes)
+  if (bytes || pbits)
     {
       grle.resize(0);
       grlerows.resize(0);
@@ -414,6 +479,7 @@ GBitmap::compress()
         {
           gbytes_data.resize(0);
           bytes = 0;
+          gpbits.resize(0);
         }
     }
 }
@@ -424,6 +490,43 @@ GBitmap::uncompress()
   GMonitorLock lock(monitor());
   if (!bytes && rle)
     decode(rle);
+  else if (!bytes && pbits)
+    unpack();
+}
+
+void
+GBitmap::pack()
+{
+  if (grays > 2)
+    G_THROW( ERR_MSG("GBitmap.cant_compress") );
+  GMonitorLock lock(monitor());
+  if (pbits || nrows==0 || ncolumns==0)
+    return;
+  const int prs = packed_rowsize();
+  unsigned char *nbits;
+  GPBuffer<unsigned char> gnbits(nbits, nrows * prs);
+  gnbits.clear();
+  if (bytes)
+    {
+      // pack pixel array
+      const unsigned char *row = bytes + border;
+      unsigned char *prow = nbits;
+      for (int n=0; n<nrows; n++, row+=bytes_per_row, prow+=prs)
+        for (int c=0; c<ncolumns; c++)
+          if (row[c])
+            prow[c>>3] |= (0x80 >> (c&7));
+    }
+  else if (rle)
+    {
+      // pack rle data, starting with the top line
+      const unsigned char *runs = rle;
+      for (int n=nrows-1; n>=0; n--)
+        rle_get_bitmap(ncolumns, runs, nbits + n * prs, false);
+    }
+  else
+    return;
+  destroy();
+  gpbits.swap(gnbits);
 }
 
 
@@ -436,6 +539,8 @@ GBitmap::get_memory_usage() const
     usage += nrows * bytes_per_row + border;
   if (rle)
     usage += rlelength;
+  if (pbits)
+    usage += nrows * packed_rowsize();
   return usage;
 }
 
@@ -622,6 +727,38 @@ GBitmap::blit(const GBitmap *bm, int x, int y)
             }
         }
     }
+  else if (bm->pbits)
+    {
+      if (!bytes_data)
+        uncompress();
+      // Blit from packed bits
+      const int prs = bm->packed_rowsize();
+      const unsigned char *srow = bm->pbits;
+      unsigned char *drow = bytes_data + border + y*bytes_per_row + x;
+      const int sc0 = max(0, -x);
+      const int sc1 = min(bm->ncolumns, ncolumns-x);
+      for (int sr = 0; sr < bm->nrows; sr++)
+        {
+          if (sr+y>=0 && sr+y<nrows) 
+            {
+              for (int sc = sc0; sc < sc1; )
+                {
+                  const int b = srow[sc>>3];
+                  if (! b)
+                    {
+                      sc = (sc | 7) + 1;
+                      continue;
+                    }
+                  const int sce = min(sc1, (sc | 7) + 1);
+                  for (; sc < sce; sc++)
+                    if (b & (0x80 >> (sc&7)))
+                      drow[sc] += 1;
+                }
+            }
+          srow += prs;
+          drow += bytes_per_row;
+        }
+    }
 }
 
 
@@ -741,6 +878,60 @@ GBitmap::blit(const GBitmap *bm, int xh, int yh, int subsample)
             }
         }
     }
+  else if (bm->pbits)
+    {
+      if (!bytes_data)
+        uncompress();
+      // Blit from packed bits
+      int dr, dr1, zdc, zdc1;
+      euclidian_ratio(yh, subsample, dr, dr1);
+      euclidian_ratio(xh, subsample, zdc, zdc1);
+      const int prs = bm->packed_rowsize();
+      const unsigned char *srow = bm->pbits;
+      unsigned char *drow = bytes_data + border + dr*bytes_per_row;
+      for (int sr = 0; sr < bm->nrows; sr++)
+        {
+          if (dr>=0 && dr<nrows) 
+            {
+              int dc = zdc;
+              int dc1 = zdc1;
+              for (int sc=0; sc < bm->ncolumns && dc < ncolumns; sc+=8) 
+                {
+                  const int b = srow[sc>>3];
+                  if (! b)
+                    {
+                      // skip eight white pixels
+                      dc1 += 8;
+                      while (dc1 >= subsample)
+                        {
+                          dc1 -= subsample;
+                          dc += 1;
+                        }
+                      continue;
+                    }
+                  for (int mask = 0x80; mask; mask >>= 1)
+                    {
+                      if ((b & mask) && dc>=0 && dc<ncolumns)
+                        drow[dc] += 1;
+                      if (++dc1 >= subsample) 
+                        {
+                          dc1 = 0;
+                          dc += 1;
+                        }
+                    }
+                }
+            }
+          // next line in source
+          srow += prs;
+          // next line fraction in destination
+          if (++dr1 >= subsample)
+            {
+              dr1 = 0;
+              dr += 1;
+              drow += bytes_per_row;
+            }
+        }
+    }
 }
 
 
@@ -821,26 +1012,17 @@ GBitmap::read_pgm_text(ByteStream &bs, int maxval)
 void 
 GBitmap::read_pbm_raw(ByteStream &bs)
 {
-  unsigned char *row = bytes_data + border;
-  row += (nrows-1) * bytes_per_row;
+  // raw pbm rows are packed rows starting with the top line
+  const int prs = packed_rowsize();
+  if (prs == 0)
+    return;
+  const int lastbits = ((ncolumns - 1) & 7) + 1;
+  const unsigned char lastmask = (unsigned char)(0xff00 >> lastbits);
   for (int n = nrows-1; n>=0; n--) 
     {
-      unsigned char acc = 0;
-      unsigned char mask = 0;
-      for (int c = 0; c<ncolumns; c++)
-        {
-          if (!mask) 
-            {
-              bs.read(&acc, 1);
-              mask = (unsigned char)0x80;
-            }
-          if (acc & mask)
-            row[c] = 1;
-          else
-            row[c] = 0;
-          mask >>= 1;
-        }
-      row -= bytes_per_row;
+      unsigned char *prow = get_packed_row(n);
+      bs.readall(prow, prs);
+      prow[prs-1] &= lastmask;
     }
 }
 
@@ -931,7 +1113,12 @@ GBitmap::save_pbm(ByteStream &bs, int raw)
     bs.writall((void*)(const char *)head, head.length());
   }
   // body
-  if(raw)
+  if(raw && pbits)
+  {
+    const int count=packed_rowsize();
+    for (int n=nrows-1; n>=0; n--)
+      bs.writall(get_packed_row(n),count);
+  }else if(raw)
   {
     if(!rle)
       compress();
@@ -1228,6 +1415,36 @@ GBitmap::rle_get_rect(GRect &rect) const
 
 
 
+int 
+GBitmap::packed_get_bits(int rowno, unsigned char *bits) const
+{
+  const unsigned char *prow = get_packed_row(rowno);
+  if (! prow)
+    return 0;
+  int c = 0;
+  for (; c+8 <= ncolumns; c+=8)
+    {
+      const int b = *prow++;
+      if (! b)
+        {
+          memset(bits+c, 0, 8);
+          continue;
+        }
+      bits[c]   = (b >> 7);
+      bits[c+1] = (b >> 6) & 1;
+      bits[c+2] = (b >> 5) & 1;
+      bits[c+3] = (b >> 4) & 1;
+      bits[c+4] = (b >> 3) & 1;
+      bits[c+5] = (b >> 2) & 1;
+      bits[c+6] = (b >> 1) & 1;
+      bits[c+7] = b & 1;
+    }
+  for (int mask=0x80; c < ncolumns; c++, mask>>=1)
+    bits[c] = ((*prow & mask) ? 1 : 0);
+  return ncolumns;
+}
+
+
 // ------ helpers
 
 int
@@ -1239,7 +1456,7 @@ GBitmap::encode(unsigned char *&pruns,GPBuffer<unsigned char> &gpruns) const
     gpruns.resize(0);
     return 0;
   }
-  if (!bytes)
+  if (!bytes && !pbits)
     {
       unsigned char *runs;
       GPBuffer<unsigned char> gruns(runs,rlelength);
@@ -1253,10 +1470,14 @@ GBitmap::encode(unsigned char *&pruns,GPBuffer<unsigned char> &gpruns) const
   int maxpos = 1024 + ncolumns + ncolumns;
   unsigned char *runs;
   GPBuffer<unsigned char> gruns(runs,maxpos);
+  // expand packed rows one at a time
+  unsigned char *prow = 0;
+  GPBuffer<unsigned char> gprow(prow, (bytes) ? 0 : ncolumns);
   // encode bitmap as rle
-  const unsigned char *row = bytes + border;
+  const unsigned char *row = (bytes) ? bytes + border : prow;
   int n = nrows - 1;
-  row += n * bytes_per_row;
+  if (bytes)
+    row += n * bytes_per_row;
   while (n >= 0)
     {
       if (maxpos < pos+ncolumns+ncolumns+2)
@@ -1264,12 +1485,15 @@ GBitmap::encode(unsigned char *&pruns,GPBuffer<unsigned char> &gpruns) const
           maxpos += 1024 + ncolumns + ncolumns;
           gruns.resize(maxpos);
         }
+      if (! bytes)
+        packed_get_bits(n, prow);
 
       unsigned char *runs_pos=runs+pos;
       const unsigned char * const runs_pos_start=runs_pos;
       append_line(runs_pos,row,ncolumns);
       pos+=(size_t)runs_pos-(size_t)runs_pos_start;
-      row -= bytes_per_row;
+      if (bytes)
+        row -= bytes_per_row;
       n -= 1;
     }
   // return result
@@ -1329,6 +1553,32 @@ GBitmap::decode(unsigned char *runs)
 #endif
 }
 
+void 
+GBitmap::unpack(void)
+{
+  // initialize pixel array
+  if (ncolumns + border != (unsigned short)(ncolumns+border))
+    G_THROW("GBitmap: image size exceeds maximum (corrupted file?)");
+  bytes_per_row = ncolumns + border;
+  size_t npixels = nrows * bytes_per_row + border;
+  if (!bytes_data)
+  {
+    gbytes_data.resize(npixels);
+    bytes = bytes_data;
+  }
+  gbytes_data.clear();
+  gzerobuffer=zeroes(bytes_per_row + border);
+  // expand bits
+  unsigned char *row = bytes_data + border;
+  for (int n=0; n<nrows; n++, row+=bytes_per_row)
+    packed_get_bits(n, row);
+  // Free packed data
+  gpbits.resize(0);
+#ifndef NDEBUG
+  check_border();
+#endif
+}
+
 class GBitmap::ZeroBuffer : public GPEnabled
 {
 public:
@@ -1586,12 +1836,155 @@ GetRowTDRLNR(
 }
 #endif // 0
 
+// Block transposition used by rotate.  Pixel #x# of row #y# of #src# is
+// copied to pixel #y# of row #x# of #dst#.  Row increments #srs# and #drs#
+// may be negative to mirror the result.
+
+#ifdef MMX_SSE2
+
+// Transposes one block of 16x16 pixels.
+static void
+transpose_bytes_sse2(const unsigned char *src, int srs, 
+                     unsigned char *dst, int drs)
+{
+  __m128i a[16], b[16];
+  for (int i=0; i<16; i++)
+    a[i] = _mm_loadu_si128((const __m128i*)(src + i*srs));
+  // Four perfect shuffles transpose the block
+  for (int k=0; k<4; k++)
+    {
+      __m128i *s = (k & 1) ? b : a;
+      __m128i *d = (k & 1) ? a : b;
+      for (int i=0; i<8; i++)
+        {
+          d[2*i] = _mm_unpacklo_epi8(s[i], s[i+8]);
+          d[2*i+1] = _mm_unpackhi_epi8(s[i], s[i+8]);
+        }
+    }
+  for (int i=0; i<16; i++)
+    _mm_storeu_si128((__m128i*)(dst + i*drs), a[i]);
+}
+
+#endif /* MMX_SSE2 */
+
+static void
+transpose_bytes(const unsigned char *src, int srs, unsigned char *dst, int drs,
+                int nrows, int ncolumns)
+{
+  int y = 0;
+#ifdef MMX_SSE2
+  if (MMXControl::simdflag > 0)
+    for (; y+16 <= nrows; y+=16)
+      {
+        const unsigned char *s = src + y*srs;
+        unsigned char *d = dst + y;
+        int x = 0;
+        for (; x+16 <= ncolumns; x+=16)
+          transpose_bytes_sse2(s + x, srs, d + x*drs, drs);
+        for (; x<ncolumns; x++)
+          for (int i=0; i<16; i++)
+            d[x*drs + i] = s[i*srs + x];
+      }
+#endif
+  for (; y<nrows; y+=16)
+    {
+      const int n = min(16, nrows - y);
+      const unsigned char *s = src + y*srs;
+      unsigned char *d = dst + y;
+      for (int x=0; x<ncolumns; x++, d+=drs)
+        for (int i=0; i<n; i++)
+          d[i] = s[i*srs + x];
+    }
+}
+
+// Transposes a block of 8x8 bits.  Byte #i# of #x#, counting from the
+// most significant byte, holds row #i#.  The leftmost pixel of each row 
+// is the most significant bit.
+static inline uint64_t
+transpose_bits(uint64_t x)
+{
+  uint64_t t;
+  t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+  x = x ^ t ^ (t << 7);
+  t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+  x = x ^ t ^ (t << 14);
+  t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+  x = x ^ t ^ (t << 28);
+  return x;
+}
+
 GP<GBitmap> 
 GBitmap::rotate(int count)
 {
   GP<GBitmap> newbitmap=this;
   count = count & 3;
-  if(count)
+  if(count && pbits)
+  {
+    GMonitorLock lock(monitor());
+    newbitmap = new GBitmap();
+    if( count & 0x01 )
+      newbitmap->init_packed(ncolumns, nrows);
+    else
+      newbitmap->init_packed(nrows, ncolumns);
+    GBitmap &dbitmap = *newbitmap;
+    dbitmap.set_grays(grays);
+    const int lastrow = dbitmap.rows()-1;
+    const int sprs = packed_rowsize();
+    const int dprs = dbitmap.packed_rowsize();
+    if (count & 0x01)
+    {
+      // Transpose blocks of 8x8 bits.  Rotating 270 degrees reads
+      // the rows from the top line so that output bytes stay aligned.
+      for(int y=0; y<nrows; y+=8)
+      {
+        const unsigned char *r[8];
+        for(int j=0; j<8; j++)
+          r[j] = get_packed_row((count==3) ? y+j : nrows-1-y-j);
+        unsigned char *d = dbitmap.pbits + (y>>3);
+        for(int xb=0; xb<sprs; xb++)
+        {
+          uint64_t w = 0;
+          for(int j=0; j<8; j++)
+            w = (w << 8) | (r[j] ? r[j][xb] : 0);
+          if (! w)
+            continue;
+          w = transpose_bits(w);
+          for(int k=0; k<8 && xb*8+k<ncolumns; k++)
+          {
+            const int dr = (count==3) ? lastrow - (xb*8+k) : xb*8+k;
+            d[dr*dprs] = (unsigned char)(w >> (56 - 8*k));
+          }
+        }
+      }
+    }
+    else
+    {
+      // Reverse the bits of each row, then realign them
+      unsigned char rev[256];
+      for(int i=0; i<256; i++)
+      {
+        int v = 0;
+        for(int k=0; k<8; k++)
+          if (i & (1 << k))
+            v |= (0x80 >> k);
+        rev[i] = v;
+      }
+      const int shift = dprs*8 - ncolumns;
+      for(int y=0; y<nrows; y++)
+      {
+        const unsigned char *r = get_packed_row(y);
+        unsigned char *d = dbitmap.pbits + (lastrow - y)*dprs;
+        for(int i=0; i<dprs; i++)
+        {
+          int v = rev[r[sprs-1-i]] << shift;
+          if (i+1 < dprs)
+            v |= rev[r[sprs-2-i]] >> (8 - shift);
+          d[i] = v;
+        }
+      }
+    }
+  }
+  else if(count)
   {
     if( count & 0x01 )
     {
@@ -1605,19 +1998,17 @@ GBitmap::rotate(int count)
       uncompress();
     GBitmap &dbitmap = *newbitmap;
     dbitmap.set_grays(grays);
+    if (MMXControl::simdflag < 0)
+      MMXControl::enable_simd();
     switch(count)
     {
     case 3: // rotate 90 counter clockwise
       {
         const int lastrow = dbitmap.rows()-1;
-        for(int y=0; y<nrows; y++)
-        {
-          const unsigned char *r=operator[] (y);
-          for(int x=0,xnew=lastrow;xnew>=0; x++,xnew--)
-          {
-            dbitmap[xnew][y] = r[x];
-          }
-        }
+        if (nrows > 0 && ncolumns > 0)
+          transpose_bytes(operator[](0), bytes_per_row,
+                          dbitmap[lastrow], -(int)dbitmap.rowsize(),
+                          nrows, ncolumns);
       }
       break;
     case 2: // rotate 180 counter clockwise
@@ -1638,14 +2029,10 @@ GBitmap::rotate(int count)
     case 1: // rotate 270 counter clockwise
       {
         const int lastcolumn = dbitmap.columns()-1;
-        for(int y=0,ynew=lastcolumn;ynew>=0;y++,ynew--)
-        {
-          const unsigned char *r=operator[] (y);
-          for(int x=0; x<ncolumns; x++)
-          {
-            dbitmap[x][ynew] = r[x];
-          }
-        }
+        if (nrows > 0 && ncolumns > 0)
+          transpose_bytes(operator[](lastcolumn), -(int)bytes_per_row,
+                          dbitmap[0], dbitmap.rowsize(),
+                          nrows, ncolumns);
       }
       break;
     }
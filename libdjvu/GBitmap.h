@@ -280,6 +280,8 @@ public:
       zero if the bitmap is not RLE encoded.  Function \Ref{compress} must
       be used to ensure that the bitmap is RLE encoded.  */
   //@{
+  /** Returns true if the bitmap is currently run length encoded. */
+  bool is_rle() const;
   /** Gets the pixels for line #rowno#.  One line of pixel is stored as
       #unsigned char# values into array #bits#.  Each pixel is either 1 or 0.
       The array must be large enough to hold the whole line.  The number of
@@ -307,6 +309,44 @@ public:
   int rle_get_rect(GRect &rect) const;
   //@}
 
+  /** @name Packed bilevel images.
+      Bilevel images can also be stored with one bit per pixel.  Each row
+      then occupies \Ref{packed_rowsize} bytes.  As in the raw PBM format,
+      the leftmost pixel of a row is the most significant bit of its first
+      byte, and the unused bits of the last byte are zero.  Rows are stored
+      from the bottom line to the top line.  Like run-length encoded bitmaps,
+      packed bitmaps are expanded on demand by the bracket operator.
+      Functions \Ref{blit}, \Ref{rotate}, \Ref{init}, \Ref{save_pbm} and
+      \Ref{compress} use the packed representation directly, and raw PBM
+      files are read into a packed bitmap.  */
+  //@{
+  /** Returns true if the bitmap is currently stored with one bit per pixel. */
+  bool is_packed() const;
+  /** Converts a bilevel image to the packed representation.  All non zero
+      pixels are considered black pixels.  This function does nothing if
+      the image is already packed. */
+  void pack();
+  /** Resets this GBitmap size to #nrows# rows and #ncolumns# columns of
+      white pixels stored with one bit per pixel.  The optional argument
+      #border# specifies the size of the border of white pixels created
+      when the image is expanded.  The number of gray levels is #2#. */
+  void init_packed(int nrows, int ncolumns, int border=0);
+  /** Returns the number of bytes used by one packed row. */
+  unsigned int packed_rowsize() const;
+  /** Returns a pointer to the bits of row #rowno#.  This function returns
+      zero if the bitmap is not packed or if the row does not exist. */
+  const unsigned char *get_packed_row(int rowno) const;
+  /** Returns a pointer to the bits of row #rowno# for reading or writing.
+      This function returns zero if the bitmap is not packed or if the row
+      does not exist. */
+  unsigned char *get_packed_row(int rowno);
+  /** Gets the pixels for line #rowno# of a packed bitmap.  Each pixel is
+      stored as an #unsigned char# equal to 1 or 0 into array #bits#.  The
+      number of pixels is returned.  This function returns zero if the
+      bitmap is not packed. */
+  int packed_get_bits(int rowno, unsigned char *bits) const;
+  //@}
+
   /** @name Additive Blit.  
       The blit functions are designed to efficiently construct an anti-aliased
       image by copying smaller images at predefined locations.  The image of a
@@ -463,6 +503,8 @@ protected:
   unsigned char  **rlerows;
   GPBuffer<unsigned char *> grlerows;
   unsigned int   rlelength;
+  unsigned char  *pbits;
+  GPBuffer<unsigned char> gpbits;
 private:
   GMonitor       *monitorptr;
 public:
@@ -477,6 +519,7 @@ private:
   static void euclidian_ratio(int a, int b, int &q, int &r);
   int encode(unsigned char *&pruns,GPBuffer<unsigned char> &gpruns) const;
   void decode(unsigned char *runs);
+  void unpack(void);
   void read_pbm_text(ByteStream &ref); 
   void read_pgm_text(ByteStream &ref, int maxval); 
   void read_pbm_raw(ByteStream &ref); 
@@ -555,6 +598,40 @@ GBitmap::rowsize() const
   return bytes_per_row;
 }
 
+inline bool
+GBitmap::is_rle() const
+{
+  return !bytes && rle;
+}
+
+inline bool
+GBitmap::is_packed() const
+{
+  return !bytes && pbits;
+}
+
+inline unsigned int
+GBitmap::packed_rowsize() const
+{
+  return (ncolumns + 7) >> 3;
+}
+
+inline const unsigned char *
+GBitmap::get_packed_row(int rowno) const
+{
+  if (!pbits || rowno<0 || rowno>=nrows)
+    return 0;
+  return pbits + rowno * packed_rowsize();
+}
+
+inline unsigned char *
+GBitmap::get_packed_row(int rowno)
+{
+  if (!pbits || rowno<0 || rowno>=nrows)
+    return 0;
+  return pbits + rowno * packed_rowsize();
+}
+
 inline int
 GBitmap::get_grays() const
 {
@@ -75,9 +75,11 @@
 #include "GThreads.h"
 #include "Arrays.h"
 #include "JPEGDecoder.h"
+#include "MMX.h"
 
 #include <stddef.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <assert.h>
 
@@ -681,7 +683,28 @@ color_correction_table(double gamma, GPixel white,
     }
 }
 
-static void
+// Color correction tables are shared by all threads through a small cache
+// keyed by the gamma correction and the white point.  Tiled rendering
+// requests the same few tables over and over.
+
+#define COLOR_CORRECTION_CACHE_SIZE 8
+
+struct ColorCorrectionEntry
+{
+  double gamma;
+  GPixel white;
+  bool identity;
+  unsigned char gtable[256][3];
+};
+
+static ColorCorrectionEntry color_correction_cache[COLOR_CORRECTION_CACHE_SIZE];
+static int color_correction_cache_count = 0;
+static int color_correction_cache_next = 0;
+static int color_correction_cache_hits = 0;
+static int color_correction_cache_misses = 0;
+
+// Returns true when table #gtable# leaves every pixel unchanged.
+static bool
 color_correction_table_cache(double gamma, GPixel white,
                              unsigned char gtable[256][3] )
 {
@@ -689,20 +712,119 @@ color_correction_table_cache(double gamma, GPixel white,
   if (gamma<1.001 && gamma>0.999 && white==GPixel::WHITE)
     {
       color_correction_table(gamma, white, gtable);
+      return true;
+    }
+  GMonitorLock lock(&pixmap_monitor());
+  ColorCorrectionEntry *entry = 0;
+  for (int i=0; i<color_correction_cache_count && !entry; i++)
+    if (color_correction_cache[i].gamma == gamma &&
+        color_correction_cache[i].white == white )
+      entry = &color_correction_cache[i];
+  if (entry)
+    {
+      color_correction_cache_hits += 1;
     }
   else
     {
-      static double lgamma = -1.0;
-      static GPixel lwhite = GPixel::BLACK;
-      static unsigned char ctable[256][3];
-      GMonitorLock lock(&pixmap_monitor());
-      if (gamma != lgamma || white != lwhite)
+      // Replace entries in round robin order
+      ColorCorrectionEntry tmp;
+      color_correction_table(gamma, white, tmp.gtable);
+      tmp.gamma = gamma;
+      tmp.white = white;
+      tmp.identity = true;
+      for (int i=0; i<256; i++)
+        if (tmp.gtable[i][0]!=i || tmp.gtable[i][1]!=i || tmp.gtable[i][2]!=i)
+          tmp.identity = false;
+      entry = &color_correction_cache[color_correction_cache_next];
+      *entry = tmp;
+      color_correction_cache_next += 1;
+      if (color_correction_cache_next >= COLOR_CORRECTION_CACHE_SIZE)
+        color_correction_cache_next = 0;
+      if (color_correction_cache_count < COLOR_CORRECTION_CACHE_SIZE)
+        color_correction_cache_count += 1;
+      color_correction_cache_misses += 1;
+    }
+  memcpy(gtable, entry->gtable, 256*3*sizeof(unsigned char));
+  return entry->identity;
+}
+
+int 
+GPixmap::get_color_correction_cache_hits(void)
+{
+  GMonitorLock lock(&pixmap_monitor());
+  return color_correction_cache_hits;
+}
+
+int 
+GPixmap::get_color_correction_cache_misses(void)
+{
+  GMonitorLock lock(&pixmap_monitor());
+  return color_correction_cache_misses;
+}
+
+
+#ifdef MMX_AVX2
+
+// Corrects blocks of 32 pixels and returns the number of pixels processed.
+// Array #table# holds the 256 entry table of each color channel.
+// Each gathered byte is offset into the table of its color channel.
+static MMX_AVX2_TARGET int
+color_correct_pixels_avx2(GPixel *pix, int npix, const int *table)
+{
+  __m256i chan[12];
+  for (int k=0; k<12; k++)
+    chan[k] = _mm256_setr_epi32(
+      (8*k)%3*256, (8*k+1)%3*256, (8*k+2)%3*256, (8*k+3)%3*256,
+      (8*k+4)%3*256, (8*k+5)%3*256, (8*k+6)%3*256, (8*k+7)%3*256 );
+  const __m256i order = _mm256_setr_epi32(0,4,1,5,2,6,3,7);
+  int x = 0;
+  for (; x+32 <= npix; x+=32)
+    {
+      __m256i *p = (__m256i*)(pix+x);
+      for (int c=0; c<3; c++)
         {
-          color_correction_table(gamma, white, ctable);
-          lgamma = gamma;
-          lwhite = white;
+          const __m256i v = _mm256_loadu_si256(p+c);
+          const __m128i lo = _mm256_castsi256_si128(v);
+          const __m128i hi = _mm256_extracti128_si256(v, 1);
+          __m256i g[4];
+          g[0] = _mm256_cvtepu8_epi32(lo);
+          g[1] = _mm256_cvtepu8_epi32(_mm_srli_si128(lo, 8));
+          g[2] = _mm256_cvtepu8_epi32(hi);
+          g[3] = _mm256_cvtepu8_epi32(_mm_srli_si128(hi, 8));
+          for (int k=0; k<4; k++)
+            g[k] = _mm256_i32gather_epi32(table, 
+                                          _mm256_add_epi32(g[k], chan[4*c+k]), 4);
+          const __m256i r = _mm256_packus_epi16(_mm256_packus_epi32(g[0], g[1]),
+                                                _mm256_packus_epi32(g[2], g[3]));
+          _mm256_storeu_si256(p+c, _mm256_permutevar8x32_epi32(r, order));
         }
-      memcpy(gtable, ctable, 256*3*sizeof(unsigned char));
+    }
+  return x;
+}
+
+#endif /* MMX_AVX2 */
+
+
+// Applies correction table #gtable# to #npix# pixels.
+static void
+color_correct_pixels(GPixel *pix, int npix, unsigned char gtable[256][3])
+{
+  int x = 0;
+#ifdef MMX_AVX2
+  if (npix >= 32 && MMXControl::simdflag >= MMXControl::SIMD_AVX2)
+    {
+      int table[3*256];
+      for (int i=0; i<256; i++)
+        for (int c=0; c<3; c++)
+          table[c*256+i] = gtable[i][c];
+      x = color_correct_pixels_avx2(pix, npix, table);
+    }
+#endif
+  for (pix += x; x<npix; x++, pix++)
+    {
+      pix->b = gtable[pix->b][0];
+      pix->g = gtable[pix->g][1];
+      pix->r = gtable[pix->r][2];
     }
 }
 
@@ -714,18 +836,16 @@ GPixmap::color_correct(double gamma_correction, GPixel white)
     return;
   // Compute correction table
   unsigned char gtable[256][3];
-  color_correction_table_cache(gamma_correction, white, gtable);
+  if (color_correction_table_cache(gamma_correction, white, gtable))
+    return;
+  if (MMXControl::simdflag < 0)
+    MMXControl::enable_simd();
   // Perform correction
-  for (int y=0; y<nrows; y++)
-  {
-    GPixel *pix = (*this)[y];
-    for (int x=0; x<ncolumns; x++, pix++)
-    {
-      pix->b = gtable[ pix->b ][0];
-      pix->g = gtable[ pix->g ][1];
-      pix->r = gtable[ pix->r ][2];
-    }
-  }
+  if (nrowsize == ncolumns && nrows > 0)
+    color_correct_pixels((*this)[0], nrows*ncolumns, gtable);
+  else
+    for (int y=0; y<nrows; y++)
+      color_correct_pixels((*this)[y], ncolumns, gtable);
 }
 
 void 
@@ -746,15 +866,13 @@ GPixmap::color_correct(double gamma_correction, GPixel white,
     return;
   // Compute correction table
   unsigned char gtable[256][3];
-  color_correction_table_cache(gamma_correction, white, gtable);
+  if (color_correction_table_cache(gamma_correction, white, gtable))
+    return;
+  if (MMXControl::simdflag < 0)
+    MMXControl::enable_simd();
   // Perform correction
-  while (--npixels>=0)
-    {
-      pix->b = gtable[pix->b][0];
-      pix->g = gtable[pix->g][1];
-      pix->r = gtable[pix->r][2];
-      pix++;
-    }
+  if (npixels > 0)
+    color_correct_pixels(pix, npixels, gtable);
 }
 
 
@@ -885,6 +1003,221 @@ GPixmap::ordered_32k_dither(int xmin, int ymin)
 //////////////////////////////////////////////////
 
 
+// Adds a row of bytes to a row of 16 bit accumulators.
+
+static void
+accumulate_row(unsigned short *acc, const unsigned char *s, int n)
+{
+  int i = 0;
+#ifdef MMX_SSE2
+  if (MMXControl::simdflag > 0)
+    {
+      const __m128i zero = _mm_setzero_si128();
+      for (; i+16 <= n; i+=16)
+        {
+          __m128i b = _mm_loadu_si128((const __m128i*)(s+i));
+          __m128i a0 = _mm_loadu_si128((const __m128i*)(acc+i));
+          __m128i a1 = _mm_loadu_si128((const __m128i*)(acc+i+8));
+          a0 = _mm_add_epi16(a0, _mm_unpacklo_epi8(b, zero));
+          a1 = _mm_add_epi16(a1, _mm_unpackhi_epi8(b, zero));
+          _mm_storeu_si128((__m128i*)(acc+i), a0);
+          _mm_storeu_si128((__m128i*)(acc+i+8), a1);
+        }
+    }
+#endif
+  for (; i<n; i++)
+    acc[i] += s[i];
+}
+
+// Sets pixel #d# to the average #(r,g,b)/s# using the inverse table
+// #invmap# when #s# is small enough.
+static inline void
+average_pixel(GPixel *d, int r, int g, int b, int s, 
+              const int *invmap, int ninvmap)
+{
+  if (s >= ninvmap)
+    {
+      d->r = r / s;
+      d->g = g / s;
+      d->b = b / s;
+    }
+  else
+    {
+      const int m = invmap[s];
+      d->r = (r*m + 0x8000) >> 16;
+      d->g = (g*m + 0x8000) >> 16;
+      d->b = (b*m + 0x8000) >> 16;
+    }
+}
+
+// Sets pixels #d[0..n-1]# to the averages of groups of #factor# pixels
+// of the #npix# accumulated pixels #acc#.  The accumulators hold the sums
+// of #nrows# source rows.  Array #invmap# contains #0x10000/s#.
+static void
+average_row(GPixel *d, int n, const unsigned short *acc, int npix, 
+            int factor, int nrows, const int *invmap, int ninvmap)
+{
+  int x = 0;
+  const int s = nrows * factor;
+  if (s < ninvmap)
+    {
+      // whole groups share the same multiplier
+      const int m = invmap[s];
+      const int nfull = mini(n, npix / factor);
+      for (; x<nfull; x++)
+        {
+          int r=0, g=0, b=0;
+          for (int k=0; k<factor; k++, acc+=3)
+            {
+              b += acc[0];
+              g += acc[1];
+              r += acc[2];
+            }
+          d[x].b = (b*m + 0x8000) >> 16;
+          d[x].g = (g*m + 0x8000) >> 16;
+          d[x].r = (r*m + 0x8000) >> 16;
+        }
+    }
+  for (; x<n; x++)
+    {
+      const int w = mini(factor, npix - x*factor);
+      int r=0, g=0, b=0;
+      for (int k=0; k<w; k++, acc+=3)
+        {
+          b += acc[0];
+          g += acc[1];
+          r += acc[2];
+        }
+      average_pixel(d+x, r, g, b, nrows*w, invmap, ninvmap);
+    }
+}
+
+
+#ifdef MMX_AVX2
+
+// The fractional resampling functions process blocks of #blockin# source
+// pixels producing #blockout# destination pixels.  Each destination byte
+// is a weighted sum of two bytes of a primary source row and two bytes
+// of a secondary source row.  Rows are processed in periods of sixteen
+// blocks.  For each group of eight destination bytes, the table gives
+// the offset of a sixteen byte load and the shuffle mask that gathers
+// the pairs of source bytes fed to the multiply-add instructions.
+
+#define RESAMPLE_MAXHALVES 48
+
+struct ResampleTable
+{
+  int blockin;
+  int blockout;
+  int nhalves;
+  int inbytes;
+  int offset[RESAMPLE_MAXHALVES];
+  unsigned char mask[RESAMPLE_MAXHALVES][16];
+  signed char w1[RESAMPLE_MAXHALVES][16];
+  signed char w2[RESAMPLE_MAXHALVES][16];
+};
+
+// Destination pixel #k# of a block combines source pixels #ab[k][0]#
+// and #ab[k][1]# of the block.  Returns false when the source bytes
+// of a group do not fit in one load.
+static bool
+resample_table(ResampleTable &t, int blockin, int blockout, const int ab[][2])
+{
+  t.blockin = blockin;
+  t.blockout = blockout;
+  t.nhalves = 6 * blockout;
+  t.inbytes = 48 * blockin;
+  if (t.nhalves > RESAMPLE_MAXHALVES)
+    return false;
+  for (int h=0; h<t.nhalves; h++)
+    {
+      int sb[16];
+      int smin = t.inbytes, smax = 0;
+      for (int i=0; i<8; i++)
+        {
+          const int o = 8*h + i;
+          const int q = o / 3;
+          const int base = (q / blockout) * blockin;
+          const int k = q % blockout;
+          sb[2*i] = 3 * (base + ab[k][0]) + o % 3;
+          sb[2*i+1] = 3 * (base + ab[k][1]) + o % 3;
+          smin = mini(smin, mini(sb[2*i], sb[2*i+1]));
+          smax = maxi(smax, maxi(sb[2*i], sb[2*i+1]));
+        }
+      const int off = mini(smin, t.inbytes - 16);
+      if (smax - off > 15)
+        return false;
+      t.offset[h] = off;
+      for (int i=0; i<16; i++)
+        t.mask[h][i] = sb[i] - off;
+    }
+  return true;
+}
+
+// Fills the weights applied to the primary (#w1#) and secondary (#w2#)
+// source rows for destination pixel #k# of each block.
+static void
+resample_weights(ResampleTable &t, const int w1[][2], const int w2[][2])
+{
+  for (int h=0; h<t.nhalves; h++)
+    for (int i=0; i<8; i++)
+      {
+        const int k = ((8*h + i) / 3) % t.blockout;
+        t.w1[h][2*i] = w1[k][0];
+        t.w1[h][2*i+1] = w1[k][1];
+        t.w2[h][2*i] = (w2 ? w2[k][0] : 0);
+        t.w2[h][2*i+1] = (w2 ? w2[k][1] : 0);
+      }
+}
+
+static inline MMX_AVX2_TARGET __m128i
+resample_half(const ResampleTable &t, int h, 
+              const unsigned char *s1, const unsigned char *s2,
+              __m128i rnd, __m128i cnt)
+{
+  const __m128i m = _mm_loadu_si128((const __m128i*)t.mask[h]);
+  __m128i a = _mm_loadu_si128((const __m128i*)(s1 + t.offset[h]));
+  a = _mm_maddubs_epi16(_mm_shuffle_epi8(a, m),
+                        _mm_loadu_si128((const __m128i*)t.w1[h]));
+  if (s2)
+    {
+      __m128i b = _mm_loadu_si128((const __m128i*)(s2 + t.offset[h]));
+      b = _mm_maddubs_epi16(_mm_shuffle_epi8(b, m),
+                            _mm_loadu_si128((const __m128i*)t.w2[h]));
+      a = _mm_add_epi16(a, b);
+    }
+  return _mm_srl_epi16(_mm_add_epi16(a, rnd), cnt);
+}
+
+// Computes #nperiods# periods of one destination row from source rows
+// #s1# and #s2# (which can be null) as #(sum + round) >> shift#.
+static MMX_AVX2_TARGET void
+resample_row_avx2(const ResampleTable &t, int nperiods,
+                  const GPixel *s1, const GPixel *s2, 
+                  int round, int shift, GPixel *d)
+{
+  const __m128i rnd = _mm_set1_epi16(round);
+  const __m128i cnt = _mm_cvtsi32_si128(shift);
+  const unsigned char *p1 = (const unsigned char*)s1;
+  const unsigned char *p2 = (const unsigned char*)s2;
+  unsigned char *q = (unsigned char*)d;
+  for (; nperiods>0; nperiods--)
+    {
+      for (int h=0; h<t.nhalves; h+=2, q+=16)
+        {
+          __m128i lo = resample_half(t, h, p1, p2, rnd, cnt);
+          __m128i hi = resample_half(t, h+1, p1, p2, rnd, cnt);
+          _mm_storeu_si128((__m128i*)q, _mm_packus_epi16(lo, hi));
+        }
+      p1 += t.inbytes;
+      if (p2)
+        p2 += t.inbytes;
+    }
+}
+
+#endif /* MMX_AVX2 */
+
+
 void  
 GPixmap::downsample(const GPixmap *src, int factor, const GRect *pdr)
 {
@@ -916,7 +1249,14 @@ GPixmap::downsample(const GPixmap *src, int factor, const GRect *pdr)
   // determine starting and ending points in source rectangle
   int sy = rect.ymin * factor;
   int sxz = rect.xmin * factor;
+  int lsxz = mini(sxz + ncolumns * factor, (int)src->columns());
 
+  // sum source rows into 16 bit accumulators
+  if (MMXControl::simdflag < 0)
+    MMXControl::enable_simd();
+  unsigned short *acc;
+  GPBuffer<unsigned short> gacc(acc, 3 * maxi(lsxz - sxz, 1));
+  const bool rowsum = (factor <= 256);
 
   // loop over source rows
   const GPixel *sptr = (*src)[sy];
@@ -924,45 +1264,58 @@ GPixmap::downsample(const GPixmap *src, int factor, const GRect *pdr)
   for (int y=0; y<nrows; y++)
   {
     int sx = sxz;
-    // loop over source columns
-    for (int x=0; x<ncolumns; x++)
+    int lsy = sy + factor;
+    if (lsy > (int)src->rows())
+      lsy = (int)src->rows();
+    if (rowsum)
     {
-      int r=0, g=0, b=0, s=0;
-      // compute average bounds
+      // add source rows and average columns
       const GPixel *ksptr = sptr;
-      int lsy = sy + factor;
-      if (lsy > (int)src->rows())
-        lsy = (int)src->rows();
-      int lsx = sx + factor;
-      if (lsx > (int)src->columns())
-        lsx = (int)src->columns();
-      // compute average
-      for (int rsy=sy; rsy<lsy; rsy++)
+      memset(acc, 0, 3 * (lsxz - sxz) * sizeof(unsigned short));
+      for (int rsy=sy; rsy<lsy; rsy++, ksptr += src->rowsize())
+        accumulate_row(acc, (const unsigned char*)(ksptr + sxz), 3*(lsxz-sxz));
+      average_row(dptr, ncolumns, acc, lsxz - sxz, factor, lsy - sy, 
+                  invmap, (int)(sizeof(invmap)/sizeof(int)));
+    }
+    else
+    {
+      // loop over source columns
+      for (int x=0; x<ncolumns; x++)
       {
-        for (int rsx = sx; rsx<lsx; rsx++)
+        int r=0, g=0, b=0, s=0;
+        // compute average bounds
+        const GPixel *ksptr = sptr;
+        int lsx = sx + factor;
+        if (lsx > (int)src->columns())
+          lsx = (int)src->columns();
+        // compute average
+        for (int rsy=sy; rsy<lsy; rsy++)
         {
-          r += ksptr[rsx].r;
-          g += ksptr[rsx].g;
-          b += ksptr[rsx].b;
-          s += 1;
+          for (int rsx = sx; rsx<lsx; rsx++)
+          {
+            r += ksptr[rsx].r;
+            g += ksptr[rsx].g;
+            b += ksptr[rsx].b;
+            s += 1;
+          }
+          ksptr += src->rowsize();
         }
-        ksptr += src->rowsize();
-      }
-      // set pixel color
-      if (s >= (int)(sizeof(invmap)/sizeof(int)))
-      {
-        dptr[x].r = r / s;
-        dptr[x].g = g / s;
-        dptr[x].b = b / s;
-      }
-      else
-      {
-        dptr[x].r = (r*invmap[s] + 0x8000) >> 16;
-        dptr[x].g = (g*invmap[s] + 0x8000) >> 16;
-        dptr[x].b = (b*invmap[s] + 0x8000) >> 16;
+        // set pixel color
+        if (s >= (int)(sizeof(invmap)/sizeof(int)))
+        {
+          dptr[x].r = r / s;
+          dptr[x].g = g / s;
+          dptr[x].b = b / s;
+        }
+        else
+        {
+          dptr[x].r = (r*invmap[s] + 0x8000) >> 16;
+          dptr[x].g = (g*invmap[s] + 0x8000) >> 16;
+          dptr[x].b = (b*invmap[s] + 0x8000) >> 16;
+        }
+        // next column
+        sx = sx + factor;
       }
-      // next column
-      sx = sx + factor;
     }
     // next row
     sy = sy + factor;
@@ -991,22 +1344,67 @@ GPixmap::upsample(const GPixmap *src, int factor, const GRect *pdr)
   int sy, sy1, sxz, sx1z;
   euclidian_ratio(rect.ymin, factor, sy, sy1);
   euclidian_ratio(rect.xmin, factor, sxz, sx1z);
+#ifdef MMX_AVX2
+  // prepare pixel replication table
+  ResampleTable t;
+  bool fast = false;
+  if (MMXControl::simdflag < 0)
+    MMXControl::enable_simd();
+  if (factor > 1 && MMXControl::simdflag >= MMXControl::SIMD_AVX2)
+  {
+    int ab[8][2], w[8][2];
+    for (int k=0; k<factor && k<8; k++)
+    {
+      ab[k][0] = ab[k][1] = 0;
+      w[k][0] = 1;
+      w[k][1] = 0;
+    }
+    if (resample_table(t, 1, factor, ab))
+    {
+      resample_weights(t, w, 0);
+      fast = true;
+    }
+  }
+#endif
   // loop over rows
   const GPixel *sptr = (*src)[sy];
   GPixel *dptr = (*this)[0];
   for (int y=0; y<nrows; y++)
   {
-    // loop over columns
-    int sx = sxz;
-    int sx1 = sx1z;
-    for (int x=0; x<ncolumns; x++)
+    if (y > 0 && sy1 > 0)
     {
-      dptr[x] = sptr[sx];
-      // next column
-      if (++sx1 >= factor)
+      // same source row
+      memcpy(dptr, dptr - rowsize(), ncolumns * sizeof(GPixel));
+    }
+    else
+    {
+      // loop over columns
+      int sx = sxz;
+      int sx1 = sx1z;
+      for (int x=0; x<ncolumns; x++)
       {
-        sx1 = 0;
-        sx += 1;
+#ifdef MMX_AVX2
+        if (fast && sx1 == 0)
+        {
+          int n = mini((ncolumns - x) / (16*factor), 
+                       ((int)src->columns() - sx) / 16);
+          if (n > 0)
+          {
+            resample_row_avx2(t, n, sptr+sx, 0, 0, 0, dptr+x);
+            sx += 16 * n;
+            x += 16 * n * factor;
+            if (x >= ncolumns)
+              break;
+          }
+        }
+#endif
+        dptr[x] = sptr[sx];
+        // next column
+        if (++sx1 >= factor)
+        {
+          sx1 = 0;
+          sx += 1;
+        }
       }
     }
     // next row
@@ -1212,6 +1610,24 @@ GPixmap::downsample43(const GPixmap *src, const GRect *pdr)
   int s4add = 4 * sadd;
   int d3add = 3 * dadd;
 
+#ifdef MMX_AVX2
+  // prepare vectorized block tables
+  static const int ab43[3][2] = { {0,1}, {1,2}, {3,2} };
+  static const int wx43[3][2] = { {11,2}, {7,7}, {11,2} };
+  static const int wy43[3][2] = { {2,1}, {1,1}, {2,1} };
+  static const int wm43[3][2] = { {7,1}, {4,4}, {7,1} };
+  ResampleTable t0, t1;
+  if (MMXControl::simdflag < 0)
+    MMXControl::enable_simd();
+  bool fast = (MMXControl::simdflag >= MMXControl::SIMD_AVX2 &&
+               resample_table(t0, 4, 3, ab43) );
+  if (fast)
+    {
+      t1 = t0;
+      resample_weights(t0, wx43, wy43);
+      resample_weights(t1, wm43, wm43);
+    }
+#endif
   // iterate over row blocks
   while (dy < destheight)
   {
@@ -1220,6 +1636,25 @@ GPixmap::downsample43(const GPixmap *src, const GRect *pdr)
     // iterate over column blocks
     while (dx < destwidth)
     {
+#ifdef MMX_AVX2
+      // process whole periods of interior blocks
+      if (fast && dx>=0 && dy>=0 && dy+3<=destheight && sy+4<=srcheight)
+        {
+          int n = mini((destwidth-dx)/48, (srcwidth-sx)/64);
+          if (n > 0)
+            {
+              const GPixel *s0 = sptr + sx;
+              GPixel *d0 = dptr + dx;
+              resample_row_avx2(t0, n, s0, s0+sadd, 8, 4, d0);
+              resample_row_avx2(t1, n, s0+sadd+sadd, s0+sadd, 8, 4, d0+dadd);
+              resample_row_avx2(t0, n, s0+s4add-sadd, s0+sadd+sadd, 8, 4, 
+                                d0+dadd+dadd);
+              dx += 48 * n;
+              sx += 64 * n;
+              continue;
+            }
+        }
+#endif
       GPixel xin[16], xout[9];
 
       if (dx>=0 && dy>=0 && dx+3<=destwidth && dy+3<=destheight)
@@ -1302,6 +1737,23 @@ GPixmap::upsample23(const GPixmap *src, const GRect *pdr)
   int s2add = 2 * sadd;
   int d3add = 3 * dadd;
 
+#ifdef MMX_AVX2
+  // prepare vectorized block tables
+  static const int ab23[3][2] = { {0,0}, {0,1}, {1,1} };
+  static const int w23[3][2] = { {2,2}, {2,2}, {2,2} };
+  static const int wm23[3][2] = { {1,1}, {1,1}, {1,1} };
+  ResampleTable t0, t1;
+  if (MMXControl::simdflag < 0)
+    MMXControl::enable_simd();
+  bool fast = (MMXControl::simdflag >= MMXControl::SIMD_AVX2 &&
+               resample_table(t0, 2, 3, ab23) );
+  if (fast)
+    {
+      t1 = t0;
+      resample_weights(t0, w23, 0);
+      resample_weights(t1, wm23, wm23);
+    }
+#endif
   // iterate over row blocks
   while (dy < destheight)
   {
@@ -1310,6 +1762,24 @@ GPixmap::upsample23(const GPixmap *src, const GRect *pdr)
     // iterate over column blocks
     while (dx < destwidth)
     {
+#ifdef MMX_AVX2
+      // process whole periods of interior blocks
+      if (fast && dx>=0 && dy>=0 && dy+3<=destheight && sy+2<=srcheight)
+        {
+          int n = mini((destwidth-dx)/48, (srcwidth-sx)/32);
+          if (n > 0)
+            {
+              const GPixel *s0 = sptr + sx;
+              GPixel *d0 = dptr + dx;
+              resample_row_avx2(t0, n, s0, 0, 2, 2, d0);
+              resample_row_avx2(t1, n, s0, s0+sadd, 2, 2, d0+dadd);
+              resample_row_avx2(t0, n, s0+sadd, 0, 2, 2, d0+dadd+dadd);
+              dx += 48 * n;
+              sx += 32 * n;
+              continue;
+            }
+        }
+#endif
       GPixel xin[4], xout[9];
 
       if (dx>=0 && dy>=0 && dx+3<=destwidth && dy+3<=destheight)
@@ -1368,6 +1838,290 @@ compute_clip()
 }
 
 
+// Enumerates the black pixel spans of a run length encoded or packed
+// bilevel mask without expanding it.  The mask monitor is held while
+// the spans are read so that the representation cannot change.
+
+class GPixmapMaskSpans
+{
+public:
+  GPixmapMaskSpans(const GBitmap *bm);
+  static bool usable(const GBitmap *bm);
+  int get(int rowno, int x0, int x1);
+  int *spans;
+private:
+  const GBitmap *bm;
+  GMonitorLock lock;
+  GPBuffer<int> gspans;
+  int *runs;
+  GPBuffer<int> gruns;
+};
+
+GPixmapMaskSpans::GPixmapMaskSpans(const GBitmap *bm)
+  : spans(0), bm(bm), lock(bm->monitor()), gspans(spans, 0),
+    runs(0), gruns(runs, 0)
+{
+  gspans.resize(bm->columns()+2);
+  if (bm->is_rle())
+    gruns.resize(bm->columns()+2);
+}
+
+bool
+GPixmapMaskSpans::usable(const GBitmap *bm)
+{
+  return bm->is_rle() || bm->is_packed();
+}
+
+// Stores the black spans of row #rowno# clipped to columns [x0,x1)
+// as pairs of start and end columns into #spans#.
+int
+GPixmapMaskSpans::get(int rowno, int x0, int x1)
+{
+  int n = 0;
+  if (runs)
+    {
+      const int nruns = bm->rle_get_runs(rowno, runs);
+      int c = 0;
+      for (int i=0; i<nruns && c<x1; i++)
+        {
+          const int e = c + runs[i];
+          if ((i & 1) && e > x0)
+            {
+              spans[n++] = maxi(c, x0);
+              spans[n++] = mini(e, x1);
+            }
+          c = e;
+        }
+    }
+  else if (const unsigned char *row = bm->get_packed_row(rowno))
+    {
+      int c = x0;
+      while (c < x1)
+        {
+          // skip white pixels
+          while (c < x1)
+            {
+              const int m = 0xff >> (c&7);
+              const int b = row[c>>3] & m;
+              if (! b)
+                c = (c|7) + 1;
+              else if (b & (0x80 >> (c&7)))
+                break;
+              else
+                c += 1;
+            }
+          if (c >= x1)
+            break;
+          const int s = c;
+          // skip black pixels
+          while (c < x1)
+            {
+              const int m = 0xff >> (c&7);
+              const int b = row[c>>3] & m;
+              if (b == m)
+                c = (c|7) + 1;
+              else if (! (b & (0x80 >> (c&7))))
+                break;
+              else
+                c += 1;
+            }
+          spans[n++] = s;
+          spans[n++] = mini(c, x1);
+        }
+    }
+  return n;
+}
+
+
+// Row compositing operations.  Each destination pixel is combined with
+// the pixel of row #src2# according to the gray level of the mask pixel:
+// zero leaves the destination unchanged, #maxgray# or more applies the
+// full operation, and intermediate levels use #multiplier[level]#.
+
+enum { COMPOSITE_ATTENUATE, COMPOSITE_BLIT, COMPOSITE_BLEND };
+
+
+#ifdef MMX_AVX2
+
+// Processes blocks of sixteen pixels and returns the number of pixels
+// processed.  Array #lev# gives the multiplier of each mask level and
+// contains zero for levels that need no multiplication.
+static MMX_AVX2_TARGET int
+composite_row_avx2(int op, GPixel *dst, const GPixel *src2, 
+                   const unsigned char *src, int n, 
+                   const unsigned short *lev, unsigned int maxgray)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i gmax = _mm_set1_epi8((char)(maxgray > 1 ? maxgray : 1));
+  // spread pixel bytes and pixel words over the three color channels
+  const __m128i e0 = _mm_setr_epi8(0,0,0,1,1,1,2,2,2,3,3,3,4,4,4,5);
+  const __m128i e1 = _mm_setr_epi8(5,5,6,6,6,7,7,7,8,8,8,9,9,9,10,10);
+  const __m128i e2 = _mm_setr_epi8(10,11,11,11,12,12,12,13,13,13,
+                                   14,14,14,15,15,15);
+  const __m128i w0 = _mm_setr_epi8(0,1,0,1,0,1,2,3,2,3,2,3,4,5,4,5);
+  const __m128i w1 = _mm_setr_epi8(4,5,6,7,6,7,6,7,8,9,8,9,8,9,10,11);
+  const __m128i w2 = _mm_setr_epi8(10,11,10,11,12,13,12,13,12,13,
+                                   14,15,14,15,14,15);
+  unsigned short levels[16];
+  int x = 0;
+  for (; x+16 <= n; x+=16)
+    {
+      const __m128i m = _mm_loadu_si128((const __m128i*)(src+x));
+      if (_mm_movemask_epi8(_mm_cmpeq_epi8(m, zero)) == 0xffff)
+        continue;
+      __m128i *d = (__m128i*)(dst+x);
+      const __m128i *s = (const __m128i*)(src2+x);
+      __m128i dv[3], sv[3], fv[3];
+      for (int c=0; c<3; c++)
+        {
+          dv[c] = _mm_loadu_si128(d+c);
+          sv[c] = (op == COMPOSITE_ATTENUATE ? zero : _mm_loadu_si128(s+c));
+        }
+      // result for full coverage
+      for (int c=0; c<3; c++)
+        if (op == COMPOSITE_BLIT)
+          fv[c] = _mm_adds_epu8(dv[c], sv[c]);
+        else
+          fv[c] = sv[c];
+      const __m128i full = _mm_cmpeq_epi8(_mm_max_epu8(m, gmax), m);
+      if (_mm_movemask_epi8(full) == 0xffff)
+        {
+          for (int c=0; c<3; c++)
+            _mm_storeu_si128(d+c, fv[c]);
+          continue;
+        }
+      if (maxgray > 1)
+        {
+          // partial coverage
+          for (int i=0; i<16; i++)
+            levels[i] = lev[src[x+i]];
+          const __m128i l0 = _mm_loadu_si128((const __m128i*)levels);
+          const __m128i l1 = _mm_loadu_si128((const __m128i*)(levels+8));
+          __m128i lv[6];
+          lv[0] = _mm_shuffle_epi8(l0, w0);
+          lv[1] = _mm_shuffle_epi8(l0, w1);
+          lv[2] = _mm_shuffle_epi8(l0, w2);
+          lv[3] = _mm_shuffle_epi8(l1, w0);
+          lv[4] = _mm_shuffle_epi8(l1, w1);
+          lv[5] = _mm_shuffle_epi8(l1, w2);
+          for (int c=0; c<3; c++)
+            {
+              __m128i r[2];
+              for (int k=0; k<2; k++)
+                {
+                  const __m128i l = lv[2*c+k];
+                  const __m128i a = (k ? _mm_unpackhi_epi8(dv[c], zero)
+                                       : _mm_unpacklo_epi8(dv[c], zero) );
+                  const __m128i b = (k ? _mm_unpackhi_epi8(sv[c], zero)
+                                       : _mm_unpacklo_epi8(sv[c], zero) );
+                  if (op == COMPOSITE_ATTENUATE)
+                    r[k] = _mm_sub_epi16(a, _mm_mulhi_epu16(a, l));
+                  else if (op == COMPOSITE_BLIT)
+                    r[k] = _mm_mulhi_epu16(b, l);
+                  else
+                    {
+                      // signed product with an unsigned multiplier
+                      const __m128i diff = _mm_sub_epi16(a, b);
+                      const __m128i h = _mm_add_epi16(
+                        _mm_mulhi_epi16(diff, l),
+                        _mm_and_si128(diff, _mm_srai_epi16(l, 15)) );
+                      r[k] = _mm_sub_epi16(a, h);
+                    }
+                }
+              dv[c] = (op == COMPOSITE_BLIT 
+                       ? _mm_adds_epu8(dv[c], _mm_packus_epi16(r[0], r[1]))
+                       : _mm_packus_epi16(r[0], r[1]) );
+            }
+        }
+      // select full coverage pixels
+      const __m128i f[3] = { _mm_shuffle_epi8(full, e0), 
+                             _mm_shuffle_epi8(full, e1),
+                             _mm_shuffle_epi8(full, e2) };
+      for (int c=0; c<3; c++)
+        _mm_storeu_si128(d+c, _mm_blendv_epi8(dv[c], fv[c], f[c]));
+    }
+  return x;
+}
+
+#endif /* MMX_AVX2 */
+
+
+static inline void
+composite_row(int op, GPixel *dst, const GPixel *src2, 
+              const unsigned char *src, int n, 
+              const unsigned int *multiplier, const unsigned short *lev,
+              unsigned int maxgray)
+{
+  int x = 0;
+#ifdef MMX_AVX2
+  if (MMXControl::simdflag >= MMXControl::SIMD_AVX2)
+    x = composite_row_avx2(op, dst, src2, src, n, lev, maxgray);
+#endif
+  for (; x<n; x++)
+    {
+      unsigned char srcpix = src[x];
+      // Perform pixel operation
+      if (srcpix > 0)
+        {
+          if (srcpix >= maxgray)
+            {
+              if (op == COMPOSITE_ATTENUATE)
+                {
+                  dst[x].b = 0;
+                  dst[x].g = 0;
+                  dst[x].r = 0;
+                }
+              else if (op == COMPOSITE_BLIT)
+                {
+                  dst[x].b = clip[dst[x].b + src2[x].b];
+                  dst[x].g = clip[dst[x].g + src2[x].g];
+                  dst[x].r = clip[dst[x].r + src2[x].r];
+                }
+              else
+                {
+                  dst[x] = src2[x];
+                }
+            }
+          else
+            {
+              unsigned int level = multiplier[srcpix];
+              if (op == COMPOSITE_ATTENUATE)
+                {
+                  dst[x].b -=  (dst[x].b * level) >> 16;
+                  dst[x].g -=  (dst[x].g * level) >> 16;
+                  dst[x].r -=  (dst[x].r * level) >> 16;
+                }
+              else if (op == COMPOSITE_BLIT)
+                {
+                  dst[x].b = clip[dst[x].b + ((src2[x].b * level) >> 16)];
+                  dst[x].g = clip[dst[x].g + ((src2[x].g * level) >> 16)];
+                  dst[x].r = clip[dst[x].r + ((src2[x].r * level) >> 16)];
+                }
+              else
+                {
+                  dst[x].b -= (((int)dst[x].b - (int)src2[x].b) * level) >> 16;
+                  dst[x].g -= (((int)dst[x].g - (int)src2[x].g) * level) >> 16;
+                  dst[x].r -= (((int)dst[x].r - (int)src2[x].r) * level) >> 16;
+                }
+            }
+        }
+    }
+}
+
+
+// Precomputes the multipliers of the partial coverage levels.
+static void
+composite_multipliers(unsigned int maxgray, unsigned int multiplier[256],
+                      unsigned short lev[256])
+{
+  for (unsigned int i=0; i<256; i++)
+    {
+      multiplier[i] = (i>0 && i<maxgray) ? 0x10000 * i / maxgray : 0;
+      lev[i] = multiplier[i];
+    }
+}
+
+
 void 
 GPixmap::attenuate(const GBitmap *bm, int xpos, int ypos)
 {
@@ -1378,39 +2132,33 @@ GPixmap::attenuate(const GBitmap *bm, int xpos, int ypos)
     xcolumns = mini(xpos + (int) bm->columns(), ncolumns) - maxi(0, xpos);
   if(xrows <= 0 || xcolumns <= 0)
     return;
+  // Process compressed bilevel masks run by run
+  if (GPixmapMaskSpans::usable(bm))
+    {
+      GPixmapMaskSpans mask(bm);
+      const int sy = -mini(0,ypos), sx = -mini(0,xpos);
+      GPixel *dst = (*this)[0] + maxi(0, ypos)*rowsize()+maxi(0, xpos) - sx;
+      for (int y=0; y<xrows; y++, dst+=rowsize())
+        for (int n=mask.get(sy+y, sx, sx+xcolumns), i=0; i<n; i+=2)
+          for (int x=mask.spans[i]; x<mask.spans[i+1]; x++)
+            dst[x].b = dst[x].g = dst[x].r = 0;
+      return;
+    }
   // Precompute multiplier map
   unsigned int multiplier[256];
+  unsigned short lev[256];
   unsigned int maxgray = bm->get_grays() - 1;
-  for (unsigned int i=0; i<maxgray ; i++)
-    multiplier[i] = 0x10000 * i / maxgray;
+  composite_multipliers(maxgray, multiplier, lev);
+  if (MMXControl::simdflag < 0)
+    MMXControl::enable_simd();
   // Compute starting point
-  const unsigned char *src = (*bm)[0] - mini(0,ypos)*bm->rowsize()-mini(0,xpos);
+  const unsigned char *src = (*bm)[0] - mini(0,ypos)*(int)bm->rowsize()-mini(0,xpos);
   GPixel *dst = (*this)[0] + maxi(0, ypos)*rowsize()+maxi(0, xpos);
   // Loop over rows
   for (int y=0; y<xrows; y++)
     {
-      // Loop over columns
-      for (int x=0; x<xcolumns; x++)
-        {
-          unsigned char srcpix = src[x];
-          // Perform pixel operation
-          if (srcpix > 0)
-            {
-              if (srcpix >= maxgray)
-                {
-                  dst[x].b = 0;
-                  dst[x].g = 0;
-                  dst[x].r = 0;
-                }
-              else
-                {
-                  unsigned int level = multiplier[srcpix];
-                  dst[x].b -=  (dst[x].b * level) >> 16;
-                  dst[x].g -=  (dst[x].g * level) >> 16;
-                  dst[x].r -=  (dst[x].r * level) >> 16;
-                }
-            }
-        }
+      composite_row(COMPOSITE_ATTENUATE, dst, 0, src, xcolumns,
+                    multiplier, lev, maxgray);
       // Next line
       dst += rowsize();
       src += bm->rowsize();
@@ -1430,43 +2178,46 @@ GPixmap::blit(const GBitmap *bm, int xpos, int ypos, const GPixel *color)
     xcolumns = mini(xpos + (int) bm->columns(), ncolumns) - maxi(0, xpos);
   if(xrows <= 0 || xcolumns <= 0)
     return;
-  // Precompute multiplier map
-  unsigned int multiplier[256];
-  unsigned int maxgray = bm->get_grays() - 1;
-  for (unsigned int i=1; i<maxgray ; i++)
-    multiplier[i] = 0x10000 * i / maxgray;
   // Cache target color
   unsigned char gr = color->r;
   unsigned char gg = color->g;
   unsigned char gb = color->b;
+  // Process compressed bilevel masks run by run
+  if (GPixmapMaskSpans::usable(bm))
+    {
+      GPixmapMaskSpans mask(bm);
+      const int sy = -mini(0,ypos), sx = -mini(0,xpos);
+      GPixel *dst = (*this)[0] + maxi(0, ypos)*rowsize()+maxi(0, xpos) - sx;
+      for (int y=0; y<xrows; y++, dst+=rowsize())
+        for (int n=mask.get(sy+y, sx, sx+xcolumns), i=0; i<n; i+=2)
+          for (int x=mask.spans[i]; x<mask.spans[i+1]; x++)
+            {
+              dst[x].b = clip[dst[x].b + gb];
+              dst[x].g = clip[dst[x].g + gg];
+              dst[x].r = clip[dst[x].r + gr];
+            }
+      return;
+    }
+  // Precompute multiplier map
+  unsigned int multiplier[256];
+  unsigned short lev[256];
+  unsigned int maxgray = bm->get_grays() - 1;
+  composite_multipliers(maxgray, multiplier, lev);
+  if (MMXControl::simdflag < 0)
+    MMXControl::enable_simd();
+  // Replicate target color
+  GPixel *crow;
+  GPBuffer<GPixel> gcrow(crow, xcolumns);
+  for (int x=0; x<xcolumns; x++)
+    crow[x] = *color;
   // Compute starting point
-  const unsigned char *src = (*bm)[0] - mini(0,ypos)*bm->rowsize()-mini(0,xpos);
+  const unsigned char *src = (*bm)[0] - mini(0,ypos)*(int)bm->rowsize()-mini(0,xpos);
   GPixel *dst = (*this)[0] + maxi(0, ypos)*rowsize()+maxi(0, xpos);
   // Loop over rows
   for (int y=0; y<xrows; y++)
     {
-      // Loop over columns
-      for (int x=0; x<xcolumns; x++)
-        {
-          unsigned char srcpix = src[x];
-          // Perform pixel operation
-          if (srcpix > 0)
-            {
-              if (srcpix >= maxgray)
-                {
-                  dst[x].b = clip[dst[x].b + gb];
-                  dst[x].g = clip[dst[x].g + gg];
-                  dst[x].r = clip[dst[x].r + gr];
-                }
-              else
-                {
-                  unsigned int level = multiplier[srcpix];
-                  dst[x].b = clip[dst[x].b + ((gb * level) >> 16)];
-                  dst[x].g = clip[dst[x].g + ((gg * level) >> 16)];
-                  dst[x].r = clip[dst[x].r + ((gr * level) >> 16)];
-                }
-            }
-        }
+      composite_row(COMPOSITE_BLIT, dst, crow, src, xcolumns,
+                    multiplier, lev, maxgray);
       // Next line
       dst += rowsize();
       src += bm->rowsize();
@@ -1488,41 +2239,40 @@ GPixmap::blit(const GBitmap *bm, int xpos, int ypos, const GPixmap *color)
       xcolumns = mini(xpos + (int) bm->columns(), ncolumns) - maxi(0, xpos);
   if(xrows <= 0 || xcolumns <= 0)
     return;
+  // Process compressed bilevel masks run by run
+  if (GPixmapMaskSpans::usable(bm))
+    {
+      GPixmapMaskSpans mask(bm);
+      const int sy = -mini(0,ypos), sx = -mini(0,xpos);
+      const GPixel *src2 = (*color)[0] + maxi(0, ypos)*color->rowsize()
+        + maxi(0, xpos) - sx;
+      GPixel *dst = (*this)[0] + maxi(0, ypos)*rowsize()+maxi(0, xpos) - sx;
+      for (int y=0; y<xrows; y++, dst+=rowsize(), src2+=color->rowsize())
+        for (int n=mask.get(sy+y, sx, sx+xcolumns), i=0; i<n; i+=2)
+          for (int x=mask.spans[i]; x<mask.spans[i+1]; x++)
+            {
+              dst[x].b = clip[dst[x].b + src2[x].b];
+              dst[x].g = clip[dst[x].g + src2[x].g];
+              dst[x].r = clip[dst[x].r + src2[x].r];
+            }
+      return;
+    }
   // Precompute multiplier map
   unsigned int multiplier[256];
+  unsigned short lev[256];
   unsigned int maxgray = bm->get_grays() - 1;
-  for (unsigned int i=1; i<maxgray ; i++)
-    multiplier[i] = 0x10000 * i / maxgray;
-  // Cache target color
+  composite_multipliers(maxgray, multiplier, lev);
+  if (MMXControl::simdflag < 0)
+    MMXControl::enable_simd();
   // Compute starting point
-  const unsigned char *src = (*bm)[0] - mini(0,ypos)*bm->rowsize()-mini(0,xpos);
+  const unsigned char *src = (*bm)[0] - mini(0,ypos)*(int)bm->rowsize()-mini(0,xpos);
   const GPixel *src2 = (*color)[0] + maxi(0, ypos)*color->rowsize()+maxi(0, xpos);
   GPixel *dst = (*this)[0] + maxi(0, ypos)*rowsize()+maxi(0, xpos);
   // Loop over rows
   for (int y=0; y<xrows; y++)
     {
-      // Loop over columns
-      for (int x=0; x<xcolumns; x++)
-        {
-          unsigned char srcpix = src[x];
-          // Perform pixel operation
-          if (srcpix > 0)
-            {
-              if (srcpix >= maxgray)
-                {
-                  dst[x].b = clip[dst[x].b + src2[x].b];
-                  dst[x].g = clip[dst[x].g + src2[x].g];
-                  dst[x].r = clip[dst[x].r + src2[x].r];
-                }
-              else
-                {
-                  unsigned int level = multiplier[srcpix];
-                  dst[x].b = clip[dst[x].b + ((src2[x].b * level) >> 16)];
-                  dst[x].g = clip[dst[x].g + ((src2[x].g * level) >> 16)];
-                  dst[x].r = clip[dst[x].r + ((src2[x].r * level) >> 16)];
-                }
-            }
-        }
+      composite_row(COMPOSITE_BLIT, dst, src2, src, xcolumns,
+                    multiplier, lev, maxgray);
       // Next line
       dst += rowsize();
       src += bm->rowsize();
@@ -1546,41 +2296,36 @@ GPixmap::blend(const GBitmap *bm, int xpos, int ypos, const GPixmap *color)
       xcolumns = mini(xpos + (int) bm->columns(), ncolumns) - maxi(0, xpos);
   if(xrows <= 0 || xcolumns <= 0)
     return;
+  // Process compressed bilevel masks run by run
+  if (GPixmapMaskSpans::usable(bm))
+    {
+      GPixmapMaskSpans mask(bm);
+      const int sy = -mini(0,ypos), sx = -mini(0,xpos);
+      const GPixel *src2 = (*color)[0] + maxi(0, ypos)*color->rowsize()
+        + maxi(0, xpos) - sx;
+      GPixel *dst = (*this)[0] + maxi(0, ypos)*rowsize()+maxi(0, xpos) - sx;
+      for (int y=0; y<xrows; y++, dst+=rowsize(), src2+=color->rowsize())
+        for (int n=mask.get(sy+y, sx, sx+xcolumns), i=0; i<n; i+=2)
+          memcpy(dst + mask.spans[i], src2 + mask.spans[i], 
+                 (mask.spans[i+1] - mask.spans[i]) * sizeof(GPixel));
+      return;
+    }
   // Precompute multiplier map
   unsigned int multiplier[256];
+  unsigned short lev[256];
   unsigned int maxgray = bm->get_grays() - 1;
-  for (unsigned int i=1; i<maxgray ; i++)
-    multiplier[i] = 0x10000 * i / maxgray;
-  // Cache target color
+  composite_multipliers(maxgray, multiplier, lev);
+  if (MMXControl::simdflag < 0)
+    MMXControl::enable_simd();
   // Compute starting point
-  const unsigned char *src = (*bm)[0] - mini(0,ypos)*bm->rowsize()-mini(0,xpos);
+  const unsigned char *src = (*bm)[0] - mini(0,ypos)*(int)bm->rowsize()-mini(0,xpos);
   const GPixel *src2 = (*color)[0] + maxi(0, ypos)*color->rowsize()+maxi(0, xpos);
   GPixel *dst = (*this)[0] + maxi(0, ypos)*rowsize()+maxi(0, xpos);
   // Loop over rows
   for (int y=0; y<xrows; y++)
     {
-      // Loop over columns
-      for (int x=0; x<xcolumns; x++)
-        {
-          unsigned char srcpix = src[x];
-          // Perform pixel operation
-          if (srcpix > 0)
-            {
-              if (srcpix >= maxgray)
-                {
-                  dst[x].b = src2[x].b;
-                  dst[x].g = src2[x].g;
-                  dst[x].r = src2[x].r;
-                }
-              else
-                {
-                  unsigned int level = multiplier[srcpix];
-                  dst[x].b -= (((int)dst[x].b - (int)src2[x].b) * level) >> 16;
-                  dst[x].g -= (((int)dst[x].g - (int)src2[x].g) * level) >> 16;
-                  dst[x].r -= (((int)dst[x].r - (int)src2[x].r) * level) >> 16;
-                }
-            }
-        }
+      composite_row(COMPOSITE_BLEND, dst, src2, src, xcolumns,
+                    multiplier, lev, maxgray);
       // Next line
       dst += rowsize();
       src += bm->rowsize();
@@ -1619,11 +2364,15 @@ GPixmap::stencil(const GBitmap *bm,
     xcolumns = bm->columns();
   if (rect.width() < xcolumns)
     xcolumns = rect.width();
+  if (xrows <= 0 || xcolumns <= 0)
+    return;
   // Precompute multiplier map
   unsigned int multiplier[256];
+  unsigned short lev[256];
   unsigned int maxgray = bm->get_grays() - 1;
-  for (unsigned int i=1; i<maxgray ; i++)
-    multiplier[i] = 0x10000 * i / maxgray;
+  composite_multipliers(maxgray, multiplier, lev);
+  if (MMXControl::simdflag < 0)
+    MMXControl::enable_simd();
   // Prepare color correction table
   unsigned char gtable[256][3];
   color_correction_table_cache(corr, white, gtable);
@@ -1632,50 +2381,60 @@ GPixmap::stencil(const GBitmap *bm,
   euclidian_ratio(rect.ymin, pms, fgy, fgy1);
   euclidian_ratio(rect.xmin, pms, fgxz, fgx1z);
   const GPixel *fg = (*pm)[fgy];
-  const unsigned char *src = (*bm)[0];
+  // Corrected foreground colors blown up to the width of one row
+  GPixel *fgrow;
+  GPBuffer<GPixel> gfgrow(fgrow, xcolumns);
+  bool fgnew = true;
+  // Process compressed bilevel masks run by run
+  GPixmapMaskSpans *mask = 0;
+  if (GPixmapMaskSpans::usable(bm))
+    mask = new GPixmapMaskSpans(bm);
+  const unsigned char *src = (mask ? 0 : (*bm)[0]);
   GPixel *dst = (*this)[0];
   // Loop over rows
   for (int y=0; y<xrows; y++)
   {
-    // Loop over columns
-    int fgx = fgxz;
-    int fgx1 = fgx1z;
-    for (int x=0; x<xcolumns; x++)
+    if (fgnew)
     {
-      unsigned char srcpix = src[x];
-      // Perform pixel operation
-      if (srcpix > 0)
+      // Loop over columns
+      int fgx = fgxz;
+      int fgx1 = fgx1z;
+      for (int x=0; x<xcolumns; x++)
       {
-        if (srcpix >= maxgray)
-        {
-          dst[x].b = gtable[fg[fgx].b][0];
-          dst[x].g = gtable[fg[fgx].g][1];
-          dst[x].r = gtable[fg[fgx].r][2];
-        }
-        else
+        fgrow[x].b = gtable[fg[fgx].b][0];
+        fgrow[x].g = gtable[fg[fgx].g][1];
+        fgrow[x].r = gtable[fg[fgx].r][2];
+        // Next column
+        if (++fgx1 >= pms)
         {
-          unsigned int level = multiplier[srcpix];
-          dst[x].b -= (((int)dst[x].b-(int)gtable[fg[fgx].b][0])*level) >> 16;
-          dst[x].g -= (((int)dst[x].g-(int)gtable[fg[fgx].g][1])*level) >> 16;
-          dst[x].r -= (((int)dst[x].r-(int)gtable[fg[fgx].r][2])*level) >> 16;
+          fgx1 = 0;
+          fgx += 1;
         }
       }
-      // Next column
-      if (++fgx1 >= pms)
-      {
-        fgx1 = 0;
-        fgx += 1;
-      }
+      fgnew = false;
+    }
+    if (mask)
+    {
+      for (int n=mask->get(y, 0, xcolumns), i=0; i<n; i+=2)
+        memcpy(dst + mask->spans[i], fgrow + mask->spans[i],
+               (mask->spans[i+1] - mask->spans[i]) * sizeof(GPixel));
+    }
+    else
+    {
+      composite_row(COMPOSITE_BLEND, dst, fgrow, src, xcolumns,
+                    multiplier, lev, maxgray);
+      src += bm->rowsize();
     }
     // Next line
     dst += rowsize();
-    src += bm->rowsize();
     if (++fgy1 >= pms)
     {
       fgy1 = 0;
       fg += pm->rowsize();
+      fgnew = true;
     } 
   }
+  delete mask;
 }
 
 void 
@@ -1687,6 +2446,93 @@ GPixmap::stencil(const GBitmap *bm,
 }
 
 
+// Block transposition used by rotate.  Pixel #x# of row #y# of #src# is
+// copied to pixel #y# of row #x# of #dst#.  Row increments #srs# and #drs#
+// may be negative to mirror the result.  Blocks of eight rows are
+// processed together so that the strided accesses stay in the cache.
+
+#ifdef MMX_AVX2
+
+// Transposes one block of 8x8 pixels.
+static MMX_AVX2_TARGET void
+transpose_pixels_avx2(const GPixel *src, int srs, GPixel *dst, int drs)
+{
+  // Expand pixels to 32 bits
+  const __m256i expand = _mm256_setr_epi8(0,1,2,-1,3,4,5,-1,6,7,8,-1,9,10,11,-1,
+                                          4,5,6,-1,7,8,9,-1,10,11,12,-1,13,14,15,-1);
+  const __m256i shrink = _mm256_setr_epi8(0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1,
+                                          0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1);
+  const __m256i order = _mm256_setr_epi32(0,1,2,4,5,6,3,7);
+  __m256i r[8], t[8];
+  for (int i=0; i<8; i++, src+=srs)
+    {
+      const unsigned char *s = (const unsigned char*)src;
+      const __m256i v = _mm256_setr_m128i(_mm_loadu_si128((const __m128i*)s),
+                                          _mm_loadu_si128((const __m128i*)(s+8)));
+      r[i] = _mm256_shuffle_epi8(v, expand);
+    }
+  // Transpose 8x8 words of 32 bits
+  for (int i=0; i<8; i+=2)
+    {
+      t[i] = _mm256_unpacklo_epi32(r[i], r[i+1]);
+      t[i+1] = _mm256_unpackhi_epi32(r[i], r[i+1]);
+    }
+  for (int i=0; i<8; i+=4)
+    {
+      r[i] = _mm256_unpacklo_epi64(t[i], t[i+2]);
+      r[i+1] = _mm256_unpackhi_epi64(t[i], t[i+2]);
+      r[i+2] = _mm256_unpacklo_epi64(t[i+1], t[i+3]);
+      r[i+3] = _mm256_unpackhi_epi64(t[i+1], t[i+3]);
+    }
+  for (int i=0; i<4; i++)
+    {
+      t[i] = _mm256_permute2x128_si256(r[i], r[i+4], 0x20);
+      t[i+4] = _mm256_permute2x128_si256(r[i], r[i+4], 0x31);
+    }
+  // Store 24 bytes per row
+  for (int i=0; i<8; i++, dst+=drs)
+    {
+      const __m256i v = _mm256_permutevar8x32_epi32(
+        _mm256_shuffle_epi8(t[i], shrink), order);
+      unsigned char *d = (unsigned char*)dst;
+      _mm_storeu_si128((__m128i*)d, _mm256_castsi256_si128(v));
+      _mm_storel_epi64((__m128i*)(d+16), _mm256_extracti128_si256(v, 1));
+    }
+}
+
+#endif /* MMX_AVX2 */
+
+static void
+transpose_pixels(const GPixel *src, int srs, GPixel *dst, int drs, 
+                 int nrows, int ncolumns)
+{
+  int y = 0;
+#ifdef MMX_AVX2
+  if (MMXControl::simdflag >= MMXControl::SIMD_AVX2)
+    for (; y+8 <= nrows; y+=8)
+      {
+        const GPixel *s = src + y*srs;
+        GPixel *d = dst + y;
+        int x = 0;
+        for (; x+8 <= ncolumns; x+=8)
+          transpose_pixels_avx2(s + x, srs, d + x*drs, drs);
+        for (; x<ncolumns; x++)
+          for (int i=0; i<8; i++)
+            d[x*drs + i] = s[i*srs + x];
+      }
+#endif
+  for (; y<nrows; y+=8)
+    {
+      const int n = mini(8, nrows - y);
+      const GPixel *s = src + y*srs;
+      GPixel *d = dst + y;
+      for (int x=0; x<ncolumns; x++, d+=drs)
+        for (int i=0; i<n; i++)
+          d[i] = s[i*srs + x];
+    }
+}
+
+
 GP<GPixmap> GPixmap::rotate(int count)
 {
   GP<GPixmap> newpixmap(this);
@@ -1701,20 +2547,18 @@ GP<GPixmap> GPixmap::rotate(int count)
     GPixmap &dpixmap = *newpixmap;
 
     GMonitorLock lock(&pixmap_monitor());
+    if (nrows==0 || ncolumns==0)
+      return newpixmap;
+    if (MMXControl::simdflag < 0)
+      MMXControl::enable_simd();
     switch(count)
     {
     case 3: //// rotate 90 counter clockwise
         {
             int lastrow = dpixmap.rows()-1;
-
-            for(int y=0; y<nrows; y++)
-            {
-                const GPixel *r=operator [] (y);
-                for(int x=0,xnew=lastrow; xnew>=0; x++,xnew--)
-                {
-                    dpixmap[xnew][y] = r[x];
-                }
-            }
+            transpose_pixels((*this)[0], rowsize(), 
+                             dpixmap[lastrow], -(int)dpixmap.rowsize(),
+                             nrows, ncolumns);
         }
         break;
     case 2: //// rotate 180 counter clockwise
@@ -1736,15 +2580,9 @@ GP<GPixmap> GPixmap::rotate(int count)
     case 1: //// rotate 270 counter clockwise
         {
             int lastcolumn = dpixmap.columns()-1;
-
-            for(int y=0,ynew=lastcolumn; ynew>=0; y++,ynew--)
-            {
-                const GPixel *r=operator [] (y);
-                for(int x=0; x<ncolumns; x++)
-                {
-                    dpixmap[x][ynew] = r[x];
-                }
-            }
+            transpose_pixels((*this)[lastcolumn], -(int)rowsize(),
+                             dpixmap[0], dpixmap.rowsize(),
+                             nrows, ncolumns);
         }
         break;
     }
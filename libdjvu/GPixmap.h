@@ -374,6 +374,12 @@ public:
       This function is {\em static} and does not modify this pixmap. */
   static void color_correct(double corr, GPixel *pix, int npix);
   static void color_correct(double corr, GPixel white, GPixel *pix, int npix);
+  /** Returns the number of color corrections that found their correction
+      table in the process wide table cache. */
+  static int get_color_correction_cache_hits(void);
+  /** Returns the number of color corrections that had to compute their
+      correction table. */
+  static int get_color_correction_cache_misses(void);
 
   //@}
   
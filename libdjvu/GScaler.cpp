@@ -65,6 +65,8 @@
 // Almost equal to my initial code.
 
 #include "GScaler.h"
+#include "GThreads.h"
+#include "MMX.h"
 
 
 #ifdef HAVE_NAMESPACES
@@ -101,13 +103,13 @@ prepare_interp()
 {
   if (! interp_ok)
     {
-      interp_ok = 1;
       for (int i=0; i<FRACSIZE; i++)
         {
           short *deltas = & interp[i][256];
           for (int j = -255; j <= 255; j++)
             deltas[j] = ( j*i + FRACSIZE2 ) >> FRACBITS;
         }
+      interp_ok = 1;
     }
 }
 
@@ -126,6 +128,228 @@ maxi(int x, int y)
 }
 
 
+// Splits #nrows# output rows into bands of #bh# rows.
+// Small outputs are not worth splitting.
+
+static int
+band_count(GThreadPool *pool, int nrows, int ncolumns, int &bh)
+{
+  bh = nrows;
+  if (!pool || nrows * ncolumns < 65536)
+    return 1;
+  int nthreads = pool->get_threads();
+  bh = maxi(32, (nrows + nthreads + nthreads - 1) / (nthreads + nthreads));
+  return (nrows + bh - 1) / bh;
+}
+
+
+// Keeps the last two lines of the reduced image.
+
+struct ReducedLines
+{
+  ReducedLines(int nbytes);
+  int l1;
+  int l2;
+  unsigned char *p1;
+  GPBuffer<unsigned char> gp1;
+  unsigned char *p2;
+  GPBuffer<unsigned char> gp2;
+};
+
+ReducedLines::ReducedLines(int nbytes)
+  : l1(-1), l2(-1), gp1(p1,nbytes), gp2(p2,nbytes)
+{
+}
+
+
+
+
+
+
+////////////////////////////////////////
+// INTERPOLATION
+
+
+// Interpolates #n# bytes between rows #lower# and #upper#
+// using fractional position #frac#.
+
+static void
+interp_rows(unsigned char *dest, const unsigned char *lower,
+            const unsigned char *upper, int n, int frac)
+{
+  int i = 0;
+#ifdef MMX_SSE2
+  if (MMXControl::simdflag > 0)
+    {
+      const __m128i zero = _mm_setzero_si128();
+      const __m128i f = _mm_set1_epi16(frac);
+      const __m128i rnd = _mm_set1_epi16(FRACSIZE2);
+      for (; i+16 <= n; i+=16)
+        {
+          __m128i l = _mm_loadu_si128((const __m128i*)(lower+i));
+          __m128i u = _mm_loadu_si128((const __m128i*)(upper+i));
+          __m128i l0 = _mm_unpacklo_epi8(l, zero);
+          __m128i l1 = _mm_unpackhi_epi8(l, zero);
+          __m128i d0 = _mm_sub_epi16(_mm_unpacklo_epi8(u, zero), l0);
+          __m128i d1 = _mm_sub_epi16(_mm_unpackhi_epi8(u, zero), l1);
+          d0 = _mm_srai_epi16(_mm_add_epi16(_mm_mullo_epi16(d0, f), rnd), 
+                              FRACBITS);
+          d1 = _mm_srai_epi16(_mm_add_epi16(_mm_mullo_epi16(d1, f), rnd), 
+                              FRACBITS);
+          _mm_storeu_si128((__m128i*)(dest+i), 
+                           _mm_packus_epi16(_mm_add_epi16(l0, d0),
+                                            _mm_add_epi16(l1, d1)) );
+        }
+    }
+#endif
+  const short *deltas = & interp[frac][256];
+  for (; i<n; i++)
+    {
+      const int l = lower[i];
+      const int u = upper[i];
+      dest[i] = l + deltas[u-l];
+    }
+}
+
+
+#ifdef MMX_AVX2
+
+// Horizontal interpolation of eight output pixels at a time.
+// Pixel #x# interpolates between pixels #(coord[x]>>FRACBITS)+offset# 
+// and the next one in array #base#.  Both pixels are gathered with a 
+// single load of four bytes.  Returns the number of pixels processed.
+
+static MMX_AVX2_TARGET int
+interp_gray_avx2(unsigned char *dest, const unsigned char *base, int offset,
+                 const int *coord, int n)
+{
+  const __m256i off = _mm256_set1_epi32(offset);
+  const __m256i fmask = _mm256_set1_epi32(FRACMASK);
+  const __m256i bmask = _mm256_set1_epi32(0xff);
+  const __m256i rnd = _mm256_set1_epi32(FRACSIZE2);
+  const __m256i pick = _mm256_setr_epi8(0,4,8,12,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+                                        0,4,8,12,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1);
+  const __m256i order = _mm256_setr_epi32(0,4,1,1,1,1,1,1);
+  int x = 0;
+  for (; x+8 <= n; x+=8)
+    {
+      const __m256i c = _mm256_loadu_si256((const __m256i*)(coord+x));
+      const __m256i idx = _mm256_add_epi32(_mm256_srai_epi32(c, FRACBITS), off);
+      const __m256i g = _mm256_i32gather_epi32((const int*)base, idx, 1);
+      const __m256i l = _mm256_and_si256(g, bmask);
+      const __m256i u = _mm256_and_si256(_mm256_srli_epi32(g, 8), bmask);
+      // Products fit in the low 16 bits of each word
+      __m256i d = _mm256_mullo_epi16(_mm256_sub_epi16(u, l), 
+                                     _mm256_and_si256(c, fmask));
+      d = _mm256_srai_epi16(_mm256_add_epi16(d, rnd), FRACBITS);
+      const __m256i r = _mm256_permutevar8x32_epi32(
+        _mm256_shuffle_epi8(_mm256_add_epi16(l, d), pick), order);
+      _mm_storel_epi64((__m128i*)(dest+x), _mm256_castsi256_si128(r));
+    }
+  return x;
+}
+
+static MMX_AVX2_TARGET int
+interp_color_avx2(GPixel *dest, const GPixel *base, int offset,
+                  const int *coord, int n)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i off = _mm256_set1_epi32(offset);
+  const __m256i fmask = _mm256_set1_epi32(FRACMASK);
+  const __m256i rnd = _mm256_set1_epi16(FRACSIZE2);
+  const __m256i shrink = _mm256_setr_epi8(0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1,
+                                          0,1,2,4,5,6,8,9,10,12,13,14,-1,-1,-1,-1);
+  const __m256i order = _mm256_setr_epi32(0,1,2,4,5,6,3,7);
+  const int *b = (const int*)base;
+  int x = 0;
+  for (; x+8 <= n; x+=8)
+    {
+      const __m256i c = _mm256_loadu_si256((const __m256i*)(coord+x));
+      __m256i idx = _mm256_add_epi32(_mm256_srai_epi32(c, FRACBITS), off);
+      idx = _mm256_add_epi32(idx, _mm256_add_epi32(idx, idx));
+      const __m256i g1 = _mm256_i32gather_epi32(b, idx, 1);
+      const __m256i g2 = _mm256_i32gather_epi32(b, _mm256_add_epi32(idx, 
+                                                _mm256_set1_epi32(3)), 1);
+      // Replicate the fractional position on the color channels
+      __m256i f = _mm256_and_si256(c, fmask);
+      f = _mm256_or_si256(f, _mm256_slli_epi32(f, 16));
+      __m256i r[2];
+      for (int k=0; k<2; k++)
+        {
+          const __m256i l = (k ? _mm256_unpackhi_epi8(g1, zero)
+                               : _mm256_unpacklo_epi8(g1, zero) );
+          const __m256i u = (k ? _mm256_unpackhi_epi8(g2, zero)
+                               : _mm256_unpacklo_epi8(g2, zero) );
+          const __m256i fk = (k ? _mm256_unpackhi_epi32(f, f)
+                                : _mm256_unpacklo_epi32(f, f) );
+          __m256i d = _mm256_mullo_epi16(_mm256_sub_epi16(u, l), fk);
+          d = _mm256_srai_epi16(_mm256_add_epi16(d, rnd), FRACBITS);
+          r[k] = _mm256_add_epi16(l, d);
+        }
+      const __m256i v = _mm256_permutevar8x32_epi32(
+        _mm256_shuffle_epi8(_mm256_packus_epi16(r[0], r[1]), shrink), order);
+      unsigned char *d = (unsigned char*)(dest+x);
+      _mm_storeu_si128((__m128i*)d, _mm256_castsi256_si128(v));
+      _mm_storel_epi64((__m128i*)(d+16), _mm256_extracti128_si256(v, 1));
+    }
+  return x;
+}
+
+#endif /* MMX_AVX2 */
+
+
+// Horizontal interpolation of #n# output pixels.  Array #base# must 
+// extend three bytes beyond the last pixel used by the interpolation.
+
+static void
+interp_gray(unsigned char *dest, const unsigned char *base, int offset,
+            const int *coord, int n)
+{
+  int x = 0;
+#ifdef MMX_AVX2
+  if (MMXControl::simdflag >= MMXControl::SIMD_AVX2)
+    x = interp_gray_avx2(dest, base, offset, coord, n);
+#endif
+  const unsigned char *line = base + offset;
+  for (; x<n; x++)
+    {
+      const int c = coord[x];
+      const unsigned char *lower = line + (c>>FRACBITS);
+      const short *deltas = &interp[c&FRACMASK][256];
+      const int l = lower[0];
+      const int u = lower[1];
+      dest[x] = l + deltas[u-l];
+    }
+}
+
+static void
+interp_color(GPixel *dest, const GPixel *base, int offset,
+             const int *coord, int n)
+{
+  int x = 0;
+#ifdef MMX_AVX2
+  if (MMXControl::simdflag >= MMXControl::SIMD_AVX2)
+    x = interp_color_avx2(dest, base, offset, coord, n);
+#endif
+  const GPixel *line = base + offset;
+  for (; x<n; x++)
+    {
+      const int c = coord[x];
+      const GPixel *lower = line + (c>>FRACBITS);
+      const short *deltas = &interp[c&FRACMASK][256];
+      const int lower_r = lower[0].r;
+      const int delta_r = deltas[(int)lower[1].r - lower_r];
+      dest[x].r = lower_r + delta_r;
+      const int lower_g = lower[0].g;
+      const int delta_g = deltas[(int)lower[1].g - lower_g];
+      dest[x].g = lower_g + delta_g;
+      const int lower_b = lower[0].b;
+      const int delta_b = deltas[(int)lower[1].b - lower_b];
+      dest[x].b = lower_b + delta_b;
+    }
+}
+
+
 
 
 
@@ -303,13 +527,11 @@ GScaler::get_input_rect( const GRect &desired_output, GRect &required_input )
 
 
 GBitmapScaler::GBitmapScaler()
-  : glbuffer(lbuffer,0), gconv(conv,0), gp1(p1,0), gp2(p2,0)
 {
 }
 
 
 GBitmapScaler::GBitmapScaler(int inw, int inh, int outw, int outh)
-  : glbuffer(lbuffer,0), gconv(conv,0), gp1(p1,0), gp2(p2,0)
 {
   set_input_size(inw, inh);
   set_output_size(outw, outh);
@@ -321,27 +543,28 @@ GBitmapScaler::~GBitmapScaler()
 }
 
 
-unsigned char *
-GBitmapScaler::get_line(int fy, 
-                        const GRect &required_red, 
-                        const GRect &provided_input,
-                        const GBitmap &input )
+static unsigned char *
+get_gray_line(ReducedLines &lines, int fy, 
+              const GRect &required_red, 
+              const GRect &provided_input,
+              const GBitmap &input, const unsigned char *conv,
+              int xshift, int yshift)
 {
   if (fy < required_red.ymin)
     fy = required_red.ymin; 
   else if (fy >= required_red.ymax)
     fy = required_red.ymax - 1;
   // Cached line
-  if (fy == l2)
-    return p2;
-  if (fy == l1)
-    return p1;
+  if (fy == lines.l2)
+    return lines.p2;
+  if (fy == lines.l1)
+    return lines.p1;
   // Shift
-  unsigned char *p = p1;
-  p1 = p2;
-  l1 = l2;
-  p2 = p;
-  l2 = fy;
+  unsigned char *p = lines.p1;
+  lines.p1 = lines.p2;
+  lines.l1 = lines.l2;
+  lines.p2 = p;
+  lines.l2 = fy;
   if (xshift==0 && yshift==0)
     {
       // Fast mode
@@ -350,7 +573,7 @@ GBitmapScaler::get_line(int fy,
       const unsigned char *inp1 = input[fy-provided_input.ymin] + dx;
       while (dx++ < dx1)
         *p++ = conv[*inp1++];
-      return p2;
+      return lines.p2;
     }
   else
     {
@@ -390,11 +613,35 @@ GBitmapScaler::get_line(int fy,
             *p = (g+s/2)/s;
         }
       // Return
-      return p2;
+      return lines.p2;
     }
 }
 
 
+struct GBitmapScaler::Bands
+{
+  GBitmapScaler *scaler;
+  const GRect *provided_input;
+  const GBitmap *input;
+  const GRect *desired_output;
+  GBitmap *output;
+  const unsigned char *conv;
+  int bh;
+};
+
+
+void
+GBitmapScaler::band_job(void *arg, int i)
+{
+  Bands *b = (Bands*)arg;
+  GRect band = *b->desired_output;
+  band.ymin += i * b->bh;
+  band.ymax = mini(band.ymax, band.ymin + b->bh);
+  b->scaler->scale_band(*b->provided_input, *b->input, 
+                        *b->desired_output, *b->output, band, b->conv);
+}
+
+
 void 
 GBitmapScaler::scale( const GRect &provided_input, const GBitmap &input,
                       const GRect &desired_output, GBitmap &output )
@@ -418,18 +665,11 @@ GBitmapScaler::scale( const GRect &provided_input, const GBitmap &input,
     output.init(desired_output.height(), desired_output.width());
   output.set_grays(256);
   // Prepare temp stuff
-  gp1.resize(0);
-  gp2.resize(0);
-  glbuffer.resize(0);
   prepare_interp();
-  const int bufw = required_red.width();
-  glbuffer.resize(bufw+2);
-  gp1.resize(bufw);
-  gp2.resize(bufw);
-  l1 = l2 = -1;
+  if (MMXControl::simdflag < 0)
+    MMXControl::enable_simd();
   // Prepare gray conversion array (conv)
-  gconv.resize(0);
-  gconv.resize(256);
+  unsigned char conv[256];
   int maxgray = input.get_grays()-1;
   for (int i=0; i<256; i++) 
     {
@@ -437,8 +677,45 @@ GBitmapScaler::scale( const GRect &provided_input, const GBitmap &input,
         ?(((i*255) + (maxgray>>1)) / maxgray)
         :255;
     }
+  // Process bands
+  GThreadPool *pool = GThreadPool::get_shared();
+  Bands bands;
+  int nbands = band_count(pool, desired_output.height(), 
+                          desired_output.width(), bands.bh);
+  if (nbands > 1)
+    {
+      // Expand the input before sharing it
+      input[0];
+      bands.scaler = this;
+      bands.provided_input = &provided_input;
+      bands.input = &input;
+      bands.desired_output = &desired_output;
+      bands.output = &output;
+      bands.conv = conv;
+      pool->run(band_job, (void*)&bands, nbands);
+    }
+  else
+    scale_band(provided_input, input, desired_output, output, 
+               desired_output, conv);
+}
+
+
+void 
+GBitmapScaler::scale_band(const GRect &provided_input, const GBitmap &input,
+                          const GRect &desired_output, GBitmap &output,
+                          const GRect &band, const unsigned char *conv)
+{
+  // Compute rectangles for this band
+  GRect required_input; 
+  GRect required_red;
+  make_rectangles(band, required_red, required_input);
+  // Prepare temp stuff
+  const int bufw = required_red.width();
+  unsigned char *lbuffer;
+  GPBuffer<unsigned char> glbuffer(lbuffer, bufw+5);
+  ReducedLines lines(bufw);
   // Loop on output lines
-  for (int y=desired_output.ymin; y<desired_output.ymax; y++)
+  for (int y=band.ymin; y<band.ymax; y++)
     {
       // Perform vertical interpolation
       {
@@ -447,44 +724,23 @@ GBitmapScaler::scale( const GRect &provided_input, const GBitmap &input,
         int fy2 = fy1+1;
         const unsigned char *lower, *upper;
         // Obtain upper and lower line in reduced image
-        lower = get_line(fy1, required_red, provided_input, input);
-        upper = get_line(fy2, required_red, provided_input, input);
+        lower = get_gray_line(lines, fy1, required_red, provided_input, 
+                              input, conv, xshift, yshift);
+        upper = get_gray_line(lines, fy2, required_red, provided_input, 
+                              input, conv, xshift, yshift);
         // Compute line
-        unsigned char *dest = lbuffer+1;
-        const short *deltas = & interp[fy&FRACMASK][256];
-        for(unsigned char const * const edest=(unsigned char const *)dest+bufw;
-          dest<edest;upper++,lower++,dest++)
-        {
-          const int l = *lower;
-          const int u = *upper;
-          *dest = l + deltas[u-l];
-        }
+        interp_rows(lbuffer+1, lower, upper, bufw, fy&FRACMASK);
       }
       // Perform horizontal interpolation
       {
         // Prepare for side effects
         lbuffer[0]   = lbuffer[1];
         lbuffer[bufw+1] = lbuffer[bufw];
-        unsigned char *line = lbuffer+1-required_red.xmin;
-        unsigned char *dest  = output[y-desired_output.ymin];
-        // Loop horizontally
-        for (int x=desired_output.xmin; x<desired_output.xmax; x++)
-          {
-            int n = hcoord[x];
-            const unsigned char *lower = line + (n>>FRACBITS);
-            const short *deltas = &interp[n&FRACMASK][256];
-            int l = lower[0];
-            int u = lower[1];
-            *dest = l + deltas[u-l];
-            dest++;
-          }
+        interp_gray(output[y-desired_output.ymin], lbuffer, 
+                    1-required_red.xmin, hcoord+desired_output.xmin, 
+                    desired_output.width());
       }
     }
-  // Free temporaries
-  gp1.resize(0);
-  gp2.resize(0);
-  glbuffer.resize(0);
-  gconv.resize(0);
 }
 
 
@@ -497,17 +753,11 @@ GBitmapScaler::scale( const GRect &provided_input, const GBitmap &input,
 
 
 GPixmapScaler::GPixmapScaler()
-  : glbuffer(lbuffer,0), 
-    gp1(p1,0), 
-    gp2(p2,0)
 {
 }
 
 
 GPixmapScaler::GPixmapScaler(int inw, int inh, int outw, int outh)
-  : glbuffer(lbuffer,0), 
-    gp1(p1,0), 
-    gp2(p2,0)
 {
   set_input_size(inw, inh);
   set_output_size(outw, outh);
@@ -519,27 +769,28 @@ GPixmapScaler::~GPixmapScaler()
 }
 
 
-GPixel *
-GPixmapScaler::get_line(int fy, 
-                        const GRect &required_red, 
-                        const GRect &provided_input,
-                        const GPixmap &input )
+static GPixel *
+get_color_line(ReducedLines &lines, int fy, 
+               const GRect &required_red, 
+               const GRect &provided_input,
+               const GPixmap &input, int xshift, int yshift)
 {
   if (fy < required_red.ymin)
     fy = required_red.ymin; 
   else if (fy >= required_red.ymax)
     fy = required_red.ymax - 1;
   // Cached line
-  if (fy == l2)
-    return p2;
-  if (fy == l1)
-    return p1;
+  if (fy == lines.l2)
+    return (GPixel *)lines.p2;
+  if (fy == lines.l1)
+    return (GPixel *)lines.p1;
   // Shift
-  GPixel *p=p1;
-  p1 = p2;
-  l1 = l2;
-  p2 = p;
-  l2 = fy;
+  unsigned char *pp = lines.p1;
+  lines.p1 = lines.p2;
+  lines.l1 = lines.l2;
+  lines.p2 = pp;
+  lines.l2 = fy;
+  GPixel *p = (GPixel *)pp;
   // Compute location of line
   GRect line;
   line.xmin = required_red.xmin << xshift;
@@ -586,7 +837,30 @@ GPixmapScaler::get_line(int fy,
         }
     }
   // Return
-  return (GPixel *)p2;
+  return (GPixel *)lines.p2;
+}
+
+
+struct GPixmapScaler::Bands
+{
+  GPixmapScaler *scaler;
+  const GRect *provided_input;
+  const GPixmap *input;
+  const GRect *desired_output;
+  GPixmap *output;
+  int bh;
+};
+
+
+void
+GPixmapScaler::band_job(void *arg, int i)
+{
+  Bands *b = (Bands*)arg;
+  GRect band = *b->desired_output;
+  band.ymin += i * b->bh;
+  band.ymax = mini(band.ymax, band.ymin + b->bh);
+  b->scaler->scale_band(*b->provided_input, *b->input, 
+                        *b->desired_output, *b->output, band);
 }
 
 
@@ -612,20 +886,45 @@ GPixmapScaler::scale( const GRect &provided_input, const GPixmap &input,
       desired_output.height() != (int)output.rows() )
     output.init(desired_output.height(), desired_output.width());
   // Prepare temp stuff 
-  gp1.resize(0);
-  gp2.resize(0);
-  glbuffer.resize(0);
   prepare_interp();
-  const int bufw = required_red.width();
-  glbuffer.resize(bufw+2);
-  if (xshift>0 || yshift>0)
+  if (MMXControl::simdflag < 0)
+    MMXControl::enable_simd();
+  // Process bands
+  GThreadPool *pool = GThreadPool::get_shared();
+  Bands bands;
+  int nbands = band_count(pool, desired_output.height(), 
+                          desired_output.width(), bands.bh);
+  if (nbands > 1)
     {
-      gp1.resize(bufw);
-      gp2.resize(bufw);
-      l1 = l2 = -1;
+      bands.scaler = this;
+      bands.provided_input = &provided_input;
+      bands.input = &input;
+      bands.desired_output = &desired_output;
+      bands.output = &output;
+      pool->run(band_job, (void*)&bands, nbands);
     }
+  else
+    scale_band(provided_input, input, desired_output, output, 
+               desired_output);
+}
+
+
+void 
+GPixmapScaler::scale_band(const GRect &provided_input, const GPixmap &input,
+                          const GRect &desired_output, GPixmap &output,
+                          const GRect &band)
+{
+  // Compute rectangles for this band
+  GRect required_input; 
+  GRect required_red;
+  make_rectangles(band, required_red, required_input);
+  // Prepare temp stuff 
+  const int bufw = required_red.width();
+  GPixel *lbuffer;
+  GPBuffer<GPixel> glbuffer(lbuffer, bufw+3);
+  ReducedLines lines((xshift>0 || yshift>0) ? bufw*sizeof(GPixel) : 0);
   // Loop on output lines
-  for (int y=desired_output.ymin; y<desired_output.ymax; y++)
+  for (int y=band.ymin; y<band.ymax; y++)
     {
       // Perform vertical interpolation
       {
@@ -636,8 +935,10 @@ GPixmapScaler::scale( const GRect &provided_input, const GPixmap &input,
         // Obtain upper and lower line in reduced image
         if (xshift>0 || yshift>0)
           {
-            lower = get_line(fy1, required_red, provided_input, input);
-            upper = get_line(fy2, required_red, provided_input, input);
+            lower = get_color_line(lines, fy1, required_red, provided_input,
+                                   input, xshift, yshift);
+            upper = get_color_line(lines, fy2, required_red, provided_input,
+                                   input, xshift, yshift);
           }
         else
           {
@@ -648,51 +949,19 @@ GPixmapScaler::scale( const GRect &provided_input, const GPixmap &input,
             upper = input[fy2-provided_input.ymin] + dx;
           }
         // Compute line
-        GPixel *dest = lbuffer+1;
-        const short *deltas = & interp[fy&FRACMASK][256];
-        for(GPixel const * const edest = (GPixel const *)dest+bufw;
-          dest<edest;upper++,lower++,dest++)
-        {
-          const int lower_r = lower->r;
-          const int delta_r = deltas[(int)upper->r - lower_r];
-          dest->r = lower_r + delta_r;
-          const int lower_g = lower->g;
-          const int delta_g = deltas[(int)upper->g - lower_g];
-          dest->g = lower_g + delta_g;
-          const int lower_b = lower->b;
-          const int delta_b = deltas[(int)upper->b - lower_b];
-          dest->b = lower_b + delta_b;
-        }
+        interp_rows((unsigned char*)(lbuffer+1), (const unsigned char*)lower,
+                    (const unsigned char*)upper, bufw*3, fy&FRACMASK);
       }
       // Perform horizontal interpolation
       {
         // Prepare for side effects
         lbuffer[0]   = lbuffer[1];
         lbuffer[bufw+1] = lbuffer[bufw];
-        GPixel *line = lbuffer+1-required_red.xmin;
-        GPixel *dest  = output[y-desired_output.ymin];
-        // Loop horizontally
-        for (int x=desired_output.xmin; x<desired_output.xmax; x++,dest++)
-          {
-            const int n = hcoord[x];
-            const GPixel *lower = line + (n>>FRACBITS);
-            const short *deltas = &interp[n&FRACMASK][256];
-            const int lower_r = lower[0].r;
-            const int delta_r = deltas[(int)lower[1].r - lower_r];
-            dest->r = lower_r + delta_r;
-            const int lower_g = lower[0].g;
-            const int delta_g = deltas[(int)lower[1].g - lower_g];
-            dest->g = lower_g + delta_g;
-            const int lower_b = lower[0].b;
-            const int delta_b = deltas[(int)lower[1].b - lower_b];
-            dest->b = lower_b + delta_b;
-          }
+        interp_color(output[y-desired_output.ymin], lbuffer, 
+                     1-required_red.xmin, hcoord+desired_output.xmin, 
+                     desired_output.width());
       }
     }
-  // Free temporaries
-  gp1.resize(0);
-  gp2.resize(0);
-  glbuffer.resize(0);
 }
 
 
@@ -92,6 +92,11 @@ namespace DJVU {
     image by a factor greater than eight.  High contrast images displayed at
     high magnification may contain visible jaggies.
 
+    Large output rectangles are split into horizontal bands that are
+    computed concurrently when the shared thread pool is enabled (see
+    \Ref{GThreadPool::get_shared}).  Each band only reads the input pixels
+    returned by \Ref{GScaler::get_input_rect} for its own rows.
+
     @memo
     Rescaling images with bilinear interpolation.
     @author
@@ -216,18 +221,11 @@ public:
               const GRect &desired_output, GBitmap &output );
 protected:
   // Helpers
-  unsigned char *get_line(int, const GRect &, const GRect &, const GBitmap &);
-  // Temporaries
-  unsigned char *lbuffer;
-  GPBuffer<unsigned char> glbuffer;
-  unsigned char *conv;
-  GPBuffer<unsigned char> gconv;
-  unsigned char *p1;
-  GPBuffer<unsigned char> gp1;
-  unsigned char *p2;
-  GPBuffer<unsigned char> gp2;
-  int l1;
-  int l2;
+  struct Bands;
+  static void band_job(void *, int);
+  void scale_band(const GRect &provided_input, const GBitmap &input,
+                  const GRect &desired_output, GBitmap &output,
+                  const GRect &band, const unsigned char *conv);
 };
 
 
@@ -287,16 +285,11 @@ public:
               const GRect &desired_output, GPixmap &output );
 protected:
   // Helpers
-  GPixel *get_line(int, const GRect &, const GRect &, const GPixmap &);
-  // Temporaries
-  GPixel *lbuffer;
-  GPBuffer<GPixel> glbuffer;
-  GPixel *p1;
-  GPBuffer<GPixel> gp1;
-  GPixel *p2;
-  GPBuffer<GPixel> gp2;
-  int    l1;
-  int    l2;
+  struct Bands;
+  static void band_job(void *, int);
+  void scale_band(const GRect &provided_input, const GPixmap &input,
+                  const GRect &desired_output, GPixmap &output,
+                  const GRect &band);
 };
 
 
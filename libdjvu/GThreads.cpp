@@ -687,6 +687,254 @@ GSafeFlags::wait_and_modify(long set_mask, long clr_mask,
 
 
 
+
+// ----------------------------------------
+// THREAD POOL
+// ----------------------------------------
+
+struct GThreadPool::Batch
+{
+  void (*job)(void*, int);
+  void *arg;
+  int njobs;
+  int next;                     // next unclaimed job
+  int done;                     // number of completed jobs
+  int failed;                   // a job has thrown an exception
+  GException error;             // first exception
+  Batch *link;
+};
+
+// Worker slots are reused once their thread has exited,
+// so that the slot array never exceeds the largest thread count.
+struct GThreadPool::Worker
+{
+  GThreadPool *pool;
+  GThread thread;
+  int running;                  // thread has not exited yet
+};
+
+GThreadPool::GThreadPool(int n)
+  : head(0), tail(0), nthreads(1), nworkers(0), workers(0), nslots(0)
+{
+  set_threads(n);
+}
+
+GThreadPool::~GThreadPool()
+{
+  {
+    GMonitorLock lock(&monitor);
+    nthreads = 0;
+    monitor.broadcast();
+    while (nworkers > 0)
+      monitor.wait();
+  }
+  for (int i=0; i<nslots; i++)
+    delete workers[i];
+  delete [] workers;
+}
+
+void
+GThreadPool::set_threads(int n)
+{
+  GMonitorLock lock(&monitor);
+  nthreads = (n > 1) ? n : 1;
+  while (nworkers < nthreads - 1)
+    {
+      // Find the slot of an exited worker
+      int i = 0;
+      while (i < nslots && workers[i] && workers[i]->running)
+        i++;
+      if (i >= nslots)
+        {
+          Worker **newworkers = new Worker*[nslots + 1];
+          for (int j=0; j<nslots; j++)
+            newworkers[j] = workers[j];
+          delete [] workers;
+          workers = newworkers;
+          workers[nslots++] = 0;
+        }
+      delete workers[i];
+      workers[i] = new Worker;
+      workers[i]->pool = this;
+      workers[i]->running = 1;
+      if (workers[i]->thread.create(worker, (void*)workers[i]))
+        {
+          // Run with the threads we have
+          delete workers[i];
+          workers[i] = 0;
+          nthreads = nworkers + 1;
+          break;
+        }
+      nworkers += 1;
+    }
+  // Wake up workers that must terminate
+  monitor.broadcast();
+}
+
+int
+GThreadPool::get_threads(void) const
+{
+  GMonitorLock lock(&monitor);
+  return nthreads;
+}
+
+void
+GThreadPool::worker(void *arg)
+{
+  Worker *w = (Worker*)arg;
+  GThreadPool *pool = w->pool;
+  GMonitorLock lock(&pool->monitor);
+  for(;;)
+    {
+      if (pool->nworkers >= pool->nthreads)
+        {
+          // The slot may be reused as soon as the monitor is released
+          w->running = 0;
+          pool->nworkers -= 1;
+          pool->monitor.broadcast();
+          return;
+        }
+      if (! (pool->head && pool->execute(pool->head)))
+        pool->monitor.wait();
+    }
+}
+
+// Executes one unclaimed job of batch b.
+// The monitor must be held and is released while the job runs.
+bool
+GThreadPool::execute(Batch *b)
+{
+  if (b->next >= b->njobs)
+    return false;
+  int i = b->next++;
+  if (b->next >= b->njobs)
+    {
+      // Remove fully claimed batch from the queue
+      Batch *prev = 0;
+      for (Batch *p = head; p; prev=p, p=p->link)
+        if (p == b)
+          {
+            if (prev)
+              prev->link = b->link;
+            else
+              head = b->link;
+            if (tail == b)
+              tail = prev;
+            break;
+          }
+    }
+  monitor.leave();
+  GException error;
+  int failed = 0;
+  try
+    {
+      G_TRY
+        {
+          (b->job)(b->arg, i);
+        }
+      G_CATCH(ex)
+        {
+          error = ex;
+          failed = 1;
+        }
+      G_ENDCATCH;
+    }
+  catch(...)
+    {
+      error = GException(ERR_MSG("GThreads.unrecognized"));
+      failed = 1;
+    }
+  monitor.enter();
+  if (failed && !b->failed)
+    {
+      b->error = error;
+      b->failed = 1;
+    }
+  b->done += 1;
+  if (b->done >= b->njobs)
+    monitor.broadcast();
+  return true;
+}
+
+void
+GThreadPool::run(void (*job)(void*, int), void *arg, int njobs)
+{
+  if (njobs <= 1 || nthreads <= 1)
+    {
+      for (int i=0; i<njobs; i++)
+        (*job)(arg, i);
+      return;
+    }
+  Batch b;
+  b.job = job;
+  b.arg = arg;
+  b.njobs = njobs;
+  b.next = 0;
+  b.done = 0;
+  b.failed = 0;
+  b.link = 0;
+  GMonitorLock lock(&monitor);
+  if (tail)
+    tail->link = &b;
+  else
+    head = &b;
+  tail = &b;
+  monitor.broadcast();
+  // Execute unclaimed jobs and wait for the others
+  while (execute(&b))
+    continue;
+  while (b.done < b.njobs)
+    monitor.wait();
+  if (b.failed)
+    throw b.error;
+}
+
+static GMonitor &
+shared_monitor(void)
+{
+  static GMonitor monitor;
+  return monitor;
+}
+
+static GThreadPool *shared_pool = 0;
+static int shared_threads = -1;
+
+int
+GThreadPool::get_shared_threads(void)
+{
+  GMonitorLock lock(&shared_monitor());
+  if (shared_threads < 0)
+    {
+      const char *envvar = getenv("LIBDJVU_THREADS");
+      shared_threads = (envvar) ? atoi(envvar) : 1;
+      if (shared_threads < 1)
+        shared_threads = 1;
+    }
+  return shared_threads;
+}
+
+void
+GThreadPool::set_shared_threads(int n)
+{
+  GMonitorLock lock(&shared_monitor());
+  shared_threads = (n > 1) ? n : 1;
+  if (shared_pool)
+    shared_pool->set_threads(shared_threads);
+}
+
+GThreadPool *
+GThreadPool::get_shared(void)
+{
+  int n = get_shared_threads();
+  if (n < 2)
+    return 0;
+  GMonitorLock lock(&shared_monitor());
+  if (! shared_pool)
+    shared_pool = new GThreadPool(n);
+  return shared_pool;
+}
+
+
 #ifdef HAVE_NAMESPACES
 }
 # ifndef NOT_USING_DJVU_NAMESPACE
@@ -418,6 +418,76 @@ GSafeFlags::operator&=(long mask)
    return *this;
 }
 
+
+
+// ----------------------------------------
+// THREAD POOL
+
+/** Pool of worker threads.  Function \Ref{run} executes a batch of
+    independent jobs using the worker threads and the calling thread, and
+    returns when all the jobs are complete.  A job may itself call #run#:
+    the calling thread always executes the jobs of its batch that no worker
+    has claimed, so that nested batches cannot deadlock.  The first
+    exception thrown by a job is rethrown by #run# once all jobs of the batch
+    have returned.
+
+    Parallel processing is opt-in.  The shared pool returned by
+    \Ref{GThreadPool::get_shared} only exists when more than one thread has
+    been requested with \Ref{GThreadPool::set_shared_threads} or with the
+    environment variable #LIBDJVU_THREADS#.  Library code should use it as
+    follows and fall back to sequential code otherwise.
+    \begin{verbatim}
+      GThreadPool *pool = GThreadPool::get_shared();
+      if (pool) 
+        pool->run(job, (void*)&data, njobs);
+    \end{verbatim} */
+
+class DJVUAPI GThreadPool
+{
+public:
+  /** Constructs a pool running jobs with #nthreads# threads, including the
+      thread calling \Ref{run}. */
+  GThreadPool(int nthreads);
+  /** Destructor.  Waits until all worker threads are terminated.  No batch
+      must be running. */
+  ~GThreadPool();
+  /** Changes the number of threads.  Worker threads are created or
+      terminated as needed. */
+  void set_threads(int nthreads);
+  /** Returns the number of threads, including the calling thread. */
+  int get_threads(void) const;
+  /** Calls #job(arg,i)# for #i# ranging from 0 to #njobs-1# and returns when
+      all these calls have returned.  The calls may happen concurrently and
+      in any order. */
+  void run(void (*job)(void *arg, int i), void *arg, int njobs);
+  /** Returns the shared pool or a null pointer when parallel processing is
+      disabled.  The pool is created on demand with the number of threads
+      set by \Ref{set_shared_threads}, or with the value of environment
+      variable #LIBDJVU_THREADS#. */
+  static GThreadPool *get_shared(void);
+  /** Sets the number of threads of the shared pool.  Values smaller than
+      two disable parallel processing. */
+  static void set_shared_threads(int nthreads);
+  /** Returns the number of threads of the shared pool. */
+  static int get_shared_threads(void);
+private:
+  struct Batch;
+  struct Worker;
+  mutable GMonitor monitor;
+  Batch *head;
+  Batch *tail;
+  int nthreads;
+  int nworkers;
+  Worker **workers;
+  int nslots;
+  static void worker(void *arg);
+  bool execute(Batch *b);
+private:
+  // Disable default members
+  GThreadPool(const GThreadPool&);
+  GThreadPool& operator=(const GThreadPool&);
+};
+
 //@}
 
 
@@ -75,12 +75,14 @@
 #include "GPixmap.h"
 #include "IFFByteStream.h"
 #include "GRect.h"
+#include "GThreads.h"
 
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include "MMX.h"
+#include "IW44SIMD.h"
 #undef IWTRANSFORM_TIMER
 #ifdef IWTRANSFORM_TIMER
 #include "GOS.h"
@@ -252,11 +254,14 @@ class IW44Image::Codec::Encode : public IW44Image::Codec
 {
 public:
   Encode(IW44Image::Map &map);
+  class SliceLog;
   // Coding
   virtual int code_slice(ZPCodec &zp);
+  int code_slice(SliceLog &log);
   float estimate_decibel(float frac);
   // Data
-  void encode_buckets(ZPCodec &zp, int bit, int band,
+  template <class ZP> int encode_slice(ZP &zp);
+  template <class ZP> void encode_buckets(ZP &zp, int bit, int band,
     IW44Image::Block &blk, IW44Image::Block &eblk, int fbucket, int nbucket);
   int encode_prepare(int band, int fbucket, int nbucket, IW44Image::Block &blk, IW44Image::Block &eblk);
   IW44Image::Map emap;
@@ -265,29 +270,115 @@ public:
 IW44Image::Codec::Encode::Encode(IW44Image::Map &map)
 : Codec(map), emap(map.iw,map.ih) {}
 
-//////////////////////////////////////////////////////
-/** IW44Image::Transform::Encode
-*/
+// SliceLog records the symbols produced by one slice of one
+// plane instead of coding them.  This lets the three planes of an
+// IWPixmap prepare a slice concurrently while the symbols are still
+// coded serially, in the order of the sequential encoder.  Each
+// symbol takes a short holding its context number and its bit.
 
-class IW44Image::Transform::Encode : IW44Image::Transform
+class IW44Image::Codec::Encode::SliceLog
 {
- public:
- // WAVELET TRANSFORM
-  /** Forward transform. */
-  static void forward(short *p, int w, int h, int rowsize, int begin, int end);
-  
-  // COLOR TRANSFORM
-  /** Extracts Y */
-  static void RGB_to_Y(const GPixel *p, int w, int h, int rowsize, 
-                       signed char *out, int outrowsize);
-  /** Extracts Cb */
-  static void RGB_to_Cb(const GPixel *p, int w, int h, int rowsize, 
-                        signed char *out, int outrowsize);
-  /** Extracts Cr */
-  static void RGB_to_Cr(const GPixel *p, int w, int h, int rowsize, 
-                        signed char *out, int outrowsize);
+public:
+  SliceLog(void);
+  void init(IW44Image::Codec &codec);
+  void encoder(int bit, BitContext &ctx);
+  void IWencoder(const bool bit);
+  void replay(ZPCodec &zp);
+private:
+  enum { NCTX = 32+80+2, PASSTHRU = NCTX };
+  void put(int sym);
+  BitContext *ctx[NCTX];
+  size_t base;                  // address of the lowest context
+  int nindex;                   // span of the context addresses
+  short *index;                 // context number by address offset
+  GPBuffer<short> gindex;
+  unsigned short *syms;
+  GPBuffer<unsigned short> gsyms;
+  int nsyms;
+  int maxsyms;
 };
 
+IW44Image::Codec::Encode::SliceLog::SliceLog(void)
+  : base(0), nindex(0), gindex(index,0),
+    gsyms(syms,0), nsyms(0), maxsyms(0)
+{
+  for (int k=0; k<NCTX; k++)
+    ctx[k] = 0;
+}
+
+void
+IW44Image::Codec::Encode::SliceLog::init(IW44Image::Codec &codec)
+{
+  int k = 0;
+  for (int i=0; i<32; i++)
+    ctx[k++] = &codec.ctxStart[i];
+  for (int b=0; b<10; b++)
+    for (int i=0; i<8; i++)
+      ctx[k++] = &codec.ctxBucket[b][i];
+  ctx[k++] = &codec.ctxMant;
+  ctx[k++] = &codec.ctxRoot;
+  // The contexts live in separate arrays.  Their numbers are
+  // indexed by address offset, computed on integers.
+  size_t lo = (size_t)ctx[0];
+  size_t hi = lo;
+  for (k=1; k<NCTX; k++)
+    {
+      if ((size_t)ctx[k] < lo)
+        lo = (size_t)ctx[k];
+      if ((size_t)ctx[k] > hi)
+        hi = (size_t)ctx[k];
+    }
+  base = lo;
+  nindex = (int)(hi - lo) + 1;
+  gindex.resize(nindex);
+  for (int i=0; i<nindex; i++)
+    index[i] = -1;
+  for (k=0; k<NCTX; k++)
+    index[(size_t)ctx[k] - base] = (short)k;
+}
+
+inline void
+IW44Image::Codec::Encode::SliceLog::put(int sym)
+{
+  if (nsyms >= maxsyms)
+    {
+      maxsyms = (maxsyms < 4096) ? 4096 : 2*maxsyms;
+      gsyms.resize(maxsyms);
+    }
+  syms[nsyms++] = (unsigned short)sym;
+}
+
+inline void
+IW44Image::Codec::Encode::SliceLog::encoder(int bit, BitContext &c)
+{
+  const size_t offset = (size_t)&c - base;
+  const int k = (offset < (size_t)nindex) ? index[offset] : -1;
+  if (k < 0)
+    G_THROW("Internal error (unknown IW44 context)");
+  put((k<<1) | (bit ? 1 : 0));
+}
+
+inline void
+IW44Image::Codec::Encode::SliceLog::IWencoder(const bool bit)
+{
+  put((PASSTHRU<<1) | (bit ? 1 : 0));
+}
+
+void
+IW44Image::Codec::Encode::SliceLog::replay(ZPCodec &zp)
+{
+  for (int i=0; i<nsyms; i++)
+    {
+      int k = syms[i] >> 1;
+      if (k == PASSTHRU)
+        zp.IWencoder(syms[i] & 1);
+      else
+        zp.encoder(syms[i] & 1, *ctx[k]);
+    }
+  nsyms = 0;
+}
+
+
 
 //////////////////////////////////////////////////////
 // MMX IMPLEMENTATION HELPERS
@@ -395,6 +486,209 @@ mmx_fv_2 ( short* &q, short* e, int s, int s3 )
 
 #endif /* MMX */
 
+
+//////////////////////////////////////////////////////
+// SSE2/AVX2 IMPLEMENTATION HELPERS
+//////////////////////////////////////////////////////
+
+// Note:
+// These functions compute the same values as the scalar code,
+// using 32 bits intermediate values truncated to 16 bits.
+// The vertical filters are shared with the backward transform
+// and live in IW44SIMD.h.
+// The horizontal filter first computes the odd samples (delta)
+// from the untouched even samples, keeping their untruncated
+// values in a row of 32 bits integers padded with zeroes,
+// and then updates the even samples from this row.
+
+#ifdef MMX_SSE2
+
+static int
+sse2_fh_odd ( short *p, int *dt, int x, int w )
+{
+  const __m128i r8 = _mm_set1_epi32(8);
+  const __m128i lomask = _mm_set1_epi32(0xffff);
+  while (x+10 < w)
+    {
+      __m128i v = _mm_loadu_si128((const __m128i*)(p+x-1));
+      __m128i a = _mm_add_epi32(_mm_srai_epi32(_mm_slli_epi32(v, 16), 16),
+                                sse2_even(p+x+1));
+      __m128i b = _mm_add_epi32(sse2_even(p+x-3), sse2_even(p+x+3));
+      a = _mm_add_epi32(_mm_slli_epi32(a, 3), a);
+      a = _mm_srai_epi32(_mm_add_epi32(_mm_sub_epi32(a, b), r8), 4);
+      a = _mm_sub_epi32(_mm_srai_epi32(v, 16), a);
+      _mm_storeu_si128((__m128i*)(dt+(x>>1)), a);
+      v = _mm_or_si128(_mm_and_si128(lomask, v), _mm_slli_epi32(a, 16));
+      _mm_storeu_si128((__m128i*)(p+x-1), v);
+      x += 8;
+    }
+  return x;
+}
+
+static int
+sse2_fh_even ( short *p, const int *dt, int x, int w )
+{
+  const __m128i r16 = _mm_set1_epi32(16);
+  const __m128i lomask = _mm_set1_epi32(0xffff);
+  while (x+7 < w)
+    {
+      const int *t = dt + (x>>1);
+      __m128i v = _mm_loadu_si128((const __m128i*)(p+x));
+      __m128i a = _mm_add_epi32(_mm_loadu_si128((const __m128i*)(t-1)),
+                                _mm_loadu_si128((const __m128i*)(t)));
+      __m128i b = _mm_add_epi32(_mm_loadu_si128((const __m128i*)(t-2)),
+                                _mm_loadu_si128((const __m128i*)(t+1)));
+      a = _mm_add_epi32(_mm_slli_epi32(a, 3), a);
+      a = _mm_srai_epi32(_mm_add_epi32(_mm_sub_epi32(a, b), r16), 5);
+      a = _mm_add_epi32(_mm_srai_epi32(_mm_slli_epi32(v, 16), 16), a);
+      v = _mm_or_si128(_mm_andnot_si128(lomask, v), _mm_and_si128(lomask, a));
+      _mm_storeu_si128((__m128i*)(p+x), v);
+      x += 8;
+    }
+  return x;
+}
+
+#ifdef MMX_AVX2
+
+static MMX_AVX2_TARGET int
+avx2_fh_odd ( short *p, int *dt, int x, int w )
+{
+  const __m256i r8 = _mm256_set1_epi32(8);
+  const __m256i lomask = _mm256_set1_epi32(0xffff);
+  while (x+18 < w)
+    {
+      __m256i v = _mm256_loadu_si256((const __m256i*)(p+x-1));
+      __m256i a = _mm256_add_epi32(
+                  _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16),
+                  avx2_even(p+x+1));
+      __m256i b = _mm256_add_epi32(avx2_even(p+x-3), avx2_even(p+x+3));
+      a = _mm256_add_epi32(_mm256_slli_epi32(a, 3), a);
+      a = _mm256_srai_epi32(_mm256_add_epi32(_mm256_sub_epi32(a, b), r8), 4);
+      a = _mm256_sub_epi32(_mm256_srai_epi32(v, 16), a);
+      _mm256_storeu_si256((__m256i*)(dt+(x>>1)), a);
+      v = _mm256_or_si256(_mm256_and_si256(lomask, v), 
+                          _mm256_slli_epi32(a, 16));
+      _mm256_storeu_si256((__m256i*)(p+x-1), v);
+      x += 16;
+    }
+  return x;
+}
+
+static MMX_AVX2_TARGET int
+avx2_fh_even ( short *p, const int *dt, int x, int w )
+{
+  const __m256i r16 = _mm256_set1_epi32(16);
+  const __m256i lomask = _mm256_set1_epi32(0xffff);
+  while (x+15 < w)
+    {
+      const int *t = dt + (x>>1);
+      __m256i v = _mm256_loadu_si256((const __m256i*)(p+x));
+      __m256i a = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(t-1)),
+                                   _mm256_loadu_si256((const __m256i*)(t)));
+      __m256i b = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(t-2)),
+                                   _mm256_loadu_si256((const __m256i*)(t+1)));
+      a = _mm256_add_epi32(_mm256_slli_epi32(a, 3), a);
+      a = _mm256_srai_epi32(_mm256_add_epi32(_mm256_sub_epi32(a, b), r16), 5);
+      a = _mm256_add_epi32(_mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16), a);
+      v = _mm256_or_si256(_mm256_andnot_si256(lomask, v), 
+                          _mm256_and_si256(lomask, a));
+      _mm256_storeu_si256((__m256i*)(p+x), v);
+      x += 16;
+    }
+  return x;
+}
+
+#endif /* MMX_AVX2 */
+
+static void
+simd_fv_1 ( short* &q, short* e, int s, int s3 )
+{
+#ifdef MMX_AVX2
+  if (MMXControl::simdflag >= MMXControl::SIMD_AVX2)
+    avx2_vfilter(q, e, s, s3, 8, 4, -1);
+#endif
+  sse2_vfilter(q, e, s, s3, 8, 4, -1);
+}
+
+static void
+simd_fv_2 ( short* &q, short* e, int s, int s3 )
+{
+#ifdef MMX_AVX2
+  if (MMXControl::simdflag >= MMXControl::SIMD_AVX2)
+    avx2_vfilter(q, e, s, s3, 16, 5, +1);
+#endif
+  sse2_vfilter(q, e, s, s3, 16, 5, +1);
+}
+
+static void
+simd_fh_1(short *p, int w, int h, int rowsize)
+{
+  // Row of delta values with two zeroes on each side
+  int *buf;
+  GPBuffer<int> gbuf(buf, (w+1)/2+4);
+  memset(buf, 0, ((w+1)/2+4)*sizeof(int));
+  int *dt = buf + 2;
+  const bool avx2 = (MMXControl::simdflag >= MMXControl::SIMD_AVX2);
+  for (int y=0; y<h; y++, p+=rowsize)
+    {
+      // 1-Delta (odd samples)
+      int x = 1;
+      int a2 = p[0];
+      int a3 = (x+3<w) ? p[x+3] : p[0];
+      if (x < w)
+        {
+          // Special case: x=1
+          a2 = (x+1<w) ? p[x+1] : p[0];
+          dt[0] = p[1] - ((p[0]+a2+1)>>1);
+          p[1] = dt[0];
+          x += 2;
+        }
+      if (x+3 < w)
+        {
+          // Generic case
+#ifdef MMX_AVX2
+          if (avx2)
+            x = avx2_fh_odd(p, dt, x, w);
+#endif
+          x = sse2_fh_odd(p, dt, x, w);
+          while (x+3 < w)
+            {
+              int a = p[x-1] + p[x+1];
+              int v = p[x] - ((((a<<3)+a-p[x-3]-p[x+3]+8)>>4));
+              dt[x>>1] = v;
+              p[x] = v;
+              x += 2;
+            }
+          a2 = p[x-1];
+          a3 = p[x+1];
+        }
+      while (x < w)
+        {
+          // Special case: w-3 <= x < w (reuses stale values)
+          int a1 = a2;
+          a2 = a3;
+          dt[x>>1] = p[x] - ((a1+a2+1)>>1);
+          p[x] = dt[x>>1];
+          x += 2;
+        }
+      // 2-Update (even samples)
+      x = 0;
+#ifdef MMX_AVX2
+      if (avx2)
+        x = avx2_fh_even(p, dt, x, w);
+#endif
+      x = sse2_fh_even(p, dt, x, w);
+      for (; x<w; x+=2)
+        {
+          const int *t = dt + (x>>1);
+          int b = t[-1] + t[0];
+          p[x] += ((((b<<3)+b-t[-2]-t[1]+16)>>5));
+        }
+    }
+}
+
+#endif /* MMX_SSE2 */
+
 //////////////////////////////////////////////////////
 // NEW FILTERS
 //////////////////////////////////////////////////////
@@ -417,8 +711,12 @@ filter_fv(short *p, int w, int h, int rowsize, int scale)
         if (y>=3 && y+3<h)
           {
             // Generic case
+#ifdef MMX_SSE2
+            if (scale==1 && MMXControl::simdflag>0)
+              simd_fv_1(q, e, s, s3);
+#endif
 #ifdef MMX
-            if (scale==1 && MMXControl::mmxflag>0)
+            if (scale==1 && MMXControl::mmxflag>0 && MMXControl::simdflag<=0)
               mmx_fv_1(q, e, s, s3);
 #endif
             while (q<e)
@@ -449,8 +747,12 @@ filter_fv(short *p, int w, int h, int rowsize, int scale)
         if (y>=6 && y<h)
           {
             // Generic case
+#ifdef MMX_SSE2
+            if (scale==1 && MMXControl::simdflag>0)
+              simd_fv_2(q, e, s, s3);
+#endif
 #ifdef MMX
-            if (scale==1 && MMXControl::mmxflag>0)
+            if (scale==1 && MMXControl::mmxflag>0 && MMXControl::simdflag<=0)
               mmx_fv_2(q, e, s, s3);
 #endif
             while (q<e)
@@ -512,6 +814,13 @@ filter_fv(short *p, int w, int h, int rowsize, int scale)
 static void 
 filter_fh(short *p, int w, int h, int rowsize, int scale)
 {
+#ifdef MMX_SSE2
+  if (scale==1 && w>=8 && MMXControl::simdflag>0)
+    {
+      simd_fh_1(p, w, h, rowsize);
+      return;
+    }
+#endif
   int y = 0;
   int s = scale;
   int s3 = s+s+s;
@@ -1073,8 +1382,8 @@ IW44Image::Codec::Encode::encode_prepare(int band, int fbucket, int nbucket, IW4
 
 // encode_buckets
 // -- code a sequence of buckets in a given block
-void
-IW44Image::Codec::Encode::encode_buckets(ZPCodec &zp, int bit, int band, 
+template <class ZP> void
+IW44Image::Codec::Encode::encode_buckets(ZP &zp, int bit, int band, 
                          IW44Image::Block &blk, IW44Image::Block &eblk,
                          int fbucket, int nbucket)
 {
@@ -1464,6 +1773,7 @@ IWBitmap::Encode::close_codec(void)
 int  
 IWBitmap::Encode::encode_chunk(GP<ByteStream> gbs, const IWEncoderParms &parm)
 {
+  flush_cache();
   // Check
   if (parm.slices==0 && parm.bytes==0 && parm.decibels==0)
     G_THROW( ERR_MSG("IW44Image.need_stop") );
@@ -1493,7 +1803,7 @@ IWBitmap::Encode::encode_chunk(GP<ByteStream> gbs, const IWEncoderParms &parm)
       {
         if (parm.decibels>0  && estdb>=parm.decibels)
           break;
-        if (parm.bytes>0  && mbs.tell()+cbytes>=parm.bytes)
+        if (parm.bytes>0  && mbs.tell()+zp.pending()+cbytes>=parm.bytes)
           break;
         if (parm.slices>0 && nslices+cslice>=parm.slices)
           break;
@@ -1564,6 +1874,87 @@ IW44Image::create_encode(
   return retval;
 }
 
+// Fills the Y, Cb and Cr maps of an IWPixmap, concurrently when
+// the shared thread pool is enabled.
+struct EncodePlaneJobs
+{
+  const GPixmap *pm;
+  IW44Image::Map::Encode *map[3];
+  const signed char *msk8;
+  int mskrowsize;
+  int gray;                     // luminance is inverted for gray images
+  int half;                     // chrominance is coded at half resolution
+};
+
+static void
+encode_plane_job(void *arg, int i)
+{
+  EncodePlaneJobs *pj = (EncodePlaneJobs*)arg;
+  const GPixmap &pm = *pj->pm;
+  int w = pm.columns();
+  int h = pm.rows();
+  signed char *buffer;
+  GPBuffer<signed char> gbuffer(buffer,w*h);
+  if (i == 0)
+    {
+      IW44Image::Transform::Encode::RGB_to_Y(pm[0], w, h, pm.rowsize(), buffer, w);
+      if (pj->gray)
+        {
+          // Stupid inversion for gray images
+          signed char *e = buffer + w*h;
+          for (signed char *b=buffer; b<e; b++)
+            *b = 255 - *b;
+        }
+    }
+  else if (i == 1)
+    IW44Image::Transform::Encode::RGB_to_Cb(pm[0], w, h, pm.rowsize(), buffer, w);
+  else
+    IW44Image::Transform::Encode::RGB_to_Cr(pm[0], w, h, pm.rowsize(), buffer, w);
+  pj->map[i]->create(buffer, w, pj->msk8, pj->mskrowsize);
+  // Perform chrominance reduction (CRCBhalf)
+  if (i > 0 && pj->half)
+    pj->map[i]->slashres(2);
+}
+
+static void
+encode_plane_jobs(EncodePlaneJobs &pj, int nplanes)
+{
+#ifndef NEED_DJVU_PROGRESS
+  GThreadPool *pool = GThreadPool::get_shared();
+  if (pool)
+    {
+      pool->run(encode_plane_job, (void*)&pj, nplanes);
+      return;
+    }
+#endif
+  for (int i=0; i<nplanes; i++)
+    encode_plane_job((void*)&pj, i);
+}
+
+// Codes one slice of each plane of an IWPixmap.  The planes record
+// their symbols concurrently into slice logs which are then coded
+// in the Y, Cb, Cr order of the sequential encoder.
+struct EncodeSliceJobs
+{
+  IW44Image::Codec::Encode *codec[3];
+  IW44Image::Codec::Encode::SliceLog *log[3];
+  int flag[3];
+  float decibels;               // decibel target, or zero
+  float frac;                   // fraction of blocks for the estimate
+  float estdb;                  // luminance quality estimate
+};
+
+static void
+encode_slice_job(void *arg, int i)
+{
+  EncodeSliceJobs *sj = (EncodeSliceJobs*)arg;
+  IW44Image::Codec::Encode *codec = sj->codec[i];
+  sj->flag[i] = codec->code_slice(*sj->log[i]);
+  if (i == 0 && sj->flag[0] && sj->decibels>0)
+    if (codec->curband==0 || sj->estdb>=sj->decibels-DECIBEL_PRUNE)
+      sj->estdb = codec->estimate_decibel(sj->frac);
+}
+
 IWPixmap::Encode::Encode(void)
 : IWPixmap(), ycodec_enc(0), cbcodec_enc(0), crcodec_enc(0)
 {}
@@ -1585,8 +1976,6 @@ IWPixmap::Encode::init(const GPixmap &pm, const GP<GBitmap> gmask, CRCBMode crcb
   /* Create */
   int w = pm.columns();
   int h = pm.rows();
-  signed char *buffer;
-  GPBuffer<signed char> gbuffer(buffer,w*h);
   // Create maps
   Map::Encode *eymap = new Map::Encode(w,h);
   ymap = eymap;
@@ -1599,49 +1988,31 @@ IWPixmap::Encode::init(const GPixmap &pm, const GP<GBitmap> gmask, CRCBMode crcb
     case CRCBfull:   crcb_half=0; crcb_delay= 0; break;
     }
   // Prepare mask information
-  const signed char *msk8 = 0;
-  int mskrowsize = 0;
+  EncodePlaneJobs pj;
+  pj.pm = &pm;
+  pj.map[0] = eymap;
+  pj.map[1] = pj.map[2] = 0;
+  pj.msk8 = 0;
+  pj.mskrowsize = 0;
+  pj.gray = (crcb_delay < 0);
+  pj.half = crcb_half;
   GBitmap *mask=gmask;
   if (mask)
   {
-    msk8 = (signed char const *)((*mask)[0]);
-    mskrowsize = mask->rowsize();
+    pj.msk8 = (signed char const *)((*mask)[0]);
+    pj.mskrowsize = mask->rowsize();
   }
-  // Fill buffer with luminance information
-  DJVU_PROGRESS_TASK(create,"initialize pixmap",3);
-  DJVU_PROGRESS_RUN(create,(crcb_delay>=0 ? 1 : 3));
-  Transform::Encode::RGB_to_Y(pm[0], w, h, pm.rowsize(), buffer, w);
-  if (crcb_delay < 0)
-    {
-      // Stupid inversion for gray images
-      signed char *e = buffer + w*h;
-      for (signed char *b=buffer; b<e; b++)
-        *b = 255 - *b;
-    }
-  // Create YMAP
-  eymap->create(buffer, w, msk8, mskrowsize);
   // Create chrominance maps
   if (crcb_delay >= 0)
     {
-      Map::Encode *ecbmap = new Map::Encode(w,h);
-      cbmap = ecbmap;
-      Map::Encode *ecrmap = new Map::Encode(w,h);
-      crmap = ecrmap;
-      // Process CB information
-      DJVU_PROGRESS_RUN(create,2);
-      Transform::Encode::RGB_to_Cb(pm[0], w, h, pm.rowsize(), buffer, w);
-      ecbmap->create(buffer, w, msk8, mskrowsize);
-      // Process CR information
-      DJVU_PROGRESS_RUN(create,3);
-      Transform::Encode::RGB_to_Cr(pm[0], w, h, pm.rowsize(), buffer, w); 
-      ecrmap->create(buffer, w, msk8, mskrowsize);
-      // Perform chrominance reduction (CRCBhalf)
-      if (crcb_half)
-        {
-          ecbmap->slashres(2);
-          ecrmap->slashres(2);
-        }
+      cbmap = pj.map[1] = new Map::Encode(w,h);
+      crmap = pj.map[2] = new Map::Encode(w,h);
     }
+  // Process Y, CB and CR information
+  DJVU_PROGRESS_TASK(create,"initialize pixmap",3);
+  DJVU_PROGRESS_RUN(create,(crcb_delay>=0 ? 1 : 3));
+  encode_plane_jobs(pj, (crcb_delay>=0) ? 3 : 1);
+  DJVU_PROGRESS_RUN(create,3);
 }
 
 void 
@@ -1676,6 +2047,7 @@ IWPixmap::Encode::close_codec(void)
 int  
 IWPixmap::Encode::encode_chunk(GP<ByteStream> gbs, const IWEncoderParms &parm)
 {
+  flush_cache();
   // Check
   if (parm.slices==0 && parm.bytes==0 && parm.decibels==0)
     G_THROW( ERR_MSG("IW44Image.need_stop2") );
@@ -1707,15 +2079,47 @@ IWPixmap::Encode::encode_chunk(GP<ByteStream> gbs, const IWEncoderParms &parm)
     float estdb = -1.0;
     GP<ZPCodec> gzp=ZPCodec::create(gmbs, true, true);
     ZPCodec &zp=*gzp;
+    // Prepare concurrent slice coding
+    GThreadPool *pool = 0;
+    EncodeSliceJobs sj;
+    Codec::Encode::SliceLog log[3];
+#ifndef NEED_DJVU_PROGRESS
+    if (crcodec_enc && cbcodec_enc)
+      pool = GThreadPool::get_shared();
+#endif
+    if (pool)
+      {
+        sj.codec[0] = ycodec_enc;
+        sj.codec[1] = cbcodec_enc;
+        sj.codec[2] = crcodec_enc;
+        for (int i=0; i<3; i++)
+          {
+            log[i].init(*sj.codec[i]);
+            sj.log[i] = &log[i];
+          }
+        sj.decibels = parm.decibels;
+        sj.frac = db_frac;
+      }
     while (flag)
       {
         if (parm.decibels>0  && estdb>=parm.decibels)
           break;
-        if (parm.bytes>0  && mbs.tell()+cbytes>=parm.bytes)
+        if (parm.bytes>0  && mbs.tell()+zp.pending()+cbytes>=parm.bytes)
           break;
         if (parm.slices>0 && nslices+cslice>=parm.slices)
           break;
         DJVU_PROGRESS_RUN(chunk,(1+nslices-cslice)|0xf);
+        if (pool && crcodec_enc && cbcodec_enc && cslice+nslices>=crcb_delay)
+          {
+            sj.estdb = estdb;
+            pool->run(encode_slice_job, (void*)&sj, 3);
+            for (int i=0; i<3; i++)
+              sj.log[i]->replay(zp);
+            flag = sj.flag[0] | sj.flag[1] | sj.flag[2];
+            estdb = sj.estdb;
+            nslices++;
+            continue;
+          }
         flag = ycodec_enc->code_slice(zp);
         if (flag && parm.decibels>0)
           if (ycodec_enc->curband==0 || estdb>=parm.decibels-DECIBEL_PRUNE)
@@ -1761,11 +2165,11 @@ IWPixmap::Encode::encode_chunk(GP<ByteStream> gbs, const IWEncoderParms &parm)
   return flag;
 }
 
-// code_slice
-// -- read/write a slice of datafile
+// encode_slice
+// -- code a slice into a ZPCodec or into a SliceLog
 
-int
-IW44Image::Codec::Encode::code_slice(ZPCodec &zp)
+template <class ZP> int
+IW44Image::Codec::Encode::encode_slice(ZP &zp)
 {
   // Check that code_slice can still run
   if (curbit < 0)
@@ -1782,7 +2186,19 @@ IW44Image::Codec::Encode::code_slice(ZPCodec &zp)
                          fbucket, nbucket);
         }
     }
-  return finish_code_slice(zp);
+  return finish_code_slice();
+}
+
+int
+IW44Image::Codec::Encode::code_slice(ZPCodec &zp)
+{
+  return encode_slice(zp);
+}
+
+int
+IW44Image::Codec::Encode::code_slice(SliceLog &log)
+{
+  return encode_slice(log);
 }
 
 
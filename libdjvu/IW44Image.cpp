@@ -75,12 +75,14 @@
 #include "GPixmap.h"
 #include "IFFByteStream.h"
 #include "GRect.h"
+#include "GThreads.h"
 
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include "MMX.h"
+#include "IW44SIMD.h"
 #undef IWTRANSFORM_TIMER
 #ifdef IWTRANSFORM_TIMER
 #include "GOS.h"
@@ -129,15 +131,6 @@ static const int iw_border = 3;
 static const int iw_shift  = 6;
 static const int iw_round  = (1<<(iw_shift-1));
 
-class IW44Image::Codec::Decode : public IW44Image::Codec 
-{
-public:
-  // Construction
-  Decode(IW44Image::Map &map) : Codec(map) {}
-  // Coding
-  virtual int code_slice(ZPCodec &zp);
-};
-
 //////////////////////////////////////////////////////
 // MMX IMPLEMENTATION HELPERS
 //////////////////////////////////////////////////////
@@ -243,6 +236,203 @@ mmx_bv_2 ( short* &q, short* e, int s, int s3 )
 }
 #endif /* MMX */
 
+
+//////////////////////////////////////////////////////
+// SSE2/AVX2 IMPLEMENTATION HELPERS
+//////////////////////////////////////////////////////
+
+// Note:
+// These functions compute the same values as the scalar code.
+// Intermediate values are computed with 32 bits integers and
+// truncated to 16 bits like the scalar assignments.
+// The vertical filters are shared with the forward transform
+// and live in IW44SIMD.h.  The horizontal filter processes even samples (lifting) and
+// then odd samples (interpolation) using a row of 32 bits
+// integers holding the untruncated lifted values.  Rows shorter
+// than 8 samples must be processed by the scalar code whose
+// boundary cases reuse stale values.
+
+#ifdef MMX_SSE2
+
+static int
+sse2_bh_even ( short *p, int *bt, int x, int w )
+{
+  const __m128i r16 = _mm_set1_epi32(16);
+  const __m128i lomask = _mm_set1_epi32(0xffff);
+  while (x+9 < w)
+    {
+      __m128i v = _mm_loadu_si128((const __m128i*)(p+x));
+      __m128i e = _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+      __m128i a = _mm_add_epi32(_mm_srai_epi32(v, 16),
+                  _mm_srai_epi32(_mm_loadu_si128((const __m128i*)(p+x-2)), 16));
+      __m128i b = _mm_add_epi32(
+                  _mm_srai_epi32(_mm_loadu_si128((const __m128i*)(p+x-4)), 16),
+                  _mm_srai_epi32(_mm_loadu_si128((const __m128i*)(p+x+2)), 16));
+      a = _mm_add_epi32(_mm_slli_epi32(a, 3), a);
+      a = _mm_srai_epi32(_mm_add_epi32(_mm_sub_epi32(a, b), r16), 5);
+      e = _mm_sub_epi32(e, a);
+      _mm_storeu_si128((__m128i*)(bt+(x>>1)), e);
+      v = _mm_or_si128(_mm_andnot_si128(lomask, v), _mm_and_si128(lomask, e));
+      _mm_storeu_si128((__m128i*)(p+x), v);
+      x += 8;
+    }
+  return x;
+}
+
+static int
+sse2_bh_odd ( short *p, int *bt, int x, int w )
+{
+  const __m128i r8 = _mm_set1_epi32(8);
+  const __m128i lomask = _mm_set1_epi32(0xffff);
+  while (x+9 < w)
+    {
+      const int *t = bt + (x>>1);
+      __m128i v = _mm_loadu_si128((const __m128i*)(p+x-1));
+      __m128i a = _mm_add_epi32(_mm_loadu_si128((const __m128i*)(t)),
+                                _mm_loadu_si128((const __m128i*)(t+1)));
+      __m128i b = _mm_add_epi32(_mm_loadu_si128((const __m128i*)(t-1)),
+                                _mm_loadu_si128((const __m128i*)(t+2)));
+      a = _mm_add_epi32(_mm_slli_epi32(a, 3), a);
+      a = _mm_srai_epi32(_mm_add_epi32(_mm_sub_epi32(a, b), r8), 4);
+      a = _mm_add_epi32(_mm_srai_epi32(v, 16), a);
+      v = _mm_or_si128(_mm_and_si128(lomask, v), _mm_slli_epi32(a, 16));
+      _mm_storeu_si128((__m128i*)(p+x-1), v);
+      x += 8;
+    }
+  return x;
+}
+
+#ifdef MMX_AVX2
+
+static MMX_AVX2_TARGET int
+avx2_bh_even ( short *p, int *bt, int x, int w )
+{
+  const __m256i r16 = _mm256_set1_epi32(16);
+  const __m256i lomask = _mm256_set1_epi32(0xffff);
+  while (x+17 < w)
+    {
+      __m256i v = _mm256_loadu_si256((const __m256i*)(p+x));
+      __m256i e = _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16);
+      __m256i a = _mm256_add_epi32(_mm256_srai_epi32(v, 16),
+         _mm256_srai_epi32(_mm256_loadu_si256((const __m256i*)(p+x-2)), 16));
+      __m256i b = _mm256_add_epi32(
+         _mm256_srai_epi32(_mm256_loadu_si256((const __m256i*)(p+x-4)), 16),
+         _mm256_srai_epi32(_mm256_loadu_si256((const __m256i*)(p+x+2)), 16));
+      a = _mm256_add_epi32(_mm256_slli_epi32(a, 3), a);
+      a = _mm256_srai_epi32(_mm256_add_epi32(_mm256_sub_epi32(a, b), r16), 5);
+      e = _mm256_sub_epi32(e, a);
+      _mm256_storeu_si256((__m256i*)(bt+(x>>1)), e);
+      v = _mm256_or_si256(_mm256_andnot_si256(lomask, v), 
+                          _mm256_and_si256(lomask, e));
+      _mm256_storeu_si256((__m256i*)(p+x), v);
+      x += 16;
+    }
+  return x;
+}
+
+static MMX_AVX2_TARGET int
+avx2_bh_odd ( short *p, int *bt, int x, int w )
+{
+  const __m256i r8 = _mm256_set1_epi32(8);
+  const __m256i lomask = _mm256_set1_epi32(0xffff);
+  while (x+17 < w)
+    {
+      const int *t = bt + (x>>1);
+      __m256i v = _mm256_loadu_si256((const __m256i*)(p+x-1));
+      __m256i a = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(t)),
+                                   _mm256_loadu_si256((const __m256i*)(t+1)));
+      __m256i b = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(t-1)),
+                                   _mm256_loadu_si256((const __m256i*)(t+2)));
+      a = _mm256_add_epi32(_mm256_slli_epi32(a, 3), a);
+      a = _mm256_srai_epi32(_mm256_add_epi32(_mm256_sub_epi32(a, b), r8), 4);
+      a = _mm256_add_epi32(_mm256_srai_epi32(v, 16), a);
+      v = _mm256_or_si256(_mm256_and_si256(lomask, v), 
+                          _mm256_slli_epi32(a, 16));
+      _mm256_storeu_si256((__m256i*)(p+x-1), v);
+      x += 16;
+    }
+  return x;
+}
+
+#endif /* MMX_AVX2 */
+
+static void
+simd_bv_1 ( short* &q, short* e, int s, int s3 )
+{
+#ifdef MMX_AVX2
+  if (MMXControl::simdflag >= MMXControl::SIMD_AVX2)
+    avx2_vfilter(q, e, s, s3, 16, 5, -1);
+#endif
+  sse2_vfilter(q, e, s, s3, 16, 5, -1);
+}
+
+static void
+simd_bv_2 ( short* &q, short* e, int s, int s3 )
+{
+#ifdef MMX_AVX2
+  if (MMXControl::simdflag >= MMXControl::SIMD_AVX2)
+    avx2_vfilter(q, e, s, s3, 8, 4, +1);
+#endif
+  sse2_vfilter(q, e, s, s3, 8, 4, +1);
+}
+
+static void
+simd_bh_1(short *p, int w, int h, int rowsize)
+{
+  int *bt;
+  GPBuffer<int> gbt(bt, (w+1)/2);
+  const bool avx2 = (MMXControl::simdflag >= MMXControl::SIMD_AVX2);
+  for (int y=0; y<h; y++, p+=rowsize)
+    {
+      // 1-Lifting (even samples)
+      int x = 0;
+      while (x < w)
+        {
+          if (x >= 4)
+            {
+#ifdef MMX_AVX2
+              if (avx2)
+                x = avx2_bh_even(p, bt, x, w);
+#endif
+              x = sse2_bh_even(p, bt, x, w);
+              if (x >= w)
+                break;
+            }
+          int a = (x>=1 ? p[x-1] : 0) + (x+1<w ? p[x+1] : 0);
+          int b = (x>=3 ? p[x-3] : 0) + (x+3<w ? p[x+3] : 0);
+          int v = p[x] - ((((a<<3)+a-b+16)>>5));
+          bt[x>>1] = v;
+          p[x] = v;
+          x += 2;
+        }
+      // 2-Interpolation (odd samples)
+      x = 1;
+      while (x < w)
+        {
+          if (x >= 3)
+            {
+#ifdef MMX_AVX2
+              if (avx2)
+                x = avx2_bh_odd(p, bt, x, w);
+#endif
+              x = sse2_bh_odd(p, bt, x, w);
+              if (x >= w)
+                break;
+            }
+          int b1 = bt[(x-1)>>1];
+          int b2 = (x+1<w) ? bt[(x+1)>>1] : b1;
+          if (x>=3 && x+3<w)
+            p[x] += ((((b1+b2)<<3)+(b1+b2)-bt[(x-3)>>1]-bt[(x+3)>>1]+8)>>4);
+          else
+            p[x] += ((b1+b2+1)>>1);
+          x += 2;
+        }
+    }
+}
+
+#endif /* MMX_SSE2 */
+
+
 static void 
 filter_bv(short *p, int w, int h, int rowsize, int scale)
 {
@@ -259,8 +449,12 @@ filter_bv(short *p, int w, int h, int rowsize, int scale)
         if (y>=3 && y+3<h)
           {
             // Generic case
+#ifdef MMX_SSE2
+            if (scale==1 && MMXControl::simdflag>0)
+              simd_bv_1(q, e, s, s3);
+#endif
 #ifdef MMX
-            if (scale==1 && MMXControl::mmxflag>0)
+            if (scale==1 && MMXControl::mmxflag>0 && MMXControl::simdflag<=0)
               mmx_bv_1(q, e, s, s3);
 #endif
             while (q<e)
@@ -321,8 +515,12 @@ filter_bv(short *p, int w, int h, int rowsize, int scale)
         if (y>=6 && y<h)
           {
             // Generic case
+#ifdef MMX_SSE2
+            if (scale==1 && MMXControl::simdflag>0)
+              simd_bv_2(q, e, s, s3);
+#endif
 #ifdef MMX
-            if (scale==1 && MMXControl::mmxflag>0)
+            if (scale==1 && MMXControl::mmxflag>0 && MMXControl::simdflag<=0)
               mmx_bv_2(q, e, s, s3);
 #endif
             while (q<e)
@@ -354,6 +552,13 @@ filter_bv(short *p, int w, int h, int rowsize, int scale)
 static void 
 filter_bh(short *p, int w, int h, int rowsize, int scale)
 {
+#ifdef MMX_SSE2
+  if (scale==1 && w>=8 && MMXControl::simdflag>0)
+    {
+      simd_bh_1(p, w, h, rowsize);
+      return;
+    }
+#endif
   int y = 0;
   int s = scale;
   int s3 = s+s+s;
@@ -538,10 +743,16 @@ static int zigzagloc[1024] = {
 struct IW44Image::Alloc // DJVU_CLASS
 {
   Alloc *next;
-  short data[IWALLOCSIZE];
-  Alloc(Alloc *n);
+  int size;
+  int top;
+  char *data;
+  Alloc(Alloc *n, int size);
+  ~Alloc();
 };
 
+// Size of a packed bucket: sixteen bytes and a shift.
+#define IWPACKSIZE  17
+
 //---------------------------------------------------------------
 // *** Class IW44Image::Block [implementation]
 
@@ -549,6 +760,7 @@ struct IW44Image::Alloc // DJVU_CLASS
 IW44Image::Block::Block(void)
 {
   pdata[0] = pdata[1] = pdata[2] = pdata[3] = 0;
+  packed[0] = packed[1] = packed[2] = packed[3] = 0;
 }
 
 void 
@@ -556,6 +768,19 @@ IW44Image::Block::zero(int n)
 {
   if (pdata[n>>4])
     pdata[n>>4][n&15] = 0;
+  packed[n>>4] &= ~(1<<(n&15));
+}
+
+short *
+IW44Image::Block::unpack(int n, IW44Image::Map *map)
+{
+  const signed char *b = (const signed char*)pdata[n>>4][n&15];
+  short *d = map->alloc(16);
+  for (int n2=0; n2<16; n2++)
+    d[n2] = (short)(b[n2] * (1 << b[16]));
+  packed[n>>4] &= ~(1<<(n&15));
+  pdata[n>>4][n&15] = d;
+  return d;
 }
 
 void  
@@ -580,6 +805,13 @@ IW44Image::Block::write_liftblock(short *coeff, int bmin, int bmax) const
       const short *d = data(n1);
       if (d == 0)
         n += 16;
+      else if (is_packed(n1))
+        {
+          const signed char *b = (const signed char*)d;
+          const int scale = 1 << b[16];
+          for (int n2=0; n2<16; n2++,n++)
+            coeff[zigzagloc[n]] = (short)(b[n2] * scale);
+        }
       else
         for (int n2=0; n2<16; n2++,n++)
           coeff[zigzagloc[n]] = d[n2];
@@ -591,16 +823,18 @@ IW44Image::Block::write_liftblock(short *coeff, int bmin, int bmax) const
 
 
 IW44Image::Map::Map(int w, int h)
-  :  blocks(0), iw(w), ih(h), chain(0)
+  :  blocks(0), iw(w), ih(h), npacked(0)
 {
   bw = (w+0x20-1) & ~0x1f;
   bh = (h+0x20-1) & ~0x1f;
   nb = (unsigned int)(bw*bh) / (32 * 32);
   blocks = new IW44Image::Block[nb];
-  top = IWALLOCSIZE;
+  for (int i=0; i<NSLABS; i++)
+    chain[i] = 0;
 }
 
-IW44Image::Map::~Map()
+static void
+free_slabs(IW44Image::Alloc *chain)
 {
   while (chain)
     {
@@ -608,42 +842,184 @@ IW44Image::Map::~Map()
       delete chain;
       chain = next;
     }
+}
+
+IW44Image::Map::~Map()
+{
+  for (int i=0; i<NSLABS; i++)
+    free_slabs(chain[i]);
   delete [] blocks;
 }
 
 
-IW44Image::Alloc::Alloc(Alloc *n)
-  : next(n) 
+IW44Image::Alloc::Alloc(Alloc *n, int sz)
+  : next(n), size(sz), top(0)
 { 
-  // see note in IW44Image::Map::alloc
-  memset(data, 0, sizeof(data)); 
+  data = new char[size];
+  // see note in IW44Image::Map::slab_alloc
+  memset(data, 0, size); 
 }
 
-short *
-IW44Image::Map::alloc(int n)
+IW44Image::Alloc::~Alloc()
 {
-  if (top+n > IWALLOCSIZE)
+  delete [] data;
+}
+
+void *
+IW44Image::Map::slab_alloc(int slab, int size)
+{
+  IW44Image::Alloc *a = chain[slab];
+  if (!a || a->top+size > a->size)
     {
       // note: everything is cleared long before we use it
       // in order to avoid the need for a memory fence.
-      chain = new IW44Image::Alloc(chain);
-      top = 0;
+      int units = (IWALLOCSIZE * sizeof(short)) / size;
+      a = chain[slab] = new IW44Image::Alloc(a, units * size);
     }
-  short *ans = chain->data + top;
-  top += n;
+  void *ans = a->data + a->top;
+  a->top += size;
   return ans;
 }
 
+short *
+IW44Image::Map::alloc(int n)
+{
+  return (short*)slab_alloc(BUCKETS, n * sizeof(short));
+}
+
 short **
 IW44Image::Map::allocp(int n)
 {
-  // Allocate enough room for pointers plus alignment
-  short *p = alloc( (n+1) * sizeof(short*) / sizeof(short) );
-  // Align on pointer size
-  while ( ((size_t)p) & (sizeof(short*)-1) )
-    p += 1;
-  // Cast and return
-  return (short**)p;
+  // Tables have their own slabs and stay aligned.
+  return (short**)slab_alloc(TABLES, n * sizeof(short*));
+}
+
+// Returns the shift that packs bucket #d# on eight bits,
+// -1 if the bucket cannot be packed, 16 if the bucket is empty.
+static int
+pack_shift(const short *d)
+{
+  int bits = 0;
+  for (int i=0; i<16; i++)
+    bits |= d[i];
+  if (! bits)
+    return 16;
+  int shift = 0;
+  while (! (bits & (1<<shift)))
+    shift += 1;
+  for (int i=0; i<16; i++)
+    {
+      int q = d[i] >> shift;
+      if (q < -128 || q > 127)
+        return -1;
+    }
+  return shift;
+}
+
+void
+IW44Image::Map::compact(int pack)
+{
+  // First pass counts the units, second pass moves them
+  // into slabs that are exactly large enough.
+  IW44Image::Alloc *old[NSLABS];
+  int count[NSLABS];
+  for (int i=0; i<NSLABS; i++)
+    count[i] = 0;
+  for (int pass=0; pass<2; pass++)
+    {
+      if (pass)
+        {
+          static const int unit[NSLABS] = 
+            { 16*sizeof(short), 16*sizeof(short*), IWPACKSIZE };
+          for (int i=0; i<NSLABS; i++)
+            {
+              old[i] = chain[i];
+              chain[i] = 0;
+              if (count[i] > 0)
+                chain[i] = new IW44Image::Alloc(0, count[i] * unit[i]);
+            }
+        }
+      for (int blockno=0; blockno<nb; blockno++)
+        {
+          IW44Image::Block &blk = blocks[blockno];
+          for (int n1=0; n1<4; n1++)
+            {
+              short **table = blk.pdata[n1];
+              if (! table)
+                continue;
+              short **ntable = 0;
+              unsigned short npacked = 0;
+              for (int n2=0; n2<16; n2++)
+                {
+                  short *d = table[n2];
+                  if (! d)
+                    continue;
+                  int kept = blk.packed[n1] & (1<<n2);
+                  int shift = (kept) ? 0 : pack_shift(d);
+                  if (shift == 16)
+                    continue;
+                  int packit = kept || (pack && shift >= 0);
+                  if (! pass)
+                    {
+                      count[(packit) ? PACKED : BUCKETS] += 1;
+                      if (! ntable)
+                        count[TABLES] += 1;
+                      ntable = table;
+                      continue;
+                    }
+                  if (! ntable)
+                    ntable = allocp(16);
+                  if (! packit)
+                    {
+                      short *nd = alloc(16);
+                      memcpy(nd, d, 16*sizeof(short));
+                      ntable[n2] = nd;
+                    }
+                  else
+                    {
+                      signed char *nd = 
+                        (signed char*)slab_alloc(PACKED, IWPACKSIZE);
+                      if (kept)
+                        memcpy(nd, d, IWPACKSIZE);
+                      else
+                        {
+                          for (int i=0; i<16; i++)
+                            nd[i] = (signed char)(d[i] >> shift);
+                          nd[16] = (signed char)shift;
+                        }
+                      ntable[n2] = (short*)nd;
+                      npacked |= (1<<n2);
+                    }
+                }
+              if (pass)
+                {
+                  blk.pdata[n1] = ntable;
+                  blk.packed[n1] = npacked;
+                }
+            }
+        }
+    }
+  for (int i=0; i<NSLABS; i++)
+    free_slabs(old[i]);
+  npacked = count[PACKED];
+}
+
+// The codecs update coefficients in place and
+// cannot work on buckets packed by compact.
+void
+IW44Image::Map::unpack(void)
+{
+  for (int blockno=0; blockno<nb && npacked>0; blockno++)
+    {
+      IW44Image::Block &blk = blocks[blockno];
+      for (int n=0; n<64; n++)
+        if (blk.is_packed(n))
+          {
+            blk.unpack(n, this);
+            npacked -= 1;
+          }
+    }
+  npacked = 0;
 }
 
 int 
@@ -662,14 +1038,47 @@ IW44Image::Map::get_memory_usage(void) const
 {
   unsigned int usage = sizeof(Map);
   usage += sizeof(IW44Image::Block) * nb;
-  for (IW44Image::Alloc *n = chain; n; n=n->next)
-    usage += sizeof(IW44Image::Alloc);
+  for (int i=0; i<NSLABS; i++)
+    for (IW44Image::Alloc *n = chain[i]; n; n=n->next)
+      usage += sizeof(IW44Image::Alloc) + n->size;
   return usage;
 }
 
 
 
 
+// Converts a row of reconstructed coefficients into signed pixels.
+// Argument step is 2 when reading the even coefficients only.
+static void
+copy_coeffs(signed char *pix, const short *p, int n, int pixsep, int step=1)
+{
+  int j = 0;
+#ifdef MMX_SSE2
+  // Saturating the rounding addition gives the same clamped values
+  if (pixsep == 1 && step == 1 && MMXControl::simdflag > 0)
+    {
+      const __m128i rnd = _mm_set1_epi16(iw_round);
+      for (; j+16 <= n; j+=16)
+        {
+          __m128i a = _mm_loadu_si128((const __m128i*)(p+j));
+          __m128i b = _mm_loadu_si128((const __m128i*)(p+j+8));
+          a = _mm_srai_epi16(_mm_adds_epi16(a, rnd), iw_shift);
+          b = _mm_srai_epi16(_mm_adds_epi16(b, rnd), iw_shift);
+          _mm_storeu_si128((__m128i*)(pix+j), _mm_packs_epi16(a, b));
+        }
+    }
+#endif
+  for (pix+=j*pixsep; j<n; j+=1,pix+=pixsep)
+    {
+      int x = (p[j*step] + iw_round) >> iw_shift;
+      if (x < -128)
+        x = -128;
+      else if (x > 127)
+        x = 127;
+      *pix = x;
+    }
+}
+
 void 
 IW44Image::Map::image(signed char *img8, int rowsize, int pixsep, int fast)
 {
@@ -708,30 +1117,24 @@ IW44Image::Map::image(signed char *img8, int rowsize, int pixsep, int fast)
   if (fast)
     {
       IW44Image::Transform::Decode::backward(data16, iw, ih, bw, 32, 2);  
+      // Copy even samples into half resolution image
       p = data16;
-      for (i=0; i<bh; i+=2,p+=bw)
-        for (int jj=0; jj<bw; jj+=2,p+=2)
-          p[bw] = p[bw+1] = p[1] = p[0];
-    }
-  else
-    {
-      IW44Image::Transform::Decode::backward(data16, iw, ih, bw, 32, 1);  
+      signed char *row = img8;
+      for (i=0; i<ih; i+=2)
+        {
+          copy_coeffs(row, p, (iw+1)/2, pixsep, 2);
+          row += rowsize;
+          p += bw+bw;
+        }
+      return;
     }
+  IW44Image::Transform::Decode::backward(data16, iw, ih, bw, 32, 1);  
   // Copy result into image
   p = data16;
   signed char *row = img8;  
   for (i=0; i<ih; i++)
     {
-      signed char *pix = row;
-      for (int j=0; j<iw; j+=1,pix+=pixsep)
-        {
-          int x = (p[j] + iw_round) >> iw_shift;
-          if (x < -128)
-            x = -128;
-          else if (x > 127)
-            x = 127;
-          *pix = x;
-        }
+      copy_coeffs(row, p, iw, pixsep);
       row += rowsize;
       p += bw;
     }
@@ -837,17 +1240,23 @@ IW44Image::Map::image(int subsample, const GRect &rect,
       // Fast mode shortcuts finer resolution
       if (fast && i>=4) 
         {
-          short *pp = data + comp.ymin*dataw;
-          for (int ii=comp.ymin; ii<comp.ymax; ii+=2, pp+=dataw+dataw)
-            for (int jj=comp.xmin; jj<comp.xmax; jj+=2)
-              pp[jj+dataw] = pp[jj+dataw+1] = pp[jj+1] = pp[jj];
-          break;
-        }
-      else
-        {
-          short *pp = data + comp.ymin*dataw + comp.xmin;
-          IW44Image::Transform::Decode::backward(pp, comp.width(), comp.height(), dataw, r, r>>1);
+          // Copy even samples into half resolution image
+          GRect hrect(rect.xmin/2, rect.ymin/2, 
+                      (rect.xmax+1)/2 - rect.xmin/2,
+                      (rect.ymax+1)/2 - rect.ymin/2);
+          short *p = data + (hrect.ymin*2 - work.ymin)*dataw 
+                          + (hrect.xmin*2 - work.xmin);
+          signed char *row = img8;
+          for (int ii=hrect.ymin; ii<hrect.ymax; ii++)
+            {
+              copy_coeffs(row, p, hrect.width(), pixsep, 2);
+              row += rowsize;
+              p += dataw+dataw;
+            }
+          return;
         }
+      short *pp = data + comp.ymin*dataw + comp.xmin;
+      IW44Image::Transform::Decode::backward(pp, comp.width(), comp.height(), dataw, r, r>>1);
       r = r>>1;
     }
   // Copy result into image
@@ -857,17 +1266,7 @@ IW44Image::Map::image(int subsample, const GRect &rect,
   signed char *row = img8;  
   for (i=nrect.ymin; i<nrect.ymax; i++)
     {
-      int j;
-      signed char *pix = row;
-      for (j=nrect.xmin; j<nrect.xmax; j+=1,pix+=pixsep)
-        {
-          int x = (p[j] + iw_round) >> iw_shift;
-          if (x < -128)
-            x = -128;
-          else if (x > 127)
-            x = 127;
-          *pix = x;
-        }
+      copy_coeffs(row, p + nrect.xmin, nrect.width(), pixsep);
       row += rowsize;
       p += dataw;
     }
@@ -969,6 +1368,19 @@ IW44Image::Codec::is_null_slice(int bit, int band)
 }
 
 
+// is_deferrable
+// -- check if the next slices only code buckets beyond nbuckets
+
+int
+IW44Image::Codec::is_deferrable(int nslices, int nbuckets) const
+{
+  if (curbit < 0 || nslices <= 0)
+    return 1;
+  // slices run through the bands in order before moving to the next bit
+  return (bandbuckets[curband].start >= nbuckets && curband + nslices <= 10);
+}
+
+
 // code_slice
 // -- read/write a slice of datafile
 
@@ -978,6 +1390,9 @@ IW44Image::Codec::Decode::code_slice(ZPCodec &zp)
   // Check that code_slice can still run
   if (curbit < 0)
     return 0;
+  // Resume on a compacted map
+  if (map.npacked)
+    map.unpack();
   // Perform coding
   if (! is_null_slice(curbit, curband))
     {
@@ -990,14 +1405,14 @@ IW44Image::Codec::Decode::code_slice(ZPCodec &zp)
                            fbucket, nbucket);
         }
     }
-  return finish_code_slice(zp);
+  return finish_code_slice();
 }
 
 // code_slice
 // -- read/write a slice of datafile
 
 int
-IW44Image::Codec::finish_code_slice(ZPCodec &zp)
+IW44Image::Codec::finish_code_slice(void)
 {
   // Reduce quantization threshold
   quant_hi[curband] = quant_hi[curband] >> 1;
@@ -1326,6 +1741,238 @@ IW44Image::TertiaryHeader::decode(GP<ByteStream> gbs, int major, int minor)
 
 
 
+//////////////////////////////////////////////////////
+// RECONSTRUCTION CACHE
+//////////////////////////////////////////////////////
+
+// The cache holds segments reconstructed by Map::image(subsample,
+// rect, ...), keyed by plane, subsampling ratio, fast mode and
+// rectangle.  The reconstruction of a segment depends on its
+// rectangle, so only the same request can be served from the cache.
+// The least recently used segments are evicted when the total size
+// exceeds the cache size.
+
+struct IW44Image::Cache
+{
+  struct Segment
+  {
+    int plane;
+    int subsample;
+    int fast;
+    GRect rect;
+    unsigned int size;
+    signed char *data;
+    unsigned long used;
+  };
+  enum { MAXSEGMENTS = 64 };
+  Cache(unsigned int maxbytes);
+  ~Cache();
+  Segment *find(int plane, int subsample, int fast, const GRect &rect);
+  void flush(void);
+  void evict(unsigned int size);
+  GMonitor monitor;
+  unsigned int maxbytes;
+  unsigned int bytes;
+  unsigned long clock;
+  int hits;
+  int misses;
+  int nsegments;
+  Segment segments[MAXSEGMENTS];
+};
+
+IW44Image::Cache::Cache(unsigned int maxbytes)
+  : maxbytes(maxbytes), bytes(0), clock(0), hits(0), misses(0), nsegments(0)
+{
+}
+
+IW44Image::Cache::~Cache()
+{
+  flush();
+}
+
+IW44Image::Cache::Segment *
+IW44Image::Cache::find(int plane, int subsample, int fast, const GRect &rect)
+{
+  for (int i=0; i<nsegments; i++)
+    if (segments[i].plane == plane && 
+        segments[i].subsample == subsample &&
+        segments[i].fast == fast &&
+        segments[i].rect == rect )
+      return &segments[i];
+  return 0;
+}
+
+void
+IW44Image::Cache::flush(void)
+{
+  for (int i=0; i<nsegments; i++)
+    delete [] segments[i].data;
+  nsegments = 0;
+  bytes = 0;
+}
+
+// Evicts segments until size more bytes fit in the cache.
+void
+IW44Image::Cache::evict(unsigned int size)
+{
+  while (nsegments > 0 && 
+         (bytes + size > maxbytes || nsegments >= MAXSEGMENTS))
+    {
+      int k = 0;
+      for (int i=1; i<nsegments; i++)
+        if (segments[i].used < segments[k].used)
+          k = i;
+      bytes -= segments[k].size;
+      delete [] segments[k].data;
+      segments[k] = segments[--nsegments];
+    }
+}
+
+// Setting LIBDJVU_IW44_CACHE to a number of kilobytes
+// enables the reconstruction cache of all images.
+static unsigned int
+default_cache_size(void)
+{
+  const char *envvar = getenv("LIBDJVU_IW44_CACHE");
+  int kbytes = (envvar) ? atoi(envvar) : 0;
+  return (kbytes > 0) ? (unsigned int)kbytes * 1024 : 0;
+}
+
+static const unsigned int cache_size = default_cache_size();
+
+void 
+IW44Image::set_cache_size(unsigned int maxbytes)
+{
+  GMonitorLock lock(&monitor);
+  if (! cache)
+    cache = new Cache(maxbytes);
+  GMonitorLock lock2(&cache->monitor);
+  cache->maxbytes = maxbytes;
+  cache->evict(0);
+}
+
+// The cache pointer is read under the monitor because
+// another thread may be creating the cache.
+IW44Image::Cache *
+IW44Image::get_cache(void) const
+{
+  GMonitorLock lock(&monitor);
+  return cache;
+}
+
+unsigned int
+IW44Image::get_cache_usage(void) const
+{
+  Cache *c = get_cache();
+  if (! c)
+    return 0;
+  GMonitorLock lock(&c->monitor);
+  return sizeof(Cache) + c->bytes;
+}
+
+int 
+IW44Image::get_cache_hits(void) const
+{
+  Cache *c = get_cache();
+  if (! c)
+    return 0;
+  GMonitorLock lock(&c->monitor);
+  return c->hits;
+}
+
+int 
+IW44Image::get_cache_misses(void) const
+{
+  Cache *c = get_cache();
+  if (! c)
+    return 0;
+  GMonitorLock lock(&c->monitor);
+  return c->misses;
+}
+
+void 
+IW44Image::flush_cache(void)
+{
+  Cache *c = get_cache();
+  if (c)
+    {
+      GMonitorLock lock(&c->monitor);
+      c->flush();
+    }
+}
+
+// Copies rows between a cached segment and an image.
+static void
+copy_segment(signed char *dst, int dstrowsize, 
+             const signed char *src, int srcrowsize, int w, int h)
+{
+  for (int i=0; i<h; i++, dst+=dstrowsize, src+=srcrowsize)
+    memcpy(dst, src, w);
+}
+
+// Reconstructs a segment of a plane like Map::image, 
+// using the cache when it is enabled and large enough.
+static void
+cached_image(IW44Image::Cache *cache, int plane, IW44Image::Map *map, 
+             int subsample, const GRect &rect, 
+             signed char *img8, int rowsize, int fast)
+{
+  // Fast mode returns the half resolution segment
+  GRect prect = rect;
+  fast = (fast && subsample == 1);
+  if (fast)
+    prect = GRect(rect.xmin/2, rect.ymin/2, 
+                  (rect.xmax+1)/2 - rect.xmin/2,
+                  (rect.ymax+1)/2 - rect.ymin/2);
+  const int w = prect.width();
+  const int h = prect.height();
+  const unsigned int size = w * h;
+  if (!cache || rect.isempty() || size > cache->maxbytes)
+    {
+      map->image(subsample, rect, img8, rowsize, 1, fast);
+      return;
+    }
+  // Search cache
+  {
+    GMonitorLock lock(&cache->monitor);
+    IW44Image::Cache::Segment *p = cache->find(plane, subsample, fast, rect);
+    if (p)
+      {
+        cache->hits += 1;
+        p->used = ++cache->clock;
+        copy_segment(img8, rowsize, p->data, w, w, h);
+        return;
+      }
+  }
+  // Reconstruct segment without holding the monitor
+  map->image(subsample, rect, img8, rowsize, 1, fast);
+  signed char *data = new signed char[size];
+  copy_segment(data, w, img8, rowsize, w, h);
+  // Insert segment unless another thread did it
+  GMonitorLock lock(&cache->monitor);
+  IW44Image::Cache::Segment *p = cache->find(plane, subsample, fast, rect);
+  if (p)
+    {
+      delete [] data;
+    }
+  else
+    {
+      cache->misses += 1;
+      cache->evict(size);
+      p = &cache->segments[cache->nsegments++];
+      p->plane = plane;
+      p->subsample = subsample;
+      p->fast = fast;
+      p->rect = rect;
+      p->size = size;
+      p->data = data;
+      cache->bytes += size;
+    }
+  p->used = ++cache->clock;
+}
+
+
+
 //////////////////////////////////////////////////////
 // CLASS IW44Image
 //////////////////////////////////////////////////////
@@ -1333,11 +1980,17 @@ IW44Image::TertiaryHeader::decode(GP<ByteStream> gbs, int major, int minor)
 IW44Image::IW44Image(void)
   : db_frac(1.0),
     ymap(0), cbmap(0), crmap(0),
-    cslice(0), cserial(0), cbytes(0)
-{}
+    cslice(0), cserial(0), cbytes(0),
+    dsubsample(1), dslice(0),
+    cache(0)
+{
+  if (cache_size)
+    cache = new Cache(cache_size);
+}
 
 IW44Image::~IW44Image()
 {
+  delete cache;
   delete ymap;
   delete cbmap;
   delete crmap;
@@ -1371,11 +2024,33 @@ IW44Image::encode_iff(IFFByteStream &, int nchunks, const IWEncoderParms *)
 }
 
   
+// Setting LIBDJVU_IW44_PACK to 0 disables bucket packing.
+static int
+default_pack_buckets(void)
+{
+  const char *envvar = getenv("LIBDJVU_IW44_PACK");
+  return (envvar && envvar[0]=='0') ? 0 : 1;
+}
+
+static const int pack_buckets = default_pack_buckets();
+
+void
+IW44Image::compact(void)
+{
+  if (ymap)
+    ymap->compact(pack_buckets);
+  if (cbmap)
+    cbmap->compact(pack_buckets);
+  if (crmap)
+    crmap->compact(pack_buckets);
+}
+
 void 
 IWBitmap::close_codec(void)
 {
   delete ycodec;
   ycodec = 0;
+  dzp = 0;
   cslice = cbytes = cserial = 0;
 }
 
@@ -1386,9 +2061,74 @@ IWPixmap::close_codec(void)
   delete cbcodec;
   delete crcodec;
   ycodec = crcodec = cbcodec = 0;
+  dzp = 0;
   cslice = cbytes = cserial = 0;
 }
 
+void
+IW44Image::set_decode_subsample(int subsample)
+{
+  dsubsample = (subsample > 1) ? subsample : 1;
+}
+
+int
+IW44Image::get_decode_subsample(void) const
+{
+  return dsubsample;
+}
+
+static int
+default_decode_subsample(void)
+{
+  const char *envvar = getenv("LIBDJVU_IW44_SUBSAMPLE");
+  int subsample = (envvar) ? atoi(envvar) : 1;
+  return (subsample > 1) ? subsample : 1;
+}
+
+static int default_subsample = default_decode_subsample();
+
+static GMonitor &subsample_monitor() {
+  static GMonitor xsubsample_monitor;
+  return xsubsample_monitor;
+}
+
+void
+IW44Image::set_default_decode_subsample(int subsample)
+{
+  GMonitorLock lock(&subsample_monitor());
+  default_subsample = (subsample > 1) ? subsample : 1;
+}
+
+int
+IW44Image::get_default_decode_subsample(void)
+{
+  GMonitorLock lock(&subsample_monitor());
+  return default_subsample;
+}
+
+// Returns the number of buckets read by Map::image
+// when reconstructing an image at this subsampling ratio.
+static int
+subsample_buckets(int subsample)
+{
+  int nlevel = 0;
+  while (nlevel<5 && (32>>nlevel)>subsample)
+    nlevel += 1;
+  return ((1<<(nlevel+nlevel))+15)>>4;
+}
+
+// Copies the chunk data when its last slices might be deferred.
+static GP<ByteStream>
+deferrable_data(GP<ByteStream> gbs, int nbuckets)
+{
+  if (nbuckets >= 64)
+    return gbs;
+  GP<ByteStream> gdata = ByteStream::create();
+  gdata->copy(*gbs);
+  gdata->seek(0);
+  return gdata;
+}
+
 int 
 IW44Image::get_width(void) const
 {
@@ -1412,6 +2152,9 @@ IWBitmap::IWBitmap(void )
 
 IWBitmap::~IWBitmap()
 {
+  // no need to compact maps about to be deleted
+  delete ycodec;
+  ycodec = 0;
   close_codec();
 }
 
@@ -1434,6 +2177,7 @@ IWBitmap::get_memory_usage(void) const
   unsigned int usage = sizeof(GBitmap);
   if (ymap)
     usage += ymap->get_memory_usage();
+  usage += get_cache_usage();
   return usage;
 }
 
@@ -1471,7 +2215,8 @@ IWBitmap::get_bitmap(int subsample, const GRect &rect)
   int w = rect.width();
   int h = rect.height();
   GP<GBitmap> pbm = GBitmap::create(h,w);
-  ymap->image(subsample, rect, (signed char*)(*pbm)[0],pbm->rowsize());
+  cached_image(get_cache(), 0, ymap, subsample, rect, 
+               (signed char*)(*pbm)[0], pbm->rowsize(), 0);
   // Shift image data
   for (int i=0; i<h; i++)
     {
@@ -1488,6 +2233,7 @@ IWBitmap::get_bitmap(int subsample, const GRect &rect)
 int
 IWBitmap::decode_chunk(GP<ByteStream> gbs)
 {
+  flush_cache();
   // Open
   if (! ycodec)
   {
@@ -1526,11 +2272,27 @@ IWBitmap::decode_chunk(GP<ByteStream> gbs)
   // Read data
   assert(ymap);
   assert(ycodec);
-  GP<ZPCodec> gzp=ZPCodec::create(gbs, false, true);
+  if (dzp)
+    {
+      // Complete the slices deferred by the previous chunk
+      for (; dslice<cslice; dslice++)
+        ycodec->code_slice(*dzp);
+      dzp = 0;
+    }
+  const int nbuckets = subsample_buckets(dsubsample);
+  GP<ZPCodec> gzp=ZPCodec::create(deferrable_data(gbs, nbuckets), false, true);
   ZPCodec &zp=*gzp;
   int flag = 1;
   while (flag && cslice<nslices)
     {
+      if (nbuckets < 64 && ycodec->is_deferrable(nslices-cslice, nbuckets))
+        {
+          // Remaining slices do not matter at subsample dsubsample
+          dzp = gzp;
+          dslice = cslice;
+          cslice = nslices;
+          break;
+        }
       flag = ycodec->code_slice(zp);
       cslice++;
     }
@@ -1603,6 +2365,9 @@ IWPixmap::IWPixmap(void)
 
 IWPixmap::~IWPixmap()
 {
+  // no need to compact maps about to be deleted
+  delete ycodec;
+  ycodec = 0;
   close_codec();
 }
 
@@ -1639,10 +2404,61 @@ IWPixmap::get_memory_usage(void) const
     usage += cbmap->get_memory_usage();
   if (crmap)
     usage += crmap->get_memory_usage();
+  usage += get_cache_usage();
   return usage;
 }
 
 
+// Reconstructs the Y, Cb and Cr planes, concurrently when the
+// shared thread pool is enabled.
+struct PlaneJobs
+{
+  IW44Image::Cache *cache;
+  IW44Image::Map *map[3];
+  signed char *img[3];
+  int rowsize[3];
+  const GRect *rect;            // null for the full image
+  int subsample;
+  int half;
+};
+
+static void
+plane_job(void *arg, int i)
+{
+  PlaneJobs *pj = (PlaneJobs*)arg;
+  int fast = (i > 0) ? pj->half : 0;
+  if (pj->rect)
+    cached_image(pj->cache, i, pj->map[i], pj->subsample, *pj->rect, 
+                 pj->img[i], pj->rowsize[i], fast);
+  else
+    pj->map[i]->image(pj->img[i], pj->rowsize[i], 1, fast);
+}
+
+static void
+plane_jobs(PlaneJobs &pj, int nplanes)
+{
+  GThreadPool *pool = GThreadPool::get_shared();
+  if (pool)
+    pool->run(plane_job, (void*)&pj, nplanes);
+  else
+    for (int i=0; i<nplanes; i++)
+      plane_job((void*)&pj, i);
+}
+
+static void
+gray_to_RGB(GPixmap &pm, const signed char *py)
+{
+  int w = pm.columns();
+  int h = pm.rows();
+  for (int i=0; i<h; i++)
+    {
+      GPixel *pixrow = pm[i];
+      const signed char *prow = py + i*w;
+      for (int j=0; j<w; j++, pixrow++)
+        pixrow->b = pixrow->g = pixrow->r = 127 - (int)prow[j];
+    }
+}
+
 GP<GPixmap> 
 IWPixmap::get_pixmap(void)
 {
@@ -1653,31 +2469,36 @@ IWPixmap::get_pixmap(void)
   int w = ymap->iw;
   int h = ymap->ih;
   GP<GPixmap> ppm = GPixmap::create(h, w);
+  // Allocate separate planes.
+  // Half resolution chroma planes are not upsampled.
+  int color = (crmap && cbmap && crcb_delay >= 0);
+  int cw = (color ? (crcb_half ? (w+1)/2 : w) : 0);
+  int ch = (color ? (crcb_half ? (h+1)/2 : h) : 0);
+  signed char *py, *pcb, *pcr;
+  GPBuffer<signed char> gpy(py, w*h);
+  GPBuffer<signed char> gpcb(pcb, cw*ch);
+  GPBuffer<signed char> gpcr(pcr, cw*ch);
   // Perform wavelet reconstruction
-  signed char *ptr = (signed char*) (*ppm)[0];
-  int rowsep = ppm->rowsize() * sizeof(GPixel);
-  int pixsep = sizeof(GPixel);
-  ymap->image(ptr, rowsep, pixsep);
-  if (crmap && cbmap && crcb_delay >= 0)
-  {
-    cbmap->image(ptr+1, rowsep, pixsep, crcb_half);
-    crmap->image(ptr+2, rowsep, pixsep, crcb_half);
-  }
+  PlaneJobs pj;
+  pj.cache = get_cache();
+  pj.map[0] = ymap;
+  pj.map[1] = cbmap;
+  pj.map[2] = crmap;
+  pj.img[0] = py;
+  pj.img[1] = pcb;
+  pj.img[2] = pcr;
+  pj.rowsize[0] = w;
+  pj.rowsize[1] = pj.rowsize[2] = cw;
+  pj.rect = 0;
+  pj.subsample = 1;
+  pj.half = crcb_half;
+  plane_jobs(pj, color ? 3 : 1);
   // Convert image data to RGB
-  if (crmap && cbmap && crcb_delay >= 0)
-    {
-      Transform::Decode::YCbCr_to_RGB((*ppm)[0], w, h, ppm->rowsize());
-    }
+  if (color)
+    Transform::Decode::YCbCr_to_RGB((*ppm)[0], w, h, ppm->rowsize(),
+                                    py, w, pcb, pcr, cw, crcb_half);
   else
-    {
-      for (int i=0; i<h; i++)
-        {
-          GPixel *pixrow = (*ppm)[i];
-          for (int j=0; j<w; j++, pixrow++)
-            pixrow->b = pixrow->g = pixrow->r 
-              = 127 - (int)(((signed char*)pixrow)[0]);
-        }
-    }
+    gray_to_RGB(*ppm, py);
   // Return
   return ppm;
 }
@@ -1693,31 +2514,39 @@ IWPixmap::get_pixmap(int subsample, const GRect &rect)
   int w = rect.width();
   int h = rect.height();
   GP<GPixmap> ppm = GPixmap::create(h,w);
+  // Allocate separate planes.
+  // Half resolution chroma planes are not upsampled.
+  // This only happens when subsample is 1.
+  int color = (crmap && cbmap && crcb_delay >= 0);
+  int half = (crcb_half && subsample == 1);
+  int cw = (color ? (half ? (rect.xmax+1)/2 - rect.xmin/2 : w) : 0);
+  int ch = (color ? (half ? (rect.ymax+1)/2 - rect.ymin/2 : h) : 0);
+  signed char *py, *pcb, *pcr;
+  GPBuffer<signed char> gpy(py, w*h);
+  GPBuffer<signed char> gpcb(pcb, cw*ch);
+  GPBuffer<signed char> gpcr(pcr, cw*ch);
   // Perform wavelet reconstruction
-  signed char *ptr = (signed char*) (*ppm)[0];
-  int rowsep = ppm->rowsize() * sizeof(GPixel);
-  int pixsep = sizeof(GPixel);
-  ymap->image(subsample, rect, ptr, rowsep, pixsep);
-  if (crmap && cbmap && crcb_delay >= 0)
-  {
-    cbmap->image(subsample, rect, ptr+1, rowsep, pixsep, crcb_half);
-    crmap->image(subsample, rect, ptr+2, rowsep, pixsep, crcb_half);
-  }
+  PlaneJobs pj;
+  pj.cache = get_cache();
+  pj.map[0] = ymap;
+  pj.map[1] = cbmap;
+  pj.map[2] = crmap;
+  pj.img[0] = py;
+  pj.img[1] = pcb;
+  pj.img[2] = pcr;
+  pj.rowsize[0] = w;
+  pj.rowsize[1] = pj.rowsize[2] = cw;
+  pj.rect = &rect;
+  pj.subsample = subsample;
+  pj.half = half;
+  plane_jobs(pj, color ? 3 : 1);
   // Convert image data to RGB
-  if (crmap && cbmap && crcb_delay >= 0)
-    {
-      Transform::Decode::YCbCr_to_RGB((*ppm)[0], w, h, ppm->rowsize());
-    }
+  if (color)
+    Transform::Decode::YCbCr_to_RGB((*ppm)[0], w, h, ppm->rowsize(),
+                                    py, w, pcb, pcr, cw,
+                                    half, rect.xmin, rect.ymin);
   else
-    {
-      for (int i=0; i<h; i++)
-        {
-          GPixel *pixrow = (*ppm)[i];
-          for (int j=0; j<w; j++, pixrow++)
-            pixrow->b = pixrow->g = pixrow->r 
-              = 127 - (int)(((signed char*)pixrow)[0]);
-        }
-    }
+    gray_to_RGB(*ppm, py);
   // Return
   return ppm;
 }
@@ -1726,6 +2555,7 @@ IWPixmap::get_pixmap(int subsample, const GRect &rect)
 int
 IWPixmap::decode_chunk(GP<ByteStream> gbs)
 {
+  flush_cache();
   // Open
   if (! ycodec)
   {
@@ -1779,11 +2609,41 @@ IWPixmap::decode_chunk(GP<ByteStream> gbs)
   // Read data
   assert(ymap);
   assert(ycodec);
-  GP<ZPCodec> gzp=ZPCodec::create(gbs, false, true);
+  if (dzp)
+    {
+      // Complete the slices deferred by the previous chunk
+      for (; dslice<cslice; dslice++)
+        {
+          ycodec->code_slice(*dzp);
+          if (crcodec && cbcodec && crcb_delay<=dslice)
+            {
+              cbcodec->code_slice(*dzp);
+              crcodec->code_slice(*dzp);
+            }
+        }
+      dzp = 0;
+    }
+  const int nbuckets = subsample_buckets(dsubsample);
+  GP<ZPCodec> gzp=ZPCodec::create(deferrable_data(gbs, nbuckets), false, true);
   ZPCodec &zp=*gzp;
   int flag = 1;
   while (flag && cslice<nslices)
     {
+      if (nbuckets < 64 && ycodec->is_deferrable(nslices-cslice, nbuckets))
+        {
+          // Chrominance slices start at slice crcb_delay
+          int cslices = nslices - ((cslice>crcb_delay) ? cslice : crcb_delay);
+          if (!crcodec || !cbcodec ||
+              (cbcodec->is_deferrable(cslices, nbuckets) &&
+               crcodec->is_deferrable(cslices, nbuckets)))
+            {
+              // Remaining slices do not matter at subsample dsubsample
+              dzp = gzp;
+              dslice = cslice;
+              cslice = nslices;
+              break;
+            }
+        }
       flag = ycodec->code_slice(zp);
       if (crcodec && cbcodec && crcb_delay<=cslice)
         {
@@ -1850,6 +2710,8 @@ IW44Image::Transform::filter_begin(int w, int h)
 {
   if (MMXControl::mmxflag < 0)  
     MMXControl::enable_mmx();
+  if (MMXControl::simdflag < 0)  
+    MMXControl::enable_simd();
 }
 
 
@@ -1868,6 +2730,67 @@ IW44Image::Transform::filter_end(void)
 //////////////////////////////////////////////////////
 
 
+//----------------------------------------------------
+// Parallel filters.
+// The vertical filter processes columns independently and the
+// horizontal filter processes rows independently.  Running them on
+// bands of columns or rows therefore computes the same values.
+
+struct FilterBands
+{
+  short *p;
+  int w, h, rowsize, scale;
+  int bw, nv;                   // column bands
+  int bh, nh;                   // row bands
+};
+
+static int
+band_count(int n, int scale, int nthreads, int &size)
+{
+  // Bands hold a multiple of 16 samples at this scale
+  int k = (n + scale - 1) / scale;
+  int b = (k + nthreads + nthreads - 1) / (nthreads + nthreads);
+  b = (max(b, 32) + 15) & ~15;
+  size = b * scale;
+  return (k + b - 1) / b;
+}
+
+static bool
+filter_bands(FilterBands &fb, GThreadPool *pool, 
+             short *p, int w, int h, int rowsize, int scale)
+{
+  // Small images are not worth splitting
+  if (((w+scale-1)/scale) * ((h+scale-1)/scale) < 65536)
+    return false;
+  int nthreads = pool->get_threads();
+  fb.p = p;
+  fb.w = w;
+  fb.h = h;
+  fb.rowsize = rowsize;
+  fb.scale = scale;
+  fb.nv = band_count(w, scale, nthreads, fb.bw);
+  fb.nh = band_count(h, scale, nthreads, fb.bh);
+  return true;
+}
+
+static void
+filter_bv_band(void *arg, int i)
+{
+  FilterBands *fb = (FilterBands*)arg;
+  int x = i * fb->bw;
+  filter_bv(fb->p + x, min(fb->bw, fb->w - x), fb->h, fb->rowsize, fb->scale);
+}
+
+static void
+filter_bh_band(void *arg, int i)
+{
+  FilterBands *fb = (FilterBands*)arg;
+  int y = i * fb->bh;
+  filter_bh(fb->p + y * fb->rowsize, fb->w, min(fb->bh, fb->h - y), 
+            fb->rowsize, fb->scale);
+}
+
+
 //----------------------------------------------------
 // Function for applying bidimensional IW44 between 
 // scale intervals begin(inclusive) and end(exclusive)
@@ -1877,6 +2800,7 @@ IW44Image::Transform::Decode::backward(short *p, int w, int h, int rowsize, int
 { 
   // PREPARATION
   filter_begin(w,h);
+  GThreadPool *pool = GThreadPool::get_shared();
   // LOOP ON SCALES
   for (int scale=begin>>1; scale>=end; scale>>=1)
     {
@@ -1884,12 +2808,19 @@ IW44Image::Transform::Decode::backward(short *p, int w, int h, int rowsize, int
       int tv,th;
       th = tv = GOS::ticks();
 #endif
-      filter_bv(p, w, h, rowsize, scale);
+      FilterBands fb;
+      if (pool && filter_bands(fb, pool, p, w, h, rowsize, scale))
+        pool->run(filter_bv_band, (void*)&fb, fb.nv);
+      else
+        filter_bv(p, w, h, rowsize, scale);
 #ifdef IWTRANSFORM_TIMER
       th = GOS::ticks();
       tv = th - tv;
 #endif
-      filter_bh(p, w, h, rowsize, scale);
+      if (pool && filter_bands(fb, pool, p, w, h, rowsize, scale))
+        pool->run(filter_bh_band, (void*)&fb, fb.nh);
+      else
+        filter_bh(p, w, h, rowsize, scale);
 #ifdef IWTRANSFORM_TIMER
       th = GOS::ticks()-th;
       DjVuPrintErrorUTF8("back%d\tv=%dms h=%dms\n", scale,tv,th);
@@ -1906,6 +2837,21 @@ IW44Image::Transform::Decode::backward(short *p, int w, int h, int rowsize, int
 // COLOR TRANSFORM 
 //////////////////////////////////////////////////////
 
+/* Converts one pixel using the Pigeon transform. */
+static inline void
+ycc_pixel(GPixel *q, int y, int b, int r)
+{
+  int t1 = b >> 2 ; 
+  int t2 = r + (r >> 1);
+  int t3 = y + 128 - t1;
+  int tr = y + 128 + t2;
+  int tg = t3 - (t2 >> 1);
+  int tb = t3 + (b << 1);
+  q->r = max(0,min(255,tr));
+  q->g = max(0,min(255,tg));
+  q->b = max(0,min(255,tb));
+}
+
 /* Converts YCbCr to RGB. */
 void 
 IW44Image::Transform::Decode::YCbCr_to_RGB(GPixel *p, int w, int h, int rowsize)
@@ -1918,17 +2864,242 @@ IW44Image::Transform::Decode::YCbCr_to_RGB(GPixel *p, int w, int h, int rowsize)
           signed char y = ((signed char*)q)[0];
           signed char b = ((signed char*)q)[1];
           signed char r = ((signed char*)q)[2];
-          // This is the Pigeon transform
-          int t1 = b >> 2 ; 
-          int t2 = r + (r >> 1);
-          int t3 = y + 128 - t1;
-          int tr = y + 128 + t2;
-          int tg = t3 - (t2 >> 1);
-          int tb = t3 + (b << 1);
-          q->r = max(0,min(255,tr));
-          q->g = max(0,min(255,tg));
-          q->b = max(0,min(255,tb));
+          ycc_pixel(q, y, b, r);
+        }
+    }
+}
+
+// Note:
+// The vector code computes the Pigeon transform with 16 bits
+// integers, which cannot overflow for signed char inputs, and
+// clamps the results with an unsigned saturating pack.  When the
+// chroma planes have half resolution, each chroma sample is
+// duplicated in the register instead of upsampling the plane.
+
+#ifdef MMX_SSE2
+
+static inline __m128i
+sse2_sext_lo(__m128i v)
+{
+  return _mm_srai_epi16(_mm_unpacklo_epi8(v, v), 8);
+}
+
+static inline __m128i
+sse2_sext_hi(__m128i v)
+{
+  return _mm_srai_epi16(_mm_unpackhi_epi8(v, v), 8);
+}
+
+static inline void
+sse2_ycc(__m128i y, __m128i b, __m128i r, __m128i &tr, __m128i &tg, __m128i &tb)
+{
+  const __m128i c128 = _mm_set1_epi16(128);
+  __m128i t1 = _mm_srai_epi16(b, 2);
+  __m128i t2 = _mm_add_epi16(r, _mm_srai_epi16(r, 1));
+  __m128i t3 = _mm_sub_epi16(_mm_add_epi16(y, c128), t1);
+  tr = _mm_add_epi16(_mm_add_epi16(y, c128), t2);
+  tg = _mm_sub_epi16(t3, _mm_srai_epi16(t2, 1));
+  tb = _mm_add_epi16(t3, _mm_slli_epi16(b, 1));
+}
+
+// Stores four pixels held in 32 bits lanes as 12 bytes.
+// This writes two bytes beyond the last pixel.
+static inline void
+sse2_store4(char *d, __m128i px)
+{
+  const __m128i lo = _mm_set_epi32(0, 0xffffff, 0, 0xffffff);
+  const __m128i hi = _mm_set_epi32(0xffffff, 0, 0xffffff, 0);
+  px = _mm_or_si128(_mm_and_si128(px, lo),
+                    _mm_srli_epi64(_mm_and_si128(px, hi), 8));
+  _mm_storel_epi64((__m128i*)d, px);
+  _mm_storel_epi64((__m128i*)(d+6), _mm_srli_si128(px, 8));
+}
+
+static int
+sse2_ycc_row(GPixel *q, const signed char *y, 
+             const signed char *b, const signed char *r, 
+             int x, int w, int half)
+{
+  const __m128i zero = _mm_setzero_si128();
+  while (x+16 < w)
+    {
+      __m128i vy = _mm_loadu_si128((const __m128i*)(y+x));
+      __m128i vb, vr;
+      if (half)
+        {
+          vb = _mm_loadl_epi64((const __m128i*)(b+(x>>1)));
+          vr = _mm_loadl_epi64((const __m128i*)(r+(x>>1)));
+          vb = _mm_unpacklo_epi8(vb, vb);
+          vr = _mm_unpacklo_epi8(vr, vr);
         }
+      else
+        {
+          vb = _mm_loadu_si128((const __m128i*)(b+x));
+          vr = _mm_loadu_si128((const __m128i*)(r+x));
+        }
+      __m128i rlo, glo, blo, rhi, ghi, bhi;
+      sse2_ycc(sse2_sext_lo(vy), sse2_sext_lo(vb), sse2_sext_lo(vr), 
+               rlo, glo, blo);
+      sse2_ycc(sse2_sext_hi(vy), sse2_sext_hi(vb), sse2_sext_hi(vr), 
+               rhi, ghi, bhi);
+      __m128i pr = _mm_packus_epi16(rlo, rhi);
+      __m128i pg = _mm_packus_epi16(glo, ghi);
+      __m128i pb = _mm_packus_epi16(blo, bhi);
+      __m128i bglo = _mm_unpacklo_epi8(pb, pg);
+      __m128i bghi = _mm_unpackhi_epi8(pb, pg);
+      __m128i rzlo = _mm_unpacklo_epi8(pr, zero);
+      __m128i rzhi = _mm_unpackhi_epi8(pr, zero);
+      char *d = (char*)(q+x);
+      sse2_store4(d, _mm_unpacklo_epi16(bglo, rzlo));
+      sse2_store4(d+12, _mm_unpackhi_epi16(bglo, rzlo));
+      sse2_store4(d+24, _mm_unpacklo_epi16(bghi, rzhi));
+      sse2_store4(d+36, _mm_unpackhi_epi16(bghi, rzhi));
+      x += 16;
+    }
+  return x;
+}
+
+#ifdef MMX_AVX2
+
+static inline MMX_AVX2_TARGET void
+avx2_ycc(__m256i y, __m256i b, __m256i r, __m256i &tr, __m256i &tg, __m256i &tb)
+{
+  const __m256i c128 = _mm256_set1_epi16(128);
+  __m256i t1 = _mm256_srai_epi16(b, 2);
+  __m256i t2 = _mm256_add_epi16(r, _mm256_srai_epi16(r, 1));
+  __m256i t3 = _mm256_sub_epi16(_mm256_add_epi16(y, c128), t1);
+  tr = _mm256_add_epi16(_mm256_add_epi16(y, c128), t2);
+  tg = _mm256_sub_epi16(t3, _mm256_srai_epi16(t2, 1));
+  tb = _mm256_add_epi16(t3, _mm256_slli_epi16(b, 1));
+}
+
+static inline MMX_AVX2_TARGET __m256i
+avx2_dup(const signed char *p)
+{
+  __m128i v = _mm_loadu_si128((const __m128i*)p);
+  return _mm256_inserti128_si256(
+           _mm256_castsi128_si256(_mm_unpacklo_epi8(v, v)),
+           _mm_unpackhi_epi8(v, v), 1);
+}
+
+// Interleaves sixteen pixels into 48 bytes.
+static inline MMX_AVX2_TARGET void
+avx2_store16(char *d, __m128i b, __m128i g, __m128i r)
+{
+  const __m128i b0 = _mm_setr_epi8(0,-1,-1,1,-1,-1,2,-1,-1,3,-1,-1,4,-1,-1,5);
+  const __m128i b1 = _mm_setr_epi8(-1,-1,6,-1,-1,7,-1,-1,8,-1,-1,9,-1,-1,10,-1);
+  const __m128i b2 = _mm_setr_epi8(-1,11,-1,-1,12,-1,-1,13,-1,-1,14,-1,-1,15,-1,-1);
+  const __m128i g0 = _mm_setr_epi8(-1,0,-1,-1,1,-1,-1,2,-1,-1,3,-1,-1,4,-1,-1);
+  const __m128i g1 = _mm_setr_epi8(5,-1,-1,6,-1,-1,7,-1,-1,8,-1,-1,9,-1,-1,10);
+  const __m128i g2 = _mm_setr_epi8(-1,-1,11,-1,-1,12,-1,-1,13,-1,-1,14,-1,-1,15,-1);
+  const __m128i r0 = _mm_setr_epi8(-1,-1,0,-1,-1,1,-1,-1,2,-1,-1,3,-1,-1,4,-1);
+  const __m128i r1 = _mm_setr_epi8(-1,5,-1,-1,6,-1,-1,7,-1,-1,8,-1,-1,9,-1,-1);
+  const __m128i r2 = _mm_setr_epi8(10,-1,-1,11,-1,-1,12,-1,-1,13,-1,-1,14,-1,-1,15);
+  _mm_storeu_si128((__m128i*)d, 
+                   _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(b, b0),
+                                             _mm_shuffle_epi8(g, g0)),
+                                _mm_shuffle_epi8(r, r0)));
+  _mm_storeu_si128((__m128i*)(d+16), 
+                   _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(b, b1),
+                                             _mm_shuffle_epi8(g, g1)),
+                                _mm_shuffle_epi8(r, r1)));
+  _mm_storeu_si128((__m128i*)(d+32), 
+                   _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(b, b2),
+                                             _mm_shuffle_epi8(g, g2)),
+                                _mm_shuffle_epi8(r, r2)));
+}
+
+static MMX_AVX2_TARGET int
+avx2_ycc_row(GPixel *q, const signed char *y, 
+             const signed char *b, const signed char *r, 
+             int x, int w, int half)
+{
+  while (x+32 <= w)
+    {
+      // The byte unpacks and the packs below both work per 128 bits
+      // lane, so each lane of 16 pixels keeps its order.
+      __m256i vy = _mm256_loadu_si256((const __m256i*)(y+x));
+      __m256i vb, vr;
+      if (half)
+        {
+          vb = avx2_dup(b+(x>>1));
+          vr = avx2_dup(r+(x>>1));
+        }
+      else
+        {
+          vb = _mm256_loadu_si256((const __m256i*)(b+x));
+          vr = _mm256_loadu_si256((const __m256i*)(r+x));
+        }
+      __m256i rlo, glo, blo, rhi, ghi, bhi;
+      avx2_ycc(_mm256_srai_epi16(_mm256_unpacklo_epi8(vy, vy), 8),
+               _mm256_srai_epi16(_mm256_unpacklo_epi8(vb, vb), 8),
+               _mm256_srai_epi16(_mm256_unpacklo_epi8(vr, vr), 8),
+               rlo, glo, blo);
+      avx2_ycc(_mm256_srai_epi16(_mm256_unpackhi_epi8(vy, vy), 8),
+               _mm256_srai_epi16(_mm256_unpackhi_epi8(vb, vb), 8),
+               _mm256_srai_epi16(_mm256_unpackhi_epi8(vr, vr), 8),
+               rhi, ghi, bhi);
+      __m256i pr = _mm256_packus_epi16(rlo, rhi);
+      __m256i pg = _mm256_packus_epi16(glo, ghi);
+      __m256i pb = _mm256_packus_epi16(blo, bhi);
+      char *d = (char*)(q+x);
+      avx2_store16(d, _mm256_castsi256_si128(pb), 
+                   _mm256_castsi256_si128(pg), _mm256_castsi256_si128(pr));
+      avx2_store16(d+48, _mm256_extracti128_si256(pb, 1),
+                   _mm256_extracti128_si256(pg, 1), 
+                   _mm256_extracti128_si256(pr, 1));
+      x += 32;
+    }
+  return x;
+}
+
+#endif /* MMX_AVX2 */
+#endif /* MMX_SSE2 */
+
+/* Converts a row of YCbCr samples into RGB pixels. */
+static void
+ycc_row(GPixel *q, const signed char *y, 
+        const signed char *b, const signed char *r, 
+        int w, int half, int xoff)
+{
+  if (half && xoff && w>0)
+    {
+      // Align pixels on chroma sample pairs
+      ycc_pixel(q, y[0], b[0], r[0]);
+      q += 1; y += 1; b += 1; r += 1; w -= 1;
+    }
+  int x = 0;
+#ifdef MMX_SSE2
+  if (MMXControl::simdflag > 0)
+    {
+#ifdef MMX_AVX2
+      if (MMXControl::simdflag >= MMXControl::SIMD_AVX2)
+        x = avx2_ycc_row(q, y, b, r, x, w, half);
+#endif
+      x = sse2_ycc_row(q, y, b, r, x, w, half);
+    }
+#endif
+  for (; x<w; x++)
+    ycc_pixel(q+x, y[x], b[x>>half], r[x>>half]);
+}
+
+/* Converts separate YCbCr planes to RGB. */
+void 
+IW44Image::Transform::Decode::YCbCr_to_RGB(GPixel *p, int w, int h, int rowsize,
+                                           const signed char *y, int yrowsize,
+                                           const signed char *cb, 
+                                           const signed char *cr, int crowsize,
+                                           int half, int xoff, int yoff)
+{
+  if (MMXControl::simdflag < 0)
+    MMXControl::enable_simd();
+  half = (half ? 1 : 0);
+  xoff = (half ? (xoff & 1) : 0);
+  yoff = (half ? (yoff & 1) : 0);
+  for (int i=0; i<h; i++,p+=rowsize,y+=yrowsize)
+    {
+      int c = ((i + yoff) >> half) * crowsize;
+      ycc_row(p, y, cb + c, cr + c, w, half, xoff);
     }
 }
 
@@ -163,6 +163,7 @@
 
 
 #include "GSmartPointer.h"
+#include "GThreads.h"
 #include "ZPCodec.h"
 
 
@@ -253,6 +254,7 @@ public:
   struct PrimaryHeader;
   struct SecondaryHeader;
   struct TertiaryHeader;
+  struct Cache;
   enum ImageType {
     GRAY=false,
     COLOR=true };
@@ -315,6 +317,47 @@ public:
       coefficients are stored in a sparse array.  This function tells what
       percentage of bins have been effectively allocated. */
   virtual int get_percent_memory(void) const = 0;
+  // CACHE
+  /** Sets the size of the reconstruction cache.  When this size is not
+      zero, functions #get_bitmap# and #get_pixmap# with a #rect# argument
+      keep the reconstructed segments, as long as they fit in #maxbytes#
+      bytes, and copy them when the same segment is requested again at the
+      same subsampling ratio.  The returned images are identical to those
+      reconstructed without the cache.  The cache is cleared whenever
+      coefficients are decoded or encoded.  Its initial size is read in
+      kilobytes from environment variable #LIBDJVU_IW44_CACHE# and defaults
+      to #0#, which disables the cache.  The cached segments are counted by
+      #get_memory_usage#. */
+  void set_cache_size(unsigned int maxbytes);
+  /** Returns the number of image planes copied from the reconstruction
+      cache by functions #get_bitmap# and #get_pixmap#.  Each color
+      component of a segment counts as one plane. */
+  int get_cache_hits(void) const;
+  /** Returns the number of image planes added to the reconstruction cache
+      by functions #get_bitmap# and #get_pixmap#. */
+  int get_cache_misses(void) const;
+  // DEFERRED DECODING
+  /** Sets the finest subsampling ratio that will be requested from functions
+      #get_bitmap# and #get_pixmap#.  When #subsample# is greater than #1#,
+      function #decode_chunk# stops decoding a chunk as soon as the remaining
+      slices of the chunk only refine wavelet bands that are not used at this
+      subsampling ratio.  These slices are decoded when the next chunk
+      arrives, because the decoder state depends on them, and are dropped by
+      #close_codec#.  The image reconstructed at ratio #subsample# or coarser
+      is identical, but thumbnails no longer pay for decoding the final
+      refinements.  Finer reconstructions are only approximate.  This
+      function must be called before decoding the first chunk. */
+  void set_decode_subsample(int subsample);
+  /** Returns the subsampling ratio set by #set_decode_subsample#. */
+  int get_decode_subsample(void) const;
+  /** Sets the decoding subsampling ratio used by class \Ref{DjVuFile} for
+      the background images.  This ratio applies to the background image,
+      whose resolution is usually a fraction of the page resolution.  The
+      initial value is read from environment variable
+      #LIBDJVU_IW44_SUBSAMPLE# and defaults to #1#. */
+  static void set_default_decode_subsample(int subsample);
+  /** Returns the default decoding subsampling ratio. */
+  static int get_default_decode_subsample(void);
   // CODER
   /** Encodes one data chunk into ByteStream #bs#.  Parameter #parms# controls
       how much data is generated.  The chunk data is written to ByteStream
@@ -346,6 +389,14 @@ public:
       #close_codec# must be called after processing the last chunk in order to
       reset the coder and release the associated memory. */
   virtual void close_codec(void) = 0;
+  /** Compacts the storage of the wavelet coefficients.  This function moves
+      the coefficients into memory blocks of the exact size and packs the
+      buckets whose coefficients fit on eight bits, unless environment
+      variable #LIBDJVU_IW44_PACK# is set to #0#.  The former memory blocks
+      are released without locking.  The caller must therefore ensure that
+      no other thread reconstructs the image or decodes chunks while this
+      function runs.  Decoding more chunks afterwards is allowed. */
+  void compact(void);
   /** Returns the chunk serial number.  This function returns the serial
       number of the last chunk encoded with #encode_chunk# or decoded with
       #decode_chunk#. The first chunk always has serial number #1#. Successive
@@ -373,6 +424,18 @@ protected:
   int cslice;
   int cserial;
   int cbytes;
+  // Deferred slices
+  int dsubsample;
+  GP<ZPCodec> dzp;
+  int dslice;
+  // Reconstruction cache
+  // -- created by the constructor or by set_cache_size
+  //    while holding the monitor.
+  Cache *cache;
+  mutable GMonitor monitor;
+  Cache *get_cache(void) const;
+  unsigned int get_cache_usage(void) const;
+  void flush_cache(void);
 private:
   // Disable assignment semantic
   IW44Image(const IW44Image &ref);
@@ -569,6 +632,32 @@ public:
   // COLOR TRANSFORM
   /*x Converts YCbCr to RGB. */
   static void YCbCr_to_RGB(GPixel *p, int w, int h, int rowsize);
+  /*x Converts separate YCbCr planes to RGB.  Chroma planes have half
+      resolution when #half# is set.  Arguments #xoff# and #yoff# then
+      tell whether the first pixel is an odd one. */
+  static void YCbCr_to_RGB(GPixel *p, int w, int h, int rowsize,
+                           const signed char *y, int yrowsize,
+                           const signed char *cb, const signed char *cr,
+                           int crowsize, int half=0, int xoff=0, int yoff=0);
+};
+
+class IW44Image::Transform::Encode : public IW44Image::Transform
+{
+public:
+ // WAVELET TRANSFORM
+  /*x Forward transform. */
+  static void forward(short *p, int w, int h, int rowsize, int begin, int end);
+  
+  // COLOR TRANSFORM
+  /*x Extracts Y */
+  static void RGB_to_Y(const GPixel *p, int w, int h, int rowsize, 
+                       signed char *out, int outrowsize);
+  /*x Extracts Cb */
+  static void RGB_to_Cb(const GPixel *p, int w, int h, int rowsize, 
+                        signed char *out, int outrowsize);
+  /*x Extracts Cr */
+  static void RGB_to_Cr(const GPixel *p, int w, int h, int rowsize, 
+                        signed char *out, int outrowsize);
 };
 
 //---------------------------------------------------------------
@@ -588,12 +677,18 @@ public:
   void  read_liftblock(const short *coeff, IW44Image::Map *map);
   void  write_liftblock(short *coeff, int bmin=0, int bmax=64) const;
   // sparse array access
+  // -- buckets packed by Map::compact are only visible through
+  //    get(), write_liftblock() and the writable data() accessor.
   const short* data(int n) const;
   short* data(int n, IW44Image::Map *map);
   void   zero(int n);
+  int    is_packed(int n) const;
   // sparse representation
 private:
   short **pdata[4];
+  unsigned short packed[4];
+  short* unpack(int n, IW44Image::Map *map);
+  friend class IW44Image::Map;
 };
 
 //---------------------------------------------------------------
@@ -609,6 +704,7 @@ public:
   Map(int w, int h);
   ~Map();
   // image access
+  // -- fast mode skips the finest level and returns a half size image
   void image(signed char *img8, int rowsize, 
              int pixsep=1, int fast=0);
   void image(int subsample, const GRect &rect, 
@@ -621,10 +717,21 @@ public:
   int bw, bh;
   int nb;
   // coefficient allocation stuff
+  // -- buckets, pointer tables and packed buckets live in separate
+  //    slab chains holding fixed size units.
+  enum { BUCKETS=0, TABLES=1, PACKED=2, NSLABS=3 };
   short *alloc(int n);
   short **allocp(int n);
-  IW44Image::Alloc *chain;
-  int top;
+  void *slab_alloc(int slab, int size);
+  IW44Image::Alloc *chain[NSLABS];
+  // compaction
+  // -- moves the coefficients into exactly sized slabs once coding is
+  //    finished, dropping empty buckets and packing small buckets on
+  //    eight bits when #pack# is set.  A decoder resuming on a
+  //    compacted map first unpacks the packed buckets with #unpack#.
+  void compact(int pack=1);
+  void unpack(void);
+  int npacked;
   // statistics
   int get_bucket_count(void) const;
   unsigned int get_memory_usage(void) const;
@@ -652,7 +759,7 @@ protected:
 public:
   virtual ~Codec();
   // Coding
-  int finish_code_slice(ZPCodec &zp);
+  int finish_code_slice(void);
   virtual int code_slice(ZPCodec &zp) = 0;
   // Data
   IW44Image::Map &map;                  // working map
@@ -676,11 +783,21 @@ public:
   BitContext ctxRoot;
   // helper
   int is_null_slice(int bit, int band);
+  int is_deferrable(int nslices, int nbuckets) const;
   int decode_prepare(int fbucket, int nbucket, IW44Image::Block &blk);
   void decode_buckets(ZPCodec &zp, int bit, int band,
     IW44Image::Block &blk, int fbucket, int nbucket);
 };
 
+class IW44Image::Codec::Decode : public IW44Image::Codec 
+{
+public:
+  // Construction
+  Decode(IW44Image::Map &map) : Codec(map) {}
+  // Coding
+  virtual int code_slice(ZPCodec &zp);
+};
+
 //////////////////////////////////////////////////////
 // DEFINITION OF CHUNK HEADERS
 //////////////////////////////////////////////////////
@@ -723,9 +840,17 @@ IW44Image::Block::data(int n, IW44Image::Map *map)
     pdata[n>>4] = map->allocp(16);
   if (! pdata[n>>4][n &15])
     pdata[n>>4][n &15] = map->alloc(16);
+  else if (is_packed(n))
+    return unpack(n, map);
   return pdata[n>>4][n&15];
 }
 
+inline int
+IW44Image::Block::is_packed(int n) const
+{
+  return (packed[n>>4] >> (n&15)) & 1;
+}
+
 inline short 
 IW44Image::Block::get(int n) const
 {
@@ -733,6 +858,11 @@ IW44Image::Block::get(int n) const
   const short *d = data(n1);
   if (! d)
     return 0;
+  if (is_packed(n1))
+    {
+      const signed char *b = (const signed char*)d;
+      return (short)(b[n&15] * (1 << b[16]));
+    }
   return d[n&15];
 }
 
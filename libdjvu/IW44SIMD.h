@@ -0,0 +1,183 @@
+//C-  -*- C++ -*-
+//C- -------------------------------------------------------------------
+//C- DjVuLibre-3.5
+//C- Copyright (c) 2002  Leon Bottou and Yann Le Cun.
+//C- Copyright (c) 2001  AT&T
+//C-
+//C- This software is subject to, and may be distributed under, the
+//C- GNU General Public License, either Version 2 of the license,
+//C- or (at your option) any later version. The license should have
+//C- accompanied the software or you may obtain a copy of the license
+//C- from the Free Software Foundation at http://www.fsf.org .
+//C-
+//C- This program is distributed in the hope that it will be useful,
+//C- but WITHOUT ANY WARRANTY; without even the implied warranty of
+//C- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//C- GNU General Public License for more details.
+//C- 
+//C- DjVuLibre-3.5 is derived from the DjVu(r) Reference Library from
+//C- Lizardtech Software.  Lizardtech Software has authorized us to
+//C- replace the original DjVu(r) Reference Library notice by the following
+//C- text (see doc/lizard2002.djvu and doc/lizardtech2007.djvu):
+//C-
+//C-  ------------------------------------------------------------------
+//C- | DjVu (r) Reference Library (v. 3.5)
+//C- | Copyright (c) 1999-2001 LizardTech, Inc. All Rights Reserved.
+//C- | The DjVu Reference Library is protected by U.S. Pat. No.
+//C- | 6,058,214 and patents pending.
+//C- |
+//C- | This software is subject to, and may be distributed under, the
+//C- | GNU General Public License, either Version 2 of the license,
+//C- | or (at your option) any later version. The license should have
+//C- | accompanied the software or you may obtain a copy of the license
+//C- | from the Free Software Foundation at http://www.fsf.org .
+//C- |
+//C- | The computer code originally released by LizardTech under this
+//C- | license and unmodified by other parties is deemed "the LIZARDTECH
+//C- | ORIGINAL CODE."  Subject to any third party intellectual property
+//C- | claims, LizardTech grants recipient a worldwide, royalty-free, 
+//C- | non-exclusive license to make, use, sell, or otherwise dispose of 
+//C- | the LIZARDTECH ORIGINAL CODE or of programs derived from the 
+//C- | LIZARDTECH ORIGINAL CODE in compliance with the terms of the GNU 
+//C- | General Public License.   This grant only confers the right to 
+//C- | infringe patent claims underlying the LIZARDTECH ORIGINAL CODE to 
+//C- | the extent such infringement is reasonably necessary to enable 
+//C- | recipient to make, have made, practice, sell, or otherwise dispose 
+//C- | of the LIZARDTECH ORIGINAL CODE (or portions thereof) and not to 
+//C- | any greater extent that may be necessary to utilize further 
+//C- | modifications or combinations.
+//C- |
+//C- | The LIZARDTECH ORIGINAL CODE is provided "AS IS" WITHOUT WARRANTY
+//C- | OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+//C- | TO ANY WARRANTY OF NON-INFRINGEMENT, OR ANY IMPLIED WARRANTY OF
+//C- | MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE.
+//C- +------------------------------------------------------------------
+
+#ifndef _IW44SIMD_H_
+#define _IW44SIMD_H_
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+#include "MMX.h"
+
+// This internal header holds the SSE2/AVX2 helpers shared by the
+// forward wavelet transform (IW44EncodeCodec.cpp) and the backward
+// wavelet transform (IW44Image.cpp).  They compute the same values
+// as the scalar code, using 32 bits intermediate values truncated
+// to 16 bits like the scalar assignments.
+
+#ifdef HAVE_NAMESPACES
+namespace DJVU {
+# ifdef NOT_DEFINED // Just to fool emacs c++ mode
+}
+#endif
+#endif
+
+#ifdef MMX_SSE2
+
+// Truncates 32 bits integers to 16 bits and packs them.
+static inline __m128i
+sse2_pack_trunc(__m128i lo, __m128i hi)
+{
+  lo = _mm_srai_epi32(_mm_slli_epi32(lo, 16), 16);
+  hi = _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16);
+  return _mm_packs_epi32(lo, hi);
+}
+
+// Sign extends the even samples of eight shorts.
+static inline __m128i
+sse2_even(const short *p)
+{
+  __m128i v = _mm_loadu_si128((const __m128i*)p);
+  return _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+}
+
+// Vertical lifting step shared by all vertical filters:
+// q[0] += sign * ((9*(q[-s]+q[s]) - q[-s3] - q[s3] + r) >> n)
+// for eight samples at a time while q+7 < e.
+static inline void
+sse2_vfilter ( short* &q, short* e, int s, int s3, int r, int n, int sign )
+{
+  const __m128i w9 = _mm_set1_epi16(9);
+  const __m128i w1 = _mm_set1_epi16(1);
+  const __m128i rr = _mm_set1_epi32(r);
+  const __m128i nn = _mm_cvtsi32_si128(n);
+  while (q+7 < e)
+    {
+      __m128i b = _mm_loadu_si128((const __m128i*)(q-s));
+      __m128i c = _mm_loadu_si128((const __m128i*)(q+s));
+      __m128i a = _mm_loadu_si128((const __m128i*)(q-s3));
+      __m128i d = _mm_loadu_si128((const __m128i*)(q+s3));
+      __m128i lo = _mm_sub_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(b,c), w9),
+                                 _mm_madd_epi16(_mm_unpacklo_epi16(a,d), w1));
+      __m128i hi = _mm_sub_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(b,c), w9),
+                                 _mm_madd_epi16(_mm_unpackhi_epi16(a,d), w1));
+      lo = _mm_sra_epi32(_mm_add_epi32(lo, rr), nn);
+      hi = _mm_sra_epi32(_mm_add_epi32(hi, rr), nn);
+      __m128i x = sse2_pack_trunc(lo, hi);
+      __m128i p = _mm_loadu_si128((const __m128i*)q);
+      p = (sign < 0) ? _mm_sub_epi16(p, x) : _mm_add_epi16(p, x);
+      _mm_storeu_si128((__m128i*)q, p);
+      q += 8;
+    }
+}
+
+#ifdef MMX_AVX2
+
+static inline MMX_AVX2_TARGET __m256i
+avx2_pack_trunc(__m256i lo, __m256i hi)
+{
+  lo = _mm256_srai_epi32(_mm256_slli_epi32(lo, 16), 16);
+  hi = _mm256_srai_epi32(_mm256_slli_epi32(hi, 16), 16);
+  return _mm256_packs_epi32(lo, hi);
+}
+
+static inline MMX_AVX2_TARGET __m256i
+avx2_even(const short *p)
+{
+  __m256i v = _mm256_loadu_si256((const __m256i*)p);
+  return _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16);
+}
+
+// Same as sse2_vfilter with sixteen samples at a time.  The unpacks
+// interleave within 128 bits lanes and the packs gather within the
+// same lanes, so the samples come back in their original order.
+static inline MMX_AVX2_TARGET void
+avx2_vfilter ( short* &q, short* e, int s, int s3, int r, int n, int sign )
+{
+  const __m256i w9 = _mm256_set1_epi16(9);
+  const __m256i w1 = _mm256_set1_epi16(1);
+  const __m256i rr = _mm256_set1_epi32(r);
+  const __m128i nn = _mm_cvtsi32_si128(n);
+  while (q+15 < e)
+    {
+      __m256i b = _mm256_loadu_si256((const __m256i*)(q-s));
+      __m256i c = _mm256_loadu_si256((const __m256i*)(q+s));
+      __m256i a = _mm256_loadu_si256((const __m256i*)(q-s3));
+      __m256i d = _mm256_loadu_si256((const __m256i*)(q+s3));
+      __m256i lo = _mm256_sub_epi32(
+                   _mm256_madd_epi16(_mm256_unpacklo_epi16(b,c), w9),
+                   _mm256_madd_epi16(_mm256_unpacklo_epi16(a,d), w1));
+      __m256i hi = _mm256_sub_epi32(
+                   _mm256_madd_epi16(_mm256_unpackhi_epi16(b,c), w9),
+                   _mm256_madd_epi16(_mm256_unpackhi_epi16(a,d), w1));
+      lo = _mm256_sra_epi32(_mm256_add_epi32(lo, rr), nn);
+      hi = _mm256_sra_epi32(_mm256_add_epi32(hi, rr), nn);
+      __m256i x = avx2_pack_trunc(lo, hi);
+      __m256i p = _mm256_loadu_si256((const __m256i*)q);
+      p = (sign < 0) ? _mm256_sub_epi16(p, x) : _mm256_add_epi16(p, x);
+      _mm256_storeu_si256((__m256i*)q, p);
+      q += 16;
+    }
+}
+
+#endif /* MMX_AVX2 */
+#endif /* MMX_SSE2 */
+
+#ifdef HAVE_NAMESPACES
+}
+# ifndef NOT_USING_DJVU_NAMESPACE
+using namespace DJVU;
+# endif
+#endif
+#endif
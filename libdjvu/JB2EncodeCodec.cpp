@@ -298,17 +298,36 @@ JB2Dict::JB2Codec::Encode::code_bitmap_directly(
   unsigned char *up2, unsigned char *up1, unsigned char *up0 )
 {
       ZPCodec &zp=*gzp;
+      // packed rows up2 and up1
+      const int nw = (dw + 31) / 32 + 1;
+      unsigned int *pup2 = alloc_row_bits(2 * nw);
+      unsigned int *pup1 = pup2 + nw;
+      pack_row(pup2, up2, dw);
+      pack_row(pup1, up1, dw);
       // iterate on rows (encoding)
       while (dy >= 0)
         {
           int context=get_direct_context(up2, up1, up0, 0);
-          for (int dx=0;dx < dw;)
+          for (int dx=0, k=0; dx < dw; k++)
             {
-              int n = up0[dx++];
-              zp.encoder(n, bitdist[context]);
-              context=shift_direct_context(context, n, up2, up1, up0, dx);
+              uint64_t w2 = get_row_window(pup2, k) << 2;
+              uint64_t w1 = get_row_window(pup1, k) << 3;
+              const int dn = (dw - dx < 32) ? dw - dx : 32;
+              for (int i = 0; i < dn; i++)
+                {
+                  const int n = up0[dx++];
+                  zp.encoder(n, bitdist[context]);
+                  context = ((context << 1) & 0x37a) |
+                    ((int)(w1 >> 63) << 2) | ((int)(w2 >> 63) << 7) | n;
+                  w1 <<= 1;
+                  w2 <<= 1;
+                }
             }
           // next row
+          unsigned int *ptmp = pup2;
+          pup2 = pup1;
+          pup1 = ptmp;
+          pack_row(pup1, up0, dw);
           dy -= 1;
           up2 = up1;
           up1 = up0;
@@ -325,23 +344,52 @@ JB2Dict::JB2Codec::Encode::code_bitmap_by_cross_coding (GBitmap &bm, GBitmap &cb
   unsigned char *xup0, unsigned char *xdn1 )
 {
       ZPCodec &zp=*gzp;
+      // packed rows up1, xup1, xup0 and xdn1
+      const int nw = (dw + 33) / 32 + 1;
+      unsigned int *pup1 = alloc_row_bits(4 * nw);
+      unsigned int *pxup1 = pup1 + nw, *pxup0 = pxup1 + nw;
+      unsigned int *pxdn1 = pxup0 + nw;
+      pack_row(pup1, up1, dw);
+      pack_row(pxup1, xup1, dw + 2);
+      pack_row(pxup0, xup0, dw + 2);
+      pack_row(pxdn1, xdn1, dw + 2);
       // iterate on rows (encoding)
       while (dy >= 0)
         {
           int context=get_cross_context(up1, up0, xup1, xup0, xdn1, 0);
-          for(int dx=0;dx < dw;)
+          for(int dx=0, k=0; dx < dw; k++)
             {
-              const int n = up0[dx++];
-              zp.encoder(n, cbitdist[context]);
-              context=shift_cross_context(context, n,  
-                                  up1, up0, xup1, xup0, xdn1, dx);
+              uint64_t w1 = get_row_window(pup1, k) << 2;
+              uint64_t xw1 = get_row_window(pxup1, k) << 1;
+              uint64_t xw0 = get_row_window(pxup0, k) << 2;
+              uint64_t xd1 = get_row_window(pxdn1, k) << 2;
+              const int dn = (dw - dx < 32) ? dw - dx : 32;
+              for (int i = 0; i < dn; i++)
+                {
+                  const int n = up0[dx++];
+                  zp.encoder(n, cbitdist[context]);
+                  context = ((context << 1) & 0x636) |
+                    ((int)(w1 >> 63) << 8) | ((int)(xw1 >> 63) << 6) |
+                    ((int)(xw0 >> 63) << 3) | (int)(xd1 >> 63) | (n << 7);
+                  w1 <<= 1;
+                  xw1 <<= 1;
+                  xw0 <<= 1;
+                  xd1 <<= 1;
+                }
             }
           // next row
+          pack_row(pup1, up0, dw);
           up1 = up0;
           up0 = bm[--dy];
           xup1 = xup0;
           xup0 = xdn1;
           xdn1 = cbm[(--cy)-1] + xd2c;
+          unsigned int *ptmp = pxup1;
+          pxup1 = pxup0;
+          pxup0 = pxdn1;
+          pxdn1 = ptmp;
+          if (dy >= 0)
+            pack_row(pxdn1, xdn1, dw + 2);
         }
 }
 
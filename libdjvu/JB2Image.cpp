@@ -245,7 +245,9 @@ JB2Dict::decode(const GP<ByteStream> &gbs, JB2DecoderCallback *cb, void *arg)
 
 
 JB2Image::JB2Image(void)
-  : width(0), height(0), reproduce_old_bug(false)
+  : width(0), height(0), 
+    index_cell(0), index_columns(0), index_rows(0),
+    reproduce_old_bug(false)
 {
 }
 
@@ -254,6 +256,9 @@ JB2Image::init(void)
 {
   width = height = 0;
   blits.empty();
+  index_cell = 0;
+  index_start.empty();
+  index_blits.empty();
   JB2Dict::init();
 }
 
@@ -263,6 +268,7 @@ JB2Image::get_memory_usage() const
   unsigned int usage = JB2Dict::get_memory_usage();
   usage += sizeof(JB2Image) - sizeof(JB2Dict);
   usage += sizeof(JB2Blit) * blits.size();
+  usage += sizeof(int) * (index_start.size() + index_blits.size());
   return usage;
 }
 
@@ -281,9 +287,131 @@ JB2Image::add_blit(const JB2Blit &blit)
   int index = blits.size();
   blits.touch(index);
   blits[index] = blit;
+  index_cell = 0;
   return index;
 }
 
+static inline int
+index_cell_of(int v, int cell, int n)
+{
+  if (v < 0)
+    return 0;
+  v = v / cell;
+  return (v < n) ? v : n - 1;
+}
+
+void
+JB2Image::build_blit_index(void) const
+{
+  // Choose cells holding about one or two blits each
+  int nblits = blits.size();
+  int cell = 64;
+  while (cell < 8192 && (width/cell+1) * (height/cell+1) > nblits + 1)
+    cell += cell;
+  int ncolumns = width / cell + 1;
+  int nrows = height / cell + 1;
+  int ncells = ncolumns * nrows;
+  // Count blits per cell
+  index_start.resize(0, ncells);
+  int *start = index_start;
+  memset(start, 0, sizeof(int) * (ncells + 1));
+  int blitno;
+  for (blitno = 0; blitno < nblits; blitno++)
+    {
+      const JB2Blit *pblit = get_blit(blitno);
+      const JB2Shape &pshape = get_shape(pblit->shapeno);
+      if (! pshape.bits)
+        continue;
+      int c0 = index_cell_of(pblit->left, cell, ncolumns);
+      int c1 = index_cell_of(pblit->left + pshape.bits->columns(), cell, ncolumns);
+      int r0 = index_cell_of(pblit->bottom, cell, nrows);
+      int r1 = index_cell_of(pblit->bottom + pshape.bits->rows(), cell, nrows);
+      for (int r = r0; r <= r1; r++)
+        for (int c = c0; c <= c1; c++)
+          start[r * ncolumns + c + 1] += 1;
+    }
+  for (int k = 0; k < ncells; k++)
+    start[k + 1] += start[k];
+  // Fill cells in increasing blit order
+  index_blits.resize(0, start[ncells] - 1);
+  int *entries = index_blits;
+  GTArray<int> afill(0, ncells - 1);
+  int *fill = afill;
+  memcpy(fill, start, sizeof(int) * ncells);
+  for (blitno = 0; blitno < nblits; blitno++)
+    {
+      const JB2Blit *pblit = get_blit(blitno);
+      const JB2Shape &pshape = get_shape(pblit->shapeno);
+      if (! pshape.bits)
+        continue;
+      int c0 = index_cell_of(pblit->left, cell, ncolumns);
+      int c1 = index_cell_of(pblit->left + pshape.bits->columns(), cell, ncolumns);
+      int r0 = index_cell_of(pblit->bottom, cell, nrows);
+      int r1 = index_cell_of(pblit->bottom + pshape.bits->rows(), cell, nrows);
+      for (int r = r0; r <= r1; r++)
+        for (int c = c0; c <= c1; c++)
+          entries[fill[r * ncolumns + c]++] = blitno;
+    }
+  index_columns = ncolumns;
+  index_rows = nrows;
+  index_cell = cell;
+}
+
+void
+JB2Image::select_blits(const GRect &rect, GTArray<int> &blitnos) const
+{
+  blitnos.empty();
+  if (rect.isempty())
+    return;
+  GMonitorLock lock(&index_monitor);
+  if (! index_cell)
+    build_blit_index();
+  int cell = index_cell;
+  int c0 = index_cell_of(rect.xmin, cell, index_columns);
+  int c1 = index_cell_of(rect.xmax, cell, index_columns);
+  int r0 = index_cell_of(rect.ymin, cell, index_rows);
+  int r1 = index_cell_of(rect.ymax, cell, index_rows);
+  const int *start = index_start;
+  const int *entries = index_blits;
+  int n = 0;
+  if (2 * (c1 - c0 + 1) * (r1 - r0 + 1) > index_columns * index_rows)
+    {
+      // Most of the image: all blits with a bitmap
+      blitnos.resize(0, get_blit_count() - 1);
+      for (int blitno = 0; blitno < get_blit_count(); blitno++)
+        if (get_shape(get_blit(blitno)->shapeno).bits)
+          blitnos[n++] = blitno;
+    }
+  else
+    {
+      // Gather the cells, then sort and remove duplicates
+      for (int r = r0; r <= r1; r++)
+        n += start[r * index_columns + c1 + 1] - start[r * index_columns + c0];
+      if (n <= 0)
+        return;
+      blitnos.resize(0, n - 1);
+      int *p = blitnos;
+      for (int r = r0; r <= r1; r++)
+        for (int k = start[r * index_columns + c0];
+             k < start[r * index_columns + c1 + 1]; k++)
+          *p++ = entries[k];
+      if (r1 > r0 || c1 > c0)
+        {
+          blitnos.sort();
+          p = blitnos;
+          int m = 1;
+          for (int k = 1; k < n; k++)
+            if (p[k] != p[m - 1])
+              p[m++] = p[k];
+          n = m;
+        }
+    }
+  if (n > 0)
+    blitnos.resize(0, n - 1);
+  else
+    blitnos.empty();
+}
+
 GP<GBitmap>
 JB2Image::get_bitmap(int subsample, int align) const
 {
@@ -294,12 +422,11 @@ JB2Image::get_bitmap(int subsample, int align) const
   int border = ((swidth + align - 1) & ~(align - 1)) - swidth;
   GP<GBitmap> bm = GBitmap::create(sheight, swidth, border);
   bm->set_grays(1+subsample*subsample);
+  JB2ShapeCache cache(*this, subsample);
   for (int blitno = 0; blitno < get_blit_count(); blitno++)
     {
       const JB2Blit *pblit = get_blit(blitno);
-      const JB2Shape  &pshape = get_shape(pblit->shapeno);
-      if (pshape.bits)
-        bm->blit(pshape.bits, pblit->left, pblit->bottom, subsample);
+      cache.blit(*bm, pblit->shapeno, pblit->left, pblit->bottom);
     }
   return bm;
 }
@@ -316,16 +443,67 @@ JB2Image::get_bitmap(const GRect &rect, int subsample, int align, int dispy) con
   int border = ((swidth + align - 1) & ~(align - 1)) - swidth;
   GP<GBitmap> bm = GBitmap::create(sheight, swidth, border);
   bm->set_grays(1+subsample*subsample);
-  for (int blitno = 0; blitno < get_blit_count(); blitno++)
+  GTArray<int> blitnos;
+  select_blits(GRect(rxmin, rymin-dispy, swidth*subsample, sheight*subsample),
+               blitnos);
+  JB2ShapeCache cache(*this, subsample);
+  for (int i = 0; i < blitnos.size(); i++)
     {
-      const JB2Blit *pblit = get_blit(blitno);
-      const JB2Shape  &pshape = get_shape(pblit->shapeno);
-      if (pshape.bits)
-        bm->blit(pshape.bits, pblit->left-rxmin, pblit->bottom-rymin+dispy, subsample);
+      const JB2Blit *pblit = get_blit(blitnos[i]);
+      cache.blit(*bm, pblit->shapeno, pblit->left-rxmin, pblit->bottom-rymin+dispy);
     }
   return bm;
 }
 
+JB2ShapeCache::JB2ShapeCache(const JB2Dict &dict, int subsample)
+  : dict(dict), subsample(subsample)
+{
+}
+
+void
+JB2ShapeCache::blit(GBitmap &bm, int shapeno, int x, int y)
+{
+  const JB2Shape &jshp = dict.get_shape(shapeno);
+  GBitmap *bits = jshp.bits;
+  if (! bits)
+    return;
+  if (subsample == 1)
+    {
+      bm.blit(bits, x, y);
+      return;
+    }
+  if (x >= (int)bm.columns() * subsample || y >= (int)bm.rows() * subsample ||
+      x + (int)bits->columns() < 0 || y + (int)bits->rows() < 0 )
+    return;
+  // Split position into reduced position and phase
+  int qx = x / subsample;
+  int qy = y / subsample;
+  if (qx * subsample > x) qx -= 1;
+  if (qy * subsample > y) qy -= 1;
+  int px = x - qx * subsample;
+  int py = y - qy * subsample;
+  int key = (shapeno * subsample + py) * subsample + px;
+  GPosition pos = reduced.contains(key);
+  if (! pos)
+    {
+      // First use: blit directly and remember the phase
+      reduced[key] = 0;
+      bm.blit(bits, x, y, subsample);
+      return;
+    }
+  GP<GBitmap> &rbits = reduced[pos];
+  if (! rbits)
+    {
+      // Second use: reduce the shape once for this phase
+      int rw = (px + bits->columns() + subsample - 1) / subsample;
+      int rh = (py + bits->rows() + subsample - 1) / subsample;
+      rbits = GBitmap::create(rh, rw);
+      rbits->set_grays(1 + subsample * subsample);
+      rbits->blit(bits, px, py, subsample);
+    }
+  bm.blit(rbits, qx, qy);
+}
+
 void 
 JB2Image::decode(const GP<ByteStream> &gbs, JB2DecoderCallback *cb, void *arg)
 {
@@ -403,7 +581,9 @@ JB2Dict::JB2Codec::JB2Codec(const bool xencoding)
     rel_loc_y_current(0),
     rel_loc_y_last(0),
     rel_size_x(0),
-    rel_size_y(0)
+    rel_size_y(0),
+    rowbits(0),
+    growbits(rowbits)
 {
   memset(bitdist, 0, sizeof(bitdist));
   memset(cbitdist, 0, sizeof(cbitdist));
@@ -801,6 +981,45 @@ JB2Dict::JB2Codec::Decode::code_relative_mark_size(GBitmap &bm, int cw, int ch,
 
 
 
+// PACKED ROWS
+// The coding loops keep the pixels entering the contexts in bit registers
+// loaded from packed copies of the neighbouring rows.  Packed rows hold one
+// bit per pixel, most significant bit first, and 32 pixels per word.  The
+// window for word #k# holds pixels #32*k# to #32*k+63#.
+
+unsigned int *
+JB2Dict::JB2Codec::alloc_row_bits(const int nwords)
+{
+  if ((int)growbits < nwords)
+    growbits.resize(nwords);
+  memset(rowbits, 0, nwords * sizeof(unsigned int));
+  return rowbits;
+}
+
+void
+JB2Dict::JB2Codec::pack_row(unsigned int *bits, const unsigned char *row, const int n)
+{
+  unsigned int w = 0;
+  int nb = 0;
+  int x = 0;
+  for (; x + 8 <= n; x += 8)
+    {
+      const unsigned char *r = row + x;
+      w = (w << 8) | (r[0] << 7) | (r[1] << 6) | (r[2] << 5) |
+        (r[3] << 4) | (r[4] << 3) | (r[5] << 2) | (r[6] << 1) | r[7];
+      if ((nb += 8) == 32)
+        {
+          *bits++ = w;
+          w = nb = 0;
+        }
+    }
+  for (; x < n; x++, nb++)
+    w = (w << 1) | row[x];
+  if (nb)
+    *bits = w << (32 - nb);
+}
+
+
 // CODE BITMAP DIRECTLY
 
 void 
@@ -821,21 +1040,43 @@ JB2Dict::JB2Codec::Decode::code_bitmap_directly(
   unsigned char *up2, unsigned char *up1, unsigned char *up0 )
 {
       ZPCodec &zp=*gzp;
+      // packed rows up2, up1 and up0
+      const int nw = (dw + 31) / 32 + 1;
+      unsigned int *pup2 = alloc_row_bits(3 * nw);
+      unsigned int *pup1 = pup2 + nw, *pup0 = pup1 + nw;
+      pack_row(pup2, up2, dw);
+      pack_row(pup1, up1, dw);
       // iterate on rows (decoding)      
       while (dy >= 0)
         {
           int context=get_direct_context(up2, up1, up0, 0);
-          for(int dx=0;dx < dw;)
+          for(int dx=0, k=0; dx < dw; k++)
             {
-              int n = zp.decoder(bitdist[context]);
-              up0[dx++] = n;
-              context=shift_direct_context(context, n, up2, up1, up0, dx);
+              uint64_t w2 = get_row_window(pup2, k) << 2;
+              uint64_t w1 = get_row_window(pup1, k) << 3;
+              const int dn = (dw - dx < 32) ? dw - dx : 32;
+              unsigned int w0 = 0;
+              for (int i = 0; i < dn; i++)
+                {
+                  const int n = zp.decoder(bitdist[context]);
+                  up0[dx++] = n;
+                  w0 = (w0 << 1) | n;
+                  context = ((context << 1) & 0x37a) |
+                    ((int)(w1 >> 63) << 2) | ((int)(w2 >> 63) << 7) | n;
+                  w1 <<= 1;
+                  w2 <<= 1;
+                }
+              pup0[k] = w0 << (32 - dn);
             }
           // next row
           dy -= 1;
           up2 = up1;
           up1 = up0;
           up0 = bm[dy];
+          unsigned int *ptmp = pup2;
+          pup2 = pup1;
+          pup1 = pup0;
+          pup0 = ptmp;
         }
 #ifndef NDEBUG
       bm.check_border();
@@ -890,17 +1131,42 @@ JB2Dict::JB2Codec::Decode::code_bitmap_by_cross_coding (GBitmap &bm, GBitmap &cb
   unsigned char *xup0, unsigned char *xdn1 )
 {
       ZPCodec &zp=*gzp;
+      // packed rows up1, up0, xup1, xup0 and xdn1
+      const int nw = (dw + 33) / 32 + 1;
+      unsigned int *pup1 = alloc_row_bits(5 * nw);
+      unsigned int *pup0 = pup1 + nw, *pxup1 = pup0 + nw;
+      unsigned int *pxup0 = pxup1 + nw, *pxdn1 = pxup0 + nw;
+      pack_row(pup1, up1, dw);
+      pack_row(pxup1, xup1, dw + 2);
+      pack_row(pxup0, xup0, dw + 2);
+      pack_row(pxdn1, xdn1, dw + 2);
       // iterate on rows (decoding)      
       while (dy >= 0)
         {
           int context=get_cross_context(
                             up1, up0, xup1, xup0, xdn1, 0);
-          for(int dx=0;dx < dw;)
+          for(int dx=0, k=0; dx < dw; k++)
             {
-              const int n = zp.decoder(cbitdist[context]);
-              up0[dx++] = n;
-              context=shift_cross_context(context, n,  
-                                  up1, up0, xup1, xup0, xdn1, dx);
+              uint64_t w1 = get_row_window(pup1, k) << 2;
+              uint64_t xw1 = get_row_window(pxup1, k) << 1;
+              uint64_t xw0 = get_row_window(pxup0, k) << 2;
+              uint64_t xd1 = get_row_window(pxdn1, k) << 2;
+              const int dn = (dw - dx < 32) ? dw - dx : 32;
+              unsigned int w0 = 0;
+              for (int i = 0; i < dn; i++)
+                {
+                  const int n = zp.decoder(cbitdist[context]);
+                  up0[dx++] = n;
+                  w0 = (w0 << 1) | n;
+                  context = ((context << 1) & 0x636) |
+                    ((int)(w1 >> 63) << 8) | ((int)(xw1 >> 63) << 6) |
+                    ((int)(xw0 >> 63) << 3) | (int)(xd1 >> 63) | (n << 7);
+                  w1 <<= 1;
+                  xw1 <<= 1;
+                  xw0 <<= 1;
+                  xd1 <<= 1;
+                }
+              pup0[k] = w0 << (32 - dn);
             }
           // next row
           up1 = up0;
@@ -908,6 +1174,15 @@ JB2Dict::JB2Codec::Decode::code_bitmap_by_cross_coding (GBitmap &bm, GBitmap &cb
           xup1 = xup0;
           xup0 = xdn1;
           xdn1 = cbm[(--cy)-1] + xd2c;
+          unsigned int *ptmp = pup1;
+          pup1 = pup0;
+          pup0 = ptmp;
+          ptmp = pxup1;
+          pxup1 = pxup0;
+          pxup0 = pxdn1;
+          pxdn1 = ptmp;
+          if (dy >= 0)
+            pack_row(pxdn1, xdn1, dw + 2);
 #ifndef NDEBUG
           bm.check_border();
 #endif
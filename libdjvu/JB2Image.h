@@ -170,6 +170,7 @@
 
 #include "GString.h"
 #include "ZPCodec.h"
+#include "GThreads.h"
 
 
 #ifdef HAVE_NAMESPACES
@@ -395,7 +396,9 @@ public:
   int get_blit_count(void) const;
   /** Returns a pointer to blit #blitno#.
       The returned pointer directly points into the blit array.
-      This pointer can be used for reading or writing the blit data. */
+      This pointer can be used for reading or writing the blit data.
+      Callers changing the position or the shape of a blit must then
+      discard the spatial index with \Ref{reset_blit_index}. */
   JB2Blit *get_blit(int blitno);
   /** Returns a constant pointer to blit #blitno#.
       The returned pointer directly points into the shape array.
@@ -406,6 +409,21 @@ public:
       shape subscript #blit.shapeno# must actually designate an already
       existing shape. */
   int  add_blit(const JB2Blit &blit);
+  /** Finds the blits located near rectangle #rect#.  This function stores
+      into array #blitnos# the increasing subscripts of all blits whose shape
+      bitmap is not null and whose bounding box intersects or touches
+      rectangle #rect#, possibly with a few more blits located nearby.
+      Rectangle #rect# is expressed in full resolution image coordinates.
+      The first call builds a spatial index dividing the image into square
+      cells listing the blits that overlap them.  This index is discarded
+      when blits are added.  It must be discarded explicitly with
+      \Ref{reset_blit_index} when blits are modified through the non
+      constant version of \Ref{get_blit} or when shape bitmaps are
+      replaced.  Concurrent calls on the same image are serialized by a
+      monitor owned by the image. */
+  void select_blits(const GRect &rect, GTArray<int> &blitnos) const;
+  /** Discards the spatial index built by \Ref{select_blits}. */
+  void reset_blit_index(void);
 
   // MEMORY OPTIMIZATION
   /** Returns the total memory used by the JB2Image.
@@ -431,6 +449,14 @@ private:
   int width;
   int height;
   GTArray<JB2Blit> blits;
+  // Spatial index of blits (see select_blits)
+  mutable int index_cell;
+  mutable int index_columns;
+  mutable int index_rows;
+  mutable GTArray<int> index_start;
+  mutable GTArray<int> index_blits;
+  mutable GMonitor index_monitor;
+  void build_blit_index(void) const;
 public:
   /** Reproduces a old bug.  Setting this flag may be necessary for accurately
       decoding DjVu files with version smaller than #18#.  The default value
@@ -439,6 +465,34 @@ public:
 };
 
 
+/** Blitting shapes with a subsampling ratio.  Rendering a blit with a
+    subsampling ratio greater than one accumulates the pixels of the
+    full resolution shape into each pixel of the reduced image.  The result
+    only depends on the shape and on the position of the blit modulo the
+    subsampling ratio.  A #JB2ShapeCache# object remembers the reduced
+    bitmaps computed for each shape and each of these sub-pixel phases.
+    Shapes used more than once with the same phase are reduced only once
+    and then added to the destination bitmap at full speed.  The result is
+    identical to calling \Ref{GBitmap::blit} with the subsampling ratio.
+    Such an object is meant to be used for the duration of a single
+    rendering operation with a fixed subsampling ratio. */
+
+class DJVUAPI JB2ShapeCache
+{
+public:
+  /** Constructs a cache for the shapes of #dict# and ratio #subsample#. */
+  JB2ShapeCache(const JB2Dict &dict, int subsample);
+  /** Adds shape #shapeno# into bitmap #bm#.  Coordinates #x# and #y# are
+      the full resolution position of the bottom left corner of the shape
+      relative to the bottom left corner of #bm#. */
+  void blit(GBitmap &bm, int shapeno, int x, int y);
+private:
+  const JB2Dict &dict;
+  int subsample;
+  GMap<int, GP<GBitmap> > reduced;
+};
+
+
 
 // JB2DICT INLINE FUNCTIONS
 
@@ -488,6 +542,12 @@ JB2Image::get_blit(int blitno)
   return & blits[blitno];
 }
 
+inline void
+JB2Image::reset_blit_index(void)
+{
+  index_cell = 0;
+}
+
 inline const JB2Blit *
 JB2Image::get_blit(int blitno) const
 {
@@ -635,6 +695,9 @@ protected:
     unsigned char const * const up0, unsigned char const * const xup1,
     unsigned char const * const xup0, unsigned char const * const xdn1,
     const int column );
+  static void pack_row(unsigned int *bits, const unsigned char *row, const int n);
+  static uint64_t get_row_window(const unsigned int *bits, const int k);
+  unsigned int *alloc_row_bits(const int nwords);
 
   virtual bool CodeBit(const bool bit, BitContext &ctx) = 0;
   virtual void code_comment(GUTF8String &comment) = 0;
@@ -709,6 +772,9 @@ protected:
   // Code bitmaps
   BitContext bitdist[1024];
   BitContext cbitdist[2048];
+  // Packed rows
+  unsigned int *rowbits;
+  GPBuffer<unsigned int> growbits;
 };
 
 inline void
@@ -793,6 +859,12 @@ JB2Dict::JB2Codec::shift_cross_context( const int context, const int n,
               (n << 7)             );
 }
 
+inline uint64_t
+JB2Dict::JB2Codec::get_row_window(const unsigned int *bits, const int k)
+{
+  return ((uint64_t)bits[k] << 32) | bits[k+1];
+}
+
 // ---------- THE END
 
 #ifdef HAVE_NAMESPACES
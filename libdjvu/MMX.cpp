@@ -65,7 +65,7 @@
 #include <stddef.h>
 #include <stdlib.h>
 
-#ifdef MMX
+#if defined(MMX) || defined(MMX_SSE2)
 # ifdef HAVE_CPUID_H
 #  include <cpuid.h>
 # endif
@@ -162,6 +162,59 @@ MMXControl::enable_mmx()
 }
 
 
+// ----------------------------------------
+// SSE2/AVX2 ENABLE/DISABLE
+
+#if defined(MMX_SSE2) && !defined(DISABLE_SIMD)
+int MMXControl::simdflag = -1;
+#else
+int MMXControl::simdflag = 0;
+#endif
+
+int 
+MMXControl::disable_simd()
+{
+  simdflag = SIMD_NONE;
+  return simdflag;
+}
+
+int 
+MMXControl::enable_simd()
+{
+  const char *envvar = getenv("LIBDJVU_DISABLE_SIMD");
+  if (envvar && envvar[0] && envvar[0]!='0')
+    return ((simdflag = SIMD_NONE));
+  int level = SIMD_NONE;
+#if defined(MMX_SSE2) && defined(__GNUC__) && defined(HAVE_CPUID_H)
+  unsigned int eax,ebx,ecx,edx;
+  if (__get_cpuid(1,&eax,&ebx,&ecx,&edx))
+    if (edx & (1<<26))
+      level = SIMD_SSE2;
+# ifdef MMX_AVX2
+  __builtin_cpu_init();
+  if (level && __builtin_cpu_supports("avx2"))
+    level = SIMD_AVX2;
+# endif
+#endif
+#if defined(MMX_SSE2) && defined(_MSC_VER) && defined(_WIN32)
+  int cpuinfo[4];
+  __cpuid(cpuinfo, 1);
+  if (cpuinfo[3] & (1<<26))
+    level = SIMD_SSE2;
+  if (level && (cpuinfo[2] & (1<<27)) && ((_xgetbv(0) & 6) == 6))
+    {
+      __cpuidex(cpuinfo, 7, 0);
+      if (cpuinfo[1] & (1<<5))
+        level = SIMD_AVX2;
+    }
+#endif
+  envvar = getenv("LIBDJVU_DISABLE_AVX2");
+  if (level > SIMD_SSE2 && envvar && envvar[0] && envvar[0]!='0')
+    level = SIMD_SSE2;
+  return ((simdflag = level));
+}
+
+
 
 #ifdef HAVE_NAMESPACES
 }
@@ -64,6 +64,30 @@
 
 #include "DjVuGlobal.h"
 
+// ----------------------------------------
+// SSE2 AND AVX2 INTRINSICS
+
+#ifndef NO_SIMD
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__SSE2__))
+# include <emmintrin.h>
+# define MMX_SSE2 1
+# if defined(__clang__) || (__GNUC__ >= 5)
+#  include <immintrin.h>
+#  define MMX_AVX2 1
+#  define MMX_AVX2_TARGET __attribute__((target("avx2")))
+# endif
+#endif
+
+#if defined(_MSC_VER) && defined(_M_X64)
+# include <immintrin.h>
+# define MMX_SSE2 1
+# define MMX_AVX2 1
+# define MMX_AVX2_TARGET
+#endif
+
+#endif
+
 #ifdef HAVE_NAMESPACES
 namespace DJVU {
 # ifdef NOT_DEFINED // Just to fool emacs c++ mode
@@ -80,9 +104,13 @@ namespace DJVU {
     Macro #MMX# is defined if the compiler supports the X86-MMX instructions.
     It does not mean however that the processor supports the instruction set.
     Variable #MMXControl::mmxflag# must be used to decide whether MMX.
-    instructions can be executed.  MMX instructions are entered in the middle
-    of C++ code using the following macros.  Examples can be found in
-    #"IWTransform.cpp"#.
+    instructions can be executed.  Similarly, macros #MMX_SSE2# and
+    #MMX_AVX2# are defined when the compiler supports the SSE2 and AVX2
+    intrinsics.  Functions using AVX2 intrinsics must be declared with
+    attribute #MMX_AVX2_TARGET# and may only be called when variable
+    #MMXControl::simdflag# is at least #MMXControl::SIMD_AVX2#.  MMX
+    instructions are entered in the middle of C++ code using the following
+    macros.  Examples can be found in #"IWTransform.cpp"#.
 
     \begin{description}
     \item[MMXrr( insn, srcreg, dstreg)] 
@@ -131,6 +159,21 @@ class MMXControl
       code. Never modify the value of this variable.  Use #enable_mmx# or
       #disable_mmx# instead. */
   static int mmxflag;  // readonly
+  // SSE2/AVX2 DETECTION
+  enum { SIMD_NONE=0, SIMD_SSE2=1, SIMD_AVX2=2 };
+  /** Detects and enables the SSE2 and AVX2 instruction sets.  Returns the
+      best instruction set level supported by both the compiler and the
+      CPU (#SIMD_NONE#, #SIMD_SSE2# or #SIMD_AVX2#).  Environment variables
+      #LIBDJVU_DISABLE_SIMD# and #LIBDJVU_DISABLE_AVX2# can be used to
+      restrict the instruction set for testing purposes. */
+  static int enable_simd();
+  /** Disables SSE2 and AVX2.  The transforms will then be performed 
+      using the baseline code. */
+  static int disable_simd();
+  /** Contains the instruction set level selected by \Ref{enable_simd}.
+      A negative value means that you must call #enable_simd# and test the
+      value again.  Never modify the value of this variable. */
+  static int simdflag;  // readonly
 };
 
 //@}
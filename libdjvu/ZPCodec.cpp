@@ -72,6 +72,7 @@
 #include <assert.h>
 #include <math.h>
 #include <stdio.h>
+#include <string.h>
 
 
 #ifdef HAVE_NAMESPACES
@@ -662,16 +663,17 @@ ZPCodec::Encode::~Encode()
 class ZPCodec::Decode : public ZPCodec
 {
 public:
-  Decode(GP<ByteStream> gbs, const bool djvucompat);
+  Decode(GP<ByteStream> gbs, const bool djvucompat, const int engine);
   virtual ~Decode();
 private:
-  void init(void); 
+  void init(const bool djvucompat, const int engine); 
 };
 
-ZPCodec::Decode::Decode(GP<ByteStream> gbs, const bool djvucompat)
+ZPCodec::Decode::Decode(GP<ByteStream> gbs, const bool djvucompat, 
+                        const int xengine)
 : ZPCodec(gbs,false,djvucompat)
 {
-  init();
+  init(djvucompat, xengine);
   // Codebit counter
 #ifdef ZPCODEC_BITCOUNT
   bitcount = 0;
@@ -681,7 +683,9 @@ ZPCodec::Decode::Decode(GP<ByteStream> gbs, const bool djvucompat)
 ZPCodec::Decode::~Decode() {}
 
 ZPCodec::ZPCodec(GP<ByteStream> xgbs, const bool xencoding, const bool djvucompat)
-: gbs(xgbs), bs(xgbs), encoding(xencoding), fence(0), subend(0), buffer(0), nrun(0)
+: gbs(xgbs), bs(xgbs), encoding(xencoding), fence(0), subend(0), buffer(0), nrun(0),
+  engine(ENGINE_CLASSIC), qcode(0), qcount(0), vbytes(0), nbytes(0), eof(false),
+  iptr(qbuf), iend(qbuf), obits(0), ocount(0), xfence(0)
 {
   // Create machine independent ffz table
   for (int i=0; i<256; i++)
@@ -704,6 +708,7 @@ ZPCodec::ZPCodec(GP<ByteStream> xgbs, const bool xencoding, const bool djvucompa
               BitContext x = default_ztable[j].dn;
               BitContext y = default_ztable[x].dn;
               dn[j] = y;
+              ztab[j].dn = y;
             }
         }
     }
@@ -720,11 +725,41 @@ ZPCodec::create(GP<ByteStream> gbs, const bool encoding, const bool djvucompat)
     retval=new ZPCodec::Encode(gbs,djvucompat);
   }else
   {
-    retval=new ZPCodec::Decode(gbs,djvucompat);
+    retval=new ZPCodec::Decode(gbs,djvucompat,get_decoder_engine());
   }
   return retval;
 }
 
+// The default engine is selected once when the library is loaded
+// so that decoders created concurrently never race on it.
+
+static int
+default_decoder_engine(void)
+{
+  const char *envvar = getenv("LIBDJVU_ZPCODEC_ENGINE");
+  if (envvar && !strcmp(envvar, "classic"))
+    return ZPCodec::ENGINE_CLASSIC;
+  else if (envvar && !strcmp(envvar, "check"))
+    return ZPCodec::ENGINE_CHECK;
+  return ZPCodec::ENGINE_FAST;
+}
+
+static int zpengine = default_decoder_engine();
+
+void
+ZPCodec::set_decoder_engine(int xengine)
+{
+  if (xengine < ENGINE_CLASSIC || xengine > ENGINE_CHECK)
+    xengine = ENGINE_FAST;
+  zpengine = xengine;
+}
+
+int
+ZPCodec::get_decoder_engine(void)
+{
+  return zpengine;
+}
+
 ////////////////////////////////////////////////////////////////
 // Z CODER DECODE ALGORITHM
 ////////////////////////////////////////////////////////////////
@@ -732,11 +767,47 @@ ZPCodec::create(GP<ByteStream> gbs, const bool encoding, const bool djvucompat)
 
 
 void 
-ZPCodec::Decode::init(void)
+ZPCodec::Decode::init(const bool djvucompat, const int xengine)
 {
   assert(sizeof(unsigned int)==4);
   assert(sizeof(unsigned short)==2);
   a = 0;
+  engine = xengine;
+  if (engine == ENGINE_CHECK)
+    {
+      /* Give a private copy of the code bytes to each engine */
+      GP<ByteStream> gmem = ByteStream::create();
+      gmem->copy(*bs);
+      gmem->seek(0);
+      GP<ByteStream> gcopy = ByteStream::create();
+      gcopy->copy(*gmem);
+      gcopy->seek(0);
+      gmem->seek(0);
+      gbs = gmem;
+      bs = gmem;
+      shadow = new ZPCodec::Decode(gcopy, djvucompat, ENGINE_CLASSIC);
+    }
+  if (engine != ENGINE_CLASSIC)
+    {
+      /* Read first 16 bits of code and preload lookahead */
+      qcode = 0;
+      qcount = -16;
+      fpreload();
+      code = (unsigned int)(qcode >> 48);
+      /* Bytes read by the classic engine at this point */
+      vbytes = 6;
+      scount = 32;
+      /* Compute initial fence */
+      fence = code;
+      if (code >= 0x8000)
+        fence = 0x7fff;
+      if (engine == ENGINE_CHECK)
+        {
+          xfence = fence;
+          fence = 0;
+        }
+      return;
+    }
   /* Read first 16 bits of code */
   if (! bs->read((void*)&byte, 1))
     byte = 0xff;
@@ -805,6 +876,9 @@ ZPCodec::ffz(unsigned int x)
 int 
 ZPCodec::decode_sub(BitContext &ctx, unsigned int z)
 {
+  if (engine != ENGINE_CLASSIC)
+    return (engine == ENGINE_FAST) ? fdecode_sub(ctx, z)
+      : xdecode(0, &ctx, 0, z);
   /* Save bit */
   int bit = (ctx & 1);
   /* Avoid interval reversion */
@@ -866,6 +940,9 @@ ZPCodec::decode_sub(BitContext &ctx, unsigned int z)
 int 
 ZPCodec::decode_sub_simple(int mps, unsigned int z)
 {
+  if (engine != ENGINE_CLASSIC)
+    return (engine == ENGINE_FAST) ? fdecode_sub_simple(mps, z)
+      : xdecode(1, 0, mps, z);
   /* Test MPS/LPS */
   if (z > code)
     {
@@ -910,6 +987,9 @@ ZPCodec::decode_sub_simple(int mps, unsigned int z)
 int  
 ZPCodec::decode_sub_nolearn(int mps, unsigned int z)
 {
+  if (engine != ENGINE_CLASSIC)
+    return (engine == ENGINE_FAST) ? fdecode_sub_nolearn(mps, z)
+      : xdecode(2, 0, mps, z);
 #ifdef ZPCODER
   unsigned int d = 0x6000 + ((z+a)>>2);
   if (z > d) 
@@ -963,6 +1043,196 @@ ZPCodec::decode_sub_nolearn(int mps, unsigned int z)
 
 
 
+////////////////////////////////////////////////////////////////
+// Z CODER FAST DECODE ALGORITHM
+////////////////////////////////////////////////////////////////
+
+// The fast engine keeps the 16 bits of the code register in the
+// upper bits of the 64-bit register qcode, followed by qcount
+// lookahead bits. Code bytes are read by blocks into qbuf.
+// Renormalization shifts qcode and refills it several bytes at a time.
+// Variables scount and vbytes replay the byte consumption of the classic
+// engine in order to signal the end of file at exactly the same point.
+
+
+void
+ZPCodec::fpreload(void)
+{
+  while (qcount <= 40)
+    {
+      if (iptr >= iend)
+        {
+          size_t n = (eof) ? 0 : bs->read((void*)qbuf, sizeof(qbuf));
+          if (n < 1)
+            {
+              eof = true;
+              qcode |= (uint64_t)0xff << (40 - qcount);
+              qcount += 8;
+              continue;
+            }
+          nbytes += n;
+          iptr = qbuf;
+          iend = qbuf + n;
+        }
+      if (iend - iptr >= 8)
+        {
+          /* Load as many whole bytes as possible at once */
+          int n = (48 - qcount) >> 3;
+          uint64_t w = 0;
+          for (int i=0; i<8; i++)
+            w = (w << 8) | iptr[i];
+          qcode |= (w >> (64 - 8*n)) << (48 - qcount - 8*n);
+          iptr += n;
+          qcount += 8*n;
+        }
+      else
+        {
+          qcode |= (uint64_t)(*iptr++) << (40 - qcount);
+          qcount += 8;
+        }
+    }
+}
+
+
+inline void
+ZPCodec::frenorm(int shift)
+{
+  a = (a << shift) & 0xffff;
+  qcode <<= shift;
+  qcount -= shift;
+  code = (unsigned int)(qcode >> 48);
+#ifdef ZPCODEC_BITCOUNT
+  bitcount += shift;
+#endif
+  if (qcount < 32)
+    fpreload();
+  /* Replay classic preload */
+  scount -= shift;
+  if (scount < 16)
+    {
+      do { scount += 8; vbytes += 1; } while (scount <= 24);
+      if (eof && vbytes > ((nbytes > 2) ? nbytes : 2) + 24)
+        G_THROW( ByteStream::EndOfFile );
+    }
+  /* Adjust fence */
+  fence = (code >= 0x8000) ? 0x7fff : code;
+}
+
+
+static inline int
+fast_ffz(unsigned int x, const char *ffzt)
+{
+#if defined(__GNUC__)
+  (void)ffzt;
+  return __builtin_clz(((x ^ 0xffff) << 16) | 0x8000);
+#else
+  return (x>=0xff00) ? (ffzt[x&0xff]+8) : (ffzt[(x>>8)&0xff]);
+#endif
+}
+
+
+int
+ZPCodec::fdecode_sub(BitContext &ctx, unsigned int z)
+{
+  const Table &t = ztab[ctx];
+  int bit = (ctx & 1);
+#ifdef ZPCODER
+  unsigned int d = 0x6000 + ((z+a)>>2);
+  z = (z > d) ? d : z;
+#endif
+#ifdef ZCODER
+  if (z >= 0x8000)
+    z = 0x4000 + (z>>1);
+#endif
+  if (z > code)
+    {
+      z = 0x10000 - z;
+      a = a + z;
+      qcode += (uint64_t)z << 48;
+      ctx = t.dn;
+      frenorm(fast_ffz(a, ffzt));
+      return bit ^ 1;
+    }
+  if (a >= t.m)
+    ctx = t.up;
+  a = z;
+  frenorm(1);
+  return bit;
+}
+
+
+int
+ZPCodec::fdecode_sub_simple(int mps, unsigned int z)
+{
+  if (z > code)
+    {
+      z = 0x10000 - z;
+      a = a + z;
+      qcode += (uint64_t)z << 48;
+      frenorm(fast_ffz(a, ffzt));
+      return mps ^ 1;
+    }
+  a = z;
+  frenorm(1);
+  return mps;
+}
+
+
+int
+ZPCodec::fdecode_sub_nolearn(int mps, unsigned int z)
+{
+#ifdef ZPCODER
+  unsigned int d = 0x6000 + ((z+a)>>2);
+  z = (z > d) ? d : z;
+#endif
+#ifdef ZCODER
+  if (z >= 0x8000)
+    z = 0x4000 + (z>>1);
+#endif
+  return fdecode_sub_simple(mps, z);
+}
+
+
+int
+ZPCodec::xdecode(int kind, BitContext *ctx, int mps, unsigned int z)
+{
+  // Decode with the fast engine.
+  // Member fence is kept at zero so that all calls land here.
+  BitContext xctx = (ctx) ? *ctx : 0;
+  int bit;
+  fence = xfence;
+  if (kind == 1)
+    bit = fdecode_sub_simple(mps, z);
+  else if (z <= fence)
+    { a = z; bit = (kind == 0) ? (*ctx & 1) : mps; }
+  else if (kind == 0)
+    bit = fdecode_sub(*ctx, z);
+  else
+    bit = fdecode_sub_nolearn(mps, z);
+  xfence = fence;
+  fence = 0;
+  // Decode with the classic engine.
+  ZPCodec &s = *shadow;
+  int sbit;
+  if (kind == 1)
+    sbit = s.decode_sub_simple(mps, z);
+  else if (z <= s.fence)
+    { s.a = z; sbit = (kind == 0) ? (xctx & 1) : mps; }
+  else if (kind == 0)
+    sbit = s.decode_sub(xctx, z);
+  else
+    sbit = s.decode_sub_nolearn(mps, z);
+  // Compare
+  if (bit != sbit || a != s.a || code != s.code || xfence != s.fence
+      || (ctx && *ctx != xctx) )
+    G_THROW( ERR_MSG("ZPCodec.check_failed") );
+  return bit;
+}
+
+
+
+
+
 ////////////////////////////////////////////////////////////////
 // Z CODER ENCODE ALGORITHM
 ////////////////////////////////////////////////////////////////
@@ -982,33 +1252,87 @@ ZPCodec::Encode::init(void)
   subend = 0;
   buffer = 0xffffff;
   nrun = 0;
+  obits = 0;
+  ocount = 0;
+  iptr = qbuf;
+  iend = qbuf + sizeof(qbuf);
 }
 
+// Code bits are accumulated in the 64-bit register obits
+// and stored into qbuf as 32-bit words. Buffer qbuf is
+// written into the bytestream when full and by eflush.
+
 void
-ZPCodec::outbit(int bit)
+ZPCodec::oflush(void)
+{
+  if (iptr > qbuf)
+    {
+      if (!encoding)
+        G_THROW( ERR_MSG("ZPCodec.no_encoding") );
+      size_t n = iptr - qbuf;
+      if (bs->write((void*)qbuf, n) != n)
+        G_THROW( ERR_MSG("ZPCodec.write_error") );
+      iptr = qbuf;
+    }
+}
+
+unsigned int
+ZPCodec::pending(void) const
 {
+  if (!encoding)
+    return 0;
+  return (unsigned int)(iptr - qbuf) + (ocount >> 3);
+}
+
+inline void
+ZPCodec::outbits(unsigned int bits, int n)
+{
+  // Argument n must be in range 1..32
   if (delay > 0)
     {
-      if (delay < 0xff) // delay=0xff suspends emission forever
-        delay -= 1;
+      if (delay >= 0xff) // delay=0xff suspends emission forever
+        return;
+      int d = (n < delay) ? n : delay;
+      delay -= d;
+      n -= d;
+      if (n <= 0)
+        return;
+      bits &= 0xffffffffU >> (32 - n);
     }
-  else
+  obits = (obits << n) | bits;
+  ocount += n;
+  if (ocount >= 32)
     {
-      /* Insert a bit */
-      byte = (byte<<1) | bit;
-      /* Output a byte */
-      if (++scount == 8)
-        {
-          if (!encoding)
-            G_THROW( ERR_MSG("ZPCodec.no_encoding") );
-          if (bs->write((void*)&byte, 1) != 1)
-            G_THROW( ERR_MSG("ZPCodec.write_error") );
-          scount = 0;
-          byte = 0;
-        }
+      ocount -= 32;
+      unsigned int w = (unsigned int)(obits >> ocount);
+      iptr[0] = (unsigned char)(w >> 24);
+      iptr[1] = (unsigned char)(w >> 16);
+      iptr[2] = (unsigned char)(w >> 8);
+      iptr[3] = (unsigned char)(w);
+      iptr += 4;
+      if (iptr + 4 > iend)
+        oflush();
     }
 }
 
+void
+ZPCodec::outbit(int bit)
+{
+  outbits(bit, 1);
+}
+
+void
+ZPCodec::outrun(int bit, unsigned int n)
+{
+  // Outputs bit followed by n opposite bits
+  outbits(bit, 1);
+  unsigned int bits = (bit) ? 0 : 0xffffffffU;
+  for (; n >= 32; n -= 32)
+    outbits(bits, 32);
+  if (n > 0)
+    outbits(bits >> (32 - n), n);
+}
+
 void 
 ZPCodec::zemit(int b)
 {
@@ -1019,23 +1343,19 @@ ZPCodec::zemit(int b)
   buffer = (buffer & 0xffffff);
   /* The following lines have been changed in order to emphazise the
    * similarity between this bit counting and the scheme of Witten, Neal & Cleary
-   * (WN&C).  Corresponding changes have been made in outbit and eflush.
+   * (WN&C).  Corresponding changes have been made in outrun and eflush.
    * Variable 'nrun' is similar to the 'bits_to_follow' in the W&N code.
    */
   switch(b)
     {
       /* Similar to WN&C upper renormalization */
     case 1:
-      outbit(1);
-      while (nrun-- > 0)
-        outbit(0);
+      outrun(1, nrun);
       nrun = 0;
       break;
       /* Similar to WN&C lower renormalization */
     case 0xff:
-      outbit(0);
-      while (nrun-- > 0)
-        outbit(1);
+      outrun(0, nrun);
       nrun = 0;
       break;
       /* Similar to WN&C central renormalization */
@@ -1066,13 +1386,18 @@ ZPCodec::eflush()
       subend = (unsigned short)(subend<<1);
     }
   /* zemit pending run */
-  outbit(1);
-  while (nrun-- > 0)
-    outbit(0);
+  outrun(1, nrun);
   nrun = 0;
   /* zemit 1 until full byte */
-  while (scount > 0)
-    outbit(1);
+  if (ocount & 7)
+    outbits(0xff >> (ocount & 7), 8 - (ocount & 7));
+  /* store remaining bytes and write buffer */
+  while (ocount > 0)
+    {
+      ocount -= 8;
+      *iptr++ = (unsigned char)(obits >> ocount);
+    }
+  oflush();
   /* prevent further emission */
   delay = 0xff;
 }
@@ -1235,6 +1560,7 @@ ZPCodec::newtable(ZPCodec::Table *table)
       m[i]  = table[i].m;
       up[i] = table[i].up;
       dn[i] = table[i].dn;
+      ztab[i] = table[i];
     }
 }
 
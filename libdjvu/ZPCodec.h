@@ -67,6 +67,12 @@
 
 #include "GContainer.h"
 
+#if HAVE_STDINT_H
+# include <stdint.h>
+#elif HAVE_INTTYPES_H
+# include <inttypes.h>
+#endif
+
 #ifdef HAVE_NAMESPACES
 namespace DJVU {
 # ifdef NOT_DEFINED // Just to fool emacs c++ mode
@@ -228,7 +234,8 @@ typedef unsigned char  BitContext;
     ZPCodec object.  Note that the encoder always flushes its internal buffers
     and writes a few final code bytes when the ZPCodec object is destroyed.
     Note also that the decoder often reads a few bytes beyond the last code byte
-    written by the encoder.  This lag means that you must reposition the
+    written by the encoder (a whole block of bytes when using the fast
+    decoder engine, see \Ref{set_decoder_engine}).  This lag means that you must reposition the
     ByteStream after the destruction of the ZPCodec object and before re-using
     the ByteStream object (see \Ref{IFFByteStream}.)
 
@@ -280,6 +287,14 @@ public:
   /** Decodes a bit without compression (pass-thru decoder).  This function
       retrieves bits encoded with the pass-thru encoder. */
   int  decoder(void);
+
+  /** Returns the number of complete code bytes produced by the encoder but
+      not yet written into the ByteStream. The encoder keeps up to a few
+      hundred code bytes in an internal buffer.  Adding this number to the
+      position of the ByteStream gives the number of code bytes produced so
+      far, for instance when encoding must stop after a given number of
+      bytes. This function returns zero when decoding. */
+  unsigned int pending(void) const;
 #ifdef ZPCODEC_BITCOUNT
   /** Counter for code bits (requires #-DZPCODEC_BITCOUNT#). This member
       variable is available when the ZP-Coder is compiled with option
@@ -303,6 +318,21 @@ public:
   int  decoder_nolearn(BitContext &ctx);
   inline int  IWdecoder(void);
   inline void IWencoder(const bool bit);
+  // Decoder engines
+  /** Decoder engines. All engines decode the same bit-exact sequence.
+      #ENGINE_CLASSIC# is the historical implementation which reads the code
+      bytes one at a time.  #ENGINE_FAST# reads the code bytes by blocks,
+      keeps the code register and the upcoming code bits in a single 64-bit
+      register, and uses merged probability and adaptation tables.
+      #ENGINE_CHECK# runs both engines in lockstep and throws an exception
+      as soon as they disagree. This is only useful for testing. */
+  enum Engine { ENGINE_CLASSIC=0, ENGINE_FAST=1, ENGINE_CHECK=2 };
+  /** Selects the engine used by decoders created afterwards.  The
+      initial value is #ENGINE_FAST# unless overridden by environment
+      variable #LIBDJVU_ZPCODEC_ENGINE# (#classic#, #fast# or #check#). */
+  static void set_decoder_engine(int engine);
+  /** Returns the engine used by newly created decoders. */
+  static int get_decoder_engine(void);
 protected:
   // coder status
   GP<ByteStream> gbs;           // Where the data goes/comes from
@@ -324,10 +354,30 @@ protected:
   BitContext    dn[256];
   // machine independent ffz
   char          ffzt[256];
+  // fast decoder engine
+  char          engine;
+  Table         ztab[256];
+  uint64_t      qcode;          // code register (top 16 bits) and lookahead
+  int           qcount;         // number of lookahead bits in qcode
+  unsigned int  vbytes;         // bytes the classic engine would have read
+  unsigned int  nbytes;         // code bytes actually read
+  bool          eof;
+  unsigned char *iptr;
+  unsigned char *iend;
+  // code byte buffer (decoder input or encoder output)
+  unsigned char qbuf[512];
+  // buffered encoder
+  uint64_t      obits;
+  int           ocount;
+  GP<ZPCodec>   shadow;         // classic decoder for ENGINE_CHECK
+  unsigned int  xfence;         // true fence for ENGINE_CHECK
   // encoder private
   void einit (void);
   void eflush (void);
   void outbit(int bit);
+  void outbits(unsigned int bits, int n);
+  void outrun(int bit, unsigned int n);
+  void oflush(void);
   void zemit(int b);
   void encode_mps(BitContext &ctx, unsigned int z);
   void encode_lps(BitContext &ctx, unsigned int z);
@@ -342,6 +392,12 @@ protected:
   int  decode_sub(BitContext &ctx, unsigned int z);
   int  decode_sub_simple(int mps, unsigned int z);
   int  decode_sub_nolearn(int mps, unsigned int z);
+  void fpreload(void);
+  void frenorm(int shift);
+  int  fdecode_sub(BitContext &ctx, unsigned int z);
+  int  fdecode_sub_simple(int mps, unsigned int z);
+  int  fdecode_sub_nolearn(int mps, unsigned int z);
+  int  xdecode(int kind, BitContext *ctx, int mps, unsigned int z);
 private:
   // no copy allowed (hate c++)
   ZPCodec(const ZPCodec&);
@@ -176,6 +176,10 @@
     pixel in the input file is irrelevant.  The DjVu IW44 Encoder will replace
     the masked pixels by a color value whose coding cost is minimal (see
     \URL{http://www.research.att.com/~leonb/DJVU/mask}).
+    \item[-threads n]
+    Prepares the luminance and chrominance planes of color images
+    concurrently using #n# threads.  The output file does not depend on the
+    number of threads.
     \end{description}
 
     {\bf Photo DjVu options} ---
@@ -217,6 +221,7 @@
 #include "DjVuInfo.h"
 #include "IFFByteStream.h"
 #include "GOS.h"
+#include "GThreads.h"
 #include "GBitmap.h"
 #include "GPixmap.h"
 #include "GURL.h"
@@ -300,6 +305,7 @@ usage()
          "    -crcbnone        -- do not encode chrominance at all\n"
          "    -crcbdelay n     -- select chrominance coding delay (default 10)\n"
          "                        for -crcbnormal and -crcbhalf modes\n"
+         "    -threads n       -- encode color planes using n threads\n"
          "\n");
   exit(1);
 }
@@ -609,6 +615,16 @@ parse(GArray<GUTF8String> &argv)
               if (*ptr || flag_gamma<=0.25 || flag_gamma>=5)
                 G_THROW( ERR_MSG("c44.illegal_gamma") );
             }
+          else if (argv[i] == "-threads")
+            {
+              if (++i >= argc)
+                G_THROW( ERR_MSG("c44.no_threads_arg") );
+              char *ptr; 
+              int threads = strtol(argv[i], &ptr, 10);
+              if (*ptr || threads<1 || threads>64)
+                G_THROW( ERR_MSG("c44.illegal_threads") );
+              GThreadPool::set_shared_threads(threads);
+            }
           else
             usage();
         }
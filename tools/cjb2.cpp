@@ -64,7 +64,7 @@
 
     {\bf Synopsis}
     \begin{verbatim}
-        cjb2 [options] <input-pbm-or-tiff>  <output-djvu>
+        cjb2 [options] <input-pbm-or-tiff>... <output-djvu>
     \end{verbatim}
 
     {\bf Description}
@@ -74,6 +74,11 @@
     of lossy encoding refinements are missing from this simple implementation.
     Comments in the code suggest a few improvements.
 
+    When several input files are given, #cjb2# produces a bundled multipage
+    document.  The shapes of each group of pages are matched together and
+    the shapes used by several pages of the group are encoded in a shared
+    dictionary included by these pages.
+
     Options are:
     \begin{description}
     \item[-dpi xxx]     Specify image resolution (default 300).
@@ -82,9 +87,13 @@
     \item[-lossy]       Lossy compression (same as -losslevel 100).
     \item[-losslevel n] Set loss level (0 to 200)
     \item[-verbose]     Display additional messages.
+    \item[-verify]      Check the indexed shape search against a full search.
+    \item[-threads n]   Match shapes using #n# threads.
+    \item[-pages-per-dict n] Share a shape dictionary among #n# pages (default 10).
     \end{description}
     Encoding is lossless unless one or several lossy options are selected.
     The #dpi# argument mostly affects the cleaning thresholds.
+    The output file does not depend on the number of threads.
 
     {\bf Bugs}
 
@@ -111,11 +120,15 @@
 #include "IFFByteStream.h"
 #include "GRect.h"
 #include "GBitmap.h"
+#include "CCImage.h"
 #include "JB2Image.h"
 #include "DjVuInfo.h"
+#include "DjVmDoc.h"
+#include "DjVmDir.h"
 #include "GOS.h"
 #include "GURL.h"
 #include "DjVuMessage.h"
+#include "GThreads.h"
 #include "jb2tune.h"
 #include "common.h"
 #if HAVE_TIFF
@@ -151,566 +164,6 @@ MAX(int a, int b)
 
 
 
-// --------------------------------------------------
-// CONNECTED COMPONENT ANALYSIS AND CLEANING
-// --------------------------------------------------
-
-// -- A run of black pixels
-struct Run    
-{ 
-  int y;         // vertical coordinate
-  short x1;      // first horizontal coordinate
-  short x2;      // last horizontal coordinate
-  int ccid;      // component id
-};
-
-// -- A component descriptor
-struct CC    
-{
-  GRect bb;      // bounding box
-  int npix;      // number of black pixels
-  int nrun;      // number of runs
-  int frun;      // first run in cc ordered array of runs
-};
-
-
-// -- An image composed of runs
-class CCImage 
-{
-public:
-  int height;            // Height of the image in pixels
-  int width;             // Width of the image in pixels
-  GTArray<Run> runs;     // array of runs
-  GTArray<CC>  ccs;      // Array of component descriptors
-  int nregularccs;       // Number of regular ccs (set by merge_and_split_ccs)
-  int largesize;         // CCs larger than that are special
-  int smallsize;         // CCs smaller than that are special 
-  int tinysize;          // CCs smaller than that may be removed 
-  CCImage();
-  void init(int width, int height, int dpi);
-  void add_single_run(int y, int x1, int x2, int ccid=0);
-  void add_bitmap_runs(const GBitmap &bm, int offx=0, int offy=0, int ccid=0);
-  GP<GBitmap> get_bitmap_for_cc(int ccid) const;
-  GP<JB2Image> get_jb2image() const;
-  void make_ccids_by_analysis();
-  void make_ccs_from_ccids();
-  void erase_tiny_ccs();
-  void merge_and_split_ccs();
-  void sort_in_reading_order(); 
-};
-
-
-// -- Compares runs
-static inline bool
-operator <= (const Run &a, const Run &b)
-{
-  return (a.y<b.y) || (a.y==b.y && a.x1<=b.x1);
-}
-
-
-// -- Constructs CCImage and provide defaults
-CCImage::CCImage()
-  : height(0), width(0), nregularccs(0)
-{
-}
-
-void
-CCImage::init(int w, int h, int dpi)
-{
-  runs.empty();
-  ccs.empty();
-  height = h;
-  width = w;
-  nregularccs = 0;
-  dpi = MAX(200, MIN(900, dpi));
-  largesize = MIN( 500, MAX(64, dpi));
-  smallsize = MAX(2, dpi/150);
-  tinysize = MAX(0, dpi*dpi/20000 - 1);
-}
-
-
-// -- Adds a run to the CCImage
-inline void 
-CCImage::add_single_run(int y, int x1, int x2, int ccid)
-{
-  int index = runs.hbound();
-  runs.touch(++index);
-  Run& run = runs[index];
-  run.y = y;
-  run.x1 = x1;
-  run.x2 = x2;
-  run.ccid = ccid;
-}
-
-
-// -- Adds runs extracted from a bitmap
-void 
-CCImage::add_bitmap_runs(const GBitmap &bm, int offx, int offy, int ccid)
-{
-  // Iterate over rows
-  for (unsigned int y=0; y<bm.rows(); y++)
-    {
-      const unsigned char *row = bm[y];
-      int w = bm.columns();
-      int x = 0;
-      // Iterate over runs
-      while (x < w)
-        {
-          while (x < w  && !row[x]) x++;
-          if (x < w)
-            {
-              int x1 = x;
-              while (x < w && row[x]) x++;
-              add_single_run(offy+y, offx+x1, offx+x-1, ccid);
-            }
-        }
-    }
-}
-
-
-// -- Performs connected component analysis
-void
-CCImage::make_ccids_by_analysis()
-{
-  // Sort runs
-  runs.sort();
-  // Single Pass Connected Component Analysis (with unodes)
-  int n;
-  int p=0;
-  GTArray<int> umap;
-  for (n=0; n<=runs.hbound(); n++)
-    {
-      int y = runs[n].y;
-      int x1 = runs[n].x1 - 1;
-      int x2 = runs[n].x2 + 1;
-      int id = (umap.hbound() + 1);
-      // iterate over previous line runs
-      for(;runs[p].y < y-1;p++);
-      for(;(runs[p].y < y) && (runs[p].x1 <= x2);p++ )
-        {
-          if ( runs[p].x2 >= x1 )
-            {
-              // previous run touches current run
-              int oid = runs[p].ccid;
-              while (umap[oid] < oid)
-                oid = umap[oid];
-              if ((int)id > umap.hbound()) {
-                id = oid;
-              } else if (id < oid) {
-                umap[oid] = id;
-              } else {
-                umap[id] = oid;
-                id = oid;
-              }
-              // freshen previous run id
-              runs[p].ccid = id;
-              // stop if previous run goes past current run
-              if (runs[p].x2 >= x2)
-                break;
-            }
-        }
-      // create new entry in umap
-      runs[n].ccid = id;
-      if (id > umap.hbound())
-        {
-          umap.touch(id);
-          umap[id] = id;
-        }
-    }
-  // Update umap and ccid
-  for (n=0; n<=runs.hbound(); n++)
-    {
-      Run &run = runs[n];
-      int ccid = run.ccid;
-      while (umap[ccid] < ccid)
-      {
-        ccid = umap[ccid];
-      }
-      umap[run.ccid] = ccid;
-      run.ccid = ccid;
-    }
-}
-
-
-// -- Constructs the ``ccs'' array from run's ccids.
-void
-CCImage::make_ccs_from_ccids()
-{
-  int n;
-  Run *pruns = runs;
-  // Find maximal ccid
-  int maxccid = nregularccs-1;
-  for (n=0; n<=runs.hbound(); n++)
-    if (pruns[n].ccid > maxccid)
-      maxccid = runs[n].ccid;
-  // Renumber ccs 
-  GTArray<int> armap(0,maxccid);
-  int *rmap = armap;
-  for (n=0; n<=maxccid; n++)
-    armap[n] = -1;
-  for (n=0; n<=runs.hbound(); n++)
-    if (pruns[n].ccid >= 0)
-      rmap[ pruns[n].ccid ] = 1;
-  int nid = 0;
-  for (n=0; n<=maxccid; n++)
-    if (rmap[n] > 0)
-      rmap[n] = nid++;
-  
-  // Adjust nregularccs (since ccs are renumbered)
-  while (nregularccs>0 && rmap[nregularccs-1]<0)
-    nregularccs -= 1;
-  if (nregularccs>0)
-    nregularccs = 1 + rmap[nregularccs-1];
-  
-  // Prepare cc descriptors
-  ccs.resize(0,nid-1);
-  for (n=0; n<nid; n++)
-    ccs[n].nrun = 0;
-  
-  // Relabel runs
-  for (n=0; n<=runs.hbound(); n++)
-    {
-      Run &run = pruns[n];
-      if (run.ccid < 0) continue;  // runs with negative ccids are destroyed
-      int oldccid = run.ccid;
-      int newccid = rmap[oldccid];
-      CC &cc = ccs[newccid];
-      run.ccid = newccid;
-      cc.nrun += 1;
-    }
-  
-  // Compute positions for runs of cc
-  int frun = 0;
-  for (n=0; n<nid; n++) 
-    {
-      ccs[n].frun = rmap[n] = frun;
-      frun += ccs[n].nrun;
-    }
-
-  // Copy runs
-  GTArray<Run> rtmp;
-  rtmp.steal(runs);
-  Run *ptmp = rtmp;
-  runs.resize(0,frun-1);
-  pruns = runs;
-  for (n=0; n<=rtmp.hbound(); n++)
-    {
-      int id = ptmp[n].ccid;
-      if (id < 0) continue;
-      int pos = rmap[id]++;
-      pruns[pos] = ptmp[n];
-    }
-
-  // Finalize ccs
-  for (n=0; n<nid; n++)
-    {
-      CC &cc = ccs[n];
-      int npix = 0;
-      runs.sort(cc.frun, cc.frun+cc.nrun-1);
-      Run *run = &runs[cc.frun];
-      int xmin = run->x1;
-      int xmax = run->x2;
-      int ymin = run->y;
-      int ymax = run->y;
-      for (int i=0; i<cc.nrun; i++, run++)
-        {
-          if (run->x1 < xmin)  xmin = run->x1;
-          if (run->x2 > xmax)  xmax = run->x2;
-          if (run->y  < ymin)  ymin = run->y;
-          if (run->y  > ymax)  ymax = run->y;
-          npix += run->x2 - run->x1 + 1;
-        }
-      cc.npix = npix;
-      cc.bb.xmin = xmin;
-      cc.bb.ymin = ymin;
-      cc.bb.xmax = xmax + 1;
-      cc.bb.ymax = ymax + 1;
-    }
-}
-
-
-// Removes ccs which are too small.
-void
-CCImage::erase_tiny_ccs()
-{
-  // ISSUE: HALFTONE DETECTION
-  // We should not remove tiny ccs if they are part of a halftone pattern...
-  for (int i=0; i<ccs.size(); i++)
-    {
-      CC& cc = ccs[i];
-      if (cc.npix <= tinysize)
-        {
-          // Mark cc to be erased
-          Run *r = &runs[cc.frun];
-          int nr = cc.nrun;
-          cc.nrun = 0;
-          cc.npix = 0;
-          while (--nr >= 0)
-            (r++)->ccid = -1;
-        }
-    }
-}
- 
-
-// -- Helper for merge_and_split_ccs
-struct Grid_x_CCid 
-{
-  short gridi;
-  short gridj;
-  int ccid;
-};
-
-
-// -- Helper for merge_and_split_ccs
-static inline unsigned int
-hash(const Grid_x_CCid &x) 
-{
-  return (x.gridi<<16) ^ (x.gridj<<8) ^ x.ccid;
-}
-
-
-// -- Helper for merge_and_split_ccs
-static inline bool
-operator==(const Grid_x_CCid &x, const Grid_x_CCid &y)
-{
-  return (x.gridi==y.gridi) && (x.gridj==y.gridj) && (x.ccid==y.ccid);
-}
-
-
-// -- Helper for merge_and_split_ccs
-static int
-makeccid(const Grid_x_CCid &x, GMap<Grid_x_CCid,int> &map, int &ncc)
-{
-  GPosition p = map.contains(x);
-  if (p) return map[p];
-  return map[x] = ncc++;
-}
-
-
-// -- Merges small ccs and split large ccs
-void
-CCImage::merge_and_split_ccs()
-{
-  int ncc = ccs.size();
-  int nruns = runs.size();
-  int splitsize = largesize;
-  if (ncc <= 0) return;
-    // Associative map for storing merged ccids
-  GMap<Grid_x_CCid,int> map;
-  nregularccs = ncc;
-  // Set the correct ccids for the runs
-  for (int ccid=0; ccid<ccs.size(); ccid++)
-    {
-      CC* cc = &ccs[ccid];
-      if (cc->nrun <= 0) continue;
-      Grid_x_CCid key;
-      int ccheight = cc->bb.height();
-      int ccwidth = cc->bb.width();
-      if (ccheight<=smallsize && ccwidth<=smallsize)
-        {
-          key.ccid = -1;
-          key.gridi = (cc->bb.ymin+cc->bb.ymax)/splitsize/2;
-          key.gridj = (cc->bb.xmin+cc->bb.xmax)/splitsize/2;
-          int newccid = makeccid(key, map, ncc);
-          for(int runid=cc->frun; runid<cc->frun+cc->nrun; runid++)
-            runs[runid].ccid = newccid;
-        }
-      else if (ccheight>=largesize || ccwidth>=largesize)
-        {
-          key.ccid = ccid;
-          for(int runid=cc->frun; runid<cc->frun+cc->nrun; runid++)
-            {
-              Run *r = & runs[runid];
-              key.gridi = r->y/splitsize;
-              key.gridj = r->x1/splitsize;
-              int gridj_end = r->x2/splitsize;
-              int gridj_span = gridj_end - key.gridj;
-              r->ccid = makeccid(key, map, ncc);
-              if (gridj_span>0)
-                {
-                  // truncate current run 
-                  runs.touch(nruns+gridj_span-1);
-                  r = &runs[runid];
-                  int x = key.gridj*splitsize + splitsize;
-                  int x_end = r->x2;
-                  r->x2 = x-1;
-                  // append additional runs to the runs array
-                  while (++key.gridj < gridj_end)
-                    {
-                      Run& newrun = runs[nruns++];
-                      newrun.y = r->y;
-                      newrun.x1 = x;
-                      x += splitsize;
-                      newrun.x2 = x-1;
-                      newrun.ccid = makeccid(key, map, ncc);
-                    }
-                  // append last run to the run array
-                  Run& newrun = runs[nruns++];
-                  newrun.y = r->y;
-                  newrun.x1 = x;
-                  newrun.x2 = x_end;
-                  newrun.ccid = makeccid(key, map, ncc);
-                }
-            }
-        }
-    }
-  // Recompute cc descriptors
-  make_ccs_from_ccids();
-}
-
-
-// -- Helps sorting cc
-static int 
-top_edges_descending (const void *pa, const void *pb)
-{
-  if (((CC*) pa)->bb.ymax != ((CC*) pb)->bb.ymax)
-    return (((CC*) pb)->bb.ymax - ((CC*) pa)->bb.ymax);
-  if (((CC*) pa)->bb.xmin != ((CC*) pb)->bb.xmin)
-    return (((CC*) pa)->bb.xmin - ((CC*) pb)->bb.xmin);
-  return (((CC*) pa)->frun - ((CC*) pb)->frun);
-}
-
-
-// -- Helps sorting cc
-static int 
-left_edges_ascending (const void *pa, const void *pb)
-{
-  if (((CC*) pa)->bb.xmin != ((CC*) pb)->bb.xmin)
-    return (((CC*) pa)->bb.xmin - ((CC*) pb)->bb.xmin);
-  if (((CC*) pb)->bb.ymax != ((CC*) pa)->bb.ymax)
-    return (((CC*) pb)->bb.ymax - ((CC*) pa)->bb.ymax);
-  return (((CC*) pa)->frun - ((CC*) pb)->frun);
-}
-
-
-// -- Helps sorting cc
-static int 
-integer_ascending (const void *pa, const void *pb)
-{
-  return ( *(int*)pb - *(int*)pa );
-}
-
-
-// -- Sort ccs in approximate reading order
-void 
-CCImage::sort_in_reading_order()
-{
-  if (nregularccs<2) return;
-  CC *ccarray = new CC[nregularccs];
-  // Copy existing ccarray (but segregate special ccs)
-  int ccid;
-  for(ccid=0; ccid<nregularccs; ccid++)
-    ccarray[ccid] = ccs[ccid];
-  // Sort the ccarray list into top-to-bottom order.
-  qsort (ccarray, nregularccs, sizeof(CC), top_edges_descending);
-  // Subdivide the ccarray list roughly into text lines [LYB]
-  // - Determine maximal top deviation
-  int maxtopchange = width / 40;
-  if (maxtopchange < 32) 
-    maxtopchange = 32;
-  // - Loop until processing all ccs
-  int ccno = 0;
-  int *bottoms = new int[nregularccs];
-  while (ccno < nregularccs)
-    {
-      // - Gather first line approximation
-      int nccno;
-      int sublist_top = ccarray[ccno].bb.ymax-1;
-      int sublist_bottom = ccarray[ccno].bb.ymin;
-      for (nccno=ccno; nccno < nregularccs; nccno++)
-        {
-          if (ccarray[nccno].bb.ymax-1 < sublist_bottom) break;
-          if (ccarray[nccno].bb.ymax-1 < sublist_top - maxtopchange) break;
-          int bottom = ccarray[nccno].bb.ymin;
-          bottoms[nccno-ccno] = bottom;
-          if (bottom < sublist_bottom)
-            sublist_bottom = bottom;
-        }
-      // - If more than one candidate cc for the line
-      if (nccno > ccno + 1)
-        {
-          // - Compute median bottom
-          qsort(bottoms, nccno-ccno, sizeof(int), integer_ascending);
-          int bottom = bottoms[ (nccno-ccno-1)/2 ];
-          // - Compose final line
-          for (nccno=ccno; nccno < nregularccs; nccno++)
-            if (ccarray[nccno].bb.ymax-1 < bottom)
-              break;
-          // - Sort final line
-          qsort (ccarray+ccno, nccno-ccno, sizeof(CC), left_edges_ascending);
-        }
-      // - Next line
-      ccno = nccno;
-    }
-  // Copy ccarray back and renumber the runs
-  for(ccid=0; ccid<nregularccs; ccid++)
-    {
-      CC& cc = ccarray[ccid];
-      ccs[ccid] = cc;
-      for(int r=cc.frun; r<cc.frun+cc.nrun; r++)
-        runs[r].ccid = ccid;
-    }
-  // Free memory
-  delete [] bottoms;
-  delete[] ccarray;
-}
-
-
-// -- Creates a bitmap for a particular component
-GP<GBitmap>   
-CCImage::get_bitmap_for_cc(const int ccid) const
-{
-  const CC &cc = ccs[ccid];
-  const GRect &bb = cc.bb;
-  GP<GBitmap> bits = GBitmap::create(bb.height(), bb.width());
-  const Run *prun = & runs[(int)cc.frun];
-  for (int i=0; i<cc.nrun; i++,prun++)
-    {
-      if (prun->y<bb.ymin || prun->y>=bb.ymax)
-        G_THROW("Internal error (y bounds)");
-      if (prun->x1<bb.xmin || prun->x2>=bb.xmax)
-        G_THROW("Internal error (x bounds)");
-      unsigned char *row = (*bits)[prun->y - bb.ymin];
-      for (int x=prun->x1; x<=prun->x2; x++)
-        row[x - bb.xmin] = 1;
-    }
-  return bits;
-}
-
-
-// -- Creates a JB2Image with the remaining components
-GP<JB2Image> 
-CCImage::get_jb2image() const
-{
-  GP<JB2Image> jimg = JB2Image::create();
-  jimg->set_dimension(width, height);
-  if (runs.hbound() < 0)
-    return jimg;
-  if (ccs.hbound() < 0)
-    G_THROW("Must first perform a cc analysis");
-  // Iterate over CCs
-  for (int ccid=0; ccid<=ccs.hbound(); ccid++)
-    {
-      JB2Shape shape;
-      JB2Blit  blit;
-      shape.parent = -1;
-      shape.bits = get_bitmap_for_cc(ccid);
-      shape.userdata = 0;
-      if (ccid >= nregularccs)
-        shape.userdata |= JB2SHAPE_SPECIAL;
-      blit.shapeno = jimg->add_shape(shape);
-      blit.left = ccs[ccid].bb.xmin;
-      blit.bottom = ccs[ccid].bb.ymin;
-      jimg->add_blit(blit);
-      shape.bits->compress();
-    }
-  // Return
-  return jimg;
-}
-
-
-
-
 // --------------------------------------------------
 // COMPLETE COMPRESSION ROUTINE
 // --------------------------------------------------
@@ -720,6 +173,8 @@ struct cjb2opts {
   int  forcedpi;
   int  losslevel;
   bool verbose;
+  bool verify;
+  int  pagesperdict;
 };
 
 #if HAVE_TIFF
@@ -803,7 +258,7 @@ read_tiff(CCImage &rimg, ByteStream *bs, cjb2opts &opts)
         opts.dpi = (int) (xres + yres) / 2;
     }
   // init rimg
-  rimg.init(w, h, opts.dpi);
+  rimg.init(w, h);
   // allocate scanline
   tsize_t scanlinesize = TIFFScanlineSize(tiff);
   scanlinesize = MAX(scanlinesize,1);
@@ -852,8 +307,9 @@ read_tiff(CCImage &rimg, ByteStream *bs, cjb2opts &opts)
 #endif // HAVE_TIFF
 
 
-void 
-cjb2(const GURL &urlin, const GURL &urlout, cjb2opts &opts)
+// -- Reads an image and extracts its connected components
+static GP<JB2Image>
+cjb2_analyze(const GURL &urlin, cjb2opts &opts)
 {
   GP<ByteStream> ibs=ByteStream::create(urlin, "rb");
   CCImage rimg;
@@ -865,7 +321,7 @@ cjb2(const GURL &urlin, const GURL &urlout, cjb2opts &opts)
 #endif
     {
       GP<GBitmap> input=GBitmap::create(*ibs);
-      rimg.init(input->columns(), input->rows(), opts.dpi);
+      rimg.init(input->columns(), input->rows());
       rimg.add_bitmap_runs(*input); 
     }
   if (opts.verbose)
@@ -873,29 +329,42 @@ cjb2(const GURL &urlin, const GURL &urlout, cjb2opts &opts)
                          rimg.runs.size() );
   
   // Component analysis
+  int dpi = MAX(200, MIN(900, opts.dpi));
+  int largesize = MIN( 500, MAX(64, dpi));   // CCs larger than that are special
+  int smallsize = MAX(2, dpi/150);           // CCs smaller than that are special
+  int tinysize = MAX(0, dpi*dpi/20000 - 1);  // CCs smaller than that may be removed
   rimg.make_ccids_by_analysis(); // obtain ccids
   rimg.make_ccs_from_ccids();    // compute cc descriptors
   if (opts.verbose)
     DjVuFormatErrorUTF8( "%s\t%d", ERR_MSG("cjb2.ccs_before"), 
                          rimg.ccs.size());
   if (opts.losslevel > 0) 
-    rimg.erase_tiny_ccs();       // clean
-  rimg.merge_and_split_ccs();    // reorganize weird ccs
+    rimg.erase_tiny_ccs(tinysize);                // clean
+  rimg.merge_and_split_ccs(smallsize, largesize); // reorganize weird ccs
   rimg.sort_in_reading_order();  // sort cc descriptors
   if (opts.verbose)
     DjVuFormatErrorUTF8( "%s\t%d", ERR_MSG("cjb2.ccs_after"), 
                          rimg.ccs.size());
   
-  // Pattern matching
-  GP<JB2Image> jimg = rimg.get_jb2image();          // get ``raw'' jb2image
-  rimg.runs.empty();                                // save memory
-  rimg.ccs.empty();                                 // save memory
+  // Get ``raw'' jb2image
+  return rimg.get_jb2image(JB2SHAPE_SPECIAL);
+}
+
+
+// -- Performs pattern matching
+static void
+cjb2_tune(JB2Image *jimg, cjb2opts &opts)
+{
+  jb2tuneopts tune;
+  tune.verify = opts.verify;
   if (opts.losslevel>1)
-    tune_jb2image_lossy(jimg, opts.dpi, opts.losslevel);
+    tune_jb2image_lossy(jimg, opts.dpi, opts.losslevel, &tune);
   else
-    tune_jb2image_lossless(jimg);
+    tune_jb2image_lossless(jimg, &tune);
   if (opts.verbose)
     {
+      DjVuFormatErrorUTF8( "%s\t%lu", ERR_MSG("cjb2.comparisons"), 
+                           (unsigned long)tune.comparisons);
       int nshape=0, nrefine=0;
       for (int i=0; i<jimg->get_shape_count(); i++) {
         if (!jimg->get_shape(i).bits) continue;
@@ -905,30 +374,279 @@ cjb2(const GURL &urlin, const GURL &urlout, cjb2opts &opts)
       DjVuFormatErrorUTF8( "%s\t%d\t%d", ERR_MSG("cjb2.shapes"), 
                            nshape, nrefine);
     }
-  
-  // Code
-  GP<ByteStream> obs=ByteStream::create(urlout, "wb");
-  GP<IFFByteStream> giff=IFFByteStream::create(obs);
+}
+
+
+// -- Writes a page, possibly including a shared dictionary
+static void
+cjb2_write(const GP<ByteStream> &gbs, JB2Image *jimg, int dpi, const char *dictid)
+{
+  GP<IFFByteStream> giff=IFFByteStream::create(gbs);
   IFFByteStream &iff=*giff;
   // -- main composite chunk
   iff.put_chunk("FORM:DJVU", 1);
   // -- ``INFO'' chunk
   GP<DjVuInfo> ginfo=DjVuInfo::create();
   DjVuInfo &info=*ginfo;
-  info.height = rimg.height;
-  info.width = rimg.width;
-  info.dpi = opts.dpi;
+  info.height = jimg->get_height();
+  info.width = jimg->get_width();
+  info.dpi = dpi;
   iff.put_chunk("INFO");
   info.encode(*iff.get_bytestream());
   iff.close_chunk();
+  // -- ``INCL'' chunk
+  if (dictid)
+    {
+      iff.put_chunk("INCL");
+      iff.get_bytestream()->writall(dictid, strlen(dictid));
+      iff.close_chunk();
+    }
   // -- ``Sjbz'' chunk
   iff.put_chunk("Sjbz");
   jimg->encode(iff.get_bytestream());
   iff.close_chunk();
   // -- terminate main composite chunk
   iff.close_chunk();
+}
+
+
+void 
+cjb2(const GURL &urlin, const GURL &urlout, cjb2opts &opts)
+{
+  GP<JB2Image> jimg = cjb2_analyze(urlin, opts);
+  cjb2_tune(jimg, opts);
+  GP<ByteStream> obs=ByteStream::create(urlout, "wb");
+  cjb2_write(obs, jimg, opts.dpi, 0);
   // Finished!
 }
+
+
+
+// --------------------------------------------------
+// MULTIPAGE COMPRESSION
+// --------------------------------------------------
+
+// Pages are processed by groups of opts.pagesperdict pages.  The shapes
+// of all pages of a group are matched together.  Shapes used by several
+// pages of the group, and the shapes they are refined from, are moved
+// into a shared dictionary that the pages include.  The other shapes
+// remain private to their page.
+
+// -- A page of a group
+struct cjb2page
+{
+  GURL url;
+  cjb2opts opts;                // options with the page resolution
+  GP<JB2Image> jimg;            // components, then final page image
+  int firstblit;                // blits of this page in the merged image
+  int nblits;
+  GP<ByteStream> data;          // encoded page
+};
+
+// -- Concurrent component analysis and page encoding
+struct cjb2jobs
+{
+  cjb2page *pages;
+  const char *dictid;
+};
+
+static void
+cjb2_analyze_job(void *arg, int i)
+{
+  cjb2jobs *jobs = (cjb2jobs*)arg;
+  cjb2page &page = jobs->pages[i];
+  page.jimg = cjb2_analyze(page.url, page.opts);
+}
+
+static void
+cjb2_write_job(void *arg, int i)
+{
+  cjb2jobs *jobs = (cjb2jobs*)arg;
+  cjb2page &page = jobs->pages[i];
+  page.data = ByteStream::create();
+  cjb2_write(page.data, page.jimg, page.opts.dpi, jobs->dictid);
+}
+
+static void
+cjb2_run(void (*job)(void*, int), cjb2jobs &jobs, int npages)
+{
+  GThreadPool *pool = GThreadPool::get_shared();
+  if (pool)
+    pool->run(job, (void*)&jobs, npages);
+  else
+    for (int i=0; i<npages; i++)
+      (*job)((void*)&jobs, i);
+}
+
+// -- Records that shape #shapeno# is used by page #pageno#
+//    (-2 for the dictionary) in array #owner#.
+static inline void
+cjb2_use(int *owner, int shapeno, int pageno)
+{
+  if (owner[shapeno] == -1)
+    owner[shapeno] = pageno;
+  else if (owner[shapeno] != pageno)
+    owner[shapeno] = -2;
+}
+
+// -- Splits a tuned merged image into a dictionary and page images
+static GP<JB2Dict>
+cjb2_split(JB2Image *merged, cjb2page *pages, int npages)
+{
+  int nshapes = merged->get_shape_count();
+  GTArray<int> owner(nshapes-1);
+  GTArray<int> remap(nshapes-1);
+  int shapeno, pageno;
+  for (shapeno=0; shapeno<nshapes; shapeno++)
+    owner[shapeno] = remap[shapeno] = -1;
+  // Find the pages using each shape.  Parents always 
+  // precede their children because matching only looks
+  // at earlier shapes.
+  for (pageno=0; pageno<npages; pageno++)
+    for (int i=0; i<pages[pageno].nblits; i++)
+      {
+        JB2Blit *blit = merged->get_blit(pages[pageno].firstblit + i);
+        cjb2_use(owner, blit->shapeno, pageno);
+      }
+  for (shapeno=nshapes-1; shapeno>=0; shapeno--)
+    {
+      JB2Shape &jshp = merged->get_shape(shapeno);
+      if (jshp.bits && jshp.parent >= 0 && owner[shapeno] != -1)
+        cjb2_use(owner, jshp.parent, owner[shapeno]);
+    }
+  // Fill dictionary
+  GP<JB2Dict> dict = JB2Dict::create();
+  for (shapeno=0; shapeno<nshapes; shapeno++)
+    {
+      JB2Shape jshp = merged->get_shape(shapeno);
+      if (jshp.bits && owner[shapeno] == -2)
+        {
+          if (jshp.parent >= 0)
+            jshp.parent = remap[jshp.parent];
+          remap[shapeno] = dict->add_shape(jshp);
+        }
+    }
+  // Fill pages
+  for (pageno=0; pageno<npages; pageno++)
+    {
+      cjb2page &page = pages[pageno];
+      GP<JB2Image> jimg = JB2Image::create();
+      jimg->set_dimension(page.jimg->get_width(), page.jimg->get_height());
+      if (dict->get_shape_count() > 0)
+        jimg->set_inherited_dict(dict);
+      for (shapeno=0; shapeno<nshapes; shapeno++)
+        {
+          JB2Shape jshp = merged->get_shape(shapeno);
+          if (jshp.bits && owner[shapeno] == pageno)
+            {
+              if (jshp.parent >= 0)
+                jshp.parent = remap[jshp.parent];
+              remap[shapeno] = jimg->add_shape(jshp);
+            }
+        }
+      for (int i=0; i<page.nblits; i++)
+        {
+          JB2Blit blit = *merged->get_blit(page.firstblit + i);
+          blit.shapeno = remap[blit.shapeno];
+          jimg->add_blit(blit);
+        }
+      page.jimg = jimg;
+    }
+  return dict;
+}
+
+void
+cjb2_multipage(const GList<GURL> &urlsin, const GURL &urlout, cjb2opts &opts)
+{
+  GP<DjVmDoc> gdoc=DjVmDoc::create();
+  DjVmDoc &doc=*gdoc;
+  int npages = urlsin.size();
+  int pagesperdict = MAX(1, opts.pagesperdict);
+  GArray<cjb2page> pages(0, pagesperdict-1);
+  GPosition pos = urlsin;
+  int pageno = 0;
+  int dictno = 0;
+  while (pageno < npages)
+    {
+      // Analyze the pages of a group concurrently
+      int ngroup = MIN(pagesperdict, npages - pageno);
+      cjb2jobs jobs;
+      jobs.pages = &pages[0];
+      jobs.dictid = 0;
+      for (int i=0; i<ngroup; i++, ++pos)
+        {
+          pages[i].url = urlsin[pos];
+          pages[i].opts = opts;
+          pages[i].opts.verbose = false;
+          pages[i].jimg = 0;
+          pages[i].data = 0;
+        }
+      cjb2_run(cjb2_analyze_job, jobs, ngroup);
+      // Merge the components of the group and match them
+      GP<JB2Image> merged = JB2Image::create();
+      int i, width = 0, height = 0;
+      for (i=0; i<ngroup; i++)
+        {
+          JB2Image &jimg = *pages[i].jimg;
+          width = MAX(width, jimg.get_width());
+          height = MAX(height, jimg.get_height());
+        }
+      merged->set_dimension(width, height);
+      for (i=0; i<ngroup; i++)
+        {
+          JB2Image &jimg = *pages[i].jimg;
+          int firstshape = merged->get_shape_count();
+          for (int s=0; s<jimg.get_shape_count(); s++)
+            merged->add_shape(jimg.get_shape(s));
+          pages[i].firstblit = merged->get_blit_count();
+          pages[i].nblits = jimg.get_blit_count();
+          for (int b=0; b<jimg.get_blit_count(); b++)
+            {
+              JB2Blit blit = *jimg.get_blit(b);
+              blit.shapeno += firstshape;
+              merged->add_blit(blit);
+            }
+        }
+      cjb2opts mopts = opts;
+      mopts.dpi = pages[0].opts.dpi;
+      cjb2_tune(merged, mopts);
+      // Split the shared shapes and encode the pages concurrently
+      GP<JB2Dict> dict = cjb2_split(merged, &pages[0], ngroup);
+      merged = 0;
+      char dictid[20];
+      if (dict->get_shape_count() > 0)
+        {
+          sprintf(dictid, "dict%04d.iff", ++dictno);
+          jobs.dictid = dictid;
+          GP<ByteStream> gbs=ByteStream::create();
+          GP<IFFByteStream> giff=IFFByteStream::create(gbs);
+          giff->put_chunk("FORM:DJVI", 1);
+          giff->put_chunk("Djbz");
+          dict->encode(giff->get_bytestream());
+          giff->close_chunk();
+          giff->close_chunk();
+          gbs->seek(0);
+          doc.insert_file(*gbs, DjVmDir::File::INCLUDE, dictid, dictid);
+          if (opts.verbose)
+            DjVuFormatErrorUTF8( "%s\t%d\t%d\t%d", ERR_MSG("cjb2.dict"), 
+                                 dict->get_shape_count(), 
+                                 pageno+1, pageno+ngroup);
+        }
+      cjb2_run(cjb2_write_job, jobs, ngroup);
+      for (i=0; i<ngroup; i++)
+        {
+          char pagename[20];
+          sprintf(pagename, "p%04d.djvu", ++pageno);
+          pages[i].data->seek(0);
+          doc.insert_file(*pages[i].data, DjVmDir::File::PAGE, 
+                          pagename, pagename);
+          pages[i].jimg = 0;
+          pages[i].data = 0;
+        }
+    }
+  // Save as a bundled file
+  doc.write(ByteStream::create(urlout,"wb"));
+}
       
 
 
@@ -947,13 +665,16 @@ usage()
          "CJB2 --- DjVuLibre-" DJVULIBRE_VERSION "\n"
 #endif
          "Simple DjVuBitonal encoder\n\n"
-         "Usage: cjb2 [options] <input-pbm-or-tiff> <output-djvu>\n"
+         "Usage: cjb2 [options] <input-pbm-or-tiff>... <output-djvu>\n"
          "Options are:\n"
          " -verbose        Display additional messages.\n"
          " -dpi <n>        Specify image resolution (default 300).\n"
          " -clean          Cleanup image by removing small flyspecks.\n"
          " -lossy          Lossy compression (implies -clean as well)\n"
          " -losslevel <n>  Loss factor (implies -lossy, default 100)\n"
+         " -verify         Check the indexed shape search against a full search.\n"
+         " -threads <n>    Match shapes using n threads.\n"
+         " -pages-per-dict <n>  Share a shape dictionary among n pages (default 10).\n"
          "Encoding is lossless unless a lossy options is selected.\n" );
   exit(10);
 }
@@ -968,14 +689,15 @@ main(int argc, const char **argv)
     dargv[i]=GNativeString(argv[i]);
   G_TRY
     {
-      GURL inputpbmurl;
-      GURL outputdjvuurl;
+      GList<GURL> urls;
       cjb2opts opts;
       // Defaults
       opts.forcedpi = 0;
       opts.dpi = 300;
       opts.losslevel = 0;
       opts.verbose = false;
+      opts.verify = false;
+      opts.pagesperdict = 10;
       // Parse options
       for (int i=1; i<argc; i++)
         {
@@ -1002,19 +724,40 @@ main(int argc, const char **argv)
             opts.losslevel = 1;
           else if (arg == "-verbose" || arg == "-v")
             opts.verbose = true;
+          else if (arg == "-verify")
+            opts.verify = true;
+          else if (arg == "-threads")
+            {
+              if (++i >= argc)
+                G_THROW( ERR_MSG("cjb2.no_threads_arg") );
+              char *end;
+              int threads = strtol(dargv[i], &end, 10);
+              if (*end || threads<1 || threads>64)
+                G_THROW( ERR_MSG("cjb2.illegal_threads") );
+              GThreadPool::set_shared_threads(threads);
+            }
+          else if (arg == "-pages-per-dict" && i+1<argc)
+            {
+              char *end;
+              opts.pagesperdict = strtol(dargv[++i], &end, 10);
+              if (*end || opts.pagesperdict<1)
+                usage();
+            }
           else if (arg[0] == '-' && arg[1])
             usage();
-          else if (inputpbmurl.is_empty())
-            inputpbmurl = GURL::Filename::UTF8(arg);
-          else if (outputdjvuurl.is_empty())
-            outputdjvuurl = GURL::Filename::UTF8(arg);
           else
-            usage();
+            urls.append(GURL::Filename::UTF8(arg));
         }
-      if (inputpbmurl.is_empty() || outputdjvuurl.is_empty())
+      if (urls.size() < 2)
         usage();
+      GPosition last = urls.lastpos();
+      GURL outputdjvuurl = urls[last];
+      urls.del(last);
       // Execute
-      cjb2(inputpbmurl, outputdjvuurl, opts);
+      if (urls.size() == 1)
+        cjb2(urls[urls.firstpos()], outputdjvuurl, opts);
+      else
+        cjb2_multipage(urls, outputdjvuurl, opts);
     }
   G_CATCH(ex)
     {
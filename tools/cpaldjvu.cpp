@@ -107,6 +107,7 @@
 #include "IFFByteStream.h"
 #include "GRect.h"
 #include "GBitmap.h"
+#include "CCImage.h"
 #include "JB2Image.h"
 #include "DjVuPalette.h"
 #include "IW44Image.h"
@@ -127,485 +128,6 @@ inline int MIN(int a, int b) { return ( a<b ?a :b); }
 inline int MAX(int a, int b) { return ( a>b ?a :b); }
 
 
-// --------------------------------------------------
-// COLOR CONNECTED COMPONENT ANALYSIS
-// --------------------------------------------------
-
-// -- A run of pixels with the same color
-struct Run    
-{ 
-  short y;       // vertical coordinate
-  short x1;      // first horizontal coordinate
-  short x2;      // last horizontal coordinate
-  short color;   // color id
-  int ccid;      // component id
-};
-
-
-// -- A component descriptor
-struct CC    
-{
-  GRect bb;      // bounding box
-  int npix;      // number of black pixels
-  int nrun;      // number of runs
-  int frun;      // first run in cc ordered array of runs
-  int color;     // color id
-};
-
-
-// -- An image composed of runs
-class CCImage 
-{
-public:
-  int height;            // Height of the image in pixels
-  int width;             // Width of the image in pixels
-  GTArray<Run> runs;     // Array of runs
-  GTArray<CC>  ccs;      // Array of component descriptors
-  int nregularccs;       // Number of regular ccs (set by merge_and_split_ccs)
-  CCImage(int width, int height);
-  void add_single_run(int y, int x1, int x2, int color, int ccid=0);
-  GP<GBitmap> get_bitmap_for_cc(int ccid) const;
-  void make_ccids_by_analysis();
-  void make_ccs_from_ccids();
-  void merge_and_split_ccs(int smallsize, int largesize);
-  void sort_in_reading_order(); 
-  void erase_cc(int ccid);
-};
-
-
-// -- Compares runs
-static inline bool
-operator <= (const Run &a, const Run &b)
-{
-  return (a.y<b.y) || (a.y==b.y && a.x1<=b.x1);
-}
-
-
-// -- Constructs CCImage and provide defaults
-CCImage::CCImage(int width, int height)
-  : height(height), width(width), nregularccs(0)
-{
-}
-
-
-// -- Adds a run to the CCImage
-inline void 
-CCImage::add_single_run(int y, int x1, int x2, int color, int ccid)
-{
-  int index = runs.hbound();
-  runs.touch(++index);
-  Run& run = runs[index];
-  run.y = y;
-  run.x1 = x1;
-  run.x2 = x2;
-  run.color = color;
-  run.ccid = ccid;
-  
-}
-
-
-// -- Performs color connected component analysis
-void
-CCImage::make_ccids_by_analysis()
-{
-  // Sort runs
-  runs.sort();
-  // Single Pass Connected Component Analysis (with unodes)
-  int n;
-  int p=0;
-  GTArray<int> umap;
-  for (n=0; n<=runs.hbound(); n++)
-    {
-      int y = runs[n].y;
-      int x1 = runs[n].x1 - 1;
-      int x2 = runs[n].x2 + 1;
-      int color = runs[n].color;
-      int id = (umap.hbound() + 1);
-      // iterate over previous line runs
-      if (p>0) p--;
-      for(;runs[p].y < y-1;p++);
-      for(;(runs[p].y < y) && (runs[p].x1 <= x2);p++ )
-        {
-          if ( runs[p].x2 >= x1 )
-            {
-              if (runs[p].color == color)
-                {
-                  // previous run touches current run and has same color
-                  int oid = runs[p].ccid;
-                  while (umap[oid] < oid)
-                    oid = umap[oid];
-                  if ((int)id > umap.hbound()) {
-                    id = oid;
-                  } else if (id < oid) {
-                    umap[oid] = id;
-                  } else {
-                    umap[id] = oid;
-                    id = oid;
-                  }
-                  // freshen previous run id
-                  runs[p].ccid = id;
-                }
-              // stop if previous run goes past current run
-              if (runs[p].x2 >= x2)
-                break;
-            }
-        }
-      // create new entry in umap
-      runs[n].ccid = id;
-      if (id > umap.hbound())
-        {
-          umap.touch(id);
-          umap[id] = id;
-        }
-    }
-  // Update umap and ccid
-  for (n=0; n<=runs.hbound(); n++)
-    {
-      Run &run = runs[n];
-      int ccid = run.ccid;
-      while (umap[ccid] < ccid)
-        ccid = umap[ccid];
-      umap[run.ccid] = ccid;
-      run.ccid = ccid;
-    }
-}
-
-
-// -- Constructs the ``ccs'' array from run's ccids.
-void
-CCImage::make_ccs_from_ccids()
-{
-  int n;
-  Run *pruns = runs;
-  // Find maximal ccid
-  int maxccid = -1;
-  for (n=0; n<=runs.hbound(); n++)
-    if (pruns[n].ccid > maxccid)
-      maxccid = runs[n].ccid;
-  GTArray<int> armap(0,maxccid);
-  int *rmap = armap;
-  // Renumber ccs 
-  for (n=0; n<=maxccid; n++)
-    armap[n] = -1;
-  for (n=0; n<=runs.hbound(); n++)
-    if (pruns[n].ccid >= 0)
-      rmap[ pruns[n].ccid ] = 1;
-  int nid = 0;
-  for (n=0; n<=maxccid; n++)
-    if (rmap[n] > 0)
-      rmap[n] = nid++;
-  // Adjust nregularccs (since ccs are renumbered)
-  while (nregularccs>0 && rmap[nregularccs-1]<0)
-    nregularccs -= 1;
-  if (nregularccs>0)
-    nregularccs = 1 + rmap[nregularccs-1];
-  // Prepare cc descriptors
-  ccs.resize(0,nid-1);
-  for (n=0; n<nid; n++)
-    ccs[n].nrun = 0;
-  // Relabel runs
-  for (n=0; n<=runs.hbound(); n++)
-    {
-      Run &run = pruns[n];
-      if (run.ccid < 0) continue;  // runs with negative ccids are destroyed
-      int oldccid = run.ccid;
-      int newccid = rmap[oldccid];
-      CC &cc = ccs[newccid];
-      run.ccid = newccid;
-      cc.nrun += 1;
-    }
-  // Compute positions for runs of cc
-  int frun = 0;
-  for (n=0; n<nid; n++) 
-    {
-      ccs[n].frun = rmap[n] = frun;
-      frun += ccs[n].nrun;
-    }
-  // Copy runs
-  GTArray<Run> rtmp;
-  rtmp.steal(runs);
-  Run *ptmp = rtmp;
-  runs.resize(0,frun-1);
-  pruns = runs;
-  for (n=0; n<=rtmp.hbound(); n++)
-    {
-      int id = ptmp[n].ccid;
-      if (id < 0) continue;
-      int pos = rmap[id]++;
-      pruns[pos] = ptmp[n];
-    }
-  // Finalize ccs
-  for (n=0; n<nid; n++)
-    {
-      CC &cc = ccs[n];
-      int npix = 0;
-      runs.sort(cc.frun, cc.frun+cc.nrun-1);
-      Run *run = &runs[cc.frun];
-      int xmin = run->x1;
-      int xmax = run->x2;
-      int ymin = run->y;
-      int ymax = run->y;
-      cc.color = run->color;
-      for (int i=0; i<cc.nrun; i++, run++)
-        {
-          if (run->x1 < xmin)  xmin = run->x1;
-          if (run->x2 > xmax)  xmax = run->x2;
-          if (run->y  < ymin)  ymin = run->y;
-          if (run->y  > ymax)  ymax = run->y;
-          npix += run->x2 - run->x1 + 1;
-        }
-      cc.npix = npix;
-      cc.bb.xmin = xmin;
-      cc.bb.ymin = ymin;
-      cc.bb.xmax = xmax + 1;
-      cc.bb.ymax = ymax + 1;
-    }
-}
-
-
-// -- Helper for merge_and_split_ccs
-struct Grid_x_Color 
-{
-  short gridi;
-  short gridj;
-  int color;
-};
-
-
-// -- Helper for merge_and_split_ccs
-static inline unsigned int
-hash(const Grid_x_Color &x) 
-{
-  return (x.gridi<<16) ^ (x.gridj<<8) ^ x.color;
-}
-
-
-// -- Helper for merge_and_split_ccs
-static inline bool
-operator==(const Grid_x_Color &x, const Grid_x_Color &y)
-{
-  return (x.gridi==y.gridi) && (x.gridj==y.gridj) && (x.color==y.color);
-}
-
-
-// -- Helper for merge_and_split_ccs
-static int
-makeccid(const Grid_x_Color &x, GMap<Grid_x_Color,int> &map, int &ncc)
-{
-  GPosition p = map.contains(x);
-  if (p) return map[p];
-  return map[x] = ncc++;
-}
-
-
-// -- Merges small ccs of similar color and splits large ccs
-void
-CCImage::merge_and_split_ccs(int smallsize, int largesize)
-{
-  int ncc = ccs.size();
-  int nruns = runs.size();
-  int splitsize = largesize;
-  if (ncc <= 0) return;
-  // Associative map for storing merged ccids
-  GMap<Grid_x_Color,int> map;
-  nregularccs = ncc;
-  // Set the correct ccids for the runs
-  for (int ccid=0; ccid<ccs.size(); ccid++)
-    {
-      CC* cc = &ccs[ccid];
-      if (cc->nrun <= 0) continue;
-      Grid_x_Color key;
-      int ccheight = cc->bb.height();
-      int ccwidth = cc->bb.width();
-      if (ccheight<=smallsize && ccwidth<=smallsize)
-        {
-          key.color = cc->color;
-          key.gridi = (cc->bb.ymin+cc->bb.ymax)/splitsize/2;
-          key.gridj = (cc->bb.xmin+cc->bb.xmax)/splitsize/2;
-          int newccid = makeccid(key, map, ncc);
-          for(int runid=cc->frun; runid<cc->frun+cc->nrun; runid++)
-            runs[runid].ccid = newccid;
-        }
-      else if (ccheight>=largesize || ccwidth>=largesize)
-        {
-          key.color = -ccid;
-          for(int runid=cc->frun; runid<cc->frun+cc->nrun; runid++)
-            {
-              Run *r = & runs[runid];
-              key.gridi = r->y/splitsize;
-              key.gridj = r->x1/splitsize;
-              int gridj_end = r->x2/splitsize;
-              int gridj_span = gridj_end - key.gridj;
-              r->ccid = makeccid(key, map, ncc);
-              if (gridj_span>0)
-                {
-                  // truncate current run 
-                  runs.touch(nruns+gridj_span-1);
-                  r = &runs[runid];
-                  int x = key.gridj*splitsize + splitsize;
-                  int x_end = r->x2;
-                  r->x2 = x-1;
-                  // append additional runs to the runs array
-                  while (++key.gridj < gridj_end)
-                    {
-                      Run& newrun = runs[nruns++];
-                      newrun.y = r->y;
-                      newrun.x1 = x;
-                      x += splitsize;
-                      newrun.x2 = x-1;
-                      newrun.color = key.color;
-                      newrun.ccid = makeccid(key, map, ncc);
-                    }
-                  // append last run to the run array
-                  Run& newrun = runs[nruns++];
-                  newrun.y = r->y;
-                  newrun.x1 = x;
-                  newrun.x2 = x_end;
-                  newrun.color = key.color;
-                  newrun.ccid = makeccid(key, map, ncc);
-                }
-            }
-        }
-    }
-  // Recompute cc descriptors
-  make_ccs_from_ccids();
-}
-
-
-// -- Helps sorting cc
-static int 
-top_edges_descending (const void *pa, const void *pb)
-{
-  if (((CC*) pa)->bb.ymax != ((CC*) pb)->bb.ymax)
-    return (((CC*) pb)->bb.ymax - ((CC*) pa)->bb.ymax);
-  if (((CC*) pa)->bb.xmin != ((CC*) pb)->bb.xmin)
-    return (((CC*) pa)->bb.xmin - ((CC*) pb)->bb.xmin);
-  return (((CC*) pa)->frun - ((CC*) pb)->frun);
-}
-
-
-// -- Helps sorting cc
-static int 
-left_edges_ascending (const void *pa, const void *pb)
-{
-  if (((CC*) pa)->bb.xmin != ((CC*) pb)->bb.xmin)
-    return (((CC*) pa)->bb.xmin - ((CC*) pb)->bb.xmin);
-  if (((CC*) pb)->bb.ymax != ((CC*) pa)->bb.ymax)
-    return (((CC*) pb)->bb.ymax - ((CC*) pa)->bb.ymax);
-  return (((CC*) pa)->frun - ((CC*) pb)->frun);
-}
-
-
-// -- Helps sorting cc
-static int 
-integer_ascending (const void *pa, const void *pb)
-{
-  return ( *(int*)pb - *(int*)pa );
-}
-
-
-// -- Sort ccs in approximate reading order
-void 
-CCImage::sort_in_reading_order()
-{
-  if (nregularccs<2) return;
-  CC *ccarray = new CC[nregularccs];
-  // Copy existing ccarray (but segregate special ccs)
-  int ccid;
-  for(ccid=0; ccid<nregularccs; ccid++)
-    ccarray[ccid] = ccs[ccid];
-  // Sort the ccarray list into top-to-bottom order.
-  qsort (ccarray, nregularccs, sizeof(CC), top_edges_descending);
-  // Subdivide the ccarray list roughly into text lines
-  int maxtopchange = width / 40;
-  if (maxtopchange < 32) 
-    maxtopchange = 32;
-  // - Loop until processing all ccs
-  int ccno = 0;
-  int *bottoms = new int[nregularccs];
-  while (ccno < nregularccs)
-    {
-      // - Gather first line approximation
-      int nccno;
-      int sublist_top = ccarray[ccno].bb.ymax-1;
-      int sublist_bottom = ccarray[ccno].bb.ymin;
-      for (nccno=ccno; nccno < nregularccs; nccno++)
-        {
-          if (ccarray[nccno].bb.ymax-1 < sublist_bottom) break;
-          if (ccarray[nccno].bb.ymax-1 < sublist_top - maxtopchange) break;
-          int bottom = ccarray[nccno].bb.ymin;
-          bottoms[nccno-ccno] = bottom;
-          if (bottom < sublist_bottom)
-            sublist_bottom = bottom;
-        }
-      // - If more than one candidate cc for the line
-      if (nccno > ccno + 1)
-        {
-          // - Compute median bottom
-          qsort(bottoms, nccno-ccno, sizeof(int), integer_ascending);
-          int bottom = bottoms[ (nccno-ccno-1)/2 ];
-          // - Compose final line
-          for (nccno=ccno; nccno < nregularccs; nccno++)
-            if (ccarray[nccno].bb.ymax-1 < bottom)
-              break;
-          // - Sort final line
-          qsort (ccarray+ccno, nccno-ccno, sizeof(CC), left_edges_ascending);
-        }
-      // - Next line
-      ccno = nccno;
-    }
-  // Copy ccarray back and renumber the runs
-  for(ccid=0; ccid<nregularccs; ccid++)
-    {
-      CC& cc = ccarray[ccid];
-      ccs[ccid] = cc;
-      for(int r=cc.frun; r<cc.frun+cc.nrun; r++)
-        runs[r].ccid = ccid;
-    }
-  // Free memory
-  delete [] bottoms;
-  delete[] ccarray;
-}
-
-
-// -- Creates a bitmap for a particular component
-GP<GBitmap>   
-CCImage::get_bitmap_for_cc(const int ccid) const
-{
-  const CC &cc = ccs[ccid];
-  const GRect &bb = cc.bb;
-  GP<GBitmap> bits = GBitmap::create(bb.height(), bb.width());
-  const Run *prun = & runs[(int)cc.frun];
-  for (int i=0; i<cc.nrun; i++,prun++)
-    {
-      if (prun->y<bb.ymin || prun->y>=bb.ymax)
-        G_THROW("Internal error (y bounds)");
-      if (prun->x1<bb.xmin || prun->x2>=bb.xmax)
-        G_THROW("Internal error (x bounds)");
-      unsigned char *row = (*bits)[prun->y - bb.ymin];
-      for (int x=prun->x1; x<=prun->x2; x++)
-        row[x - bb.xmin] = 1;
-    }
-  return bits;
-}
-
-
-// -- Marks cc for deletion
-void 
-CCImage::erase_cc(int ccid)
-{
-  CC &cc = ccs[ccid];
-  Run *r = &runs[cc.frun];
-  int nr = cc.nrun;
-  cc.nrun = 0;
-  cc.npix = 0;
-  while (--nr >= 0)
-    (r++)->ccid = -1;  // will be deleted by make_ccs_from_ccids()
-}
-
-
-
-
 // --------------------------------------------------
 // DEMOTION OF FOREGROUND CCS TO BACKGROUND STATUS
 // --------------------------------------------------
@@ -737,28 +259,8 @@ cpaldjvu(ByteStream *ibs, GURL &urlout, const cpaldjvuopts &opts)
   rimg.sort_in_reading_order();                   // Sort cc descriptors
   
   // Create JB2Image and fill colordata
-  GP<JB2Image> gjimg=JB2Image::create();
+  GP<JB2Image> gjimg=rimg.get_jb2image(JB2SHAPE_SPECIAL, &pal);
   JB2Image &jimg=*gjimg;
-  jimg.set_dimension(w, h);
-  int nccs = rimg.ccs.size();
-  for (int ccid=0; ccid<nccs; ccid++)
-    {
-      JB2Shape shape;
-      JB2Blit  blit;
-      shape.parent = -1;
-      shape.userdata = 0;
-      if (ccid >= rimg.nregularccs)
-        shape.userdata |= JB2SHAPE_SPECIAL;
-      shape.bits = rimg.get_bitmap_for_cc(ccid);
-      shape.bits->compress();
-      CC& cc = rimg.ccs[ccid];
-      blit.shapeno = jimg.add_shape(shape);
-      blit.left = cc.bb.xmin;
-      blit.bottom = cc.bb.ymin;
-      int blitno = jimg.add_blit(blit);
-      pal.colordata.touch(blitno);
-      pal.colordata[blitno] = cc.color;
-    }
   
   // Organize JB2Image
   tune_jb2image_lossless(&jimg);
@@ -145,6 +145,7 @@
 #include "IFFByteStream.h"
 #include "GRect.h"
 #include "GBitmap.h"
+#include "CCImage.h"
 #include "JB2Image.h"
 #include "DjVuPalette.h"
 #include "IW44Image.h"
@@ -152,6 +153,7 @@
 #include "DjVmDoc.h"
 #include "DjVmNav.h"
 #include "GOS.h"
+#include "GThreads.h"
 #include "GURL.h"
 #include "DjVuMessage.h"
 #include "DjVuText.h"
@@ -465,58 +467,18 @@ BufferByteStream::read_ps_string(GUTF8String &s)
 }
 
 // --------------------------------------------------
-// COLOR CONNECTED COMPONENT ANALYSIS
+// READING RUN LENGTH ENCODED IMAGES
 // --------------------------------------------------
 
 
-// -- A run of pixels with the same color
-struct Run    
-{ 
-  short y;       // vertical coordinate
-  short x1;      // first horizontal coordinate
-  short x2;      // last horizontal coordinate
-  short color;   // color id
-  int ccid;      // component id
-};
-
-
-// -- Compares runs for y-x sorting
-static inline bool
-operator <= (const Run &a, const Run &b)
-{
-  return (a.y<b.y) || (a.y==b.y && a.x1<=b.x1);
-}
-
-
-// -- Color component descriptor
-struct CC    
-{
-  GRect bb;      // bounding box
-  int npix;      // number of black pixels
-  int nrun;      // number of runs
-  int frun;      // first run in cc ordered array of runs
-  int color;     // color id
-};
-
-
-// -- An image composed of runs
-class CRLEImage 
+// -- An image composed of runs read from a run length encoded file
+class CRLEImage : public CCImage
 {
 public:
-  int height;            // Height of the image in pixels
-  int width;             // Width of the image in pixels
   GP<DjVuPalette> pal;   // Color palette
-  GTArray<Run>    runs;  // Array of runs
-  GTArray<CC>     ccs;   // Array of component descriptors
-  int  nregularccs;      // Number of regular ccs (set by merge_and_split_ccs)
   char bg_flags;         // Comment flags about background.
   char fg_flags;         // Comment flags about foreground.
   CRLEImage(BufferByteStream &bs);
-  GP<GBitmap> get_bitmap_for_cc(int ccid) const;
-  void make_ccids_by_analysis();
-  void make_ccs_from_ccids();
-  void merge_and_split_ccs(int smallsize, int largesize);
-  void sort_in_reading_order(); 
 private:
   unsigned int read_integer(BufferByteStream &bs);
   void insert_runs(int y, const short *x1x2color, int nruns);
@@ -588,7 +550,7 @@ CRLEImage::insert_runs(int y, const short *x1x2color, int count)
 // -- Constructs CRLEImage from a run lenght encoded file,
 //    making sure that runs are properly sorted.
 CRLEImage::CRLEImage(BufferByteStream &bs)
-  : height(0), width(0), nregularccs(0), bg_flags(0), fg_flags(0)
+  : bg_flags(0), fg_flags(0)
 {
   unsigned int magic = bs.read16();
   width = read_integer(bs);
@@ -691,392 +653,6 @@ CRLEImage::CRLEImage(BufferByteStream &bs)
 }
 
 
-// -- Performs color connected component analysis
-//    assuming that runs are already y-x sorted.
-void
-CRLEImage::make_ccids_by_analysis()
-{
-  // runs.sort(); (we know that runs are 
-  // Single Pass Connected Component Analysis (with unodes)
-  int n;
-  int p=0;
-  GTArray<int> umap;
-  for (n=0; n<=runs.hbound(); n++)
-    {
-      int y = runs[n].y;
-      int x1 = runs[n].x1 - 1;
-      int x2 = runs[n].x2 + 1;
-      int color = runs[n].color;
-      int id = (umap.hbound() + 1);
-      // iterate over previous line runs
-      if (p>0) p--;
-      for(;runs[p].y < y-1;p++);
-      for(;(runs[p].y < y) && (runs[p].x1 <= x2);p++ )
-        {
-          if ( runs[p].x2 >= x1 )
-            {
-              if (runs[p].color == color)
-                {
-                  // previous run touches current run and has same color
-                  int oid = runs[p].ccid;
-                  while (umap[oid] < oid)
-                    oid = umap[oid];
-                  if ((int)id > umap.hbound()) {
-                    id = oid;
-                  } else if (id < oid) {
-                    umap[oid] = id;
-                  } else {
-                    umap[id] = oid;
-                    id = oid;
-                  }
-                  // freshen previous run id
-                  runs[p].ccid = id;
-                }
-              // stop if previous run goes past current run
-              if (runs[p].x2 >= x2)
-                break;
-            }
-        }
-      // create new entry in umap
-      runs[n].ccid = id;
-      if (id > umap.hbound())
-        {
-          umap.touch(id);
-          umap[id] = id;
-        }
-    }
-  // Update umap and ccid
-  for (n=0; n<=runs.hbound(); n++)
-    {
-      Run &run = runs[n];
-      int ccid = run.ccid;
-      while (umap[ccid] < ccid)
-        ccid = umap[ccid];
-      umap[run.ccid] = ccid;
-      run.ccid = ccid;
-    }
-}
-
-
-// -- Constructs the ``ccs'' array from run's ccids.
-void
-CRLEImage::make_ccs_from_ccids()
-{
-  int n;
-  Run *pruns = runs;
-  // Find maximal ccid
-  int maxccid = -1;
-  for (n=0; n<=runs.hbound(); n++)
-    if (pruns[n].ccid > maxccid)
-      maxccid = runs[n].ccid;
-  GTArray<int> armap(0,maxccid);
-  int *rmap = armap;
-  // Renumber ccs 
-  for (n=0; n<=maxccid; n++)
-    armap[n] = -1;
-  for (n=0; n<=runs.hbound(); n++)
-    if (pruns[n].ccid >= 0)
-      rmap[ pruns[n].ccid ] = 1;
-  int nid = 0;
-  for (n=0; n<=maxccid; n++)
-    if (rmap[n] > 0)
-      rmap[n] = nid++;
-  // Adjust nregularccs (since ccs are renumbered)
-  while (nregularccs>0 && rmap[nregularccs-1]<0)
-    nregularccs -= 1;
-  if (nregularccs>0)
-    nregularccs = 1 + rmap[nregularccs-1];
-  // Prepare cc descriptors
-  ccs.resize(0,nid-1);
-  for (n=0; n<nid; n++)
-    ccs[n].nrun = 0;
-  // Relabel runs
-  for (n=0; n<=runs.hbound(); n++)
-    {
-      Run &run = pruns[n];
-      if (run.ccid < 0) continue;  // runs with negative ccids are destroyed
-      int oldccid = run.ccid;
-      int newccid = rmap[oldccid];
-      CC &cc = ccs[newccid];
-      run.ccid = newccid;
-      cc.nrun += 1;
-    }
-  // Compute positions for runs of cc
-  int frun = 0;
-  for (n=0; n<nid; n++) 
-    {
-      ccs[n].frun = rmap[n] = frun;
-      frun += ccs[n].nrun;
-    }
-  // Copy runs
-  GTArray<Run> rtmp;
-  rtmp.steal(runs);
-  Run *ptmp = rtmp;
-  runs.resize(0,frun-1);
-  pruns = runs;
-  for (n=0; n<=rtmp.hbound(); n++)
-    {
-      int id = ptmp[n].ccid;
-      if (id < 0) continue;
-      int pos = rmap[id]++;
-      pruns[pos] = ptmp[n];
-    }
-  // Finalize ccs
-  for (n=0; n<nid; n++)
-    {
-      CC &cc = ccs[n];
-      int npix = 0;
-      runs.sort(cc.frun, cc.frun+cc.nrun-1);
-      Run *run = &runs[cc.frun];
-      int xmin = run->x1;
-      int xmax = run->x2;
-      int ymin = run->y;
-      int ymax = run->y;
-      cc.color = run->color;
-      for (int i=0; i<cc.nrun; i++, run++)
-        {
-          if (run->x1 < xmin)  xmin = run->x1;
-          if (run->x2 > xmax)  xmax = run->x2;
-          if (run->y  < ymin)  ymin = run->y;
-          if (run->y  > ymax)  ymax = run->y;
-          npix += run->x2 - run->x1 + 1;
-        }
-      cc.npix = npix;
-      cc.bb.xmin = xmin;
-      cc.bb.ymin = ymin;
-      cc.bb.xmax = xmax + 1;
-      cc.bb.ymax = ymax + 1;
-    }
-}
-
-
-// -- Helper for merge_and_split_ccs
-struct Grid_x_Color 
-{
-  short gridi;
-  short gridj;
-  int color;
-};
-
-
-// -- Helper for merge_and_split_ccs
-static inline unsigned int
-hash(const Grid_x_Color &x) 
-{
-  return (x.gridi<<16) ^ (x.gridj<<8) ^ x.color;
-}
-
-
-// -- Helper for merge_and_split_ccs
-static inline bool
-operator==(const Grid_x_Color &x, const Grid_x_Color &y)
-{
-  return (x.gridi==y.gridi) && (x.gridj==y.gridj) && (x.color==y.color);
-}
-
-
-// -- Helper for merge_and_split_ccs
-static int
-makeccid(const Grid_x_Color &x, GMap<Grid_x_Color,int> &map, int &ncc)
-{
-  GPosition p = map.contains(x);
-  if (p) return map[p];
-  return map[x] = ncc++;
-}
-
-
-// -- Merges small ccs of similar color and splits large ccs
-void
-CRLEImage::merge_and_split_ccs(int smallsize, int largesize)
-{
-  int ncc = ccs.size();
-  int nruns = runs.size();
-  int splitsize = largesize;
-  if (ncc <= 0) return;
-  // Associative map for storing merged ccids
-  GMap<Grid_x_Color,int> map;
-  nregularccs = ncc;
-  // Set the correct ccids for the runs
-  for (int ccid=0; ccid<ccs.size(); ccid++)
-    {
-      CC* cc = &ccs[ccid];
-      if (cc->nrun <= 0) continue;
-      Grid_x_Color key;
-      key.color = cc->color;
-      int ccheight = cc->bb.height();
-      int ccwidth = cc->bb.width();
-      if (ccheight<=smallsize && ccwidth<=smallsize)
-        {
-          key.gridi = (cc->bb.ymin+cc->bb.ymax)/splitsize/2;
-          key.gridj = (cc->bb.xmin+cc->bb.xmax)/splitsize/2;
-          int newccid = makeccid(key, map, ncc);
-          for(int runid=cc->frun; runid<cc->frun+cc->nrun; runid++)
-            runs[runid].ccid = newccid;
-        }
-      else if (ccheight>=largesize || ccwidth>=largesize)
-        {
-          for(int runid=cc->frun; runid<cc->frun+cc->nrun; runid++)
-            {
-              Run *r = & runs[runid];
-              key.gridi = r->y/splitsize;
-              key.gridj = r->x1/splitsize;
-              int gridj_end = r->x2/splitsize;
-              int gridj_span = gridj_end - key.gridj;
-              r->ccid = makeccid(key, map, ncc);
-              if (gridj_span>0)
-                {
-                  // truncate current run 
-                  runs.touch(nruns+gridj_span-1);
-                  r = &runs[runid];
-                  int x = key.gridj*splitsize + splitsize;
-                  int x_end = r->x2;
-                  r->x2 = x-1;
-                  // append additional runs to the runs array
-                  while (++key.gridj < gridj_end)
-                    {
-                      Run& newrun = runs[nruns++];
-                      newrun.y = r->y;
-                      newrun.x1 = x;
-                      x += splitsize;
-                      newrun.x2 = x-1;
-                      newrun.color = key.color;
-                      newrun.ccid = makeccid(key, map, ncc);
-                    }
-                  // append last run to the run array
-                  Run& newrun = runs[nruns++];
-                  newrun.y = r->y;
-                  newrun.x1 = x;
-                  newrun.x2 = x_end;
-                  newrun.color = key.color;
-                  newrun.ccid = makeccid(key, map, ncc);
-                }
-            }
-        }
-    }
-  // Recompute cc descriptors
-  make_ccs_from_ccids();
-}
-
-
-// -- Helps sorting cc
-static int 
-top_edges_descending (const void *pa, const void *pb)
-{
-  if (((CC*) pa)->bb.ymax != ((CC*) pb)->bb.ymax)
-    return (((CC*) pb)->bb.ymax - ((CC*) pa)->bb.ymax);
-  if (((CC*) pa)->bb.xmin != ((CC*) pb)->bb.xmin)
-    return (((CC*) pa)->bb.xmin - ((CC*) pb)->bb.xmin);
-  return (((CC*) pa)->frun - ((CC*) pb)->frun);
-}
-
-
-// -- Helps sorting cc
-static int 
-left_edges_ascending (const void *pa, const void *pb)
-{
-  if (((CC*) pa)->bb.xmin != ((CC*) pb)->bb.xmin)
-    return (((CC*) pa)->bb.xmin - ((CC*) pb)->bb.xmin);
-  if (((CC*) pb)->bb.ymax != ((CC*) pa)->bb.ymax)
-    return (((CC*) pb)->bb.ymax - ((CC*) pa)->bb.ymax);
-  return (((CC*) pa)->frun - ((CC*) pb)->frun);
-}
-
-
-// -- Helps sorting cc
-static int 
-integer_ascending (const void *pa, const void *pb)
-{
-  return ( *(int*)pb - *(int*)pa );
-}
-
-
-// -- Sort ccs in approximate reading order
-void 
-CRLEImage::sort_in_reading_order()
-{
-  if (nregularccs<2) return;
-  CC *ccarray = new CC[nregularccs];
-  // Copy existing ccarray (but segregate special ccs)
-  int ccid;
-  for(ccid=0; ccid<nregularccs; ccid++)
-    ccarray[ccid] = ccs[ccid];
-  // Sort the ccarray list into top-to-bottom order.
-  qsort (ccarray, nregularccs, sizeof(CC), top_edges_descending);
-  // Subdivide the ccarray list roughly into text lines
-  int maxtopchange = width / 40;
-  if (maxtopchange < 32) 
-    maxtopchange = 32;
-  // - Loop until processing all ccs
-  int ccno = 0;
-  int *bottoms = new int[nregularccs];
-  while (ccno < nregularccs)
-    {
-      // - Gather first line approximation
-      int nccno;
-      int sublist_top = ccarray[ccno].bb.ymax-1;
-      int sublist_bottom = ccarray[ccno].bb.ymin;
-      for (nccno=ccno; nccno < nregularccs; nccno++)
-        {
-          if (ccarray[nccno].bb.ymax-1 < sublist_bottom) break;
-          if (ccarray[nccno].bb.ymax-1 < sublist_top - maxtopchange) break;
-          int bottom = ccarray[nccno].bb.ymin;
-          bottoms[nccno-ccno] = bottom;
-          if (bottom < sublist_bottom)
-            sublist_bottom = bottom;
-        }
-      // - If more than one candidate cc for the line
-      if (nccno > ccno + 1)
-        {
-          // - Compute median bottom
-          qsort(bottoms, nccno-ccno, sizeof(int), integer_ascending);
-          int bottom = bottoms[ (nccno-ccno-1)/2 ];
-          // - Compose final line
-          for (nccno=ccno; nccno < nregularccs; nccno++)
-            if (ccarray[nccno].bb.ymax-1 < bottom)
-              break;
-          // - Sort final line
-          qsort (ccarray+ccno, nccno-ccno, sizeof(CC), left_edges_ascending);
-        }
-      // - Next line
-      ccno = nccno;
-    }
-  // Copy ccarray back and renumber the runs
-  for(ccid=0; ccid<nregularccs; ccid++)
-    {
-      CC& cc = ccarray[ccid];
-      ccs[ccid] = cc;
-      for(int r=cc.frun; r<cc.frun+cc.nrun; r++)
-        runs[r].ccid = ccid;
-    }
-  // Free memory
-  delete [] bottoms;
-  delete[] ccarray;
-}
-
-
-// -- Creates a bitmap for a particular component
-GP<GBitmap>   
-CRLEImage::get_bitmap_for_cc(const int ccid) const
-{
-  const CC &cc = ccs[ccid];
-  const GRect &bb = cc.bb;
-  GP<GBitmap> bits = GBitmap::create(bb.height(), bb.width());
-  const Run *prun = & runs[(int)cc.frun];
-  for (int i=0; i<cc.nrun; i++,prun++)
-    {
-      if (prun->y<bb.ymin || prun->y>=bb.ymax)
-        G_THROW("Internal error (y bounds)");
-      if (prun->x1<bb.xmin || prun->x2>=bb.xmax)
-        G_THROW("Internal error (x bounds)");
-      unsigned char *row = (*bits)[prun->y - bb.ymin];
-      for (int x=prun->x1; x<=prun->x2; x++)
-        row[x - bb.xmin] = 1;
-    }
-  return bits;
-}
-
-
-
 // --------------------------------------------------
 // PROCESS BACKGROUND PIXMAP
 // --------------------------------------------------
@@ -1539,7 +1115,7 @@ csepdjvu_page(BufferByteStream &bs,
   // Post-process Color Connected Components
   int largesize = MIN(500, MAX(64, opts.dpi));
   int smallsize = MAX(2, opts.dpi/150);
-  rimg.merge_and_split_ccs(smallsize,largesize);  // Eliminates gross ccs
+  rimg.merge_and_split_ccs(smallsize,largesize,true); // Eliminates gross ccs
   if (opts.verbose > 1)
     DjVuFormatErrorUTF8( "%s\t%d",
                      ERR_MSG("csepdjvu.merge_split"), 
@@ -1547,28 +1123,8 @@ csepdjvu_page(BufferByteStream &bs,
   rimg.sort_in_reading_order();                   // Sort cc descriptors
   
   // Create JB2Image and fill colordata
-  GP<JB2Image> gjimg=JB2Image::create(); 
+  GP<JB2Image> gjimg=rimg.get_jb2image(JB2SHAPE_SPECIAL, rimg.pal); 
   JB2Image &jimg=*gjimg;
-  jimg.set_dimension(w, h);
-  int nccs = rimg.ccs.size();
-  for (int ccid=0; ccid<nccs; ccid++)
-    {
-      JB2Shape shape;
-      JB2Blit  blit;
-      shape.parent = -1;
-      shape.userdata = 0;
-      if (ccid >= rimg.nregularccs)
-        shape.userdata |= JB2SHAPE_SPECIAL;
-      shape.bits = rimg.get_bitmap_for_cc(ccid);
-      shape.bits->compress();
-      CC& cc = rimg.ccs[ccid];
-      blit.shapeno = jimg.add_shape(shape);
-      blit.left = cc.bb.xmin;
-      blit.bottom = cc.bb.ymin;
-      int blitno = jimg.add_blit(blit);
-      rimg.pal->colordata.touch(blitno);
-      rimg.pal->colordata[blitno] = cc.color;
-    }
   
   // Organize JB2Image
   tune_jb2image_lossless(&jimg);
@@ -1728,6 +1284,7 @@ usage()
     "   -t         Restricts text information to lines only.\n"
     "   -q <spec>  Select quality for background (default: 72+11+10+10);\n"
     "              see option -slice in program c44 for more information.\n"
+    "   -threads <n>  Encode background color planes using <n> threads.\n"
     "Each separated files contain one or more pages\n"
     "Each page is composed of:\n"
     " (1) a B&W-RLE or Color-RLE image representing the foreground,\n"
@@ -1811,6 +1368,15 @@ main(int argc, const char **argv)
               if (*end || opts.dpi<25 || opts.dpi>6000)
                 usage();
             }
+          else if (arg == "-threads" && i+1<argc)
+            {
+              // Specify number of threads
+              char *end;
+              int threads = strtol(dargv[++i], &end, 10);
+              if (*end || threads<1 || threads>64)
+                usage();
+              GThreadPool::set_shared_threads(threads);
+            }
           else if (arg == "-q" && i+1 < argc)
             {
               // Specify background quality
@@ -0,0 +1,547 @@
+//C-  -*- C++ -*-
+//C- -------------------------------------------------------------------
+//C- DjVuLibre-3.5
+//C- Copyright (c) 2002  Leon Bottou and Yann Le Cun.
+//C- Copyright (c) 2001  AT&T
+//C-
+//C- This software is subject to, and may be distributed under, the
+//C- GNU General Public License, either Version 2 of the license,
+//C- or (at your option) any later version. The license should have
+//C- accompanied the software or you may obtain a copy of the license
+//C- from the Free Software Foundation at http://www.fsf.org .
+//C-
+//C- This program is distributed in the hope that it will be useful,
+//C- but WITHOUT ANY WARRANTY; without even the implied warranty of
+//C- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//C- GNU General Public License for more details.
+//C- 
+//C- DjVuLibre-3.5 is derived from the DjVu(r) Reference Library from
+//C- Lizardtech Software.  Lizardtech Software has authorized us to
+//C- replace the original DjVu(r) Reference Library notice by the following
+//C- text (see doc/lizard2002.djvu and doc/lizardtech2007.djvu):
+//C-
+//C-  ------------------------------------------------------------------
+//C- | DjVu (r) Reference Library (v. 3.5)
+//C- | Copyright (c) 1999-2001 LizardTech, Inc. All Rights Reserved.
+//C- | The DjVu Reference Library is protected by U.S. Pat. No.
+//C- | 6,058,214 and patents pending.
+//C- |
+//C- | This software is subject to, and may be distributed under, the
+//C- | GNU General Public License, either Version 2 of the license,
+//C- | or (at your option) any later version. The license should have
+//C- | accompanied the software or you may obtain a copy of the license
+//C- | from the Free Software Foundation at http://www.fsf.org .
+//C- |
+//C- | The computer code originally released by LizardTech under this
+//C- | license and unmodified by other parties is deemed "the LIZARDTECH
+//C- | ORIGINAL CODE."  Subject to any third party intellectual property
+//C- | claims, LizardTech grants recipient a worldwide, royalty-free, 
+//C- | non-exclusive license to make, use, sell, or otherwise dispose of 
+//C- | the LIZARDTECH ORIGINAL CODE or of programs derived from the 
+//C- | LIZARDTECH ORIGINAL CODE in compliance with the terms of the GNU 
+//C- | General Public License.   This grant only confers the right to 
+//C- | infringe patent claims underlying the LIZARDTECH ORIGINAL CODE to 
+//C- | the extent such infringement is reasonably necessary to enable 
+//C- | recipient to make, have made, practice, sell, or otherwise dispose 
+//C- | of the LIZARDTECH ORIGINAL CODE (or portions thereof) and not to 
+//C- | any greater extent that may be necessary to utilize further 
+//C- | modifications or combinations.
+//C- |
+//C- | The LIZARDTECH ORIGINAL CODE is provided "AS IS" WITHOUT WARRANTY
+//C- | OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+//C- | TO ANY WARRANTY OF NON-INFRINGEMENT, OR ANY IMPLIED WARRANTY OF
+//C- | MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE.
+//C- +------------------------------------------------------------------
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+#if NEED_GNUG_PRAGMAS
+# pragma implementation
+#endif
+
+/** @name iw44test
+
+    {\bf Synopsis}
+    \begin{verbatim}
+        iw44test [<testname>...]
+    \end{verbatim}
+
+    {\bf Description} --- Program #iw44test# runs regression tests for
+    the IW44 codec (see \Ref{IW44Image.h}) on synthetic images and exits
+    with a non zero status when a test fails.  All tests are run when no
+    test name is given.  This program is run by #make check# and is not
+    installed.
+
+    \begin{description}
+    \item[size] Encodes gray and color images with byte budgets like
+       #c44 -size# and compares the chunk sizes and contents with the
+       output of the reference encoder.
+    \item[transform] Runs the forward and backward wavelet transforms on random
+       coefficient maps with the scalar code and with each SIMD level
+       supported by the processor, and compares the results.  Environment
+       variables #LIBDJVU_DISABLE_SIMD# and #LIBDJVU_DISABLE_AVX2# restrict
+       the tested levels (see \Ref{MMX.h}).
+    \item[compact] Decodes a gray image chunk by chunk and compacts the
+       coefficient map between chunks, as #IW44Image::compact# does, before
+       refining it with the next chunk.  The reconstructed image must
+       match the image decoded without compaction.
+    \item[cache] Renders segments of a color image twice with the
+       reconstruction cache enabled.  The segments must match the
+       segments rendered by an image without cache, and the second
+       rendering must be served by the cache.
+    \end{description}
+
+    @memo
+    IW44 regression tests.
+*/
+//@{
+//@}
+
+// The transform test needs the internal classes
+#define IW44IMAGE_IMPLIMENTATION /* */
+
+#include "IW44Image.h"
+#include "GBitmap.h"
+#include "GPixmap.h"
+#include "GRect.h"
+#include "ByteStream.h"
+#include "GContainer.h"
+#include "GException.h"
+#include "GString.h"
+#include "DjVuMessage.h"
+#include "MMX.h"
+#include "common.h"
+
+#include <string.h>
+
+
+// ----------------------------------------
+// SYNTHETIC IMAGES
+
+static unsigned int
+random_next(unsigned int &seed)
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 8) & 0xffff;
+}
+
+// Smooth gradients, a few sharp edges and some noise,
+// so that all the wavelet bands carry information.
+
+static int
+synthetic_value(int x, int y, int c, unsigned int &seed)
+{
+  int v = (x * (3 + c) + y * (5 - c)) / 4;
+  v += ((x / 37 + y / 23 + c) & 1) ? 60 : 0;
+  if ((x - 200) * (x - 200) + (y - 150) * (y - 150) < 70 * 70)
+    v = 255 - v;
+  v += (int)(random_next(seed) % 17) - 8;
+  return (v & 0x100) ? (255 - (v & 0xff)) : (v & 0xff);
+}
+
+static GP<GPixmap>
+synthetic_pixmap(int w, int h)
+{
+  GP<GPixmap> gpm = GPixmap::create(h, w);
+  unsigned int seed = 1;
+  for (int y=0; y<h; y++)
+    {
+      GPixel *row = (*gpm)[y];
+      for (int x=0; x<w; x++)
+        {
+          row[x].r = synthetic_value(x, y, 0, seed);
+          row[x].g = synthetic_value(x, y, 1, seed);
+          row[x].b = synthetic_value(x, y, 2, seed);
+        }
+    }
+  return gpm;
+}
+
+static GP<GBitmap>
+synthetic_bitmap(int w, int h)
+{
+  GP<GBitmap> gbm = GBitmap::create(h, w);
+  gbm->set_grays(256);
+  unsigned int seed = 2;
+  for (int y=0; y<h; y++)
+    {
+      unsigned char *row = (*gbm)[y];
+      for (int x=0; x<w; x++)
+        row[x] = synthetic_value(x, y, 1, seed);
+    }
+  return gbm;
+}
+
+static unsigned int
+checksum(ByteStream &bs)
+{
+  unsigned int h = 2166136261U;
+  unsigned char buffer[1024];
+  size_t n;
+  bs.seek(0);
+  while ((n = bs.read(buffer, sizeof(buffer))) > 0)
+    for (size_t i=0; i<n; i++)
+      h = (h ^ buffer[i]) * 16777619U;
+  return h;
+}
+
+
+// ----------------------------------------
+// TEST: SIZE
+
+// Chunk sizes and checksums produced by the reference encoder.  Byte
+// budgets are cumulative like the arguments of #c44 -size#.
+
+struct SizeCase
+{
+  int color;
+  int nchunks;
+  int bytes[3];
+  int sizes[3];
+  unsigned int sums[3];
+};
+
+static const SizeCase size_cases[] = {
+  { 0, 1, {   700 },
+    {   730 }, { 0x697a3cee } },
+  { 0, 1, {  1500 },
+    {  1657 }, { 0x097f06aa } },
+  { 0, 1, {  2500 },
+    {  2701 }, { 0x59beb7c0 } },
+  { 0, 1, {  3500 },
+    {  3543 }, { 0xa184b596 } },
+  { 0, 1, {  5000 },
+    {  5258 }, { 0x5c16c4f1 } },
+  { 0, 3, {  1200,  2600,  6000 },
+    {  1360,  1343,  3482 }, { 0x099b9a6c, 0xc3551778, 0x5c810354 } },
+  { 1, 1, {   700 },
+    {   743 }, { 0xf52d826c } },
+  { 1, 1, {  1500 },
+    {  1594 }, { 0x9a6e300e } },
+  { 1, 1, {  2500 },
+    {  2816 }, { 0x1650b32b } },
+  { 1, 1, {  3500 },
+    {  3672 }, { 0xf6f18230 } },
+  { 1, 1, {  5000 },
+    {  5126 }, { 0x1266c47b } },
+  { 1, 3, {  1200,  2600,  6000 },
+    {  1594,  1224,  3241 }, { 0x9a6e300e, 0xc0e6ba0e, 0x31ee7f5c } },
+};
+
+static GP<IW44Image>
+create_size_image(int color)
+{
+  if (color)
+    return IW44Image::create_encode(*synthetic_pixmap(400, 300));
+  return IW44Image::create_encode(*synthetic_bitmap(400, 300));
+}
+
+static bool
+test_size(void)
+{
+  bool ok = true;
+  const int ncases = sizeof(size_cases) / sizeof(size_cases[0]);
+  for (int k=0; k<ncases; k++)
+    {
+      const SizeCase &t = size_cases[k];
+      GP<IW44Image> iw = create_size_image(t.color);
+      for (int i=0; i<t.nchunks; i++)
+        {
+          IWEncoderParms parms;
+          parms.bytes = t.bytes[i];
+          GP<ByteStream> gbs = ByteStream::create();
+          iw->encode_chunk(gbs, parms);
+          const int size = gbs->size();
+          const unsigned int sum = checksum(*gbs);
+          if (size != t.sizes[i] || sum != t.sums[i])
+            {
+              DjVuPrintErrorUTF8("size: %s -size %d chunk %d: "
+                                 "got %d bytes (%08x), expected %d (%08x)\n",
+                                 (t.color ? "color" : "gray"), t.bytes[i], i,
+                                 size, sum, t.sizes[i], t.sums[i]);
+              ok = false;
+            }
+        }
+    }
+  return ok;
+}
+
+
+// ----------------------------------------
+// TEST: TRANSFORM
+
+// Random geometry: image sizes up to 260, row sizes with padding,
+// scale ranges within 32..1.  Coefficients either span the full
+// 16 bit range or stay in the small range of decoded images.
+// The reference also disables the old MMX code because it
+// saturates instead of wrapping around on overflows.
+// The forward transform walks the same scales upwards.
+
+static bool
+check_transform(const char *level, bool forward, int ncases)
+{
+  unsigned int seed = 3;
+  for (int k=0; k<ncases; k++)
+    {
+      const int w = 1 + random_next(seed) % 260;
+      const int h = 1 + random_next(seed) % 260;
+      const int rowsize = w + random_next(seed) % 40;
+      const int begin = 32 >> (random_next(seed) % 5);
+      int end = 1;
+      while (end < begin/2 && (random_next(seed) & 3) == 0)
+        end <<= 1;
+      const bool full = (random_next(seed) & 1);
+      const int n = rowsize * h;
+      GTArray<short> ref(n-1);
+      GTArray<short> vec(n-1);
+      for (int i=0; i<n; i++)
+        {
+          const unsigned int r = random_next(seed);
+          ref[i] = vec[i] = (short)(full ? r : ((int)(r % 2048) - 1024));
+        }
+      MMXControl::disable_simd();
+      if (forward)
+        IW44Image::Transform::Encode::forward(ref, w, h, rowsize, end, begin);
+      else
+        IW44Image::Transform::Decode::backward(ref, w, h, rowsize, begin, end);
+      MMXControl::enable_simd();
+      if (forward)
+        IW44Image::Transform::Encode::forward(vec, w, h, rowsize, end, begin);
+      else
+        IW44Image::Transform::Decode::backward(vec, w, h, rowsize, begin, end);
+      if (memcmp((const short*)ref, (const short*)vec, n * sizeof(short)))
+        {
+          int i = 0;
+          while (ref[i] == vec[i])
+            i++;
+          DjVuPrintErrorUTF8("transform: %s %s differs from scalar code "
+                             "(%dx%d, rowsize %d, scales %d..%d) "
+                             "at (%d,%d): %d instead of %d\n", level,
+                             (forward ? "forward" : "backward"),
+                             w, h, rowsize, (forward ? end : begin),
+                             (forward ? begin : end),
+                             i % rowsize, i / rowsize, vec[i], ref[i]);
+          return false;
+        }
+    }
+  return true;
+}
+
+static bool
+test_transform(void)
+{
+  static const char *names[] = { "scalar", "SSE2", "AVX2" };
+  const int ncases = 400;
+  bool ok = true;
+  MMXControl::disable_mmx();
+  const int level = MMXControl::enable_simd();
+  if (level == MMXControl::SIMD_NONE)
+    DjVuPrintMessageUTF8("transform: no SIMD level to test\n");
+  else
+    ok = check_transform(names[level], false, ncases)
+      && check_transform(names[level], true, ncases);
+#ifdef HAVE_SETENV
+  // Also test SSE2 when AVX2 is available
+  if (level > MMXControl::SIMD_SSE2)
+    {
+      setenv("LIBDJVU_DISABLE_AVX2", "1", 1);
+      if (MMXControl::enable_simd() == MMXControl::SIMD_SSE2)
+        ok = check_transform(names[MMXControl::SIMD_SSE2], false, ncases)
+          && check_transform(names[MMXControl::SIMD_SSE2], true, ncases)
+          && ok;
+      unsetenv("LIBDJVU_DISABLE_AVX2");
+    }
+#endif
+  MMXControl::enable_mmx();
+  MMXControl::enable_simd();
+  return ok;
+}
+
+
+// ----------------------------------------
+// TEST: COMPACT
+
+// Decodes the chunks, optionally compacting
+// the coefficients after each chunk.
+
+static GP<GBitmap>
+decode_chunks(GP<ByteStream> *chunks, int nchunks, bool compact)
+{
+  GP<IW44Image> iw = IW44Image::create_decode(IW44Image::GRAY);
+  for (int i=0; i<nchunks; i++)
+    {
+      chunks[i]->seek(0);
+      iw->decode_chunk(chunks[i]);
+      if (compact)
+        iw->compact();
+    }
+  iw->close_codec();
+  return iw->get_bitmap();
+}
+
+static bool
+same_bitmap(const GBitmap &a, const GBitmap &b)
+{
+  if (a.rows() != b.rows() || a.columns() != b.columns())
+    return false;
+  for (unsigned int y=0; y<a.rows(); y++)
+    if (memcmp(a[y], b[y], a.columns()))
+      return false;
+  return true;
+}
+
+static bool
+test_compact(void)
+{
+  // Encode chunks of 20, 25 and 29 slices
+  const int nchunks = 3;
+  static const int slices[nchunks] = { 20, 45, 74 };
+  GP<ByteStream> chunks[nchunks];
+  GP<IW44Image> iw = IW44Image::create_encode(*synthetic_bitmap(300, 200));
+  for (int i=0; i<nchunks; i++)
+    {
+      IWEncoderParms parms;
+      parms.slices = slices[i];
+      chunks[i] = ByteStream::create();
+      iw->encode_chunk(chunks[i], parms);
+    }
+  // Decode with and without compaction
+  GP<GBitmap> ref = decode_chunks(chunks, nchunks, false);
+  GP<GBitmap> img = decode_chunks(chunks, nchunks, true);
+  if (! same_bitmap(*img, *ref))
+    {
+      DjVuPrintErrorUTF8("compact: refining a compacted map "
+                         "gives a different image\n");
+      return false;
+    }
+  return true;
+}
+
+
+// ----------------------------------------
+// TEST: CACHE
+
+static bool
+same_pixmap(const GPixmap &a, const GPixmap &b)
+{
+  if (a.rows() != b.rows() || a.columns() != b.columns())
+    return false;
+  for (unsigned int y=0; y<a.rows(); y++)
+    if (memcmp(a[y], b[y], a.columns() * sizeof(GPixel)))
+      return false;
+  return true;
+}
+
+static bool
+test_cache(void)
+{
+  // Half resolution chroma also exercises the fast mode
+  const int w = 300, h = 200;
+  GP<IW44Image> iw = IW44Image::create_encode(*synthetic_pixmap(w, h), 0,
+                                              IW44Image::CRCBhalf);
+  GP<ByteStream> gbs = ByteStream::create();
+  IWEncoderParms parms;
+  parms.slices = 74;
+  iw->encode_chunk(gbs, parms);
+  GP<IW44Image> ref = IW44Image::create_decode(IW44Image::COLOR);
+  GP<IW44Image> img = IW44Image::create_decode(IW44Image::COLOR);
+  ref->set_cache_size(0);
+  img->set_cache_size(1 << 20);
+  gbs->seek(0);
+  ref->decode_chunk(gbs);
+  gbs->seek(0);
+  img->decode_chunk(gbs);
+  ref->close_codec();
+  img->close_codec();
+  // Render tiles twice, the second time from the cache
+  const unsigned int usage = img->get_memory_usage();
+  for (int subsample=1; subsample<=4; subsample+=subsample)
+    {
+      const int sw = (w + subsample - 1) / subsample;
+      const int sh = (h + subsample - 1) / subsample;
+      for (int y=0; y<sh; y+=45)
+        for (int x=0; x<sw; x+=57)
+          {
+            GRect rect(x, y, 64, 48);
+            rect.intersect(rect, GRect(0, 0, sw, sh));
+            GP<GPixmap> pm = ref->get_pixmap(subsample, rect);
+            for (int pass=0; pass<2; pass++)
+              if (! same_pixmap(*img->get_pixmap(subsample, rect), *pm))
+                {
+                  DjVuPrintErrorUTF8("cache: segment %dx%d+%d+%d at "
+                                     "subsample %d differs\n", 
+                                     rect.width(), rect.height(),
+                                     rect.xmin, rect.ymin, subsample);
+                  return false;
+                }
+          }
+    }
+  const int hits = img->get_cache_hits();
+  const int misses = img->get_cache_misses();
+  if (hits == 0 || hits != misses || img->get_memory_usage() <= usage)
+    {
+      DjVuPrintErrorUTF8("cache: %d hits and %d misses\n", hits, misses);
+      return false;
+    }
+  return true;
+}
+
+
+// ----------------------------------------
+// MAIN
+
+struct Test
+{
+  const char *name;
+  bool (*run)(void);
+};
+
+static const Test tests[] = {
+  { "size", test_size },
+  { "transform", test_transform },
+  { "compact", test_compact },
+  { "cache", test_cache },
+};
+
+int
+main(int argc, char **argv)
+{
+  DJVU_LOCALE;
+  const int ntests = sizeof(tests) / sizeof(tests[0]);
+  int failed = 0;
+  G_TRY
+    {
+      for (int i=1; i<argc; i++)
+        {
+          int j = 0;
+          while (j < ntests && strcmp(argv[i], tests[j].name))
+            j++;
+          if (j >= ntests)
+            {
+              DjVuPrintErrorUTF8("%s: unknown test '%s'\n", argv[0], argv[i]);
+              exit(1);
+            }
+        }
+      for (int j=0; j<ntests; j++)
+        {
+          bool selected = (argc < 2);
+          for (int i=1; i<argc; i++)
+            if (!strcmp(argv[i], tests[j].name))
+              selected = true;
+          if (! selected)
+            continue;
+          const bool ok = tests[j].run();
+          DjVuPrintMessageUTF8("%s: %s\n", tests[j].name, ok ? "ok" : "FAILED");
+          if (! ok)
+            failed += 1;
+        }
+    }
+  G_CATCH(ex)
+    {
+      ex.perror();
+      exit(1);
+    }
+  G_ENDCATCH;
+  return (failed) ? 1 : 0;
+}
@@ -0,0 +1,268 @@
+//C-  -*- C++ -*-
+//C- -------------------------------------------------------------------
+//C- DjVuLibre-3.5
+//C- Copyright (c) 2002  Leon Bottou and Yann Le Cun.
+//C- Copyright (c) 2001  AT&T
+//C-
+//C- This software is subject to, and may be distributed under, the
+//C- GNU General Public License, either Version 2 of the license,
+//C- or (at your option) any later version. The license should have
+//C- accompanied the software or you may obtain a copy of the license
+//C- from the Free Software Foundation at http://www.fsf.org .
+//C-
+//C- This program is distributed in the hope that it will be useful,
+//C- but WITHOUT ANY WARRANTY; without even the implied warranty of
+//C- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//C- GNU General Public License for more details.
+//C- 
+//C- DjVuLibre-3.5 is derived from the DjVu(r) Reference Library from
+//C- Lizardtech Software.  Lizardtech Software has authorized us to
+//C- replace the original DjVu(r) Reference Library notice by the following
+//C- text (see doc/lizard2002.djvu and doc/lizardtech2007.djvu):
+//C-
+//C-  ------------------------------------------------------------------
+//C- | DjVu (r) Reference Library (v. 3.5)
+//C- | Copyright (c) 1999-2001 LizardTech, Inc. All Rights Reserved.
+//C- | The DjVu Reference Library is protected by U.S. Pat. No.
+//C- | 6,058,214 and patents pending.
+//C- |
+//C- | This software is subject to, and may be distributed under, the
+//C- | GNU General Public License, either Version 2 of the license,
+//C- | or (at your option) any later version. The license should have
+//C- | accompanied the software or you may obtain a copy of the license
+//C- | from the Free Software Foundation at http://www.fsf.org .
+//C- |
+//C- | The computer code originally released by LizardTech under this
+//C- | license and unmodified by other parties is deemed "the LIZARDTECH
+//C- | ORIGINAL CODE."  Subject to any third party intellectual property
+//C- | claims, LizardTech grants recipient a worldwide, royalty-free, 
+//C- | non-exclusive license to make, use, sell, or otherwise dispose of 
+//C- | the LIZARDTECH ORIGINAL CODE or of programs derived from the 
+//C- | LIZARDTECH ORIGINAL CODE in compliance with the terms of the GNU 
+//C- | General Public License.   This grant only confers the right to 
+//C- | infringe patent claims underlying the LIZARDTECH ORIGINAL CODE to 
+//C- | the extent such infringement is reasonably necessary to enable 
+//C- | recipient to make, have made, practice, sell, or otherwise dispose 
+//C- | of the LIZARDTECH ORIGINAL CODE (or portions thereof) and not to 
+//C- | any greater extent that may be necessary to utilize further 
+//C- | modifications or combinations.
+//C- |
+//C- | The LIZARDTECH ORIGINAL CODE is provided "AS IS" WITHOUT WARRANTY
+//C- | OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+//C- | TO ANY WARRANTY OF NON-INFRINGEMENT, OR ANY IMPLIED WARRANTY OF
+//C- | MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE.
+//C- +------------------------------------------------------------------
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+#if NEED_GNUG_PRAGMAS
+# pragma implementation
+#endif
+
+/** @name jb2bench
+
+    {\bf Synopsis}
+    \begin{verbatim}
+        jb2bench [<size>...]
+    \end{verbatim}
+
+    {\bf Description} --- Program #jb2bench# measures the shape
+    comparisons performed by the JB2 pattern matcher of #cjb2#,
+    #cpaldjvu# and #csepdjvu#.  For each glyph size (default 12 and 30
+    pixels) it renders a set of noisy glyphs and compares every pair of
+    glyphs whose dimensions differ by at most two pixels, first with the
+    per-pixel loop formerly used by the pattern matcher, then with the
+    packed shapes of #jb2tune.cpp#.  Each line reports the number of
+    comparisons and the time taken by both methods, measured on the best
+    of three runs.  The program fails when both methods disagree.  Setting
+    variable #LIBDJVU_DISABLE_AVX2# measures the packed comparison without
+    the population count instruction.  This program is not installed.
+
+    @memo
+    JB2 shape comparison benchmark.
+*/
+//@{
+//@}
+
+#include "GBitmap.h"
+#include "GContainer.h"
+#include "GException.h"
+#include "GOS.h"
+#include "DjVuMessage.h"
+#include "common.h"
+#include "jb2tune.h"
+
+#include <stdlib.h>
+
+#define REFINE_THRESHOLD 21
+
+static const int nglyphs = 1500;
+static const int nletters = 40;
+
+static unsigned int seed = 12345;
+
+static int
+random_int(int n)
+{
+  seed = seed * 1103515245 + 12345;
+  return (int)((seed >> 8) % (unsigned int) n);
+}
+
+// Each letter is a few rectangles in the unit square.  Glyphs render a
+// letter at a size jittered by one pixel and flip a few pixels, so
+// that the comparisons see both similar and dissimilar pairs.
+static GP<GBitmap>
+make_glyph(int size, const GTArray<int> &boxes)
+{
+  const int rows = size + random_int(3) - 1;
+  const int cols = size * 3 / 4 + random_int(3) - 1;
+  GP<GBitmap> gbm = GBitmap::create(rows, cols);
+  GBitmap &bm = *gbm;
+  for (int k=0; k<boxes.size(); k+=4)
+    for (int r=boxes[k]*rows/64; r<boxes[k+1]*rows/64; r++)
+      for (int c=boxes[k+2]*cols/64; c<boxes[k+3]*cols/64; c++)
+        bm[r][c] = 1;
+  for (int n=rows*cols/50; n>0; n--)
+    {
+      unsigned char *p = &bm[random_int(rows)][random_int(cols)];
+      *p = !*p;
+    }
+  return gbm;
+}
+
+// Count pixel differences like tune_jb2image did before the shapes
+// were packed.  The bitmaps must have a border of at least four pixels.
+static int
+pixel_compare(GBitmap &bitmap, GBitmap &cross_bitmap, int best_score)
+{
+  int rows = bitmap.rows();
+  int cols = bitmap.columns();
+  int cross_cols = cross_bitmap.columns();
+  int cross_rows = cross_bitmap.rows();
+  // Compute alignment (these are always +1, 0 or -1)
+  int cross_col_adjust = (cross_cols-cross_cols/2)-(cols-cols/2);
+  int cross_row_adjust = (cross_rows-cross_rows/2)-(rows-rows/2);
+  // Count pixel differences (including borders)
+  int score = 0;
+  for (int row = -1; row <= rows; row++) 
+    {
+      unsigned char *p_row = bitmap[row];
+      unsigned char *p_cross_row = cross_bitmap[row+cross_row_adjust];
+      p_cross_row += cross_col_adjust;
+      for (int column = -1; column <= cols; column++) 
+        if (p_row[column] != p_cross_row[column])
+          score ++;
+      if (score >= best_score)  // prune
+        break;
+    }
+  return score;
+}
+
+// Compare all close enough pairs, either with the per-pixel loop or
+// with the packed shapes, and store the sum of the scores in total.
+static long
+compare_all(GPArray<GBitmap> &glyphs, PackedShapes *packed, long &total)
+{
+  long comparisons = 0;
+  total = 0;
+  for (int i=0; i<glyphs.size(); i++)
+    {
+      GBitmap &bitmap = *glyphs[i];
+      int rows = bitmap.rows();
+      int cols = bitmap.columns();
+      int best_score = (REFINE_THRESHOLD * rows * cols + 50) / 100;
+      if (best_score < 2)
+        best_score = 2;
+      for (int j=0; j<i; j++)
+        {
+          GBitmap &cross_bitmap = *glyphs[j];
+          int cross_rows = cross_bitmap.rows();
+          int cross_cols = cross_bitmap.columns();
+          if (abs(cross_rows - rows) > 2) 
+            continue;
+          if (abs(cross_cols - cols) > 2)
+            continue;
+          comparisons++;
+          if (packed)
+            total += packed->compare(i, j, best_score);
+          else
+            total += pixel_compare(bitmap, cross_bitmap, best_score);
+        }
+    }
+  return comparisons;
+}
+
+static void
+bench(int size)
+{
+  GPArray<GBitmap> glyphs(nglyphs-1);
+  GTArray<int> letters[nletters];
+  for (int l=0; l<nletters; l++)
+    {
+      letters[l].resize(4*(3+random_int(3))-1);
+      for (int k=0; k<letters[l].size(); k+=4)
+        {
+          int r = random_int(48), c = random_int(48);
+          int h = 4 + random_int(60 - r), w = 4 + random_int(60 - c);
+          letters[l][k] = r;
+          letters[l][k+1] = r + h;
+          letters[l][k+2] = c;
+          letters[l][k+3] = c + w;
+        }
+    }
+  PackedShapes packed(nglyphs);
+  for (int i=0; i<nglyphs; i++)
+    {
+      glyphs[i] = make_glyph(size, letters[random_int(nletters)]);
+      glyphs[i]->minborder(4);
+      packed.pack(i, *glyphs[i]);
+    }
+  long totals[2];
+  long comparisons = 0;
+  unsigned long best[2];
+  for (int method=0; method<2; method++)
+    for (int run=0; run<3; run++)
+      {
+        const unsigned long start = GOS::ticks();
+        comparisons = compare_all(glyphs, method ? &packed : 0, totals[method]);
+        const unsigned long ms = GOS::ticks() - start;
+        if (run == 0 || ms < best[method])
+          best[method] = ms;
+      }
+  if (totals[0] != totals[1])
+    G_THROW("jb2bench: packed and per-pixel scores differ");
+  DjVuPrintMessageUTF8("%3d px: %ld comparisons: per-pixel %lu ms, "
+                       "packed %lu ms\n", size, comparisons, best[0], best[1]);
+}
+
+int
+main(int argc, char **argv)
+{
+  DJVU_LOCALE;
+  G_TRY
+    {
+      if (argc < 2)
+        {
+          bench(12);
+          bench(30);
+        }
+      for (int i=1; i<argc; i++)
+        {
+          const int size = atoi(argv[i]);
+          if (size < 4 || size > 1000)
+            {
+              DjVuPrintErrorUTF8("Usage: %s [<size>...]\n", argv[0]);
+              exit(1);
+            }
+          bench(size);
+        }
+    }
+  G_CATCH(ex)
+    {
+      ex.perror();
+      exit(1);
+    }
+  G_ENDCATCH;
+  return 0;
+}
@@ -103,6 +103,11 @@ typedef struct Classification
 {
     Class *first_class;
     ClassNode *first_node, *last_node;
+    int32 class_count;
+    mdjvu_runner_t runner;  /* NULL for sequential comparisons */
+    Class **classes;        /* classes in list order, for the runner */
+    int *results;           /* results of the comparisons with them */
+    int32 capacity;
 } Classification;
 
 /* Creates an empty class and links it to the list of classes. */
@@ -114,6 +119,7 @@ static Class *new_class(Classification *cl)
     c->next_class = cl->first_class;
     if (cl->first_class) cl->first_class->prev_class = c;
     cl->first_class = c;
+    cl->class_count++;
     return c;
 }
 
@@ -130,6 +136,7 @@ static void delete_class(Classification *cl, Class *c)
     if (next)
         next->prev_class = prev;
 
+    cl->class_count--;
     FREE(c);
 }
 
@@ -215,17 +222,79 @@ static int compare_to_class(mdjvu_pattern_t p, Class *c, int32 dpi,
     return r;
 }
 
+/* Comparisons of a pattern with a range of classes, run through the runner.
+ * They only read the classes, so they can happen concurrently.
+ */
+#define CLASSES_PER_JOB 256
+
+typedef struct ClassJobs
+{
+    mdjvu_pattern_t p;
+    Classification *cl;
+    int32 dpi;
+    mdjvu_matcher_options_t options;
+} ClassJobs;
+
+static void compare_job(void *arg, int32 i)
+{
+    ClassJobs *jobs = (ClassJobs *) arg;
+    Classification *cl = jobs->cl;
+    int32 k = i * CLASSES_PER_JOB;
+    int32 end = k + CLASSES_PER_JOB;
+    if (end > cl->class_count) end = cl->class_count;
+    for (; k < end; k++)
+        cl->results[k] = compare_to_class(jobs->p, cl->classes[k],
+                                          jobs->dpi, jobs->options);
+}
+
+/* Compares p with all classes through the runner.
+ * Returns 0 if there are too few classes to make it worthwhile.
+ * Merging never deletes a class that comes later in the list,
+ * so the results stay in step with the classes visited by classify().
+ */
+static int compare_to_all_classes(Classification *cl, mdjvu_pattern_t p,
+                                  int32 dpi, mdjvu_matcher_options_t options)
+{
+    ClassJobs jobs;
+    Class *c;
+    int32 k = 0;
+    if (!cl->runner || cl->class_count < 2 * CLASSES_PER_JOB) return 0;
+    if (cl->capacity < cl->class_count)
+    {
+        FREEV(cl->classes);
+        FREEV(cl->results);
+        cl->capacity = 2 * cl->class_count;
+        cl->classes = MALLOCV(Class *, cl->capacity);
+        cl->results = MALLOCV(int, cl->capacity);
+    }
+    for (c = cl->first_class; c; c = c->next_class)
+        cl->classes[k++] = c;
+    jobs.p = p;
+    jobs.cl = cl;
+    jobs.dpi = dpi;
+    jobs.options = options;
+    cl->runner(compare_job, &jobs,
+               (cl->class_count + CLASSES_PER_JOB - 1) / CLASSES_PER_JOB);
+    return 1;
+}
+
 static void classify(Classification *cl, mdjvu_pattern_t p,
                      int32 dpi, mdjvu_matcher_options_t options)
 {
     Class *class_of_this = NULL;
     Class *c, *next_c = NULL;
-    for (c = cl->first_class; c; c = next_c)
+    int precomputed = compare_to_all_classes(cl, p, dpi, options);
+    int32 k = 0;
+    for (c = cl->first_class; c; c = next_c, k++)
     {
         next_c = c->next_class; /* That's because c may be deleted in merging */
 
         if (class_of_this == c) continue;
-        if (compare_to_class(p, c, dpi, options) != 1) continue;
+        if (precomputed)
+        {
+            if (cl->results[k] != 1) continue;
+        }
+        else if (compare_to_class(p, c, dpi, options) != 1) continue;
 
         if (class_of_this)
             class_of_this = merge(cl, class_of_this, c);
@@ -239,6 +308,13 @@ static void classify(Classification *cl, mdjvu_pattern_t p,
 MDJVU_IMPLEMENT int32 mdjvu_classify_patterns
     (mdjvu_pattern_t *b, int32 *r, int32 n, int32 dpi,
      mdjvu_matcher_options_t options)
+{
+    return mdjvu_classify_patterns_with_runner(b, r, n, dpi, options, NULL);
+}
+
+MDJVU_IMPLEMENT int32 mdjvu_classify_patterns_with_runner
+    (mdjvu_pattern_t *b, int32 *r, int32 n, int32 dpi,
+     mdjvu_matcher_options_t options, mdjvu_runner_t runner)
 {
     int32 i, max_tag;
     ClassNode *node;
@@ -246,9 +322,16 @@ MDJVU_IMPLEMENT int32 mdjvu_classify_patterns
 
     cl.first_class = NULL;
     cl.first_node = cl.last_node = NULL;
+    cl.class_count = 0;
+    cl.runner = runner;
+    cl.classes = NULL;
+    cl.results = NULL;
+    cl.capacity = 0;
 
     for (i = 0; i < n; i++) if (b[i]) classify(&cl, b[i], dpi, options);
 
+    FREEV(cl.classes);
+    FREEV(cl.results);
     max_tag = put_tags(&cl);
     delete_all_classes(&cl);
 
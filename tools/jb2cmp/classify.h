@@ -71,6 +71,20 @@ MDJVU_FUNCTION int32 mdjvu_classify_patterns
     (mdjvu_pattern_t *, int32 *result, int32 n, int32 dpi,
      mdjvu_matcher_options_t);
 
+/* Runs job(arg, i) for i ranging from 0 to n-1, possibly concurrently,
+ * and returns when all these calls have returned.
+ */
+typedef void (*mdjvu_runner_t)(void (*job)(void *arg, int32 i),
+                               void *arg, int32 n);
+
+/* Same as mdjvu_classify_patterns, but the comparisons of each pattern
+ * with the existing classes are dispatched through the runner.
+ * The result does not depend on the runner.
+ */
+MDJVU_FUNCTION int32 mdjvu_classify_patterns_with_runner
+    (mdjvu_pattern_t *, int32 *result, int32 n, int32 dpi,
+     mdjvu_matcher_options_t, mdjvu_runner_t);
+
 #ifndef NO_MINIDJVU
 
 /* Special tag 0 is reserved for bitmaps marked "no-substitution". */
@@ -67,6 +67,8 @@
 #include "GRect.h"
 #include "GBitmap.h"
 #include "JB2Image.h"
+#include "MMX.h"
+#include "GThreads.h"
 
 #include "jb2tune.h"
 
@@ -75,6 +77,13 @@
 #include "jb2cmp/classify.h"
 
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#if HAVE_STDINT_H
+# include <stdint.h>
+#elif HAVE_INTTYPES_H
+# include <inttypes.h>
+#endif
 
 #define REFINE_THRESHOLD 21
 
@@ -178,6 +187,14 @@ compute_comparable_image(GBitmap *bits)
 }
 
 
+// Run the comparisons of Ilya's pattern matcher on the shared pool.
+static void
+run_on_shared_pool(void (*job)(void*, int), void *arg, int njobs)
+{
+  GThreadPool::get_shared()->run(job, arg, njobs);
+}
+
+
 // Compute MatchData array for lossy compression.
 static void
 compute_matchdata_lossy(JB2Image *jimg, MatchData *lib,
@@ -202,7 +219,11 @@ compute_matchdata_lossy(JB2Image *jimg, MatchData *lib,
     }
   // Run Ilya's pattern matcher.
   GTArray<int> tags(nshapes);  
-  int maxtag = mdjvu_classify_patterns(handles, tags, nshapes, dpi, options);
+  mdjvu_runner_t runner = 0;
+  if (GThreadPool::get_shared())
+    runner = run_on_shared_pool;
+  int maxtag = mdjvu_classify_patterns_with_runner(handles, tags, nshapes, 
+                                                   dpi, options, runner);
   // Extract substitutions
   GTArray<int> reps(maxtag);
   for (i=0; i<=maxtag; i++)
@@ -222,18 +243,524 @@ compute_matchdata_lossy(JB2Image *jimg, MatchData *lib,
 }
 
 
+PackedShapes::PackedShapes(int nshapes)
+  : offset(nshapes-1), rows(nshapes-1), cols(nshapes-1),
+    gwords(words, 0), nwords(0), maxwords(0)
+{
+  for (int i=0; i<nshapes; i++)
+    offset[i] = -1;
+#if defined(MMX_AVX2) && defined(__GNUC__)
+  if (MMXControl::simdflag < 0)
+    MMXControl::enable_simd();
+#endif
+}
+
+void
+PackedShapes::pack(int shapeno, GBitmap &bitmap)
+{
+  int h = bitmap.rows();
+  int w = bitmap.columns();
+  int n = wpl(w) * (h + 4);
+  if (nwords + n > maxwords)
+    {
+      maxwords = 2 * (nwords + n);
+      gwords.resize(maxwords);
+    }
+  offset[shapeno] = nwords;
+  rows[shapeno] = h;
+  cols[shapeno] = w;
+  uint64_t *p = words + nwords;
+  memset((void*)p, 0, n * sizeof(uint64_t));
+  nwords += n;
+  p += 2 * wpl(w);
+  for (int i=0; i<h; i++, p+=wpl(w))
+    {
+      unsigned char *row = bitmap[i];
+      for (int j=0; j<w; j++)
+        if (row[j])
+          p[(j+2) >> 6] |= (uint64_t)1 << ((j+2) & 63);
+    }
+}
+
+// Population count without hardware support.
+struct SoftPopcount
+{
+  static inline int count(uint64_t x)
+  {
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (int)((x * 0x0101010101010101ULL) >> 56);
+  }
+};
+
+// Count differing bits in rows of n bits starting
+// at bit s of p and at bit xs of xp.
+template <class POP> static inline int
+xor_count(const uint64_t *p, int s, const uint64_t *xp, int xs, int n)
+{
+  int count = 0;
+  for (int k=0; n>0; k++, n-=64)
+    {
+      uint64_t a = p[k] >> s;
+      if (s)
+        a |= p[k+1] << (64-s);
+      uint64_t b = xp[k] >> xs;
+      if (xs)
+        b |= xp[k+1] << (64-xs);
+      uint64_t x = a ^ b;
+      if (n < 64)
+        x &= ((uint64_t)1 << n) - 1;
+      count += POP::count(x);
+    }
+  return count;
+}
+
+// Count pixel differences between two packed shapes over the
+// window covering the first shape plus a one pixel border.  The
+// loop stops as soon as the count reaches best_score.
+template <class POP> static inline int
+packed_compare(const uint64_t *p, int rows, int cols,
+               const uint64_t *xp, int cross_rows, int cross_cols,
+               int best_score)
+{
+  int w = (cols + 4 + 63) / 64 + 1;
+  int xw = (cross_cols + 4 + 63) / 64 + 1;
+  // Compute alignment (these are always +1, 0 or -1)
+  int cross_col_adjust = (cross_cols-cross_cols/2)-(cols-cols/2);
+  int cross_row_adjust = (cross_rows-cross_rows/2)-(rows-rows/2);
+  // Count pixel differences (including borders)
+  int score = 0;
+  p += w;
+  xp += (1 + cross_row_adjust) * xw;
+  for (int row = -1; row <= rows; row++, p+=w, xp+=xw) 
+    {
+      score += xor_count<POP>(p, 1, xp, 1 + cross_col_adjust, cols + 2);
+      if (score >= best_score)  // prune
+        break;
+    }
+  return score;
+}
+
+#if defined(MMX_AVX2) && defined(__GNUC__)
+// Population count with the POPCNT instruction, which
+// all processors supporting AVX2 also support.
+struct HardPopcount
+{
+  static inline int count(uint64_t x) __attribute__((always_inline))
+  {
+    return __builtin_popcountll(x);
+  }
+};
+
+__attribute__((target("popcnt"))) static int
+packed_compare_popcnt(const uint64_t *p, int rows, int cols,
+                      const uint64_t *xp, int cross_rows, int cross_cols,
+                      int best_score)
+{
+  return packed_compare<HardPopcount>(p, rows, cols, 
+                                      xp, cross_rows, cross_cols, best_score);
+}
+#endif
+
+int
+PackedShapes::compare(int shapeno, int cross, int best_score)
+{
+  const uint64_t *p = words + offset[shapeno];
+  const uint64_t *xp = words + offset[cross];
+#if defined(MMX_AVX2) && defined(__GNUC__)
+  if (MMXControl::simdflag >= MMXControl::SIMD_AVX2)
+    return packed_compare_popcnt(p, rows[shapeno], cols[shapeno], 
+                                 xp, rows[cross], cols[cross], best_score);
+#endif
+  return packed_compare<SoftPopcount>(p, rows[shapeno], cols[shapeno], 
+                                      xp, rows[cross], cols[cross], best_score);
+}
+
+
+// Search cross-coding buddy by comparing the current shape with
+// all earlier shapes.  Returns the best candidate or -1.
+static int
+search_exhaustive(MatchData *lib, PackedShapes &packed, int current, 
+                  int &best_score, long &comparisons)
+{
+  GBitmap &bitmap = *lib[current].bits;
+  int rows = bitmap.rows();
+  int cols = bitmap.columns();
+  int black_pixels = lib[current].area;
+  int closest = -1;
+  for (int candidate = 0; candidate < current; candidate++) 
+    {
+      // Access candidate bitmap
+      if (! lib[candidate].bits) 
+        continue;
+      GBitmap &cross_bitmap = *lib[candidate].bits;
+      int cross_cols = cross_bitmap.columns();
+      int cross_rows = cross_bitmap.rows();
+      // Prune
+      if (abs (lib[candidate].area - black_pixels) > best_score) 
+        continue;
+      if (abs (cross_rows - rows) > 2) 
+        continue;
+      if (abs (cross_cols - cols) > 2)
+        continue;
+      // Compare
+      int score = packed.compare(current, candidate, best_score);
+      comparisons += 1;
+      if (score < best_score) 
+        {
+          best_score = score;
+          closest = candidate;
+        }
+    }
+  return closest;
+}
+
+
+// Index of the shapes that can serve as cross-coding buddies.
+//
+// The exhaustive search returns the candidate with the smallest
+// pixel difference, the earliest one in case of ties, provided that
+// this difference is below the initial threshold.  The number of
+// black pixels and the row and column black pixel counts give lower
+// bounds of that difference because the compared window covers both
+// shapes.  The index therefore keeps the shapes of each size sorted
+// by black pixel count and visits the plausible sizes starting with
+// the closest pixel counts.  This makes the threshold drop quickly
+// and lets the search stop as soon as the pixel count difference
+// exceeds it.  Ties are resolved on the shape number so that the
+// result does not depend on the visiting order.  The searches only
+// consider the shapes of the index that precede the current shape.
+// They do not modify the index and can run concurrently.
+class ShapeIndex
+{
+public:
+  ShapeIndex(MatchData *lib, PackedShapes &packed, int nshapes);
+  void insert(int shapeno);
+  void remove(int shapeno);
+  int search(int current, int &best_score, long &comparisons);
+private:
+  struct List : public GPEnabled {
+    int rows, cols;                // shape size
+    int size;                      // number of shapes
+    int next;                      // next list with the same key
+    GTArray<int> shapes;           // shape numbers sorted by area
+    GTArray<int> areas;            // corresponding areas
+    GTArray<int> profiles;         // corresponding pixel counts
+  };
+  MatchData *lib;
+  PackedShapes &packed;
+  GMap<unsigned int,int> slots;    // first list for each key
+  GPArray<List> lists;
+  GTArray<int> profile;            // offset of the pixel counts of each shape
+  GTArray<int> counts;             // row counts then column counts
+  int nlists;
+  int ncounts;
+  static unsigned int key(int rows, int cols);
+  int find_list(int rows, int cols);
+  void add_counts(int shapeno);
+  static int difference_bound(const int *rc, int rows, int cols, 
+                              const int *xrc, int cross_rows, int cross_cols,
+                              int best_score);
+};
+
+ShapeIndex::ShapeIndex(MatchData *lib, PackedShapes &packed, int nshapes)
+  : lib(lib), packed(packed), profile(nshapes-1), nlists(0), ncounts(0)
+{
+  for (int i=0; i<nshapes; i++)
+    profile[i] = -1;
+}
+
+inline unsigned int
+ShapeIndex::key(int rows, int cols)
+{
+  return ((unsigned int)rows << 16) ^ (unsigned int)cols;
+}
+
+// Return the list of shapes of a given size or -1.
+int
+ShapeIndex::find_list(int rows, int cols)
+{
+  GPosition pos = slots.contains(key(rows, cols));
+  int slot = pos ? slots[pos] : -1;
+  while (slot >= 0 && (lists[slot]->rows != rows || lists[slot]->cols != cols))
+    slot = lists[slot]->next;
+  return slot;
+}
+
+// Record row and column pixel counts with two zeros on each
+// side, enough to cover the alignment offsets of the comparisons.
+void
+ShapeIndex::add_counts(int shapeno)
+{
+  GBitmap &bitmap = *lib[shapeno].bits;
+  int rows = bitmap.rows();
+  int cols = bitmap.columns();
+  int n = rows + cols + 8;
+  if (ncounts + n > counts.size())
+    counts.resize(0, 2 * (ncounts + n) - 1);
+  profile[shapeno] = ncounts;
+  int *rc = &counts[ncounts + 2];
+  int *cc = rc + rows + 4;
+  ncounts += n;
+  int i, j;
+  for (j=-2; j<cols+2; j++)
+    cc[j] = 0;
+  for (i=0; i<rows; i++)
+    {
+      unsigned char *row = bitmap[i];
+      int n = 0;
+      for (j=0; j<cols; j++)
+        if (row[j])
+          {
+            n += 1;
+            cc[j] += 1;
+          }
+      rc[i] = n;
+    }
+  rc[-2] = rc[-1] = rc[rows] = rc[rows+1] = 0;
+}
+
+// Make a shape visible to the searches
+void
+ShapeIndex::insert(int shapeno)
+{
+  GBitmap &bitmap = *lib[shapeno].bits;
+  int rows = bitmap.rows();
+  int cols = bitmap.columns();
+  if (profile[shapeno] < 0)
+    add_counts(shapeno);
+  // Locate list
+  int slot = find_list(rows, cols);
+  if (slot < 0)
+    {
+      slot = nlists++;
+      if (nlists > lists.size())
+        lists.resize(0, 2 * nlists - 1);
+      unsigned int k = key(rows, cols);
+      GPosition pos = slots.contains(k);
+      lists[slot] = new List;
+      lists[slot]->rows = rows;
+      lists[slot]->cols = cols;
+      lists[slot]->size = 0;
+      lists[slot]->next = pos ? slots[pos] : -1;
+      slots[k] = slot;
+    }
+  // Insert sorted by area
+  List &list = *lists[slot];
+  int area = lib[shapeno].area;
+  int lo = 0;
+  int hi = list.size;
+  while (lo < hi)
+    {
+      int mid = (lo + hi) / 2;
+      if (list.areas[mid] <= area)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  if (list.size >= list.shapes.size())
+    {
+      list.shapes.resize(0, 2 * list.size + 7);
+      list.areas.resize(0, 2 * list.size + 7);
+      list.profiles.resize(0, 2 * list.size + 7);
+    }
+  for (int i = list.size; i > lo; i--)
+    {
+      list.shapes[i] = list.shapes[i-1];
+      list.areas[i] = list.areas[i-1];
+      list.profiles[i] = list.profiles[i-1];
+    }
+  list.shapes[lo] = shapeno;
+  list.areas[lo] = area;
+  list.profiles[lo] = profile[shapeno];
+  list.size += 1;
+}
+
+// Hide a shape from the searches
+void
+ShapeIndex::remove(int shapeno)
+{
+  GBitmap &bitmap = *lib[shapeno].bits;
+  int slot = find_list(bitmap.rows(), bitmap.columns());
+  if (slot < 0)
+    return;
+  List &list = *lists[slot];
+  int i = 0;
+  while (i < list.size && list.shapes[i] != shapeno)
+    i++;
+  if (i >= list.size)
+    return;
+  list.size -= 1;
+  for (; i < list.size; i++)
+    {
+      list.shapes[i] = list.shapes[i+1];
+      list.areas[i] = list.areas[i+1];
+      list.profiles[i] = list.profiles[i+1];
+    }
+}
+
+// Lower bound of the number of differing pixels
+// using the row and column pixel counts.
+int
+ShapeIndex::difference_bound(const int *rc, int rows, int cols, 
+                             const int *xrc, int cross_rows, int cross_cols,
+                             int best_score)
+{
+  int cross_col_adjust = (cross_cols-cross_cols/2)-(cols-cols/2);
+  int cross_row_adjust = (cross_rows-cross_rows/2)-(rows-rows/2);
+  const int *cc = rc + rows + 4;
+  const int *xcc = xrc + cross_rows + 4 + cross_col_adjust;
+  xrc += cross_row_adjust;
+  int i, n, bound = 0;
+  for (i=-1; i<=rows; i++)
+    bound += abs(rc[i] - xrc[i]);
+  if (bound > best_score)
+    return bound;
+  for (n=0, i=-1; i<=cols; i++)
+    n += abs(cc[i] - xcc[i]);
+  return (n > bound) ? n : bound;
+}
+
+int
+ShapeIndex::search(int current, int &best_score, long &comparisons)
+{
+  // Sizes that differ by at most two rows or columns,
+  // starting with the size of the current shape.
+  static const signed char offsets[25][2] = {
+    { 0, 0}, { 0,-1}, { 0, 1}, {-1, 0}, { 1, 0}, 
+    {-1,-1}, {-1, 1}, { 1,-1}, { 1, 1}, { 0,-2}, 
+    { 0, 2}, {-2, 0}, { 2, 0}, {-1,-2}, {-1, 2},
+    { 1,-2}, { 1, 2}, {-2,-1}, {-2, 1}, { 2,-1},
+    { 2, 1}, {-2,-2}, {-2, 2}, { 2,-2}, { 2, 2} };
+  GBitmap &bitmap = *lib[current].bits;
+  int rows = bitmap.rows();
+  int cols = bitmap.columns();
+  int black_pixels = lib[current].area;
+  int closest = -1;
+  const int *xcounts = &counts[2];
+  const int *rc = xcounts + profile[current];
+  for (int d = 0; d < 25; d++)
+    {
+      int r = rows + offsets[d][0];
+      int c = cols + offsets[d][1];
+      if (r < 1 || c < 1)
+        continue;
+      int slot = find_list(r, c);
+      if (slot < 0)
+        continue;
+      List &list = *lists[slot];
+      const int *areas = &list.areas[0];
+      const int *shapes = &list.shapes[0];
+      const int *profiles = &list.profiles[0];
+      // Locate closest area
+      int n = list.size;
+      int lo = 0;
+      int hi = n;
+      while (lo < hi)
+        {
+          int mid = (lo + hi) / 2;
+          if (areas[mid] < black_pixels)
+            lo = mid + 1;
+          else
+            hi = mid;
+        }
+      hi = lo;
+      lo = lo - 1;
+      // Visit by increasing area difference
+      for (;;)
+        {
+          int dlo = (lo >= 0) ? black_pixels - areas[lo] : -1;
+          int dhi = (hi < n) ? areas[hi] - black_pixels : -1;
+          int k;
+          if (dlo >= 0 && (dhi < 0 || dlo <= dhi) && dlo <= best_score)
+            k = lo--;
+          else if (dhi >= 0 && dhi <= best_score)
+            k = hi++;
+          else
+            break;
+          int candidate = shapes[k];
+          if (candidate >= current)
+            continue;
+          if (difference_bound(rc, rows, cols, xcounts + profiles[k], 
+                               r, c, best_score) > best_score)
+            continue;
+          // Compare, also detecting ties
+          int score = packed.compare(current, candidate, best_score + 1);
+          comparisons += 1;
+          if (score < best_score ||
+              (score == best_score && closest >= 0 && candidate < closest))
+            {
+              best_score = score;
+              closest = candidate;
+            }
+        }
+    }
+  return closest;
+}
+
+
+// Candidate searches performed concurrently for a block of shapes
+// before the sequential loop of tune_jb2image processes them.  The
+// sequential loop removes the exact matches from the index, possibly
+// including shapes of the block that the speculative searches have
+// seen.  A speculative result remains valid unless the selected
+// candidate was removed, because the best candidate of a set is also
+// the best candidate of any subset containing it.
+struct SearchJobs
+{
+  ShapeIndex *index;
+  MatchData *lib;
+  int start;                    // first shape of the block
+  int end;                      // end of the block
+  int *threshold;               // initial score of each shape
+  int *closest;                 // speculative candidate
+  int *score;                   // speculative score
+  long *comparisons;            // comparisons of each job
+};
+
+#define SEARCH_JOB_SIZE 32
+#define SEARCH_BLOCK_SIZE 1024
+
+static void
+search_job(void *arg, int i)
+{
+  SearchJobs *sj = (SearchJobs*)arg;
+  int start = sj->start + i * SEARCH_JOB_SIZE;
+  int end = start + SEARCH_JOB_SIZE;
+  if (end > sj->end)
+    end = sj->end;
+  long comparisons = 0;
+  for (int current = start; current < end; current++)
+    if (sj->lib[current].bits)
+      {
+        int best_score = sj->threshold[current];
+        sj->closest[current] = sj->index->search(current, best_score, 
+                                                 comparisons);
+        sj->score[current] = best_score;
+      }
+  sj->comparisons[i] = comparisons;
+}
+
+
 // Reorganize jb2image on the basis of matchdata.
 // Also locate cross-coding buddys.
 // Flag lossy is not strictly necessary
 // but speeds up things when it is false.
 static void 
-tune_jb2image(JB2Image *jimg, MatchData *lib, bool lossy)
+tune_jb2image(JB2Image *jimg, MatchData *lib, bool lossy, jb2tuneopts *opts)
 {
   int nshapes = jimg->get_shape_count();
-  // Loop on all shapes
+  PackedShapes packed(nshapes);
+  ShapeIndex index(lib, packed, nshapes);
+  GTArray<int> threshold(nshapes-1);
+  long comparisons = 0;
+  long verified = 0;
+  // Prepare all shapes
   for (int current=0; current<nshapes; current++)
     {
       JB2Shape &jshp = jimg->get_shape(current);
+      threshold[current] = 0;
       // Process substitutions.
       if (lossy && !(jshp.userdata & JB2SHAPE_LOSSLESS))
         {
@@ -253,73 +780,96 @@ tune_jb2image(JB2Image *jimg, MatchData *lib, bool lossy)
       int rows = bitmap.rows();
       int cols = bitmap.columns();
       int best_score = (REFINE_THRESHOLD * rows * cols + 50) / 100;
-      int black_pixels = lib[current].area;
-      int closest = -1;
-      // Search cross-coding buddy
       bitmap.minborder(2);
       if (best_score < 2) 
         best_score = 2;
-      for (int candidate = 0; candidate < current; candidate++) 
+      threshold[current] = best_score;
+      packed.pack(current, bitmap);
+    }
+  // Process shapes by blocks, searching concurrently if possible
+  GThreadPool *pool = GThreadPool::get_shared();
+  int block = pool ? SEARCH_BLOCK_SIZE : 1;
+  GTArray<int> spec_closest;
+  GTArray<int> spec_score;
+  GTArray<long> counts;
+  if (pool)
+    {
+      spec_closest.resize(block-1);
+      spec_score.resize(block-1);
+      counts.resize(block/SEARCH_JOB_SIZE-1);
+    }
+  for (int start=0; start<nshapes; start+=block)
+    {
+      int end = start + block;
+      if (end > nshapes)
+        end = nshapes;
+      for (int current=start; current<end; current++)
+        if (lib[current].bits)
+          index.insert(current);
+      if (pool)
         {
-          int row, column;
-          // Access candidate bitmap
-          if (! lib[candidate].bits) 
-            continue;
-          GBitmap &cross_bitmap = *lib[candidate].bits;
-          int cross_cols = cross_bitmap.columns();
-          int cross_rows = cross_bitmap.rows();
-          // Prune
-          if (abs (lib[candidate].area - black_pixels) > best_score) 
-            continue;
-          if (abs (cross_rows - rows) > 2) 
-            continue;
-          if (abs (cross_cols - cols) > 2)
+          int njobs = (end - start + SEARCH_JOB_SIZE - 1) / SEARCH_JOB_SIZE;
+          SearchJobs sj;
+          sj.index = &index;
+          sj.lib = lib;
+          sj.start = start;
+          sj.end = end;
+          sj.threshold = threshold;
+          sj.closest = (int*)spec_closest - start;
+          sj.score = (int*)spec_score - start;
+          sj.comparisons = counts;
+          pool->run(search_job, (void*)&sj, njobs);
+          for (int i=0; i<njobs; i++)
+            comparisons += counts[i];
+        }
+      // Loop on the shapes of the block
+      for (int current=start; current<end; current++)
+        {
+          if (! lib[current].bits)
             continue;
-          // Compute alignment (these are always +1, 0 or -1)
-          int cross_col_adjust = (cross_cols-cross_cols/2)-(cols-cols/2);
-          int cross_row_adjust = (cross_rows-cross_rows/2)-(rows-rows/2);
-          // Ensure adequate borders
-          cross_bitmap.minborder (2-cross_col_adjust);
-          cross_bitmap.minborder (2+cols-cross_cols+cross_col_adjust);
-          // Count pixel differences (including borders)
-          int score = 0;
-          unsigned char *p_row;
-          unsigned char *p_cross_row;
-          for (row = -1; row <= rows; row++) 
+          JB2Shape &jshp = jimg->get_shape(current);
+          // Search cross-coding buddy
+          int best_score = threshold[current];
+          int closest = -1;
+          if (pool)
             {
-              p_row = bitmap[row];
-              p_cross_row = cross_bitmap[row+cross_row_adjust];
-              p_cross_row += cross_col_adjust;
-              for (column = -1; column <= cols; column++) 
-                if (p_row[column] != p_cross_row[column])
-                  score ++;
-              if (score >= best_score)  // prune
-                break;
+              best_score = spec_score[current-start];
+              closest = spec_closest[current-start];
             }
-          if (score < best_score) 
+          if (!pool || (closest >= 0 && ! lib[closest].bits))
             {
-              best_score = score;
-              closest = candidate;
+              best_score = threshold[current];
+              closest = index.search(current, best_score, comparisons);
             }
-        }
-      // Decide what to do with the match.
-      if (closest >= 0)
-        {
-          // Mark the shape for cross-coding (``soft pattern matching'')
-          jshp.parent = closest;
-          // Exact match ==> Substitution
-          if (best_score == 0)
+          if (opts && opts->verify)
             {
-              lib[current].match = closest;
-              lib[current].bits = 0;
+              int score = threshold[current];
+              if (search_exhaustive(lib, packed, current, score, verified)
+                  != closest || score != best_score)
+                G_THROW("jb2tune: indexed shape search does not match");
+            }
+          // Decide what to do with the match.
+          if (closest >= 0)
+            {
+              // Mark the shape for cross-coding (``soft pattern matching'')
+              jshp.parent = closest;
+              // Exact match ==> Substitution
+              if (best_score == 0)
+                {
+                  index.remove(current);
+                  lib[current].match = closest;
+                  lib[current].bits = 0;
+                }
+              // ISSUE: CROSS-IMPROVING.  When we decide not to do a
+              // substitution, we can slightly modify the current shape in
+              // order to make it closer to the matching shape, therefore
+              // improving the file size.  In fact there is a continuity
+              // between pure cross-coding and pure substitution...
             }
-          // ISSUE: CROSS-IMPROVING.  When we decide not to do a substitution,
-          // we can slightly modify the current shape in order to make it
-          // closer to the matching shape, therefore improving the file size.
-          // In fact there is a continuity between pure cross-coding and pure
-          // substitution...
         }
     }
+  if (opts)
+    opts->comparisons += comparisons;
   
   // Process shape substitutions
   for (int blitno=0; blitno<jimg->get_blit_count(); blitno++)
@@ -359,6 +909,7 @@ tune_jb2image(JB2Image *jimg, MatchData *lib, bool lossy)
           jshp.bits = 0;
         }
     }
+  jimg->reset_blit_index();
 }
 
 
@@ -369,12 +920,12 @@ tune_jb2image(JB2Image *jimg, MatchData *lib, bool lossy)
 
 
 void 
-tune_jb2image_lossless(JB2Image *jimg)
+tune_jb2image_lossless(JB2Image *jimg, jb2tuneopts *opts)
 {
   int nshapes = jimg->get_shape_count();
   GArray<MatchData> lib(nshapes);
   compute_matchdata_lossless(jimg, lib);
-  tune_jb2image(jimg, lib, false);
+  tune_jb2image(jimg, lib, false, opts);
 }
 
 
@@ -383,7 +934,7 @@ tune_jb2image_lossless(JB2Image *jimg)
 // Thanks to Ilya Mezhirov.
 
 void 
-tune_jb2image_lossy(JB2Image *jimg, int dpi, int aggression)
+tune_jb2image_lossy(JB2Image *jimg, int dpi, int aggression, jb2tuneopts *opts)
 {
   int nshapes = jimg->get_shape_count();
   GArray<MatchData> lib(nshapes);
@@ -393,5 +944,5 @@ tune_jb2image_lossy(JB2Image *jimg, int dpi, int aggression)
   compute_matchdata_lossy(jimg, lib, dpi, options);
   mdjvu_matcher_options_destroy(options);
 
-  tune_jb2image(jimg, lib, true);
+  tune_jb2image(jimg, lib, true, opts);
 }
@@ -62,11 +62,52 @@
 # pragma interface
 #endif
 
+#include "GContainer.h"
 #include "GBitmap.h"
 #include "JB2Image.h"
 
-extern void tune_jb2image_lossy(JB2Image *jimg, int dpi, int aggression);
-extern void tune_jb2image_lossless(JB2Image *jimg);
+#if HAVE_STDINT_H
+# include <stdint.h>
+#elif HAVE_INTTYPES_H
+# include <inttypes.h>
+#endif
+
+// Options and statistics for shape matching.
+// Flag verify runs the exhaustive candidate search next to the indexed
+// one and throws an exception when they select different matches.
+struct jb2tuneopts
+{
+  bool verify;          // check the indexed candidate search
+  long comparisons;     // number of bitmap comparisons performed
+  jb2tuneopts() : verify(false), comparisons(0) {}
+};
+
+extern void tune_jb2image_lossy(JB2Image *jimg, int dpi, int aggression,
+                                jb2tuneopts *opts=0);
+extern void tune_jb2image_lossless(JB2Image *jimg, jb2tuneopts *opts=0);
+
+// Shapes packed with one bit per pixel in 64 bit words.  Each row
+// holds two blank columns on each side plus one blank word, and each
+// shape has two blank rows above and below.  The alignment offsets of
+// the comparisons then never address pixels outside the packed data.
+// Function compare counts the differing pixels like the former
+// per-pixel loop of tune_jb2image and stops at best_score.
+class PackedShapes
+{
+public:
+  PackedShapes(int nshapes);
+  void pack(int shapeno, GBitmap &bitmap);
+  int compare(int shapeno, int cross, int best_score);
+private:
+  GTArray<int> offset;            // first word of each shape
+  GTArray<int> rows;
+  GTArray<int> cols;
+  uint64_t *words;
+  GPBuffer<uint64_t> gwords;
+  int nwords;
+  int maxwords;
+  static inline int wpl(int cols) { return (cols + 4 + 63) / 64 + 1; }
+};
 
 // Values for userdata in JB2Shape
 #define JB2SHAPE_LOSSLESS 1
@@ -0,0 +1,198 @@
+//C-  -*- C++ -*-
+//C- -------------------------------------------------------------------
+//C- DjVuLibre-3.5
+//C- Copyright (c) 2002  Leon Bottou and Yann Le Cun.
+//C- Copyright (c) 2001  AT&T
+//C-
+//C- This software is subject to, and may be distributed under, the
+//C- GNU General Public License, either Version 2 of the license,
+//C- or (at your option) any later version. The license should have
+//C- accompanied the software or you may obtain a copy of the license
+//C- from the Free Software Foundation at http://www.fsf.org .
+//C-
+//C- This program is distributed in the hope that it will be useful,
+//C- but WITHOUT ANY WARRANTY; without even the implied warranty of
+//C- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//C- GNU General Public License for more details.
+//C- 
+//C- DjVuLibre-3.5 is derived from the DjVu(r) Reference Library from
+//C- Lizardtech Software.  Lizardtech Software has authorized us to
+//C- replace the original DjVu(r) Reference Library notice by the following
+//C- text (see doc/lizard2002.djvu and doc/lizardtech2007.djvu):
+//C-
+//C-  ------------------------------------------------------------------
+//C- | DjVu (r) Reference Library (v. 3.5)
+//C- | Copyright (c) 1999-2001 LizardTech, Inc. All Rights Reserved.
+//C- | The DjVu Reference Library is protected by U.S. Pat. No.
+//C- | 6,058,214 and patents pending.
+//C- |
+//C- | This software is subject to, and may be distributed under, the
+//C- | GNU General Public License, either Version 2 of the license,
+//C- | or (at your option) any later version. The license should have
+//C- | accompanied the software or you may obtain a copy of the license
+//C- | from the Free Software Foundation at http://www.fsf.org .
+//C- |
+//C- | The computer code originally released by LizardTech under this
+//C- | license and unmodified by other parties is deemed "the LIZARDTECH
+//C- | ORIGINAL CODE."  Subject to any third party intellectual property
+//C- | claims, LizardTech grants recipient a worldwide, royalty-free, 
+//C- | non-exclusive license to make, use, sell, or otherwise dispose of 
+//C- | the LIZARDTECH ORIGINAL CODE or of programs derived from the 
+//C- | LIZARDTECH ORIGINAL CODE in compliance with the terms of the GNU 
+//C- | General Public License.   This grant only confers the right to 
+//C- | infringe patent claims underlying the LIZARDTECH ORIGINAL CODE to 
+//C- | the extent such infringement is reasonably necessary to enable 
+//C- | recipient to make, have made, practice, sell, or otherwise dispose 
+//C- | of the LIZARDTECH ORIGINAL CODE (or portions thereof) and not to 
+//C- | any greater extent that may be necessary to utilize further 
+//C- | modifications or combinations.
+//C- |
+//C- | The LIZARDTECH ORIGINAL CODE is provided "AS IS" WITHOUT WARRANTY
+//C- | OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+//C- | TO ANY WARRANTY OF NON-INFRINGEMENT, OR ANY IMPLIED WARRANTY OF
+//C- | MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE.
+//C- +------------------------------------------------------------------
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+#if NEED_GNUG_PRAGMAS
+# pragma implementation
+#endif
+
+/** @name pixbench
+
+    {\bf Synopsis}
+    \begin{verbatim}
+        pixbench [<width> <height>]
+    \end{verbatim}
+
+    {\bf Description} --- Program #pixbench# measures the resampling
+    functions of class \Ref{GPixmap}.  It creates a pseudo-random color page
+    of #width# by #height# pixels (default 2550 by 3300, a letter page
+    scanned at 300 dpi) and a page three times smaller, as found in the
+    background layer of compound documents.  Functions #downsample# and
+    #downsample43# reduce the large page.  Functions #upsample# and
+    #upsample23# enlarge the small page.  Each line reports the time and the
+    output throughput in megapixels per second, measured on the best of
+    eleven runs of about twenty million output pixels each.  Variables
+    #LIBDJVU_DISABLE_SIMD# and #LIBDJVU_DISABLE_AVX2# select the code paths
+    being measured.  This program is not installed.
+
+    @memo
+    GPixmap resampling benchmark.
+*/
+//@{
+//@}
+
+#include "GPixmap.h"
+#include "GException.h"
+#include "GOS.h"
+#include "DjVuMessage.h"
+#include "common.h"
+
+#include <stdlib.h>
+
+enum { DOWNSAMPLE, DOWNSAMPLE43, UPSAMPLE, UPSAMPLE23 };
+
+static GP<GPixmap>
+make_page(int width, int height)
+{
+  GP<GPixmap> gpm = GPixmap::create(height, width);
+  GPixmap &pm = *gpm;
+  unsigned int seed = 12345;
+  for (int y=0; y<height; y++)
+    {
+      GPixel *row = pm[y];
+      for (int x=0; x<width; x++)
+        {
+          seed = seed * 1103515245 + 12345;
+          row[x].b = (unsigned char)(seed >> 8);
+          row[x].g = (unsigned char)(seed >> 16);
+          row[x].r = (unsigned char)(seed >> 24);
+        }
+    }
+  return gpm;
+}
+
+static void
+resample(GPixmap *dst, int func, int factor, const GPixmap *src)
+{
+  switch (func)
+    {
+    case DOWNSAMPLE:
+      dst->downsample(src, factor);
+      break;
+    case DOWNSAMPLE43:
+      dst->downsample43(src);
+      break;
+    case UPSAMPLE:
+      dst->upsample(src, factor);
+      break;
+    case UPSAMPLE23:
+      dst->upsample23(src);
+      break;
+    }
+}
+
+// Each run repeats the function until about 20 million pixels
+// are produced so that short calls are timed accurately.
+static void
+bench(const char *name, int func, int factor, const GPixmap *src)
+{
+  GP<GPixmap> dst = GPixmap::create();
+  resample(dst, func, factor, src);
+  const double mpixels = (double) dst->columns() * dst->rows() / 1000000;
+  const int reps = (mpixels < 20) ? (int)(20 / mpixels) : 1;
+  double best = 0;
+  for (int run=0; run<11; run++)
+    {
+      const unsigned long start = GOS::ticks();
+      for (int i=0; i<reps; i++)
+        resample(dst, func, factor, src);
+      const double ms = (double)(GOS::ticks() - start) / reps;
+      if (run == 0 || ms < best)
+        best = ms;
+    }
+  DjVuPrintMessageUTF8("%-13s %4dx%-4d -> %4dx%-4d: %5.1f ms, %4.0f Mpixels/s\n",
+                       name, src->columns(), src->rows(),
+                       dst->columns(), dst->rows(), best,
+                       mpixels * 1000.0 / (best > 0 ? best : 1));
+}
+
+int
+main(int argc, char **argv)
+{
+  DJVU_LOCALE;
+  G_TRY
+    {
+      int width = 2550;
+      int height = 3300;
+      if (argc == 3)
+        {
+          width = atoi(argv[1]);
+          height = atoi(argv[2]);
+        }
+      if ((argc != 1 && argc != 3) || width < 3 || height < 3)
+        {
+          DjVuPrintErrorUTF8("Usage: %s [<width> <height>]\n", argv[0]);
+          exit(1);
+        }
+      GP<GPixmap> page = make_page(width, height);
+      GP<GPixmap> small = make_page((width + 2) / 3, (height + 2) / 3);
+      bench("downsample 2", DOWNSAMPLE, 2, page);
+      bench("downsample 3", DOWNSAMPLE, 3, page);
+      bench("downsample 4", DOWNSAMPLE, 4, page);
+      bench("downsample43", DOWNSAMPLE43, 0, page);
+      bench("upsample 2", UPSAMPLE, 2, small);
+      bench("upsample 3", UPSAMPLE, 3, small);
+      bench("upsample23", UPSAMPLE23, 0, small);
+    }
+  G_CATCH(ex)
+    {
+      ex.perror();
+      exit(1);
+    }
+  G_ENDCATCH;
+  return 0;
+}
@@ -0,0 +1,184 @@
+//C-  -*- C++ -*-
+//C- -------------------------------------------------------------------
+//C- DjVuLibre-3.5
+//C- Copyright (c) 2002  Leon Bottou and Yann Le Cun.
+//C- Copyright (c) 2001  AT&T
+//C-
+//C- This software is subject to, and may be distributed under, the
+//C- GNU General Public License, either Version 2 of the license,
+//C- or (at your option) any later version. The license should have
+//C- accompanied the software or you may obtain a copy of the license
+//C- from the Free Software Foundation at http://www.fsf.org .
+//C-
+//C- This program is distributed in the hope that it will be useful,
+//C- but WITHOUT ANY WARRANTY; without even the implied warranty of
+//C- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//C- GNU General Public License for more details.
+//C- 
+//C- DjVuLibre-3.5 is derived from the DjVu(r) Reference Library from
+//C- Lizardtech Software.  Lizardtech Software has authorized us to
+//C- replace the original DjVu(r) Reference Library notice by the following
+//C- text (see doc/lizard2002.djvu and doc/lizardtech2007.djvu):
+//C-
+//C-  ------------------------------------------------------------------
+//C- | DjVu (r) Reference Library (v. 3.5)
+//C- | Copyright (c) 1999-2001 LizardTech, Inc. All Rights Reserved.
+//C- | The DjVu Reference Library is protected by U.S. Pat. No.
+//C- | 6,058,214 and patents pending.
+//C- |
+//C- | This software is subject to, and may be distributed under, the
+//C- | GNU General Public License, either Version 2 of the license,
+//C- | or (at your option) any later version. The license should have
+//C- | accompanied the software or you may obtain a copy of the license
+//C- | from the Free Software Foundation at http://www.fsf.org .
+//C- |
+//C- | The computer code originally released by LizardTech under this
+//C- | license and unmodified by other parties is deemed "the LIZARDTECH
+//C- | ORIGINAL CODE."  Subject to any third party intellectual property
+//C- | claims, LizardTech grants recipient a worldwide, royalty-free, 
+//C- | non-exclusive license to make, use, sell, or otherwise dispose of 
+//C- | the LIZARDTECH ORIGINAL CODE or of programs derived from the 
+//C- | LIZARDTECH ORIGINAL CODE in compliance with the terms of the GNU 
+//C- | General Public License.   This grant only confers the right to 
+//C- | infringe patent claims underlying the LIZARDTECH ORIGINAL CODE to 
+//C- | the extent such infringement is reasonably necessary to enable 
+//C- | recipient to make, have made, practice, sell, or otherwise dispose 
+//C- | of the LIZARDTECH ORIGINAL CODE (or portions thereof) and not to 
+//C- | any greater extent that may be necessary to utilize further 
+//C- | modifications or combinations.
+//C- |
+//C- | The LIZARDTECH ORIGINAL CODE is provided "AS IS" WITHOUT WARRANTY
+//C- | OF ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED
+//C- | TO ANY WARRANTY OF NON-INFRINGEMENT, OR ANY IMPLIED WARRANTY OF
+//C- | MERCHANTABILITY OR FITNESS FOR A PARTICULAR PURPOSE.
+//C- +------------------------------------------------------------------
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+#if NEED_GNUG_PRAGMAS
+# pragma implementation
+#endif
+
+/** @name zpbench
+
+    {\bf Synopsis}
+    \begin{verbatim}
+        zpbench [<megabits>]
+    \end{verbatim}
+
+    {\bf Description} --- Program #zpbench# measures the throughput of the
+    ZP-Coder encoder (see \Ref{ZPCodec.h}).  It encodes a pseudo-random
+    message of #megabits# million bits (default 8) into a memory
+    \Ref{ByteStream} with the adaptive encoder (#learning#), with the
+    non adaptive encoder (#nolearn#) and with the pass-thru encoder used by
+    the IW44 codec (#IW#).  Each line reports the code size and the message
+    throughput in megabytes per second, measured on the best of three runs.
+    This program is not installed.
+
+    @memo
+    ZP-Coder encoder benchmark.
+*/
+//@{
+//@}
+
+#include "ZPCodec.h"
+#include "ByteStream.h"
+#include "GContainer.h"
+#include "GException.h"
+#include "GOS.h"
+#include "DjVuMessage.h"
+#include "common.h"
+
+enum { LEARNING, NOLEARN, IW };
+
+// Message bits are drawn from a linear congruential generator.  The
+// context of each bit selects one of a few skewed distributions so
+// that the adaptive encoder has something to learn.
+
+static const unsigned int skew[8] = { 2, 8, 30, 64, 128, 192, 240, 253 };
+
+static void
+make_message(GTArray<unsigned char> &bits, GTArray<unsigned char> &ctxs)
+{
+  unsigned int seed = 12345;
+  const int n = bits.size();
+  for (int i=0; i<n; i++)
+    {
+      seed = seed * 1103515245 + 12345;
+      const int ctx = (seed >> 28) & 7;
+      bits[i] = (((seed >> 8) & 0xff) >= skew[ctx]) ? 1 : 0;
+      ctxs[i] = (unsigned char) ctx;
+    }
+}
+
+static int
+encode(int mode, const GTArray<unsigned char> &bits,
+       const GTArray<unsigned char> &ctxs)
+{
+  GP<ByteStream> gbs = ByteStream::create();
+  {
+    GP<ZPCodec> gzp = ZPCodec::create(gbs, true, true);
+    ZPCodec &zp = *gzp;
+    BitContext ctx[8];
+    for (int c=0; c<8; c++)
+      ctx[c] = (mode == NOLEARN) ? zp.state((float)(256 - skew[c]) / 256) : 0;
+    const int n = bits.size();
+    const unsigned char *b = bits;
+    const unsigned char *x = ctxs;
+    if (mode == LEARNING)
+      for (int i=0; i<n; i++)
+        zp.encoder(b[i], ctx[x[i]]);
+    else if (mode == NOLEARN)
+      for (int i=0; i<n; i++)
+        zp.encoder_nolearn(b[i], ctx[x[i]]);
+    else
+      for (int i=0; i<n; i++)
+        zp.IWencoder(b[i] != 0);
+  }
+  return gbs->size();
+}
+
+int
+main(int argc, char **argv)
+{
+  DJVU_LOCALE;
+  G_TRY
+    {
+      int megabits = 8;
+      if (argc > 2 || (argc == 2 && (megabits = atoi(argv[1])) <= 0))
+        {
+          DjVuPrintErrorUTF8("Usage: %s [<megabits>]\n", argv[0]);
+          exit(1);
+        }
+      const int n = megabits << 20;
+      GTArray<unsigned char> bits(n-1);
+      GTArray<unsigned char> ctxs(n-1);
+      make_message(bits, ctxs);
+      static const char *names[] = { "learning", "nolearn", "IW" };
+      for (int mode=LEARNING; mode<=IW; mode++)
+        {
+          int size = 0;
+          unsigned long best = 0;
+          for (int run=0; run<3; run++)
+            {
+              const unsigned long start = GOS::ticks();
+              size = encode(mode, bits, ctxs);
+              const unsigned long ms = GOS::ticks() - start;
+              if (run == 0 || ms < best)
+                best = ms;
+            }
+          const double mbytes = (double) n / 8 / (1 << 20);
+          DjVuPrintMessageUTF8("%-9s %d Mbits -> %d bytes: %lu ms, %.1f MB/s\n",
+                               names[mode], megabits, size, best,
+                               mbytes * 1000.0 / (best ? best : 1));
+        }
+    }
+  G_CATCH(ex)
+    {
+      ex.perror();
+      exit(1);
+    }
+  G_ENDCATCH;
+  return 0;
+}